@@ -421,6 +421,10 @@ int virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
                                    const char *filters,
                                    unsigned int flags);
 
+int virAdmConnectDumpLoggingMemory(virAdmConnectPtr conn,
+                                   const char *file,
+                                   unsigned int flags);
+
 # ifdef __cplusplus
 }
 # endif
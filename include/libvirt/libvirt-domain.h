@@ -2185,6 +2185,8 @@ typedef enum {
     VIR_DOMAIN_STATS_PERF = (1 << 6), /* return domain perf event info */
     VIR_DOMAIN_STATS_IOTHREAD = (1 << 7), /* return iothread poll info */
     VIR_DOMAIN_STATS_MEMORY = (1 << 8), /* return domain memory info */
+    VIR_DOMAIN_STATS_MONITOR = (1 << 9), /* return hypervisor monitor
+                                            command timing info */
 } virDomainStatsTypes;
 
 typedef enum {
@@ -5079,6 +5081,11 @@ int virDomainGetGuestInfo(virDomainPtr domain,
                           int *nparams,
                           unsigned int flags);
 
+int virDomainListGetGuestInfo(virDomainPtr *doms,
+                              unsigned int types,
+                              virDomainStatsRecordPtr **retInfo,
+                              unsigned int flags);
+
 typedef enum {
     VIR_DOMAIN_AGENT_RESPONSE_TIMEOUT_BLOCK = -2,
     VIR_DOMAIN_AGENT_RESPONSE_TIMEOUT_DEFAULT = -1,
@@ -468,6 +468,16 @@ adminConnectSetLoggingFilters(virNetDaemonPtr dmn G_GNUC_UNUSED,
     return virLogSetFilters(filters);
 }
 
+static int
+adminConnectDumpLoggingMemory(virNetDaemonPtr dmn G_GNUC_UNUSED,
+                              const char *file,
+                              unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return virLogDumpMemory(file);
+}
+
 static int
 adminDispatchConnectGetLoggingOutputs(virNetServerPtr server G_GNUC_UNUSED,
                                       virNetServerClientPtr client G_GNUC_UNUSED,
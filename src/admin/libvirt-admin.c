@@ -1266,3 +1266,38 @@ virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
     virDispatchError(NULL);
     return -1;
 }
+
+/**
+ * virAdmConnectDumpLoggingMemory:
+ * @conn: pointer to an active admin connection
+ * @file: path to the file on the daemon's host to write the messages into
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Write the messages recorded by the in-memory ("memory") logging output of
+ * the daemon into @file, which is created or truncated. If @file is NULL, the
+ * messages recorded since the last dump are appended to the dump file given
+ * in the definition of the output.
+ *
+ * Returns 0 if the messages were written successfully, or -1 in case of an
+ * error, e.g. when no memory output is defined.
+ */
+int
+virAdmConnectDumpLoggingMemory(virAdmConnectPtr conn,
+                               const char *file,
+                               unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, file=%s, flags=0x%x", conn, NULLSTR(file), flags);
+
+    virResetLastError();
+    virCheckAdmConnectReturn(conn, -1);
+
+    if ((ret = remoteAdminConnectDumpLoggingMemory(conn, file, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
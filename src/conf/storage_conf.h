@@ -76,6 +76,19 @@ typedef enum {
 
 VIR_ENUM_DECL(virStorageVolDefRefreshAllocation);
 
+/* Identity of a file backed volume as of its last probe, used by
+ * backends refreshing their pools incrementally. Not part of the XML. */
+typedef struct _virStorageVolStamp virStorageVolStamp;
+typedef virStorageVolStamp *virStorageVolStampPtr;
+struct _virStorageVolStamp {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -88,6 +101,8 @@ struct _virStorageVolDef {
 
     virStorageVolSource source;
     virStorageSource target;
+
+    virStorageVolStamp stamp;
 };
 
 typedef struct _virStorageVolDefList virStorageVolDefList;
@@ -42,6 +42,7 @@ static virClassPtr virStoragePoolObjClass;
 static virClassPtr virStoragePoolObjListClass;
 static virClassPtr virStorageVolObjClass;
 static virClassPtr virStorageVolObjListClass;
+static virClassPtr virStorageVolObjIndexClass;
 
 static void
 virStoragePoolObjDispose(void *opaque);
@@ -51,6 +52,8 @@ static void
 virStorageVolObjDispose(void *opaque);
 static void
 virStorageVolObjListDispose(void *opaque);
+static void
+virStorageVolObjIndexDispose(void *opaque);
 
 
 
@@ -80,6 +83,31 @@ struct _virStorageVolObjList {
     GHashTable *objsPath;
 };
 
+/* List of pools holding a volume with the same key or path. Usually
+ * there is just one, but e.g. a SCSI and a multipath pool may expose
+ * the same LUN. */
+typedef struct _virStorageVolObjIndexEntry virStorageVolObjIndexEntry;
+struct _virStorageVolObjIndexEntry {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virStorageVolObjIndexEntry *next;
+};
+
+/* Volumes of all pools in a virStoragePoolObjList, shared by the list
+ * and its pools so that volume lookups don't have to visit every pool */
+typedef struct _virStorageVolObjIndex virStorageVolObjIndex;
+typedef virStorageVolObjIndex *virStorageVolObjIndexPtr;
+struct _virStorageVolObjIndex {
+    virObjectLockable parent;
+
+    /* key string -> virStorageVolObjIndexEntry mapping
+     * for (1), lookup-by-key across pools */
+    GHashTable *keys;
+
+    /* path string -> virStorageVolObjIndexEntry mapping
+     * for (1), lookup-by-path across pools */
+    GHashTable *paths;
+};
+
 struct _virStoragePoolObj {
     virObjectLockable parent;
 
@@ -89,11 +117,15 @@ struct _virStoragePoolObj {
     bool starting;
     bool autostart;
     unsigned int asyncjobs;
+    /* bumped whenever a volume is added or removed, so that a refresh
+     * which runs unlocked can tell the volume list changed meanwhile */
+    unsigned long long volgen;
 
     virStoragePoolDefPtr def;
     virStoragePoolDefPtr newDef;
 
     virStorageVolObjListPtr volumes;
+    virStorageVolObjIndexPtr volIndex;
 };
 
 struct _virStoragePoolObjList {
@@ -106,6 +138,9 @@ struct _virStoragePoolObjList {
     /* name string -> virStoragePoolObj mapping
      * for (1), lockless lookup-by-name */
     GHashTable *objsName;
+
+    /* volumes of all the pools above */
+    virStorageVolObjIndexPtr volIndex;
 };
 
 
@@ -118,6 +153,9 @@ virStorageVolObjOnceInit(void)
     if (!VIR_CLASS_NEW(virStorageVolObjList, virClassForObjectRWLockable()))
         return -1;
 
+    if (!VIR_CLASS_NEW(virStorageVolObjIndex, virClassForObjectLockable()))
+        return -1;
+
     return 0;
 }
 
@@ -194,6 +232,131 @@ virStorageVolObjListDispose(void *opaque)
 }
 
 
+static void
+virStorageVolObjIndexEntryFree(void *opaque)
+{
+    virStorageVolObjIndexEntry *entry = opaque;
+
+    while (entry) {
+        virStorageVolObjIndexEntry *next = entry->next;
+
+        g_free(entry);
+        entry = next;
+    }
+}
+
+
+static virStorageVolObjIndexPtr
+virStorageVolObjIndexNew(void)
+{
+    virStorageVolObjIndexPtr index;
+
+    if (virStorageVolObjInitialize() < 0)
+        return NULL;
+
+    if (!(index = virObjectLockableNew(virStorageVolObjIndexClass)))
+        return NULL;
+
+    index->keys = virHashNew(virStorageVolObjIndexEntryFree);
+    index->paths = virHashNew(virStorageVolObjIndexEntryFree);
+
+    return index;
+}
+
+
+static void
+virStorageVolObjIndexDispose(void *opaque)
+{
+    virStorageVolObjIndexPtr index = opaque;
+
+    virHashFree(index->keys);
+    virHashFree(index->paths);
+}
+
+
+/* Must be called with the index locked */
+static void
+virStorageVolObjIndexAdd(GHashTable *table,
+                         const char *name,
+                         const unsigned char *uuid)
+{
+    virStorageVolObjIndexEntry *head = virHashLookup(table, name);
+    virStorageVolObjIndexEntry *entry;
+
+    for (entry = head; entry; entry = entry->next) {
+        if (memcmp(entry->uuid, uuid, VIR_UUID_BUFLEN) == 0)
+            return;
+    }
+
+    entry = g_new0(virStorageVolObjIndexEntry, 1);
+    memcpy(entry->uuid, uuid, VIR_UUID_BUFLEN);
+
+    if (head) {
+        entry->next = head->next;
+        head->next = entry;
+    } else {
+        g_hash_table_insert(table, g_strdup(name), entry);
+    }
+}
+
+
+/* Must be called with the index locked */
+static void
+virStorageVolObjIndexRemove(GHashTable *table,
+                            const char *name,
+                            const unsigned char *uuid)
+{
+    virStorageVolObjIndexEntry *head = virHashLookup(table, name);
+    virStorageVolObjIndexEntry *prev = NULL;
+    virStorageVolObjIndexEntry *entry;
+
+    for (entry = head; entry; prev = entry, entry = entry->next) {
+        if (memcmp(entry->uuid, uuid, VIR_UUID_BUFLEN) != 0)
+            continue;
+
+        if (prev) {
+            prev->next = entry->next;
+            g_free(entry);
+        } else if (entry->next) {
+            /* keep the head, which is owned by the hash table */
+            virStorageVolObjIndexEntry *next = entry->next;
+
+            memcpy(entry->uuid, next->uuid, VIR_UUID_BUFLEN);
+            entry->next = next->next;
+            g_free(next);
+        } else {
+            virHashRemoveEntry(table, name);
+        }
+        return;
+    }
+}
+
+
+static void
+virStoragePoolObjIndexVol(virStoragePoolObjPtr obj,
+                          virStorageVolDefPtr voldef,
+                          bool add)
+{
+    virStorageVolObjIndexPtr index = obj->volIndex;
+
+    /* Pools which are not part of any list are not indexed */
+    if (!index)
+        return;
+
+    virObjectLock(index);
+    if (add) {
+        virStorageVolObjIndexAdd(index->keys, voldef->key, obj->def->uuid);
+        virStorageVolObjIndexAdd(index->paths, voldef->target.path,
+                                 obj->def->uuid);
+    } else {
+        virStorageVolObjIndexRemove(index->keys, voldef->key, obj->def->uuid);
+        virStorageVolObjIndexRemove(index->paths, voldef->target.path,
+                                    obj->def->uuid);
+    }
+    virObjectUnlock(index);
+}
+
+
 static int
 virStoragePoolObjOnceInit(void)
 {
@@ -367,6 +530,13 @@ virStoragePoolObjDecrAsyncjobs(virStoragePoolObjPtr obj)
 }
 
 
+unsigned long long
+virStoragePoolObjGetVolGeneration(virStoragePoolObjPtr obj)
+{
+    return obj->volgen;
+}
+
+
 void
 virStoragePoolObjDispose(void *opaque)
 {
@@ -374,6 +544,7 @@ virStoragePoolObjDispose(void *opaque)
 
     virStoragePoolObjClearVols(obj);
     virObjectUnref(obj->volumes);
+    virObjectUnref(obj->volIndex);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -390,6 +561,7 @@ virStoragePoolObjListDispose(void *opaque)
 
     virHashFree(pools->objs);
     virHashFree(pools->objsName);
+    virObjectUnref(pools->volIndex);
 }
 
 
@@ -405,7 +577,8 @@ virStoragePoolObjListNew(void)
         return NULL;
 
     if (!(pools->objs = virHashNew(virObjectFreeHashData)) ||
-        !(pools->objsName = virHashNew(virObjectFreeHashData))) {
+        !(pools->objsName = virHashNew(virObjectFreeHashData)) ||
+        !(pools->volIndex = virStorageVolObjIndexNew())) {
         virObjectUnref(pools);
         return NULL;
     }
@@ -609,6 +782,98 @@ virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
 }
 
 
+static virStoragePoolObjPtr
+virStoragePoolObjListFindVolume(virStoragePoolObjListPtr pools,
+                                bool byPath,
+                                const char *name,
+                                virStorageVolDefPtr *voldef)
+{
+    virStorageVolObjIndexPtr index = pools->volIndex;
+    virStorageVolObjIndexEntry *head;
+    virStorageVolObjIndexEntry *entry;
+    g_autofree unsigned char *uuids = NULL;
+    size_t nuuids = 0;
+    size_t i;
+
+    *voldef = NULL;
+
+    /* Copy the candidate pools out, the index must not be locked
+     * while locking a pool */
+    virObjectLock(index);
+    head = virHashLookup(byPath ? index->paths : index->keys, name);
+    for (entry = head; entry; entry = entry->next)
+        nuuids++;
+
+    uuids = g_new0(unsigned char, nuuids * VIR_UUID_BUFLEN);
+    for (entry = head, i = 0; entry; entry = entry->next, i++)
+        memcpy(uuids + i * VIR_UUID_BUFLEN, entry->uuid, VIR_UUID_BUFLEN);
+    virObjectUnlock(index);
+
+    for (i = 0; i < nuuids; i++) {
+        virStoragePoolObjPtr obj;
+
+        if (!(obj = virStoragePoolObjFindByUUID(pools,
+                                                uuids + i * VIR_UUID_BUFLEN)))
+            continue;
+
+        if (virStoragePoolObjIsActive(obj)) {
+            if (byPath)
+                *voldef = virStorageVolDefFindByPath(obj, name);
+            else
+                *voldef = virStorageVolDefFindByKey(obj, name);
+
+            if (*voldef)
+                return obj;
+        }
+
+        virStoragePoolObjEndAPI(&obj);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virStoragePoolObjListFindVolByKey
+ * @pools: Storage pool object list pointer
+ * @key: Storage volume key to find
+ * @voldef: filled with the volume definition found
+ *
+ * Lookup the active pool holding a volume with @key without having to
+ * search through all the pools in @pools.
+ *
+ * Returns: Locked and reffed storage pool object or NULL if not found
+ */
+virStoragePoolObjPtr
+virStoragePoolObjListFindVolByKey(virStoragePoolObjListPtr pools,
+                                  const char *key,
+                                  virStorageVolDefPtr *voldef)
+{
+    return virStoragePoolObjListFindVolume(pools, false, key, voldef);
+}
+
+
+/**
+ * virStoragePoolObjListFindVolByPath
+ * @pools: Storage pool object list pointer
+ * @path: Storage volume target path to find
+ * @voldef: filled with the volume definition found
+ *
+ * Lookup the active pool holding a volume with target @path without
+ * having to search through all the pools in @pools. The @path has to
+ * match the target path of the volume exactly.
+ *
+ * Returns: Locked and reffed storage pool object or NULL if not found
+ */
+virStoragePoolObjPtr
+virStoragePoolObjListFindVolByPath(virStoragePoolObjListPtr pools,
+                                   const char *path,
+                                   virStorageVolDefPtr *voldef)
+{
+    return virStoragePoolObjListFindVolume(pools, true, path, voldef);
+}
+
+
 static virStoragePoolObjPtr
 virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr obj,
                                          virStoragePoolDefPtr def)
@@ -626,15 +891,39 @@ virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr obj,
 }
 
 
+static int
+virStoragePoolObjClearVolsIndexCb(void *payload,
+                                  const char *name G_GNUC_UNUSED,
+                                  void *opaque)
+{
+    virStorageVolObjPtr volobj = payload;
+    virStoragePoolObjPtr obj = opaque;
+
+    virStorageVolObjIndexRemove(obj->volIndex->keys,
+                                volobj->voldef->key, obj->def->uuid);
+    virStorageVolObjIndexRemove(obj->volIndex->paths,
+                                volobj->voldef->target.path, obj->def->uuid);
+    return 0;
+}
+
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr obj)
 {
     if (!obj->volumes)
         return;
 
+    if (obj->volIndex) {
+        virObjectLock(obj->volIndex);
+        virHashForEach(obj->volumes->objsKey,
+                       virStoragePoolObjClearVolsIndexCb, obj);
+        virObjectUnlock(obj->volIndex);
+    }
+
     virHashRemoveAll(obj->volumes->objsKey);
     virHashRemoveAll(obj->volumes->objsName);
     virHashRemoveAll(obj->volumes->objsPath);
+    obj->volgen++;
 }
 
 
@@ -668,6 +957,8 @@ virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
     virObjectRef(volobj);
 
     volobj->voldef = voldef;
+    virStoragePoolObjIndexVol(obj, voldef, true);
+    obj->volgen++;
     virObjectRWUnlock(volumes);
     virStorageVolObjEndAPI(&volobj);
     return 0;
@@ -699,10 +990,12 @@ virStoragePoolObjRemoveVol(virStoragePoolObjPtr obj,
 
     virObjectRef(volobj);
     virObjectLock(volobj);
+    virStoragePoolObjIndexVol(obj, voldef, false);
     virHashRemoveEntry(volumes->objsKey, voldef->key);
     virHashRemoveEntry(volumes->objsName, voldef->name);
     virHashRemoveEntry(volumes->objsPath, voldef->target.path);
     virStorageVolObjEndAPI(&volobj);
+    obj->volgen++;
 
     virObjectRWUnlock(volumes);
 }
@@ -1588,6 +1881,7 @@ virStoragePoolObjListAdd(virStoragePoolObjListPtr pools,
 
     if (!(obj = virStoragePoolObjNew()))
         goto error;
+    obj->volIndex = virObjectRef(pools->volIndex);
 
     virUUIDFormat(def->uuid, uuidstr);
     if (virHashAddEntry(pools->objs, uuidstr, obj) < 0)
@@ -116,6 +116,9 @@ virStoragePoolObjIncrAsyncjobs(virStoragePoolObjPtr obj);
 void
 virStoragePoolObjDecrAsyncjobs(virStoragePoolObjPtr obj);
 
+unsigned long long
+virStoragePoolObjGetVolGeneration(virStoragePoolObjPtr obj);
+
 int
 virStoragePoolObjLoadAllConfigs(virStoragePoolObjListPtr pools,
                                 const char *configDir,
@@ -133,6 +136,16 @@ virStoragePoolObjPtr
 virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
                             const char *name);
 
+virStoragePoolObjPtr
+virStoragePoolObjListFindVolByKey(virStoragePoolObjListPtr pools,
+                                  const char *key,
+                                  virStorageVolDefPtr *voldef);
+
+virStoragePoolObjPtr
+virStoragePoolObjListFindVolByPath(virStoragePoolObjListPtr pools,
+                                   const char *path,
+                                   virStorageVolDefPtr *voldef);
+
 int
 virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
                         virStorageVolDefPtr voldef);
@@ -1405,6 +1405,14 @@ typedef int
                            char ***msgs,
                            unsigned int flags);
 
+typedef int
+(*virDrvDomainListGetGuestInfo)(virConnectPtr conn,
+                                virDomainPtr *doms,
+                                unsigned int ndoms,
+                                unsigned int types,
+                                virDomainStatsRecordPtr **retInfo,
+                                unsigned int flags);
+
 typedef struct _virHypervisorDriver virHypervisorDriver;
 typedef virHypervisorDriver *virHypervisorDriverPtr;
 
@@ -1671,4 +1679,5 @@ struct _virHypervisorDriver {
     virDrvDomainAuthorizedSSHKeysGet domainAuthorizedSSHKeysGet;
     virDrvDomainAuthorizedSSHKeysSet domainAuthorizedSSHKeysSet;
     virDrvDomainGetMessages domainGetMessages;
+    virDrvDomainListGetGuestInfo domainListGetGuestInfo;
 };
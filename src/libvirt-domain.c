@@ -11887,6 +11887,36 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *                       bytes consumed by @vcpus that passing through all
  *                       memory controllers, either local or remote controller.
  *
+ * VIR_DOMAIN_STATS_MONITOR:
+ *     Return timing statistics of the commands issued by the hypervisor driver
+ *     on the monitor of a running domain. All times are in microseconds and
+ *     accumulated since the hypervisor driver connected to the monitor, that
+ *     is since the domain was started or, if the daemon was restarted in the
+ *     meantime, since it reconnected to the domain. The typed parameter keys
+ *     are in this format:
+ *
+ *     "monitor.command.count" - number of distinct commands issued as
+ *                               unsigned int.
+ *     "monitor.command.<num>.name" - name of the command <num> as string.
+ *     "monitor.command.<num>.calls" - number of times the command was issued
+ *                                     as unsigned long long.
+ *     "monitor.command.<num>.time.total" - total time between submitting the
+ *                                          command and receiving its reply
+ *                                          as unsigned long long.
+ *     "monitor.command.<num>.time.max" - longest time between submitting the
+ *                                        command and receiving its reply
+ *                                        as unsigned long long.
+ *     "monitor.command.<num>.time.queued" - total time the command spent
+ *                                           waiting for transmission to the
+ *                                           hypervisor as unsigned long long.
+ *     "monitor.command.<num>.time.parse" - total time spent parsing replies
+ *                                          to the command as unsigned
+ *                                          long long.
+ *     "monitor.command.<num>.histogram.<bucket>" - number of calls whose
+ *                          round trip took less than 100us (bucket 0),
+ *                          1ms (1), 10ms (2), 100ms (3), 1s (4) or longer (5)
+ *                          as unsigned long long.
+ *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
  * applicable for the current state of the guest domain, or their retrieval
@@ -12073,7 +12103,8 @@ virDomainListGetStats(virDomainPtr *doms,
  * @stats: NULL terminated array of virDomainStatsRecords to free
  *
  * Convenience function to free a list of domain stats returned by
- * virDomainListGetStats and virConnectGetAllDomainStats.
+ * virDomainListGetStats and virConnectGetAllDomainStats or a list of
+ * guest info returned by virDomainListGetGuestInfo.
  */
 void
 virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
@@ -12598,6 +12629,94 @@ int virDomainGetGuestInfo(virDomainPtr domain,
     return -1;
 }
 
+/**
+ * virDomainListGetGuestInfo:
+ * @doms: NULL terminated array of domains
+ * @types: types of information to return, binary-OR of virDomainGuestInfoTypes
+ * @retInfo: Pointer that will be filled with the array of returned info
+ * @flags: currently unused, set to 0
+ *
+ * Queries the guest agents of the domains provided by @doms for the
+ * information about the guest systems. Note that all domains in @doms must
+ * share the same connection.
+ *
+ * This is the bulk variant of virDomainGetGuestInfo: the information
+ * groups selected by @types and the typed parameters returned for each
+ * domain are the same as documented there. The guest agents of different
+ * domains are queried concurrently by the hypervisor driver, so a slow or
+ * unresponsive agent doesn't delay gathering the information from the other
+ * domains beyond the agent response timeout.
+ *
+ * Domains which are not running, don't have a responsive guest agent or for
+ * which the information can't be gathered for any other reason are left out
+ * of the returned array rather than failing the whole call.
+ *
+ * Returns the count of returned info structures on success, -1 on error.
+ * The requested data are returned in the @retInfo parameter. The returned
+ * array should be freed by the caller. See virDomainStatsRecordListFree.
+ * Note that the count of returned structures may be less than the domain
+ * count provided via @doms.
+ */
+int
+virDomainListGetGuestInfo(virDomainPtr *doms,
+                          unsigned int types,
+                          virDomainStatsRecordPtr **retInfo,
+                          unsigned int flags)
+{
+    virConnectPtr conn = NULL;
+    virDomainPtr *nextdom = doms;
+    unsigned int ndoms = 0;
+    int ret = -1;
+
+    VIR_DEBUG("doms=%p, types=0x%x, retInfo=%p, flags=0x%x",
+              doms, types, retInfo, flags);
+
+    virResetLastError();
+
+    virCheckNonNullArgGoto(doms, cleanup);
+    virCheckNonNullArgGoto(retInfo, cleanup);
+
+    if (!*doms) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("doms array in %s must contain at least one domain"),
+                       __FUNCTION__);
+        goto cleanup;
+    }
+
+    conn = doms[0]->conn;
+    virCheckConnectReturn(conn, -1);
+    virCheckReadOnlyGoto(conn->flags, cleanup);
+
+    if (!conn->driver->domainListGetGuestInfo) {
+        virReportUnsupportedError();
+        goto cleanup;
+    }
+
+    while (*nextdom) {
+        virDomainPtr dom = *nextdom;
+
+        virCheckDomainGoto(dom, cleanup);
+
+        if (dom->conn != conn) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("domains in 'doms' array must belong to a "
+                             "single connection"));
+            goto cleanup;
+        }
+
+        ndoms++;
+        nextdom++;
+    }
+
+    ret = conn->driver->domainListGetGuestInfo(conn, doms, ndoms,
+                                               types, retInfo, flags);
+
+ cleanup:
+    if (ret < 0)
+        virDispatchError(conn);
+    return ret;
+}
+
 /**
  * virDomainSetBlockThreshold:
  * @domain: pointer to domain object
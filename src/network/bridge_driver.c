@@ -66,6 +66,7 @@
 #include "network_event.h"
 #include "virhook.h"
 #include "virjson.h"
+#include "virleasedb.h"
 #include "virnetworkportdef.h"
 #include "virutil.h"
 
@@ -426,6 +427,7 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
 {
     g_autofree char *leasefile = NULL;
     g_autofree char *customleasefile = NULL;
+    g_autofree char *leasedbfile = NULL;
     g_autofree char *radvdconfigfile = NULL;
     g_autofree char *configfile = NULL;
     g_autofree char *radvdpidbase = NULL;
@@ -446,6 +448,9 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     if (!(customleasefile = networkDnsmasqLeaseFileNameCustom(driver, def->bridge)))
         return -1;
 
+    if (!(leasedbfile = virLeaseDBFileName(driver->dnsmasqStateDir, def->bridge)))
+        return -1;
+
     if (!(radvdconfigfile = networkRadvdConfigFileName(driver, def->name)))
         return -1;
 
@@ -465,6 +470,7 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     dnsmasqDelete(dctx);
     unlink(leasefile);
     unlink(customleasefile);
+    unlink(leasedbfile);
     unlink(configfile);
 
     /* MAC map manager */
@@ -4050,6 +4056,7 @@ networkGetDHCPLeases(virNetworkPtr net,
     bool need_results = !!leases;
     long long currtime = 0;
     g_autofree char *lease_entries = NULL;
+    g_autofree char *lease_db_file = NULL;
     g_autofree char *custom_lease_file = NULL;
     g_autoptr(virJSONValue) leases_array = NULL;
     g_autofree virNetworkDHCPLeasePtr *leases_ret = NULL;
@@ -4072,36 +4079,43 @@ networkGetDHCPLeases(virNetworkPtr net,
     if (virNetworkGetDHCPLeasesEnsureACL(net->conn, def) < 0)
         goto cleanup;
 
-    /* Retrieve custom leases file location */
+    /* Retrieve lease database and custom leases file location */
+    lease_db_file = virLeaseDBFileName(driver->dnsmasqStateDir, def->bridge);
     custom_lease_file = networkDnsmasqLeaseFileNameCustom(driver, def->bridge);
 
-    /* Read entire contents */
-    if (virFileReadAllQuiet(custom_lease_file,
-                            VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
-                            &lease_entries) < 0) {
-        /* Not all networks are guaranteed to have leases file.
-         * Only those which run dnsmasq. Therefore, if we failed
-         * to read the leases file, don't report error. Return 0
-         * leases instead. */
-        if (errno == ENOENT) {
-            rv = 0;
-        } else {
-            virReportSystemError(errno,
-                                 _("Unable to read leases file: %s"),
-                                 custom_lease_file);
+    if (virFileExists(lease_db_file)) {
+        if (!(leases_array = virLeaseDBReadLeases(lease_db_file)))
+            goto cleanup;
+    } else {
+        /* The leases helper has not converted the custom leases
+         * file into a database yet, read it directly */
+        if (virFileReadAllQuiet(custom_lease_file,
+                                VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
+                                &lease_entries) < 0) {
+            /* Not all networks are guaranteed to have leases file.
+             * Only those which run dnsmasq. Therefore, if we failed
+             * to read the leases file, don't report error. Return 0
+             * leases instead. */
+            if (errno == ENOENT) {
+                rv = 0;
+            } else {
+                virReportSystemError(errno,
+                                     _("Unable to read leases file: %s"),
+                                     custom_lease_file);
+            }
+            goto cleanup;
         }
-        goto cleanup;
-    }
 
-    if (STREQ(lease_entries, "")) {
-        rv = 0;
-        goto cleanup;
-    }
+        if (STREQ(lease_entries, "")) {
+            rv = 0;
+            goto cleanup;
+        }
 
-    if (!(leases_array = virJSONValueFromString(lease_entries))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("invalid json in file: %s"), custom_lease_file);
-        goto cleanup;
+        if (!(leases_array = virJSONValueFromString(lease_entries))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("invalid json in file: %s"), custom_lease_file);
+            goto cleanup;
+        }
     }
 
     if (!virJSONValueIsArray(leases_array)) {
@@ -32,6 +32,7 @@
 #include "viralloc.h"
 #include "virjson.h"
 #include "virlease.h"
+#include "virleasedb.h"
 #include "virenum.h"
 #include "configmake.h"
 #include "virgettext.h"
@@ -55,9 +56,14 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details\n"), program_name);
     } else {
         printf(_("Usage: %s add|old|del|init mac|clientid ip [hostname]\n"
+                 "       %s --export-leases bridge\n"
                  "Designed for use with 'dnsmasq --dhcp-script'\n"
-                 "Refer to man page of dnsmasq for more details'\n"),
-               program_name);
+                 "Refer to man page of dnsmasq for more details'\n"
+                 "\n"
+                 "--export-leases writes the leases of the network using\n"
+                 "the bridge to the JSON lease file read by libvirt older\n"
+                 "than 7.2.0\n"),
+               program_name, program_name);
     }
     exit(status);
 }
@@ -79,14 +85,35 @@ VIR_ENUM_IMPL(virLeaseAction,
               "add", "old", "del", "init",
 );
 
+/* The JSON lease file is no longer updated on lease changes, it's only
+ * written on request, e.g. before downgrading to an older version. */
+static int
+leaseshelperExportLeases(virLeaseDBPtr lease_db,
+                         const char *custom_lease_file)
+{
+    g_autoptr(virJSONValue) leases_array = NULL;
+    g_autofree char *leases_str = NULL;
+
+    if (!(leases_array = virLeaseDBGetLeases(lease_db)))
+        return -1;
+
+    if (!(leases_str = virJSONValueToString(leases_array, true))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("empty json array"));
+        return -1;
+    }
+
+    return virFileRewriteStr(custom_lease_file, 0644, leases_str);
+}
+
 int
 main(int argc, char **argv)
 {
     g_autofree char *pid_file = NULL;
     g_autofree char *custom_lease_file = NULL;
+    g_autofree char *lease_db_file = NULL;
     const char *ip = NULL;
     const char *mac = NULL;
-    const char *leases_str = NULL;
     const char *iaid = getenv("DNSMASQ_IAID");
     const char *clientid = getenv("DNSMASQ_CLIENT_ID");
     const char *interface = getenv("DNSMASQ_INTERFACE");
@@ -95,9 +122,10 @@ main(int argc, char **argv)
     int action = -1;
     int pid_file_fd = -1;
     int rv = EXIT_FAILURE;
-    bool delete = false;
+    bool export_leases = false;
+    g_autoptr(virLeaseDB) lease_db = NULL;
     g_autoptr(virJSONValue) lease_new = NULL;
-    g_autoptr(virJSONValue) leases_array_new = NULL;
+    g_autoptr(virJSONValue) leases_array = NULL;
 
     virSetErrorFunc(NULL, NULL);
     virSetErrorLogPriorityFunc(NULL);
@@ -119,9 +147,16 @@ main(int argc, char **argv)
             helperVersion(argv[0]);
             exit(EXIT_SUCCESS);
         }
+
+        if (STREQ(argv[1], "--export-leases")) {
+            if (argc != 3)
+                usage(EXIT_FAILURE);
+            export_leases = true;
+            interface = argv[2];
+        }
     }
 
-    if (argc != 4 && argc != 5 && argc != 2) {
+    if (!export_leases && argc != 4 && argc != 5 && argc != 2) {
         /* Refer man page of dnsmasq --dhcp-script for more details */
         usage(EXIT_FAILURE);
     }
@@ -139,7 +174,8 @@ main(int argc, char **argv)
     ip = argv[3];
     mac = argv[2];
 
-    if ((action = virLeaseActionTypeFromString(argv[1])) < 0) {
+    if (!export_leases &&
+        (action = virLeaseActionTypeFromString(argv[1])) < 0) {
         fprintf(stderr, _("Unsupported action: %s\n"), argv[1]);
         exit(EXIT_FAILURE);
     }
@@ -158,6 +194,8 @@ main(int argc, char **argv)
 
     custom_lease_file = g_strdup_printf(LOCALSTATEDIR "/lib/libvirt/dnsmasq/%s.status",
                                         interface);
+    lease_db_file = virLeaseDBFileName(LOCALSTATEDIR "/lib/libvirt/dnsmasq",
+                                       interface);
 
     pid_file = g_strdup(RUNSTATEDIR "/leaseshelper.pid");
 
@@ -169,13 +207,25 @@ main(int argc, char **argv)
         goto cleanup;
     }
 
-    /* Since interfaces can be hot plugged, we need to make sure that the
-     * corresponding custom lease file exists. If not, 'touch' it */
-    if (virFileTouch(custom_lease_file, 0644) < 0) {
-        fprintf(stderr,
-                _("Unable to create: %s\n errno=%d"),
-                custom_lease_file, errno);
+    /* Since interfaces can be hot plugged, the lease database might not
+     * exist yet, in which case it is created. Leases recorded in the custom
+     * lease file by older versions are imported into it. */
+    if (!(lease_db = virLeaseDBOpen(lease_db_file, custom_lease_file)))
         goto cleanup;
+
+    if (export_leases) {
+        if (leaseshelperExportLeases(lease_db, custom_lease_file) < 0)
+            goto cleanup;
+
+        rv = EXIT_SUCCESS;
+        goto cleanup;
+    }
+
+    if (server_duid) {
+        if (virLeaseDBSetServerDUID(lease_db, server_duid) < 0)
+            goto cleanup;
+    } else {
+        server_duid = g_strdup(virLeaseDBGetServerDUID(lease_db));
     }
 
     switch ((enum virLeaseActionFlags) action) {
@@ -185,8 +235,8 @@ main(int argc, char **argv)
         if (virLeaseNew(&lease_new, mac, clientid, ip, hostname, iaid, server_duid) < 0)
             goto cleanup;
         /* Custom ipv6 leases *will not* be created if the env-var DNSMASQ_MAC
-         * is not set. In the special case, when the $(interface).status file
-         * is not already present and dnsmasq is (re)started, the corresponding
+         * is not set. In the special case, when the lease database does not
+         * contain the lease yet and dnsmasq is (re)started, the corresponding
          * ipv6 custom lease will be created only when the guest sends the
          * 'old' action for its existing ipv6 interfaces.
          *
@@ -200,48 +250,20 @@ main(int argc, char **argv)
         if (!lease_new)
             break;
 
-        G_GNUC_FALLTHROUGH;
-    case VIR_LEASE_ACTION_DEL:
-        /* Delete the corresponding lease, if it already exists */
-        delete = true;
-        break;
-
-    case VIR_LEASE_ACTION_INIT:
-    case VIR_LEASE_ACTION_LAST:
-        break;
-    }
-
-    leases_array_new = virJSONValueNewArray();
-
-    if (virLeaseReadCustomLeaseFile(leases_array_new, custom_lease_file,
-                                    delete ? ip : NULL, &server_duid) < 0)
-        goto cleanup;
-
-    switch ((enum virLeaseActionFlags) action) {
-    case VIR_LEASE_ACTION_INIT:
-        if (virLeasePrintLeases(leases_array_new, server_duid) < 0)
+        /* Any previous lease for the same address is replaced */
+        if (virLeaseDBAdd(lease_db, lease_new) < 0)
             goto cleanup;
-
         break;
 
-    case VIR_LEASE_ACTION_OLD:
-    case VIR_LEASE_ACTION_ADD:
-        if (lease_new && virJSONValueArrayAppend(leases_array_new, &lease_new) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("failed to create json"));
-            goto cleanup;
-        }
-
-        G_GNUC_FALLTHROUGH;
     case VIR_LEASE_ACTION_DEL:
-        if (!(leases_str = virJSONValueToString(leases_array_new, true))) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("empty json array"));
+        /* Delete the corresponding lease, if it already exists */
+        if (virLeaseDBRemove(lease_db, ip) < 0)
             goto cleanup;
-        }
+        break;
 
-        /* Write to file */
-        if (virFileRewriteStr(custom_lease_file, 0644, leases_str) < 0)
+    case VIR_LEASE_ACTION_INIT:
+        if (!(leases_array = virLeaseDBGetLeases(lease_db)) ||
+            virLeasePrintLeases(leases_array, server_duid) < 0)
             goto cleanup;
         break;
 
@@ -90,6 +90,15 @@ static enum ctdirStatus iptables_ctdir_corrected;
 
 static bool newMatchState;
 
+/* Rules whose source or destination address is given by a list variable
+ * with at least this many values match a set of the addresses instead
+ * of being instantiated for each of them; 0 if sets are not used */
+#define EBIPTABLES_IPSET_MIN_VALUES 8
+static unsigned int ipsetMinValues;
+
+#define IPSET_PREFIX "lv-"
+#define IPSET_HASH_LENGTH 10
+
 #define MATCH_PHYSDEV_IN_FW   "-m", "physdev", "--physdev-in"
 #define MATCH_PHYSDEV_OUT_FW  "-m", "physdev", "--physdev-is-bridged", "--physdev-out"
 #define MATCH_PHYSDEV_OUT_OLD_FW  "-m", "physdev", "--physdev-out"
@@ -99,6 +108,7 @@ static int ebiptablesDriverInit(bool privileged);
 static void ebiptablesDriverShutdown(void);
 static int ebtablesCleanAll(const char *ifname);
 static int ebiptablesAllTeardown(const char *ifname);
+static void ebiptablesForgetRules(const char *ifname, GHashTable *ipsets);
 
 struct ushort_map {
     unsigned short attr;
@@ -3074,6 +3084,8 @@ ebtablesCleanAll(const char *ifname)
 {
     g_autoptr(virFirewall) fw = virFirewallNew();
 
+    ebiptablesForgetRules(ifname, NULL);
+
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
 
     ebtablesUnlinkRootChainFW(fw, true, ifname);
@@ -3194,28 +3206,229 @@ ebtablesGetProtoIdxByFiltername(const char *filtername)
 }
 
 
+void
+ebiptablesSetIPSetMinValues(unsigned int minValues)
+{
+    ipsetMinValues = minValues;
+}
+
+
+/*
+ * iptablesIPSetVarIsPrivate:
+ *
+ * Check whether the list variable accessed by @item is not accessed by
+ * any other address of @ipHdr and no other variable of @rule iterates
+ * along with it, so that the rule can match all of its values at once.
+ */
+static bool
+iptablesIPSetVarIsPrivate(virNWFilterRuleDefPtr rule,
+                          ipHdrDataDefPtr ipHdr,
+                          nwItemDescPtr item)
+{
+    nwItemDescPtr items[] = {
+        &ipHdr->dataSrcIPAddr, &ipHdr->dataSrcIPMask,
+        &ipHdr->dataDstIPAddr, &ipHdr->dataDstIPMask,
+        &ipHdr->dataSrcIPFrom, &ipHdr->dataSrcIPTo,
+        &ipHdr->dataDstIPFrom, &ipHdr->dataDstIPTo,
+    };
+    const char *varName = virNWFilterVarAccessGetVarName(item->varAccess);
+    unsigned int iterId = virNWFilterVarAccessGetIterId(item->varAccess);
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS(items); i++) {
+        if (items[i] != item &&
+            (items[i]->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) &&
+            STREQ(virNWFilterVarAccessGetVarName(items[i]->varAccess),
+                  varName))
+            return false;
+    }
+
+    for (i = 0; i < rule->nVarAccess; i++) {
+        virNWFilterVarAccessPtr vap = rule->varAccess[i];
+
+        if (virNWFilterVarAccessEqual(vap, item->varAccess))
+            continue;
+
+        if (STREQ(virNWFilterVarAccessGetVarName(vap), varName) ||
+            (virNWFilterVarAccessGetType(vap) == VIR_NWFILTER_VAR_ACCESS_ITERATOR &&
+             virNWFilterVarAccessGetIterId(vap) == iterId))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * iptablesRuleUseIPSet:
+ * @rule: the rule instance
+ * @ifname: name of the interface
+ * @ipsets: buffer collecting the commands creating the sets
+ * @def: filled with the rule to instantiate
+ *
+ * If the source or destination address of @rule is given by a list
+ * variable with at least ipsetMinValues values, fill @def with a copy of
+ * the rule matching a set of these addresses instead and add the commands
+ * creating the set to @ipsets. The set is named after its content, so the
+ * same set is shared by the old and new rules while the filter is being
+ * updated. The caller must free the varAccess array of @def.
+ *
+ * Returns 1 if @def was filled, 0 if the rule is to be instantiated for
+ * each value, -1 on error.
+ */
+static int
+iptablesRuleUseIPSet(virNWFilterRuleInstPtr rule,
+                     const char *ifname,
+                     virBufferPtr ipsets,
+                     virNWFilterRuleDefPtr def)
+{
+    ipHdrDataDefPtr ipHdr = &rule->def->p.allHdrFilter.ipHdr;
+    ipHdrDataDefPtr defIPHdr;
+    nwItemDescPtr item = NULL;
+    nwItemDescPtr defItem;
+    virNWFilterVarValuePtr value = NULL;
+    g_auto(GStrv) members = NULL;
+    g_autofree char *content = NULL;
+    g_autofree char *hash = NULL;
+    g_autofree char *name = NULL;
+    unsigned int nvalues = 0;
+    size_t nmembers = 0;
+    bool src = false;
+    int family;
+    size_t i;
+
+    if (!ipsetMinValues ||
+        HAS_ENTRY_ITEM(&ipHdr->dataIPSet))
+        return 0;
+
+    for (i = 0; i < 2 && !item; i++) {
+        nwItemDescPtr addr = i == 0 ? &ipHdr->dataSrcIPAddr : &ipHdr->dataDstIPAddr;
+        nwItemDescPtr mask = i == 0 ? &ipHdr->dataSrcIPMask : &ipHdr->dataDstIPMask;
+
+        if (!(addr->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) ||
+            ENTRY_WANT_NEG_SIGN(addr) ||
+            HAS_ENTRY_ITEM(mask) ||
+            virNWFilterVarAccessGetType(addr->varAccess) != VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+            continue;
+
+        value = virHashLookup(rule->vars,
+                              virNWFilterVarAccessGetVarName(addr->varAccess));
+        if (!value ||
+            (nvalues = virNWFilterVarValueGetCardinality(value)) < ipsetMinValues ||
+            !iptablesIPSetVarIsPrivate(rule->def, ipHdr, addr))
+            continue;
+
+        item = addr;
+        src = i == 0;
+    }
+
+    if (!item)
+        return 0;
+
+    family = item->datatype == DATATYPE_IPV6ADDR ? AF_INET6 : AF_INET;
+
+    /* the values are not validated when they are assigned */
+    members = g_new0(char *, nvalues + 1);
+    for (i = 0; i < nvalues; i++) {
+        virSocketAddr addr;
+
+        if (virSocketAddrParse(&addr,
+                               virNWFilterVarValueGetNthValue(value, i),
+                               family) < 0 ||
+            !(members[nmembers++] = virSocketAddrFormat(&addr)))
+            return -1;
+    }
+
+    qsort(members, nmembers, sizeof(*members), virStringSortCompare);
+    for (i = 1; i < nmembers;) {
+        if (STREQ(members[i], members[i - 1])) {
+            g_free(members[i]);
+            memmove(members + i, members + i + 1,
+                    (nmembers - i) * sizeof(*members));
+            nmembers--;
+        } else {
+            i++;
+        }
+    }
+
+    content = g_strjoinv("\n", members);
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, content, -1);
+    name = g_strdup_printf(IPSET_PREFIX "%s-%.*s",
+                           ifname, IPSET_HASH_LENGTH, hash);
+
+    virBufferAsprintf(ipsets, "create %s hash:ip family %s\n",
+                      name, family == AF_INET6 ? "inet6" : "inet");
+    for (i = 0; i < nmembers; i++)
+        virBufferAsprintf(ipsets, "add %s %s\n", name, members[i]);
+
+    *def = *rule->def;
+    def->varAccess = g_new0(virNWFilterVarAccessPtr, rule->def->nVarAccess);
+    def->nVarAccess = 0;
+    for (i = 0; i < rule->def->nVarAccess; i++) {
+        if (!virNWFilterVarAccessEqual(rule->def->varAccess[i], item->varAccess))
+            def->varAccess[def->nVarAccess++] = rule->def->varAccess[i];
+    }
+
+    defIPHdr = &def->p.allHdrFilter.ipHdr;
+    defItem = src ? &defIPHdr->dataSrcIPAddr : &defIPHdr->dataDstIPAddr;
+    defItem->flags = 0;
+    defItem->varAccess = NULL;
+
+    defIPHdr->dataIPSet.flags = NWFILTER_ENTRY_ITEM_FLAG_EXISTS;
+    defIPHdr->dataIPSet.datatype = DATATYPE_IPSETNAME;
+    if (virStrcpyStatic(defIPHdr->dataIPSet.u.ipset.setname, name) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("ipset name '%s' is too long"), name);
+        g_free(def->varAccess);
+        return -1;
+    }
+
+    /* flags are printed as 'src' if set and as 'dst' if not, the other
+     * way round for incoming traffic */
+    defIPHdr->dataIPSetFlags.flags = NWFILTER_ENTRY_ITEM_FLAG_EXISTS;
+    defIPHdr->dataIPSetFlags.datatype = DATATYPE_IPSETFLAGS;
+    defIPHdr->dataIPSetFlags.u.ipset.numFlags = 1;
+    defIPHdr->dataIPSetFlags.u.ipset.flags = src ? 1 : 0;
+
+    return 1;
+}
+
+
 static int
 iptablesRuleInstCommand(virFirewallPtr fw,
                         const char *ifname,
-                        virNWFilterRuleInstPtr rule)
+                        virNWFilterRuleInstPtr rule,
+                        virBufferPtr ipsets)
 {
     virNWFilterVarCombIterPtr vciter, tmp;
+    virNWFilterRuleDef setdef;
+    virNWFilterRuleDefPtr def = rule->def;
+    g_autofree virNWFilterVarAccessPtr *setVarAccess = NULL;
+    int rc;
     int ret = -1;
 
+    if ((rc = iptablesRuleUseIPSet(rule, ifname, ipsets, &setdef)) < 0)
+        return -1;
+
+    if (rc > 0) {
+        def = &setdef;
+        setVarAccess = setdef.varAccess;
+    }
+
     /* rule->vars holds all the variables names that this rule will access.
      * iterate over all combinations of the variables' values and instantiate
      * the filtering rule with each combination.
      */
     tmp = vciter = virNWFilterVarCombIterCreate(rule->vars,
-                                                rule->def->varAccess,
-                                                rule->def->nVarAccess);
+                                                def->varAccess,
+                                                def->nVarAccess);
     if (!vciter)
         return -1;
 
     do {
         if (ebiptablesCreateRuleInstance(fw,
                                          rule->chainSuffix,
-                                         rule->def,
+                                         def,
                                          ifname,
                                          tmp) < 0)
             goto cleanup;
@@ -3321,13 +3534,641 @@ ebtablesGetSubChainInsts(GHashTable *chains,
     return 0;
 }
 
+
+/*
+ * The rules instantiated for each interface are remembered in the form
+ * of the commands which created them, so that an update of the filter
+ * can be applied by adding and removing individual rules of the chains
+ * of the interface instead of building all the chains from scratch.
+ */
+typedef struct _ebiptablesRuleLine ebiptablesRuleLine;
+typedef ebiptablesRuleLine *ebiptablesRuleLinePtr;
+struct _ebiptablesRuleLine {
+    virFirewallLayer layer;
+    bool ignoreErrors;
+    char **args; /* NULL terminated, with the final chain names */
+    size_t nargs;
+    /* index of "-A" in @args if the rule is appended to a chain of the
+     * interface, -1 otherwise */
+    ssize_t append;
+};
+
+typedef struct _ebiptablesRuleSet ebiptablesRuleSet;
+typedef ebiptablesRuleSet *ebiptablesRuleSetPtr;
+struct _ebiptablesRuleSet {
+    size_t nlines;
+    ebiptablesRuleLinePtr lines;
+};
+
+typedef struct _ebiptablesIfaceRules ebiptablesIfaceRules;
+typedef ebiptablesIfaceRules *ebiptablesIfaceRulesPtr;
+struct _ebiptablesIfaceRules {
+    /* rules in the chains of the interface */
+    ebiptablesRuleSetPtr current;
+    /* rules in the temporary chains, or the previous rules
+     * if @updatedInPlace is set */
+    ebiptablesRuleSetPtr pending;
+    bool updatedInPlace;
+};
+
+/* upper limit of the size of the table used to compare the rules of
+ * a chain, chains with more rules are built from scratch */
+#define EBIPTABLES_CHAIN_DIFF_MAX (1024 * 1024)
+
+static virMutex ifaceRulesLock = VIR_MUTEX_INITIALIZER;
+static GHashTable *ifaceRules;
+
+
+static void
+ebiptablesRuleSetFree(ebiptablesRuleSetPtr set)
+{
+    size_t i;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < set->nlines; i++)
+        g_strfreev(set->lines[i].args);
+    g_free(set->lines);
+    g_free(set);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(ebiptablesRuleSet, ebiptablesRuleSetFree);
+
+
+static void
+ebiptablesIfaceRulesFree(void *opaque)
+{
+    ebiptablesIfaceRulesPtr iface = opaque;
+
+    if (!iface)
+        return;
+
+    ebiptablesRuleSetFree(iface->current);
+    ebiptablesRuleSetFree(iface->pending);
+    g_free(iface);
+}
+
+
+/*
+ * Call this function while holding ifaceRulesLock
+ */
+static ebiptablesIfaceRulesPtr
+ebiptablesIfaceRulesGet(const char *ifname,
+                        bool create)
+{
+    ebiptablesIfaceRulesPtr iface = NULL;
+
+    if (!ifaceRules) {
+        if (!create)
+            return NULL;
+        if (!(ifaceRules = virHashNew(ebiptablesIfaceRulesFree)))
+            return NULL;
+    }
+
+    if ((iface = virHashLookup(ifaceRules, ifname)) || !create)
+        return iface;
+
+    iface = g_new0(ebiptablesIfaceRules, 1);
+    if (virHashAddEntry(ifaceRules, ifname, iface) < 0) {
+        ebiptablesIfaceRulesFree(iface);
+        return NULL;
+    }
+
+    return iface;
+}
+
+
+/*
+ * ebiptablesRuleSetGetIPSets:
+ * @set: rules of an interface
+ * @ifname: name of the interface
+ * @ipsets: hash table of set names
+ * @drop: whether to remove the names
+ *
+ * Add the names of the sets created for @ifname which are matched by the
+ * rules of @set to @ipsets, or remove them from it if @drop is true.
+ */
+static void
+ebiptablesRuleSetGetIPSets(ebiptablesRuleSetPtr set,
+                           const char *ifname,
+                           GHashTable *ipsets,
+                           bool drop)
+{
+    g_autofree char *prefix = g_strdup_printf(IPSET_PREFIX "%s-", ifname);
+    size_t i, j;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < set->nlines; i++) {
+        char **args = set->lines[i].args;
+
+        for (j = 0; j + 1 < set->lines[i].nargs; j++) {
+            const char *hash;
+
+            if (STRNEQ(args[j], "--match-set") ||
+                !(hash = STRSKIP(args[j + 1], prefix)) ||
+                strlen(hash) != IPSET_HASH_LENGTH ||
+                strchr(hash, '-'))
+                continue;
+
+            if (drop)
+                virHashRemoveEntry(ipsets, args[j + 1]);
+            else
+                ignore_value(virHashUpdateEntry(ipsets, args[j + 1], NULL));
+        }
+    }
+}
+
+
+/*
+ * ebiptablesCreateIPSets:
+ * @ipsets: commands creating the sets
+ *
+ * Create the sets of addresses matched by the rules. Sets and addresses
+ * which exist already are left alone.
+ */
 static int
-ebiptablesApplyNewRules(const char *ifname,
-                        virNWFilterRuleInstPtr *rules,
-                        size_t nrules)
+ebiptablesCreateIPSets(virBufferPtr ipsets)
+{
+    g_autoptr(virCommand) cmd = NULL;
+    g_autofree char *input = NULL;
+
+    if (!virBufferUse(ipsets))
+        return 0;
+
+    input = virBufferContentAndReset(ipsets);
+
+    cmd = virCommandNewArgList(IPSET_PATH, "-exist", "restore", NULL);
+    virCommandSetInputBuffer(cmd, input);
+
+    return virCommandRun(cmd, NULL);
+}
+
+
+/*
+ * ebiptablesDestroyIPSets:
+ * @ipsets: hash table of set names
+ *
+ * Destroy the sets of addresses which are no longer matched by the rules
+ * of the interface they were created for. Sets which are still in use
+ * cannot be destroyed and are left alone.
+ */
+static void
+ebiptablesDestroyIPSets(GHashTable *ipsets)
+{
+    g_autofree virHashKeyValuePairPtr names = NULL;
+    size_t nnames;
+    size_t i;
+
+    if (!ipsets || !(names = virHashGetItems(ipsets, &nnames, true)))
+        return;
+
+    for (i = 0; i < nnames; i++) {
+        g_autoptr(virCommand) cmd = NULL;
+        int status;
+
+        cmd = virCommandNewArgList(IPSET_PATH, "destroy", names[i].key, NULL);
+        if (virCommandRun(cmd, &status) < 0 || status != 0) {
+            VIR_DEBUG("Unable to destroy ipset %s",
+                      (const char *)names[i].key);
+            virResetLastError();
+        }
+    }
+}
+
+
+/*
+ * ebiptablesForgetRules:
+ * @ifname: name of the interface
+ * @ipsets: hash table filled with the names of the sets used by the rules
+ *          or NULL
+ */
+static void
+ebiptablesForgetRules(const char *ifname,
+                      GHashTable *ipsets)
+{
+    ebiptablesIfaceRulesPtr iface;
+
+    virMutexLock(&ifaceRulesLock);
+    if ((iface = ebiptablesIfaceRulesGet(ifname, false))) {
+        if (ipsets) {
+            ebiptablesRuleSetGetIPSets(iface->current, ifname, ipsets, false);
+            ebiptablesRuleSetGetIPSets(iface->pending, ifname, ipsets, false);
+        }
+        virHashRemoveEntry(ifaceRules, ifname);
+    }
+    virMutexUnlock(&ifaceRulesLock);
+}
+
+
+/*
+ * ebiptablesRenameTmpChain:
+ * @name: name of a chain
+ * @ifname: name of the interface
+ *
+ * Returns the name the temporary chain @name of interface @ifname gets
+ * once the new rules are switched to, or NULL if @name is not such a
+ * chain.
+ */
+static char *
+ebiptablesRenameTmpChain(const char *name,
+                         const char *ifname)
+{
+    char tmp[MAX_CHAINNAME_LENGTH];
+    const char *suffix;
+    size_t i;
+
+    for (i = 0; chainprefixes_host_temp[i]; i++) {
+        char prefix = chainprefixes_host_temp[i];
+        char newPrefix = chainprefixes_host[i];
+
+        PRINT_ROOT_CHAIN(tmp, prefix, ifname);
+        if (STREQ(name, tmp))
+            return g_strdup_printf("libvirt-%c-%s", newPrefix, ifname);
+
+        g_snprintf(tmp, sizeof(tmp), "%c-%s-", prefix, ifname);
+        if ((suffix = STRSKIP(name, tmp)))
+            return g_strdup_printf("%c-%s-%s", newPrefix, ifname, suffix);
+
+        g_snprintf(tmp, sizeof(tmp), "F%c-%s", prefix, ifname);
+        if (STREQ(name, tmp))
+            return g_strdup_printf("F%c-%s", newPrefix, ifname);
+
+        g_snprintf(tmp, sizeof(tmp), "H%c-%s", prefix, ifname);
+        if (STREQ(name, tmp))
+            return g_strdup_printf("H%c-%s", newPrefix, ifname);
+    }
+
+    return NULL;
+}
+
+
+struct ebiptablesRuleSetData {
+    const char *ifname;
+    ebiptablesRuleSetPtr set;
+};
+
+
+static int
+ebiptablesRuleSetAddLine(virFirewallLayer layer,
+                         bool ignoreErrors,
+                         const char *const *args,
+                         size_t nargs,
+                         void *opaque)
+{
+    struct ebiptablesRuleSetData *data = opaque;
+    ebiptablesRuleLine line = {
+        .layer = layer,
+        .ignoreErrors = ignoreErrors,
+        .nargs = nargs,
+        .append = -1,
+    };
+    size_t i;
+
+    line.args = g_new0(char *, nargs + 1);
+    for (i = 0; i < nargs; i++) {
+        if (!(line.args[i] = ebiptablesRenameTmpChain(args[i], data->ifname)))
+            line.args[i] = g_strdup(args[i]);
+    }
+
+    for (i = 0; i + 1 < nargs; i++) {
+        if (STREQ(args[i], "-t")) {
+            i++;
+            continue;
+        }
+
+        /* a renamed chain is a chain of the interface */
+        if (STREQ(args[i], "-A") && !ignoreErrors &&
+            STRNEQ(args[i + 1], line.args[i + 1]))
+            line.append = i;
+        break;
+    }
+
+    if (VIR_APPEND_ELEMENT(data->set->lines, data->set->nlines, line) < 0) {
+        g_strfreev(line.args);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static ebiptablesRuleSetPtr
+ebiptablesRuleSetNew(virFirewallPtr fw,
+                     const char *ifname)
+{
+    g_autoptr(ebiptablesRuleSet) set = g_new0(ebiptablesRuleSet, 1);
+    struct ebiptablesRuleSetData data = { ifname, set };
+
+    if (virFirewallForEachRule(fw, ebiptablesRuleSetAddLine, &data) < 0)
+        return NULL;
+
+    return g_steal_pointer(&set);
+}
+
+
+static bool
+ebiptablesRuleLineEqual(const ebiptablesRuleLine *a,
+                        const ebiptablesRuleLine *b)
+{
+    size_t i;
+
+    if (a->layer != b->layer ||
+        a->ignoreErrors != b->ignoreErrors ||
+        a->nargs != b->nargs)
+        return false;
+
+    for (i = 0; i < a->nargs; i++) {
+        if (STRNEQ(a->args[i], b->args[i]))
+            return false;
+    }
+
+    return true;
+}
+
+
+static bool
+ebiptablesRuleLineSameChain(const ebiptablesRuleLine *a,
+                            const ebiptablesRuleLine *b)
+{
+    return a->append >= 0 && b->append >= 0 &&
+        a->layer == b->layer &&
+        STREQ(a->args[a->append + 1], b->args[b->append + 1]);
+}
+
+
+/*
+ * ebiptablesRuleSetSameChains:
+ *
+ * Check whether the rules creating, linking and removing chains are
+ * the same in both @a and @b, that is whether the rule sets differ in
+ * the rules of the chains of the interface only.
+ */
+static bool
+ebiptablesRuleSetSameChains(ebiptablesRuleSetPtr a,
+                            ebiptablesRuleSetPtr b)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    while (true) {
+        while (i < a->nlines && a->lines[i].append >= 0)
+            i++;
+        while (j < b->nlines && b->lines[j].append >= 0)
+            j++;
+
+        if (i == a->nlines || j == b->nlines)
+            return i == a->nlines && j == b->nlines;
+
+        if (!ebiptablesRuleLineEqual(&a->lines[i], &b->lines[j]))
+            return false;
+
+        i++;
+        j++;
+    }
+}
+
+
+static size_t
+ebiptablesRuleSetGetChain(ebiptablesRuleSetPtr set,
+                          const ebiptablesRuleLine *chain,
+                          ebiptablesRuleLinePtr **lines)
+{
+    size_t nlines = 0;
+    size_t i;
+
+    *lines = g_new0(ebiptablesRuleLinePtr, set->nlines);
+
+    for (i = 0; i < set->nlines; i++) {
+        if (ebiptablesRuleLineSameChain(&set->lines[i], chain))
+            (*lines)[nlines++] = &set->lines[i];
+    }
+
+    return nlines;
+}
+
+
+static void
+ebiptablesRuleLineInsertFW(virFirewallPtr fw,
+                           ebiptablesRuleLinePtr line,
+                           size_t pos)
+{
+    virFirewallRulePtr fwrule = virFirewallAddRule(fw, line->layer, NULL);
+    size_t i;
+
+    for (i = 0; i < line->nargs; i++) {
+        if ((ssize_t)i == line->append) {
+            virFirewallRuleAddArgList(fw, fwrule, "-I", line->args[++i], NULL);
+            virFirewallRuleAddArgFormat(fw, fwrule, "%zu", pos);
+        } else {
+            virFirewallRuleAddArg(fw, fwrule, line->args[i]);
+        }
+    }
+}
+
+
+static void
+ebiptablesRuleLineDeleteFW(virFirewallPtr fw,
+                           ebiptablesRuleLinePtr line,
+                           size_t pos)
+{
+    virFirewallRulePtr fwrule = virFirewallAddRule(fw, line->layer, NULL);
+    size_t i;
+
+    for (i = 0; (ssize_t)i < line->append; i++)
+        virFirewallRuleAddArg(fw, fwrule, line->args[i]);
+
+    virFirewallRuleAddArgList(fw, fwrule,
+                              "-D", line->args[line->append + 1], NULL);
+    virFirewallRuleAddArgFormat(fw, fwrule, "%zu", pos);
+}
+
+
+/*
+ * ebiptablesChainDiffFW:
+ * @fw: firewall to add the commands to
+ * @from: the rules currently in the chain
+ * @nfrom: number of @from
+ * @to: the rules the chain should contain
+ * @nto: number of @to
+ * @nadded: incremented by the number of added rules
+ * @nremoved: incremented by the number of removed rules
+ *
+ * Add commands turning the rules of a chain from @from into @to while
+ * keeping the longest common subsequence of rules in place. The new
+ * rules are inserted in their order before any of the old ones are
+ * removed, starting from the last one. This way a packet is always
+ * handled either by the old or by the new rules.
+ */
+static void
+ebiptablesChainDiffFW(virFirewallPtr fw,
+                      ebiptablesRuleLinePtr *from,
+                      size_t nfrom,
+                      ebiptablesRuleLinePtr *to,
+                      size_t nto,
+                      size_t *nadded,
+                      size_t *nremoved)
+{
+    g_autofree size_t *lcs = g_new0(size_t, (nfrom + 1) * (nto + 1));
+    g_autofree ssize_t *matchOld = g_new0(ssize_t, nto + 1);
+    g_autofree bool *keptOld = g_new0(bool, nfrom + 1);
+    g_autofree ssize_t *cur = g_new0(ssize_t, nfrom + nto + 1);
+    size_t ncur = nfrom;
+    size_t i, j, k;
+
+#define LCS(i, j) lcs[(i) * (nto + 1) + (j)]
+    for (i = nfrom; i-- > 0;) {
+        for (j = nto; j-- > 0;) {
+            if (ebiptablesRuleLineEqual(from[i], to[j]))
+                LCS(i, j) = LCS(i + 1, j + 1) + 1;
+            else
+                LCS(i, j) = MAX(LCS(i + 1, j), LCS(i, j + 1));
+        }
+    }
+
+    for (j = 0; j < nto; j++)
+        matchOld[j] = -1;
+
+    i = j = 0;
+    while (i < nfrom && j < nto) {
+        if (ebiptablesRuleLineEqual(from[i], to[j])) {
+            matchOld[j] = i;
+            keptOld[i] = true;
+            i++;
+            j++;
+        } else if (LCS(i + 1, j) >= LCS(i, j + 1)) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+#undef LCS
+
+    /* @cur tracks the content of the chain, old rules by their index
+     * in @from and new rules as -1 */
+    for (i = 0; i < nfrom; i++)
+        cur[i] = i;
+
+    for (j = 0; j < nto; j++) {
+        size_t pos = ncur;
+
+        if (matchOld[j] >= 0)
+            continue;
+
+        /* insert right in front of the next kept rule */
+        for (k = j + 1; k < nto; k++) {
+            if (matchOld[k] >= 0)
+                break;
+        }
+        if (k < nto) {
+            for (pos = 0; cur[pos] != matchOld[k]; pos++)
+                ;
+        }
+
+        memmove(cur + pos + 1, cur + pos, (ncur - pos) * sizeof(*cur));
+        cur[pos] = -1;
+        ncur++;
+
+        ebiptablesRuleLineInsertFW(fw, to[j], pos + 1);
+        (*nadded)++;
+    }
+
+    for (i = nfrom; i-- > 0;) {
+        size_t pos;
+
+        if (keptOld[i])
+            continue;
+
+        for (pos = 0; cur[pos] != (ssize_t)i; pos++)
+            ;
+
+        memmove(cur + pos, cur + pos + 1, (ncur - pos - 1) * sizeof(*cur));
+        ncur--;
+
+        ebiptablesRuleLineDeleteFW(fw, from[i], pos + 1);
+        (*nremoved)++;
+    }
+}
+
+
+/*
+ * ebiptablesRuleSetDiffFW:
+ * @fw: firewall to add the commands to
+ * @from: the rules currently instantiated
+ * @to: the rules to instantiate
+ * @nadded: filled with the number of added rules
+ * @nremoved: filled with the number of removed rules
+ *
+ * Add commands to @fw which turn the rules of the chains of an
+ * interface from @from into @to.
+ *
+ * Returns 1 if the commands were added, 0 if @to differs from @from in
+ * more than the rules of the chains of the interface.
+ */
+static int
+ebiptablesRuleSetDiffFW(virFirewallPtr fw,
+                        ebiptablesRuleSetPtr from,
+                        ebiptablesRuleSetPtr to,
+                        size_t *nadded,
+                        size_t *nremoved)
+{
+    ebiptablesRuleSetPtr sets[] = { to, from };
+    size_t s, i, k;
+
+    *nadded = 0;
+    *nremoved = 0;
+
+    if (!ebiptablesRuleSetSameChains(from, to))
+        return 0;
+
+    for (s = 0; s < G_N_ELEMENTS(sets); s++) {
+        for (i = 0; i < sets[s]->nlines; i++) {
+            ebiptablesRuleLinePtr line = &sets[s]->lines[i];
+            g_autofree ebiptablesRuleLinePtr *fromLines = NULL;
+            g_autofree ebiptablesRuleLinePtr *toLines = NULL;
+            size_t nfrom;
+            size_t nto;
+            bool seen = false;
+
+            if (line->append < 0)
+                continue;
+
+            /* skip chains which were handled already */
+            for (k = 0; k < to->nlines && !seen; k++) {
+                if (s == 0 && k == i)
+                    break;
+                seen = ebiptablesRuleLineSameChain(&to->lines[k], line);
+            }
+            for (k = 0; s == 1 && k < i && !seen; k++)
+                seen = ebiptablesRuleLineSameChain(&from->lines[k], line);
+            if (seen)
+                continue;
+
+            nfrom = ebiptablesRuleSetGetChain(from, line, &fromLines);
+            nto = ebiptablesRuleSetGetChain(to, line, &toLines);
+
+            if ((nfrom + 1) * (nto + 1) > EBIPTABLES_CHAIN_DIFF_MAX)
+                return 0;
+
+            ebiptablesChainDiffFW(fw, fromLines, nfrom, toLines, nto,
+                                  nadded, nremoved);
+        }
+    }
+
+    return 1;
+}
+
+
+static int
+ebiptablesApplyNewRulesFW(virFirewallPtr fw,
+                          virBufferPtr ipsets,
+                          const char *ifname,
+                          virNWFilterRuleInstPtr *rules,
+                          size_t nrules)
 {
     size_t i, j;
-    g_autoptr(virFirewall) fw = virFirewallNew();
     g_autoptr(GHashTable) chains_in_set  = virHashNew(NULL);
     g_autoptr(GHashTable) chains_out_set = virHashNew(NULL);
     bool haveEbtables = false;
@@ -3467,7 +4308,8 @@ ebiptablesApplyNewRules(const char *ifname,
             if (virNWFilterRuleIsProtocolIPv4(rules[i]->def)) {
                 if (iptablesRuleInstCommand(fw,
                                             ifname,
-                                            rules[i]) < 0)
+                                            rules[i],
+                                            ipsets) < 0)
                     goto cleanup;
             }
         }
@@ -3489,7 +4331,8 @@ ebiptablesApplyNewRules(const char *ifname,
             if (virNWFilterRuleIsProtocolIPv6(rules[i]->def)) {
                 if (iptablesRuleInstCommand(fw,
                                             ifname,
-                                            rules[i]) < 0)
+                                            rules[i],
+                                            ipsets) < 0)
                     goto cleanup;
             }
         }
@@ -3519,9 +4362,6 @@ ebiptablesApplyNewRules(const char *ifname,
     ebtablesRemoveTmpRootChainFW(fw, true, ifname);
     ebtablesRemoveTmpRootChainFW(fw, false, ifname);
 
-    if (virFirewallApply(fw) < 0)
-        goto cleanup;
-
     ret = 0;
 
  cleanup:
@@ -3532,6 +4372,153 @@ ebiptablesApplyNewRules(const char *ifname,
 }
 
 
+static int
+ebiptablesApplyNewRules(const char *ifname,
+                        virNWFilterRuleInstPtr *rules,
+                        size_t nrules)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    g_auto(virBuffer) ipsets = VIR_BUFFER_INITIALIZER;
+    g_autoptr(ebiptablesRuleSet) set = NULL;
+    g_autoptr(GHashTable) unused = NULL;
+    ebiptablesIfaceRulesPtr iface;
+    int ret;
+
+    if (ebiptablesApplyNewRulesFW(fw, &ipsets, ifname, rules, nrules) < 0 ||
+        !(set = ebiptablesRuleSetNew(fw, ifname)) ||
+        ebiptablesCreateIPSets(&ipsets) < 0)
+        return -1;
+
+    ret = virFirewallApply(fw);
+
+    virMutexLock(&ifaceRulesLock);
+    if ((iface = ebiptablesIfaceRulesGet(ifname, true))) {
+        g_clear_pointer(&iface->pending, ebiptablesRuleSetFree);
+        if (ret == 0) {
+            iface->pending = g_steal_pointer(&set);
+        } else {
+            unused = virHashNew(NULL);
+            ebiptablesRuleSetGetIPSets(set, ifname, unused, false);
+            ebiptablesRuleSetGetIPSets(iface->current, ifname, unused, true);
+        }
+        iface->updatedInPlace = false;
+    }
+    virMutexUnlock(&ifaceRulesLock);
+
+    ebiptablesDestroyIPSets(unused);
+
+    return ret;
+}
+
+
+/* Logs a rule of the difference applied by ebiptablesUpdateRules */
+static int
+ebiptablesLogUpdateRule(virFirewallLayer layer,
+                        bool ignoreErrors G_GNUC_UNUSED,
+                        const char *const *args,
+                        size_t nargs,
+                        void *opaque)
+{
+    const char *ifname = opaque;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *rule = NULL;
+    size_t i;
+
+    switch (layer) {
+    case VIR_FIREWALL_LAYER_ETHERNET:
+        virBufferAddLit(&buf, "ebtables");
+        break;
+    case VIR_FIREWALL_LAYER_IPV4:
+        virBufferAddLit(&buf, "iptables");
+        break;
+    case VIR_FIREWALL_LAYER_IPV6:
+        virBufferAddLit(&buf, "ip6tables");
+        break;
+    case VIR_FIREWALL_LAYER_LAST:
+        break;
+    }
+
+    for (i = 0; i < nargs; i++)
+        virBufferAsprintf(&buf, " %s", args[i]);
+
+    rule = virBufferContentAndReset(&buf);
+    VIR_INFO("Updating rules of interface %s: %s", ifname, rule);
+
+    return 0;
+}
+
+
+/**
+ * ebiptablesUpdateRules:
+ * @ifname: name of the interface
+ * @rules: the new rules
+ * @nrules: number of @rules
+ *
+ * Try to turn the rules of @ifname into @rules by adding and removing
+ * individual rules of its chains instead of building new chains. This
+ * is possible if the currently instantiated rules are known and @rules
+ * need the same chains. The change is made permanent by tearOldRules or
+ * reverted by tearNewRules.
+ *
+ * Returns 1 if the rules were updated, 0 if new chains need to be built
+ * using applyNewRules, -1 on error.
+ */
+static int
+ebiptablesUpdateRules(const char *ifname,
+                      virNWFilterRuleInstPtr *rules,
+                      size_t nrules)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    g_autoptr(virFirewall) delta = virFirewallNew();
+    g_auto(virBuffer) ipsets = VIR_BUFFER_INITIALIZER;
+    g_autoptr(ebiptablesRuleSet) set = NULL;
+    ebiptablesIfaceRulesPtr iface;
+    size_t nadded;
+    size_t nremoved;
+    int ret = 0;
+
+    if (ebiptablesApplyNewRulesFW(fw, &ipsets, ifname, rules, nrules) < 0 ||
+        !(set = ebiptablesRuleSetNew(fw, ifname)))
+        return -1;
+
+    virMutexLock(&ifaceRulesLock);
+
+    iface = ebiptablesIfaceRulesGet(ifname, false);
+    if (!iface || !iface->current || iface->pending)
+        goto cleanup;
+
+    virFirewallStartTransaction(delta, 0);
+    if (ebiptablesRuleSetDiffFW(delta, iface->current, set,
+                                &nadded, &nremoved) == 0) {
+        VIR_DEBUG("Chains of interface %s changed, rebuilding them", ifname);
+        goto cleanup;
+    }
+
+    VIR_INFO("Updating rules of interface %s: %zu added, %zu removed",
+             ifname, nadded, nremoved);
+    ignore_value(virFirewallForEachRule(delta, ebiptablesLogUpdateRule,
+                                        (void *) ifname));
+
+    if ((nadded || nremoved) &&
+        (ebiptablesCreateIPSets(&ipsets) < 0 || virFirewallApply(delta) < 0)) {
+        VIR_WARN("Failed to update rules of interface %s, rebuilding them: %s",
+                 ifname, virGetLastErrorMessage());
+        virResetLastError();
+        virHashRemoveEntry(ifaceRules, ifname);
+        goto cleanup;
+    }
+
+    iface->pending = g_steal_pointer(&iface->current);
+    iface->current = g_steal_pointer(&set);
+    iface->updatedInPlace = true;
+    ret = 1;
+
+ cleanup:
+    virMutexUnlock(&ifaceRulesLock);
+    return ret;
+}
+
+
 static void
 ebiptablesTearNewRulesFW(virFirewallPtr fw, const char *ifname)
 {
@@ -3549,22 +4536,104 @@ ebiptablesTearNewRulesFW(virFirewallPtr fw, const char *ifname)
 }
 
 
+/*
+ * ebiptablesRevertUpdate:
+ *
+ * Restore the rules of @iface which were updated in place.
+ * Call this function while holding ifaceRulesLock.
+ */
+static int
+ebiptablesRevertUpdate(const char *ifname,
+                       ebiptablesIfaceRulesPtr iface,
+                       GHashTable *unused)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    size_t nadded;
+    size_t nremoved;
+
+    ebiptablesRuleSetGetIPSets(iface->current, ifname, unused, false);
+    ebiptablesRuleSetGetIPSets(iface->pending, ifname, unused, true);
+
+    virFirewallStartTransaction(fw, 0);
+    if (ebiptablesRuleSetDiffFW(fw, iface->current, iface->pending,
+                                &nadded, &nremoved) == 0 ||
+        ((nadded || nremoved) && virFirewallApply(fw) < 0)) {
+        virHashRemoveEntry(ifaceRules, ifname);
+        return -1;
+    }
+
+    ebiptablesRuleSetFree(iface->current);
+    iface->current = g_steal_pointer(&iface->pending);
+    iface->updatedInPlace = false;
+
+    return 0;
+}
+
+
 static int
 ebiptablesTearNewRules(const char *ifname)
 {
     g_autoptr(virFirewall) fw = virFirewallNew();
+    g_autoptr(GHashTable) unused = virHashNew(NULL);
+    ebiptablesIfaceRulesPtr iface;
+    int ret;
+
+    virMutexLock(&ifaceRulesLock);
+    if ((iface = ebiptablesIfaceRulesGet(ifname, false))) {
+        if (iface->updatedInPlace) {
+            ret = ebiptablesRevertUpdate(ifname, iface, unused);
+            virMutexUnlock(&ifaceRulesLock);
+
+            if (ret == 0)
+                ebiptablesDestroyIPSets(unused);
+            return ret;
+        }
+        ebiptablesRuleSetGetIPSets(iface->pending, ifname, unused, false);
+        ebiptablesRuleSetGetIPSets(iface->current, ifname, unused, true);
+        g_clear_pointer(&iface->pending, ebiptablesRuleSetFree);
+    }
+    virMutexUnlock(&ifaceRulesLock);
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
 
     ebiptablesTearNewRulesFW(fw, ifname);
 
-    return virFirewallApply(fw);
+    ret = virFirewallApply(fw);
+
+    ebiptablesDestroyIPSets(unused);
+
+    return ret;
 }
 
 static int
 ebiptablesTearOldRules(const char *ifname)
 {
     g_autoptr(virFirewall) fw = virFirewallNew();
+    g_autoptr(GHashTable) unused = virHashNew(NULL);
+    ebiptablesIfaceRulesPtr iface;
+    int ret;
+
+    virMutexLock(&ifaceRulesLock);
+    if ((iface = ebiptablesIfaceRulesGet(ifname, false))) {
+        if (iface->updatedInPlace) {
+            /* there are no temporary chains to switch to */
+            ebiptablesRuleSetGetIPSets(iface->pending, ifname, unused, false);
+            ebiptablesRuleSetGetIPSets(iface->current, ifname, unused, true);
+            g_clear_pointer(&iface->pending, ebiptablesRuleSetFree);
+            iface->updatedInPlace = false;
+            virMutexUnlock(&ifaceRulesLock);
+
+            ebiptablesDestroyIPSets(unused);
+            return 0;
+        }
+        if (iface->pending) {
+            ebiptablesRuleSetGetIPSets(iface->current, ifname, unused, false);
+            ebiptablesRuleSetGetIPSets(iface->pending, ifname, unused, true);
+            ebiptablesRuleSetFree(iface->current);
+            iface->current = g_steal_pointer(&iface->pending);
+        }
+    }
+    virMutexUnlock(&ifaceRulesLock);
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
 
@@ -3583,7 +4652,11 @@ ebiptablesTearOldRules(const char *ifname)
     ebtablesRemoveRootChainFW(fw, false, ifname);
     ebtablesRenameTmpSubAndRootChainsFW(fw, ifname);
 
-    return virFirewallApply(fw);
+    ret = virFirewallApply(fw);
+
+    ebiptablesDestroyIPSets(unused);
+
+    return ret;
 }
 
 
@@ -3600,6 +4673,10 @@ static int
 ebiptablesAllTeardown(const char *ifname)
 {
     g_autoptr(virFirewall) fw = virFirewallNew();
+    g_autoptr(GHashTable) unused = virHashNew(NULL);
+    int ret;
+
+    ebiptablesForgetRules(ifname, unused);
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
 
@@ -3621,7 +4698,11 @@ ebiptablesAllTeardown(const char *ifname)
     ebtablesRemoveRootChainFW(fw, true, ifname);
     ebtablesRemoveRootChainFW(fw, false, ifname);
 
-    return virFirewallApply(fw);
+    ret = virFirewallApply(fw);
+
+    ebiptablesDestroyIPSets(unused);
+
+    return ret;
 }
 
 
@@ -3633,6 +4714,7 @@ virNWFilterTechDriver ebiptables_driver = {
     .shutdown = ebiptablesDriverShutdown,
 
     .applyNewRules       = ebiptablesApplyNewRules,
+    .updateRules         = ebiptablesUpdateRules,
     .tearNewRules        = ebiptablesTearNewRules,
     .tearOldRules        = ebiptablesTearOldRules,
     .allTeardown         = ebiptablesAllTeardown,
@@ -3726,6 +4808,29 @@ ebiptablesDriverProbeStateMatch(void)
     return 0;
 }
 
+static void
+ebiptablesDriverProbeIPSet(void)
+{
+    g_autoptr(virCommand) cmd = NULL;
+    g_autofree char *output = NULL;
+    int status;
+
+    if (!virFileIsExecutable(IPSET_PATH))
+        return;
+
+    /* listing the sets fails if the kernel does not support them */
+    cmd = virCommandNewArgList(IPSET_PATH, "list", "-n", NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, &status) < 0 || status != 0) {
+        VIR_INFO("ipset is not usable, not using sets of addresses");
+        virResetLastError();
+        return;
+    }
+
+    ipsetMinValues = EBIPTABLES_IPSET_MIN_VALUES;
+}
+
+
 static int
 ebiptablesDriverInit(bool privileged)
 {
@@ -3733,6 +4838,7 @@ ebiptablesDriverInit(bool privileged)
         return 0;
 
     ebiptablesDriverProbeCtdir();
+    ebiptablesDriverProbeIPSet();
     if (ebiptablesDriverProbeStateMatch() < 0)
         return -1;
 
@@ -3745,5 +4851,10 @@ ebiptablesDriverInit(bool privileged)
 static void
 ebiptablesDriverShutdown(void)
 {
+    virMutexLock(&ifaceRulesLock);
+    virHashFree(ifaceRules);
+    ifaceRules = NULL;
+    virMutexUnlock(&ifaceRulesLock);
+
     ebiptables_driver.flags = 0;
 }
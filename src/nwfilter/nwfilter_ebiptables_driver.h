@@ -27,6 +27,8 @@
 
 extern virNWFilterTechDriver ebiptables_driver;
 
+void ebiptablesSetIPSetMinValues(unsigned int minValues);
+
 #define EBIPTABLES_DRIVER_ID "ebiptables"
 
 #define IPTABLES_MAX_COMMENT_LENGTH  256
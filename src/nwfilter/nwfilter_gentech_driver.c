@@ -603,7 +603,17 @@ virNWFilterDoInstantiate(virNWFilterTechDriverPtr techdriver,
         if (virNWFilterLockIface(binding->portdevname) < 0)
             goto error;
 
-        rc = techdriver->applyNewRules(binding->portdevname, inst.rules, inst.nrules);
+        /* when updating a filter, try to change only the rules which
+         * differ instead of building new chains */
+        rc = 0;
+        if (!teardownOld && techdriver->updateRules)
+            rc = techdriver->updateRules(binding->portdevname,
+                                         inst.rules, inst.nrules);
+
+        if (rc == 0)
+            rc = techdriver->applyNewRules(binding->portdevname, inst.rules, inst.nrules);
+        else if (rc > 0)
+            rc = 0;
 
         if (teardownOld && rc == 0)
             techdriver->tearOldRules(binding->portdevname);
@@ -47,6 +47,10 @@ typedef int (*virNWFilterRuleApplyNewRules)(const char *ifname,
                                             virNWFilterRuleInstPtr *rules,
                                             size_t nrules);
 
+typedef int (*virNWFilterRuleUpdateRules)(const char *ifname,
+                                          virNWFilterRuleInstPtr *rules,
+                                          size_t nrules);
+
 typedef int (*virNWFilterRuleTeardownNewRules)(const char *ifname);
 
 typedef int (*virNWFilterRuleTeardownOldRules)(const char *ifname);
@@ -79,6 +83,7 @@ struct _virNWFilterTechDriver {
     virNWFilterTechDrvShutdown shutdown;
 
     virNWFilterRuleApplyNewRules applyNewRules;
+    virNWFilterRuleUpdateRules updateRules;
     virNWFilterRuleTeardownNewRules tearNewRules;
     virNWFilterRuleTeardownOldRules tearOldRules;
     virNWFilterRuleAllTeardown allTeardown;
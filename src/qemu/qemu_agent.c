@@ -110,6 +110,9 @@ struct _qemuAgent {
     bool running;
     bool singleSync;
     bool inSync;
+    /* Set while a batch of commands sharing one guest-sync is
+     * being executed (see qemuAgentBatchBegin) */
+    bool batch;
 
     virDomainObjPtr vm;
 
@@ -896,7 +899,7 @@ qemuAgentGuestSync(qemuAgentPtr agent)
     qemuAgentMessage sync_msg;
     int timeout = VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT;
 
-    if (agent->singleSync && agent->inSync)
+    if ((agent->singleSync || agent->batch) && agent->inSync)
         return 0;
 
     /* if user specified a custom agent timeout that is lower than the
@@ -944,7 +947,7 @@ qemuAgentGuestSync(qemuAgentPtr agent)
         }
     }
 
-    if (agent->singleSync)
+    if (agent->singleSync || agent->batch)
         agent->inSync = true;
 
     ret = 0;
@@ -2490,6 +2493,44 @@ qemuAgentGetTimezone(qemuAgentPtr agent,
     return 0;
 }
 
+/**
+ * qemuAgentBatchBegin:
+ * @agent: agent object
+ *
+ * Starts a batch of agent commands which are executed right after each
+ * other, e.g. when gathering various information about the guest. Only
+ * the first command of the batch is preceded by the guest-sync handshake,
+ * unless some command times out in which case the agent is synchronized
+ * again before the next one. This has no effect if the agent needs to be
+ * synchronized only once anyway. The commands themselves are still sent one
+ * at a time, each after the reply to the previous one was received.
+ *
+ * The agent object must be locked prior to calling this function and the
+ * batch must be terminated by qemuAgentBatchEnd before unlocking it.
+ */
+void
+qemuAgentBatchBegin(qemuAgentPtr agent)
+{
+    agent->batch = true;
+}
+
+
+/**
+ * qemuAgentBatchEnd:
+ * @agent: agent object
+ *
+ * Ends a batch of agent commands started by qemuAgentBatchBegin.
+ */
+void
+qemuAgentBatchEnd(qemuAgentPtr agent)
+{
+    agent->batch = false;
+
+    if (!agent->singleSync)
+        agent->inSync = false;
+}
+
+
 /* qemuAgentSetResponseTimeout:
  * @agent: agent object
  * @timeout: number of seconds to wait for agent response
@@ -182,6 +182,9 @@ int qemuAgentGetTimezone(qemuAgentPtr mon,
                          int *maxparams,
                          bool report_unsupported);
 
+void qemuAgentBatchBegin(qemuAgentPtr agent);
+void qemuAgentBatchEnd(qemuAgentPtr agent);
+
 void qemuAgentSetResponseTimeout(qemuAgentPtr mon,
                                  int timeout);
 
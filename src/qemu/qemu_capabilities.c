@@ -5255,13 +5255,19 @@ virQEMUCapsInitProcessCaps(virQEMUCapsPtr qemuCaps)
 }
 
 
+/*
+ * The QMP schema is consulted only while probing, all the queries are
+ * evaluated against it right away and only the resulting flags are stored
+ * in the capabilities cache. Thus neither the schema nor any index of it
+ * needs to outlive this function.
+ */
 static int
 virQEMUCapsProbeQMPSchemaCapabilities(virQEMUCapsPtr qemuCaps,
                                       qemuMonitorPtr mon)
 {
     struct virQEMUCapsStringFlags *entry;
     virJSONValuePtr schemareply;
-    GHashTable *schema = NULL;
+    g_autoptr(GHashTable) schema = NULL;
     size_t i;
 
     if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_QUERY_QMP_SCHEMA))
@@ -5281,15 +5287,15 @@ virQEMUCapsProbeQMPSchemaCapabilities(virQEMUCapsPtr qemuCaps,
             virQEMUCapsSet(qemuCaps, entry->flag);
     }
 
-    /* probe also for basic event support */
+    /* probe also for basic event support, events are top level entries
+     * of the schema so there's no need to parse a query path */
     for (i = 0; i < G_N_ELEMENTS(virQEMUCapsEvents); i++) {
         entry = virQEMUCapsEvents + i;
 
-        if (virQEMUQAPISchemaPathExists(entry->value, schema))
+        if (virHashLookup(schema, entry->value))
             virQEMUCapsSet(qemuCaps, entry->flag);
     }
 
-    virHashFree(schema);
     return 0;
 }
 
@@ -5714,6 +5720,54 @@ virQEMUCapsCacheLookup(virFileCachePtr cache,
 }
 
 
+/**
+ * virQEMUCapsCachePopulate:
+ * @cache: QEMU capabilities cache
+ * @nworkers: maximum number of concurrent probes, 0 means one per host CPU
+ *
+ * Makes sure capabilities of the default emulator binary of every guest
+ * architecture are cached. Binaries which were not probed yet or which have
+ * outdated cached capabilities are probed concurrently.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virQEMUCapsCachePopulate(virFileCachePtr cache,
+                         unsigned int nworkers)
+{
+    virQEMUCapsCachePrivPtr priv = virFileCacheGetPriv(cache);
+    virArch hostarch = virArchFromHost();
+    g_autoptr(GPtrArray) binaries = g_ptr_array_new_with_free_func(g_free);
+    size_t i;
+
+    for (i = 0; i < VIR_ARCH_LAST; i++) {
+        char *binary = virQEMUCapsGetDefaultEmulator(hostarch, i);
+
+        if (!binary)
+            continue;
+
+        if (g_ptr_array_find_with_equal_func(binaries, binary,
+                                             g_str_equal, NULL)) {
+            g_free(binary);
+            continue;
+        }
+
+        g_ptr_array_add(binaries, binary);
+    }
+
+    if (nworkers == 0) {
+        int ncpus = virHostCPUGetCount();
+
+        nworkers = ncpus > 0 ? ncpus : 1;
+    }
+
+    priv->microcodeVersion = virHostCPUGetMicrocodeVersion(priv->hostArch);
+
+    return virFileCachePopulate(cache, (const char **) binaries->pdata,
+                                binaries->len, nworkers);
+}
+
+
 virQEMUCapsPtr
 virQEMUCapsCacheLookupCopy(virFileCachePtr cache,
                            virDomainVirtType virtType,
@@ -723,6 +723,8 @@ virFileCachePtr virQEMUCapsCacheNew(const char *libDir,
                                     gid_t gid);
 virQEMUCapsPtr virQEMUCapsCacheLookup(virFileCachePtr cache,
                                       const char *binary);
+int virQEMUCapsCachePopulate(virFileCachePtr cache,
+                             unsigned int nworkers);
 virQEMUCapsPtr virQEMUCapsCacheLookupCopy(virFileCachePtr cache,
                                           virDomainVirtType virtType,
                                           const char *binary,
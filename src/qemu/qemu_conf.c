@@ -617,6 +617,13 @@ virQEMUDriverConfigLoadSaveEntry(virQEMUDriverConfigPtr cfg,
         return -1;
     if (virConfGetValueString(conf, "snapshot_image_format", &cfg->snapshotImageFormat) < 0)
         return -1;
+    if (virConfGetValueUInt(conf, "save_parallel_channels", &cfg->saveParallelChannels) < 0)
+        return -1;
+    if (cfg->saveParallelChannels > 255) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("save_parallel_channels must not be greater than 255"));
+        return -1;
+    }
     if (virConfGetValueString(conf, "auto_dump_path", &cfg->autoDumpPath) < 0)
         return -1;
     if (virConfGetValueBool(conf, "auto_dump_bypass_cache", &cfg->autoDumpBypassCache) < 0)
@@ -1040,6 +1047,21 @@ virQEMUDriverConfigLoadCapsFiltersEntry(virQEMUDriverConfigPtr cfg,
 }
 
 
+static int
+virQEMUDriverConfigLoadCapsProbeEntry(virQEMUDriverConfigPtr cfg,
+                                      virConfPtr conf)
+{
+    if (virConfGetValueBool(conf, "capability_probe_on_start",
+                            &cfg->capsProbeOnStart) < 0)
+        return -1;
+    if (virConfGetValueUInt(conf, "capability_probe_workers",
+                            &cfg->capsProbeWorkers) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
                                 const char *filename,
                                 bool privileged)
@@ -1111,6 +1133,9 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virQEMUDriverConfigLoadCapsFiltersEntry(cfg, conf) < 0)
         return -1;
 
+    if (virQEMUDriverConfigLoadCapsProbeEntry(cfg, conf) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -1313,12 +1338,21 @@ virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
 {
     size_t i, j;
     g_autoptr(virCaps) caps = NULL;
+    g_autoptr(virQEMUDriverConfig) cfg = NULL;
     g_autofree virSecurityManagerPtr *sec_managers = NULL;
     /* Security driver data */
     const char *doi, *model, *lbl, *type;
     const int virtTypes[] = {VIR_DOMAIN_VIRT_KVM,
                              VIR_DOMAIN_VIRT_QEMU,};
 
+    cfg = virQEMUDriverGetConfig(driver);
+
+    /* Probe all emulators concurrently first so that virQEMUCapsInit
+     * only needs to pick up the cached results */
+    if (virQEMUCapsCachePopulate(driver->qemuCapsCache,
+                                 cfg->capsProbeWorkers) < 0)
+        return NULL;
+
     /* Basic host arch / guest machine capabilities */
     if (!(caps = virQEMUCapsInit(driver->qemuCapsCache)))
         return NULL;
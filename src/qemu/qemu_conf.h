@@ -191,6 +191,7 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    unsigned int saveParallelChannels;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
@@ -223,6 +224,9 @@ struct _virQEMUDriverConfig {
     gid_t swtpm_group;
 
     char **capabilityfilters;
+
+    bool capsProbeOnStart;
+    unsigned int capsProbeWorkers;
 };
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(virQEMUDriverConfig, virObjectUnref);
@@ -284,6 +288,10 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virFileCachePtr qemuCapsCache;
 
+    /* Immutable after startup, joined in qemuStateCleanup */
+    virThread capsProbeThread;
+    bool capsProbeThreadActive;
+
     /* Immutable pointer, self-locking APIs */
     virObjectEventStatePtr domainEventState;
 
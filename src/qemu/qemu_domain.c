@@ -836,6 +836,7 @@ static virObjectPtr
 qemuDomainVcpuPrivateNew(void)
 {
     qemuDomainVcpuPrivatePtr priv;
+    size_t i;
 
     if (qemuDomainVcpuPrivateInitialize() < 0)
         return NULL;
@@ -843,15 +844,49 @@ qemuDomainVcpuPrivateNew(void)
     if (!(priv = virObjectNew(qemuDomainVcpuPrivateClass)))
         return NULL;
 
+    for (i = 0; i < QEMU_DOMAIN_VCPU_STAT_FILE_LAST; i++)
+        priv->statFDs[i] = -1;
+
     return (virObjectPtr) priv;
 }
 
 
+/* Number of /proc files of vCPU threads kept open across all domains. The
+ * limit keeps hosts with many vCPUs well within the file descriptor limit
+ * of the daemon, files beyond it are opened again for every read. */
+#define QEMU_DOMAIN_VCPU_STAT_FDS_MAX 1024
+static int qemuDomainVcpuStatFDs;
+
+
+static void
+qemuDomainVcpuStatFileClose(int *fd)
+{
+    if (*fd < 0)
+        return;
+
+    VIR_FORCE_CLOSE(*fd);
+    g_atomic_int_add(&qemuDomainVcpuStatFDs, -1);
+}
+
+
+static void
+qemuDomainVcpuPrivateCloseStatFiles(qemuDomainVcpuPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < QEMU_DOMAIN_VCPU_STAT_FILE_LAST; i++)
+        qemuDomainVcpuStatFileClose(&priv->statFDs[i]);
+
+    priv->statTid = 0;
+}
+
+
 static void
 qemuDomainVcpuPrivateDispose(void *obj)
 {
     qemuDomainVcpuPrivatePtr priv = obj;
 
+    qemuDomainVcpuPrivateCloseStatFiles(priv);
     g_free(priv->type);
     g_free(priv->alias);
     virJSONValueFree(priv->props);
@@ -9427,6 +9462,120 @@ qemuDomainHasVcpuPids(virDomainObjPtr vm)
 }
 
 
+VIR_ENUM_IMPL(qemuDomainVcpuStatFile,
+              QEMU_DOMAIN_VCPU_STAT_FILE_LAST,
+              "stat",
+              "sched",
+              "schedstat",
+);
+
+
+/**
+ * qemuDomainVcpuReadStatFile:
+ * @vm: domain object
+ * @vcpuid: cpu id
+ * @file: /proc file of the vCPU thread to read
+ * @maxlen: maximum number of bytes to read
+ * @buf: filled with the contents of the file
+ *
+ * Reads a statistics file of the thread running vCPU @vcpuid. The file is
+ * opened on first use and, as long as not too many of these files are open
+ * already, kept open so that subsequent polls of statistics only need to
+ * re-read it. The files are reopened once the thread of the vCPU changes,
+ * e.g. after vCPU hotplug. The caller has to hold the lock of @vm.
+ *
+ * Returns the number of bytes read, or 0 if the statistics are not available
+ * (@buf is set to NULL in such case). The vCPU thread may be gone or not known
+ * yet and some of the files depend on the kernel configuration, therefore
+ * failing to open or read the file is not an error.
+ */
+int
+qemuDomainVcpuReadStatFile(virDomainObjPtr vm,
+                           unsigned int vcpuid,
+                           qemuDomainVcpuStatFile file,
+                           int maxlen,
+                           char **buf)
+{
+    virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, vcpuid);
+    qemuDomainVcpuPrivatePtr vcpupriv;
+    VIR_AUTOCLOSE tmpfd = -1;
+    int *fd;
+    int len;
+
+    *buf = NULL;
+
+    if (!vcpu)
+        return 0;
+
+    vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
+
+    if (vcpupriv->tid == 0)
+        return 0;
+
+    if (vcpupriv->statTid != vcpupriv->tid) {
+        qemuDomainVcpuPrivateCloseStatFiles(vcpupriv);
+        vcpupriv->statTid = vcpupriv->tid;
+    }
+
+    fd = &vcpupriv->statFDs[file];
+
+    if (*fd < 0) {
+        g_autofree char *path = NULL;
+
+        /* In general, we cannot assume pid_t fits in int; but /proc parsing
+         * is specific to Linux where int works fine.  */
+        path = g_strdup_printf("/proc/%d/task/%d/%s",
+                               (int)vm->pid, (int)vcpupriv->tid,
+                               qemuDomainVcpuStatFileTypeToString(file));
+
+        if ((tmpfd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            VIR_DEBUG("Unable to open '%s': %s", path, g_strerror(errno));
+            return 0;
+        }
+
+        if (g_atomic_int_add(&qemuDomainVcpuStatFDs, 1) <
+            QEMU_DOMAIN_VCPU_STAT_FDS_MAX) {
+            *fd = tmpfd;
+            tmpfd = -1;
+        } else {
+            g_atomic_int_add(&qemuDomainVcpuStatFDs, -1);
+            fd = &tmpfd;
+        }
+    }
+
+    if ((len = virFilePReadLimFD(*fd, maxlen, buf)) < 0) {
+        VIR_DEBUG("Unable to read '%s' of vCPU %u: %s",
+                  qemuDomainVcpuStatFileTypeToString(file), vcpuid,
+                  g_strerror(errno));
+        if (fd != &tmpfd)
+            qemuDomainVcpuStatFileClose(fd);
+        return 0;
+    }
+
+    return len;
+}
+
+
+/**
+ * qemuDomainCloseVcpuStatFiles:
+ * @vm: domain object
+ *
+ * Closes the statistics files of all vCPU threads of @vm opened by
+ * qemuDomainVcpuReadStatFile.
+ */
+void
+qemuDomainCloseVcpuStatFiles(virDomainObjPtr vm)
+{
+    size_t i;
+
+    for (i = 0; i < virDomainDefGetVcpusMax(vm->def); i++) {
+        virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        qemuDomainVcpuPrivateCloseStatFiles(QEMU_DOMAIN_VCPU_PRIVATE(vcpu));
+    }
+}
+
+
 /**
  * qemuDomainGetVcpuPid:
  * @vm: domain object
@@ -321,6 +321,15 @@ virObjectPtr qemuDomainStorageSourcePrivateNew(void);
 qemuDomainStorageSourcePrivatePtr
 qemuDomainStorageSourcePrivateFetch(virStorageSourcePtr src);
 
+typedef enum {
+    QEMU_DOMAIN_VCPU_STAT_FILE_STAT,
+    QEMU_DOMAIN_VCPU_STAT_FILE_SCHED,
+    QEMU_DOMAIN_VCPU_STAT_FILE_SCHEDSTAT,
+
+    QEMU_DOMAIN_VCPU_STAT_FILE_LAST
+} qemuDomainVcpuStatFile;
+VIR_ENUM_DECL(qemuDomainVcpuStatFile);
+
 typedef struct _qemuDomainVcpuPrivate qemuDomainVcpuPrivate;
 typedef qemuDomainVcpuPrivate *qemuDomainVcpuPrivatePtr;
 struct _qemuDomainVcpuPrivate {
@@ -342,6 +351,11 @@ struct _qemuDomainVcpuPrivate {
     int thread_id;
     int node_id;
     int vcpus;
+
+    /* /proc files of the vcpu thread kept open for repeated reads of
+     * statistics, opened for thread @statTid */
+    pid_t statTid;
+    int statFDs[QEMU_DOMAIN_VCPU_STAT_FILE_LAST];
 };
 
 #define QEMU_DOMAIN_VCPU_PRIVATE(vcpu) \
@@ -825,6 +839,12 @@ int qemuDomainDefValidateMemoryHotplug(const virDomainDef *def,
 bool qemuDomainSupportsNewVcpuHotplug(virDomainObjPtr vm);
 bool qemuDomainHasVcpuPids(virDomainObjPtr vm);
 pid_t qemuDomainGetVcpuPid(virDomainObjPtr vm, unsigned int vcpuid);
+int qemuDomainVcpuReadStatFile(virDomainObjPtr vm,
+                               unsigned int vcpuid,
+                               qemuDomainVcpuStatFile file,
+                               int maxlen,
+                               char **buf);
+void qemuDomainCloseVcpuStatFiles(virDomainObjPtr vm);
 int qemuDomainValidateVcpuInfo(virDomainObjPtr vm);
 int qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
@@ -588,6 +588,51 @@ qemuDomainFindMaxID(virDomainObjPtr vm,
 }
 
 
+struct qemuStateProbeCapsData {
+    virFileCachePtr cache;
+    unsigned int nworkers;
+};
+
+
+static void
+qemuStateProbeCapsThread(void *opaque)
+{
+    struct qemuStateProbeCapsData *data = opaque;
+
+    VIR_DEBUG("Probing capabilities of QEMU binaries");
+
+    if (virQEMUCapsCachePopulate(data->cache, data->nworkers) < 0) {
+        VIR_WARN("Failed to probe QEMU capabilities: %s",
+                 virGetLastErrorMessage());
+    }
+
+    virObjectUnref(data->cache);
+    g_free(data);
+}
+
+
+static void
+qemuStateProbeCaps(virQEMUDriverPtr driver,
+                   unsigned int nworkers)
+{
+    struct qemuStateProbeCapsData *data = g_new0(struct qemuStateProbeCapsData, 1);
+
+    data->cache = virObjectRef(driver->qemuCapsCache);
+    data->nworkers = nworkers;
+
+    if (virThreadCreateFull(&driver->capsProbeThread, true,
+                            qemuStateProbeCapsThread,
+                            "qemu-caps-probe", false, data) < 0) {
+        VIR_WARN("Failed to start QEMU capabilities probing thread");
+        virObjectUnref(data->cache);
+        g_free(data);
+        return;
+    }
+
+    driver->capsProbeThreadActive = true;
+}
+
+
 /**
  * qemuStateInitialize:
  *
@@ -870,6 +915,9 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->qemuCapsCache)
         goto error;
 
+    if (cfg->capsProbeOnStart)
+        qemuStateProbeCaps(qemu_driver, cfg->capsProbeWorkers);
+
     if (!(sec_managers = qemuSecurityGetNested(qemu_driver->securityManager)))
         goto error;
 
@@ -1118,6 +1166,9 @@ qemuStateCleanup(void)
     if (!qemu_driver)
         return -1;
 
+    if (qemu_driver->capsProbeThreadActive)
+        virThreadJoin(&qemu_driver->capsProbeThread);
+
     virObjectUnref(qemu_driver->migrationErrors);
     virObjectUnref(qemu_driver->closeCallbacks);
     virLockManagerPluginUnref(qemu_driver->lockManager);
@@ -1335,28 +1386,24 @@ static char *qemuConnectGetCapabilities(virConnectPtr conn) {
 
 static int
 qemuGetSchedstatDelay(unsigned long long *cpudelay,
-                      pid_t pid,
-                      pid_t tid)
+                      virDomainObjPtr vm,
+                      unsigned int vcpuid)
 {
-    g_autofree char *path = NULL;
     g_autofree char *buf = NULL;
+    int len;
 
-    if (tid)
-        path = g_strdup_printf("/proc/%d/task/%d/schedstat", (int)pid, (int)tid);
-    else
-        path = g_strdup_printf("/proc/%d/schedstat", (int)pid);
+    *cpudelay = 0;
 
     /* This file might not exist (needs CONFIG_SCHED_INFO) */
-    if (!virFileExists(path))
+    if ((len = qemuDomainVcpuReadStatFile(vm, vcpuid,
+                                          QEMU_DOMAIN_VCPU_STAT_FILE_SCHEDSTAT,
+                                          1024, &buf)) == 0)
         return 0;
 
-    if (virFileReadAll(path, 1024, &buf) < 0)
-        return -1;
-
     if (sscanf(buf, "%*u %llu", cpudelay) != 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unable to parse schedstat info at '%s'"),
-                       path);
+                       _("Unable to parse schedstat info of vCPU %u"),
+                       vcpuid);
         return -1;
     }
 
@@ -1366,39 +1413,24 @@ qemuGetSchedstatDelay(unsigned long long *cpudelay,
 
 static int
 qemuGetSchedInfo(unsigned long long *cpuWait,
-                 pid_t pid, pid_t tid)
+                 virDomainObjPtr vm,
+                 unsigned int vcpuid)
 {
-    g_autofree char *proc = NULL;
     g_autofree char *data = NULL;
-    char **lines = NULL;
+    g_auto(GStrv) lines = NULL;
     size_t i;
-    int ret = -1;
     double val;
+    int len;
 
     *cpuWait = 0;
 
-    /* In general, we cannot assume pid_t fits in int; but /proc parsing
-     * is specific to Linux where int works fine.  */
-    if (tid)
-        proc = g_strdup_printf("/proc/%d/task/%d/sched", (int)pid, (int)tid);
-    else
-        proc = g_strdup_printf("/proc/%d/sched", (int)pid);
-    if (!proc)
-        goto cleanup;
-    ret = -1;
-
     /* The file is not guaranteed to exist (needs CONFIG_SCHED_DEBUG) */
-    if (access(proc, R_OK) < 0) {
-        ret = 0;
-        goto cleanup;
-    }
-
-    if (virFileReadAll(proc, (1<<16), &data) < 0)
-        goto cleanup;
+    if ((len = qemuDomainVcpuReadStatFile(vm, vcpuid,
+                                          QEMU_DOMAIN_VCPU_STAT_FILE_SCHED,
+                                          (1<<16), &data)) == 0)
+        return 0;
 
     lines = g_strsplit(data, "\n", 0);
-    if (!lines)
-        goto cleanup;
 
     for (i = 0; lines[i] != NULL; i++) {
         const char *line = lines[i];
@@ -1412,7 +1444,7 @@ qemuGetSchedInfo(unsigned long long *cpuWait,
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("Missing separator in sched info '%s'"),
                                lines[i]);
-                goto cleanup;
+                return -1;
             }
             line++;
             while (*line == ' ')
@@ -1422,7 +1454,7 @@ qemuGetSchedInfo(unsigned long long *cpuWait,
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("Unable to parse sched info value '%s'"),
                                line);
-                goto cleanup;
+                return -1;
             }
 
             *cpuWait = (unsigned long long)(val * 1000000);
@@ -1430,39 +1462,26 @@ qemuGetSchedInfo(unsigned long long *cpuWait,
         }
     }
 
-    ret = 0;
-
- cleanup:
-    g_strfreev(lines);
-    return ret;
+    return 0;
 }
 
 
-static int
-qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
-                   pid_t pid, int tid)
+static void
+qemuParseProcessInfo(const char *data,
+                     unsigned long long *cpuTime,
+                     int *lastCpu,
+                     long *vm_rss,
+                     pid_t pid,
+                     int tid)
 {
-    g_autofree char *proc = NULL;
-    FILE *pidinfo;
     unsigned long long usertime = 0, systime = 0;
     long rss = 0;
     int cpu = 0;
 
-    /* In general, we cannot assume pid_t fits in int; but /proc parsing
-     * is specific to Linux where int works fine.  */
-    if (tid)
-        proc = g_strdup_printf("/proc/%d/task/%d/stat", (int)pid, tid);
-    else
-        proc = g_strdup_printf("/proc/%d/stat", (int)pid);
-    if (!proc)
-        return -1;
-
-    pidinfo = fopen(proc, "r");
-
     /* See 'man proc' for information about what all these fields are. We're
      * only interested in a very few of them */
-    if (!pidinfo ||
-        fscanf(pidinfo,
+    if (!data ||
+        sscanf(data,
                /* pid -> stime */
                "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
                /* cutime -> endcode */
@@ -1490,22 +1509,93 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
 
     VIR_DEBUG("Got status for %d/%d user=%llu sys=%llu cpu=%d rss=%ld",
               (int)pid, tid, usertime, systime, cpu, rss);
+}
 
-    VIR_FORCE_FCLOSE(pidinfo);
+
+static int
+qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
+                   pid_t pid, int tid)
+{
+    g_autofree char *proc = NULL;
+    g_autofree char *data = NULL;
+
+    /* In general, we cannot assume pid_t fits in int; but /proc parsing
+     * is specific to Linux where int works fine.  */
+    if (tid)
+        proc = g_strdup_printf("/proc/%d/task/%d/stat", (int)pid, tid);
+    else
+        proc = g_strdup_printf("/proc/%d/stat", (int)pid);
+
+    ignore_value(virFileReadAllQuiet(proc, 4096, &data));
+
+    qemuParseProcessInfo(data, cpuTime, lastCpu, vm_rss, pid, tid);
 
     return 0;
 }
 
 
+static int
+qemuGetVcpuProcessInfo(unsigned long long *cpuTime,
+                       int *lastCpu,
+                       virDomainObjPtr vm,
+                       unsigned int vcpuid)
+{
+    g_autofree char *data = NULL;
+
+    ignore_value(qemuDomainVcpuReadStatFile(vm, vcpuid,
+                                            QEMU_DOMAIN_VCPU_STAT_FILE_STAT,
+                                            4096, &data));
+
+    qemuParseProcessInfo(data, cpuTime, lastCpu, NULL,
+                         vm->pid, qemuDomainGetVcpuPid(vm, vcpuid));
+
+    return 0;
+}
+
+
+/*
+ * Fetches CPU time and scheduling delay of all vCPU threads at once if the
+ * kernel allows it. Returns NULL if the per-thread /proc files have to be
+ * used instead.
+ */
+static virProcessThreadStatsPtr
+qemuDomainHelperGetVcpuThreadStats(virDomainObjPtr vm,
+                                   int maxinfo)
+{
+    g_autofree virProcessThreadStatsPtr stats = NULL;
+    size_t nstats = 0;
+    size_t i;
+
+    stats = g_new0(virProcessThreadStats, maxinfo);
+
+    for (i = 0; i < virDomainDefGetVcpusMax(vm->def) && nstats < maxinfo; i++) {
+        if (!virDomainDefGetVcpu(vm->def, i)->online)
+            continue;
+
+        stats[nstats++].tid = qemuDomainGetVcpuPid(vm, i);
+    }
+
+    if (virProcessGetThreadStats(vm->pid, stats, nstats,
+                                 VIR_PROCESS_THREAD_STATS_NO_FALLBACK) < 0) {
+        virResetLastError();
+        return NULL;
+    }
+
+    return g_steal_pointer(&stats);
+}
+
+
 static int
 qemuDomainHelperGetVcpus(virDomainObjPtr vm,
                          virVcpuInfoPtr info,
+                         bool placement,
                          unsigned long long *cpuwait,
                          unsigned long long *cpudelay,
                          int maxinfo,
                          unsigned char *cpumaps,
                          int maplen)
 {
+    g_autofree virProcessThreadStatsPtr threadstats = NULL;
     size_t ncpuinfo = 0;
     size_t i;
 
@@ -1524,6 +1614,10 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
     if (cpumaps)
         memset(cpumaps, 0, sizeof(*cpumaps) * maxinfo);
 
+    /* taskstats don't report the host CPU a thread runs on */
+    if ((info && !placement) || cpudelay)
+        threadstats = qemuDomainHelperGetVcpuThreadStats(vm, maxinfo);
+
     for (i = 0; i < virDomainDefGetVcpusMax(vm->def) && ncpuinfo < maxinfo; i++) {
         virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, i);
         pid_t vcpupid = qemuDomainGetVcpuPid(vm, i);
@@ -1536,11 +1630,10 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
             vcpuinfo->number = i;
             vcpuinfo->state = VIR_VCPU_RUNNING;
 
-            if (qemuGetProcessInfo(&vcpuinfo->cpuTime,
-                                   &vcpuinfo->cpu, NULL,
-                                   vm->pid, vcpupid) < 0) {
-                virReportSystemError(errno, "%s",
-                                     _("cannot get vCPU placement & pCPU time"));
+            if (threadstats && !placement) {
+                vcpuinfo->cpuTime = threadstats[ncpuinfo].cpuTime;
+            } else if (qemuGetVcpuProcessInfo(&vcpuinfo->cpuTime,
+                                              &vcpuinfo->cpu, vm, i) < 0) {
                 return -1;
             }
         }
@@ -1557,13 +1650,16 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
         }
 
         if (cpuwait) {
-            if (qemuGetSchedInfo(&(cpuwait[ncpuinfo]), vm->pid, vcpupid) < 0)
+            if (qemuGetSchedInfo(&(cpuwait[ncpuinfo]), vm, i) < 0)
                 return -1;
         }
 
         if (cpudelay) {
-            if (qemuGetSchedstatDelay(&(cpudelay[ncpuinfo]), vm->pid, vcpupid) < 0)
+            if (threadstats && threadstats[ncpuinfo].haveDelay) {
+                cpudelay[ncpuinfo] = threadstats[ncpuinfo].cpuDelay;
+            } else if (qemuGetSchedstatDelay(&(cpudelay[ncpuinfo]), vm, i) < 0) {
                 return -1;
+            }
         }
 
         ncpuinfo++;
@@ -1808,7 +1904,7 @@ static virDomainPtr qemuDomainCreateXML(virConnectPtr conn,
     }
 
     if (qemuProcessStart(conn, driver, vm, NULL, QEMU_ASYNC_JOB_START,
-                         NULL, -1, NULL, NULL,
+                         NULL, -1, NULL, NULL, NULL, NULL,
                          VIR_NETDEV_VPORT_PROFILE_OP_CREATE,
                          start_flags) < 0) {
         virDomainAuditStart(vm, "booted", false);
@@ -2816,10 +2912,18 @@ qemuDomainSaveInternal(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virQEMUSaveDataPtr data = NULL;
     g_autoptr(qemuDomainSaveCookie) cookie = NULL;
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
 
     if (!qemuMigrationSrcIsAllowed(driver, vm, false, 0))
         goto cleanup;
 
+    if (cfg->saveParallelChannels > 0 && compressor) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("save_parallel_channels cannot be used with "
+                         "compressed save images"));
+        goto cleanup;
+    }
+
     if (qemuDomainObjBeginAsyncJob(driver, vm, QEMU_ASYNC_JOB_SAVE,
                                    VIR_DOMAIN_JOB_OPERATION_SAVE, flags) < 0)
         goto cleanup;
@@ -2886,6 +2990,8 @@ qemuDomainSaveInternal(virQEMUDriverPtr driver,
         goto endjob;
     xml = NULL;
 
+    virQEMUSaveDataSetChannels(data, cfg->saveParallelChannels);
+
     ret = qemuSaveImageCreate(driver, vm, path, data, compressor,
                               flags, QEMU_ASYNC_JOB_SAVE);
     if (ret < 0)
@@ -3101,6 +3207,7 @@ qemuDomainManagedSaveRemove(virDomainPtr dom, unsigned int flags)
                              name);
         goto cleanup;
     }
+    qemuSaveImageRemoveChannels(name);
 
     vm->hasManagedSave = false;
     ret = 0;
@@ -4910,7 +5017,8 @@ qemuDomainGetVcpus(virDomainPtr dom,
         goto cleanup;
     }
 
-    ret = qemuDomainHelperGetVcpus(vm, info, NULL, NULL, maxinfo, cpumaps, maplen);
+    ret = qemuDomainHelperGetVcpus(vm, info, true, NULL, NULL, maxinfo,
+                                   cpumaps, maplen);
 
  cleanup:
     virDomainObjEndAPI(&vm);
@@ -6092,7 +6200,9 @@ qemuDomainRestoreFlags(virConnectPtr conn,
         goto cleanup;
 
     ret = qemuSaveImageStartVM(conn, driver, vm, &fd, data, path,
-                               false, QEMU_ASYNC_JOB_START);
+                               false,
+                               (flags & VIR_DOMAIN_SAVE_BYPASS_CACHE) != 0,
+                               QEMU_ASYNC_JOB_START);
 
     qemuProcessEndJob(driver, vm);
 
@@ -6360,7 +6470,7 @@ qemuDomainObjRestore(virConnectPtr conn,
     def = NULL;
 
     ret = qemuSaveImageStartVM(conn, driver, vm, &fd, data, path,
-                               start_paused, asyncJob);
+                               start_paused, bypass_cache, asyncJob);
 
  cleanup:
     virQEMUSaveDataFree(data);
@@ -6596,6 +6706,7 @@ qemuDomainObjStart(virConnectPtr conn,
                                      managed_save);
                 return ret;
             }
+            qemuSaveImageRemoveChannels(managed_save);
             vm->hasManagedSave = false;
         } else {
             virDomainJobOperation op = priv->job.current->operation;
@@ -6609,6 +6720,7 @@ qemuDomainObjStart(virConnectPtr conn,
                     VIR_WARN("Failed to remove the managed state %s", managed_save);
                 else
                     vm->hasManagedSave = false;
+                qemuSaveImageRemoveChannels(managed_save);
 
                 return ret;
             } else if (ret < 0) {
@@ -6624,7 +6736,7 @@ qemuDomainObjStart(virConnectPtr conn,
     }
 
     ret = qemuProcessStart(conn, driver, vm, NULL, asyncJob,
-                           NULL, -1, NULL, NULL,
+                           NULL, -1, NULL, NULL, NULL, NULL,
                            VIR_NETDEV_VPORT_PROFILE_OP_CREATE, start_flags);
     virDomainAuditStart(vm, "booted", ret >= 0);
     if (ret >= 0) {
@@ -6861,6 +6973,7 @@ qemuDomainUndefineFlags(virDomainPtr dom,
                                  "save image"));
                 goto endjob;
             }
+            qemuSaveImageRemoveChannels(name);
         } else {
             virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                            _("Refusing to undefine while domain managed "
@@ -9973,12 +10086,18 @@ qemuDomainBlocksStatsGather(virQEMUDriverPtr driver,
     }
 
     qemuDomainObjEnterMonitor(driver, vm);
-    nstats = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
+    if (capacity && blockdev) {
+        bool hascapacity;
+
+        nstats = qemuMonitorGetAllBlockStatsInfoBlockdev(priv->mon,
+                                                         &blockstats, false,
+                                                         &hascapacity);
+        if (nstats >= 0 && !hascapacity)
+            rc = -1;
+    } else {
+        nstats = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
 
-    if (capacity && nstats >= 0) {
-        if (blockdev)
-            rc = qemuMonitorBlockStatsUpdateCapacityBlockdev(priv->mon, blockstats);
-        else
+        if (capacity && nstats >= 0)
             rc = qemuMonitorBlockStatsUpdateCapacity(priv->mon, blockstats, false);
     }
 
@@ -17895,6 +18014,75 @@ qemuDomainGetStatsMemory(virQEMUDriverPtr driver,
 }
 
 
+static int
+qemuDomainGetStatsMonitor(virQEMUDriverPtr driver G_GNUC_UNUSED,
+                          virDomainObjPtr dom,
+                          virTypedParamListPtr params,
+                          unsigned int privflags G_GNUC_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorCommandStatsPtr *stats = NULL;
+    size_t nstats = 0;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom) || !priv->mon)
+        return 0;
+
+    if (qemuMonitorGetCommandStats(priv->mon, &stats, &nstats) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamListAddUInt(params, nstats, "monitor.command.count") < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        qemuMonitorCommandStatsPtr cmd = stats[i];
+
+        if (virTypedParamListAddString(params, cmd->name,
+                                       "monitor.command.%zu.name", i) < 0)
+            goto cleanup;
+
+        if (virTypedParamListAddULLong(params, cmd->calls,
+                                       "monitor.command.%zu.calls", i) < 0)
+            goto cleanup;
+
+        if (virTypedParamListAddULLong(params, cmd->totalTime,
+                                       "monitor.command.%zu.time.total", i) < 0)
+            goto cleanup;
+
+        if (virTypedParamListAddULLong(params, cmd->maxTime,
+                                       "monitor.command.%zu.time.max", i) < 0)
+            goto cleanup;
+
+        if (virTypedParamListAddULLong(params, cmd->queuedTime,
+                                       "monitor.command.%zu.time.queued", i) < 0)
+            goto cleanup;
+
+        if (virTypedParamListAddULLong(params, cmd->parseTime,
+                                       "monitor.command.%zu.time.parse", i) < 0)
+            goto cleanup;
+
+        for (j = 0; j < QEMU_MONITOR_COMMAND_STATS_BUCKETS; j++) {
+            if (virTypedParamListAddULLong(params, cmd->histogram[j],
+                                           "monitor.command.%zu.histogram.%zu",
+                                           i, j) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nstats; i++)
+        qemuMonitorCommandStatsFree(stats[i]);
+    g_free(stats);
+    return ret;
+}
+
+
 static int
 qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
@@ -17986,7 +18174,7 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
             virResetLastError();
     }
 
-    if (qemuDomainHelperGetVcpus(dom, cpuinfo, cpuwait, cpudelay,
+    if (qemuDomainHelperGetVcpus(dom, cpuinfo, false, cpuwait, cpudelay,
                                  virDomainDefGetVcpus(dom->def),
                                  NULL, 0) < 0) {
         virResetLastError();
@@ -18425,12 +18613,19 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
         qemuDomainObjEnterMonitor(driver, dom);
 
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats, visitBacking);
+        if (blockdev) {
+            bool hascapacity;
 
-        if (rc >= 0) {
-            if (blockdev)
-                rc = qemuMonitorBlockStatsUpdateCapacityBlockdev(priv->mon, stats);
-            else
+            rc = qemuMonitorGetAllBlockStatsInfoBlockdev(priv->mon, &stats,
+                                                         visitBacking,
+                                                         &hascapacity);
+            /* missing capacity data is fine, like in the non-batched case */
+            if (rc >= 0 && !hascapacity)
+                virResetLastError();
+        } else {
+            rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats, visitBacking);
+
+            if (rc >= 0)
                 ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
                                                                  visitBacking));
         }
@@ -18594,6 +18789,7 @@ static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
     { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
     { qemuDomainGetStatsIOThread, VIR_DOMAIN_STATS_IOTHREAD, true },
     { qemuDomainGetStatsMemory, VIR_DOMAIN_STATS_MEMORY, false },
+    { qemuDomainGetStatsMonitor, VIR_DOMAIN_STATS_MONITOR, false },
     { NULL, 0, false }
 };
 
@@ -20016,21 +20212,20 @@ qemuAgentFSInfoFormatParams(qemuAgentFSInfoPtr *fsinfo,
 }
 
 
+/* Gathers the guest info of @vm selected by @supportedTypes into @params.
+ * The caller must hold a lock on @vm. */
 static int
-qemuDomainGetGuestInfo(virDomainPtr dom,
-                       unsigned int types,
-                       virTypedParameterPtr *params,
-                       int *nparams,
-                       unsigned int flags)
+qemuDomainGetGuestInfoVM(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         unsigned int supportedTypes,
+                         bool report_unsupported,
+                         virTypedParameterPtr *params,
+                         int *nparams)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm = NULL;
     qemuAgentPtr agent;
     int ret = -1;
     int maxparams = 0;
     g_autofree char *hostname = NULL;
-    unsigned int supportedTypes;
-    bool report_unsupported = types != 0;
     int rc;
     size_t nfs = 0;
     qemuAgentFSInfoPtr *agentfsinfo = NULL;
@@ -20038,17 +20233,6 @@ qemuDomainGetGuestInfo(virDomainPtr dom,
     qemuAgentDiskInfoPtr *agentdiskinfo = NULL;
     size_t i;
 
-    virCheckFlags(0, -1);
-
-    if (qemuDomainGetGuestInfoCheckSupport(types, &supportedTypes) < 0)
-        return -1;
-
-    if (!(vm = qemuDomainObjFromDomain(dom)))
-        goto cleanup;
-
-    if (virDomainGetGuestInfoEnsureACL(dom->conn, vm->def) < 0)
-        goto cleanup;
-
     if (qemuDomainObjBeginAgentJob(driver, vm,
                                    QEMU_AGENT_JOB_QUERY) < 0)
         goto cleanup;
@@ -20057,6 +20241,7 @@ qemuDomainGetGuestInfo(virDomainPtr dom,
         goto endagentjob;
 
     agent = qemuDomainObjEnterAgent(vm);
+    qemuAgentBatchBegin(agent);
 
     /* The agent info commands will return -2 for any commands that are not
      * supported by the agent, or -1 for all other errors. In the case where no
@@ -20101,6 +20286,7 @@ qemuDomainGetGuestInfo(virDomainPtr dom,
         }
     }
 
+    qemuAgentBatchEnd(agent);
     qemuDomainObjExitAgent(vm, agent);
     qemuDomainObjEndAgentJob(vm);
 
@@ -20133,10 +20319,10 @@ qemuDomainGetGuestInfo(virDomainPtr dom,
         qemuAgentDiskInfoFree(agentdiskinfo[i]);
     g_free(agentdiskinfo);
 
-    virDomainObjEndAPI(&vm);
     return ret;
 
  exitagent:
+    qemuAgentBatchEnd(agent);
     qemuDomainObjExitAgent(vm, agent);
 
  endagentjob:
@@ -20145,6 +20331,176 @@ qemuDomainGetGuestInfo(virDomainPtr dom,
 }
 
 
+static int
+qemuDomainGetGuestInfo(virDomainPtr dom,
+                       unsigned int types,
+                       virTypedParameterPtr *params,
+                       int *nparams,
+                       unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    int ret = -1;
+    unsigned int supportedTypes;
+
+    virCheckFlags(0, -1);
+
+    if (qemuDomainGetGuestInfoCheckSupport(types, &supportedTypes) < 0)
+        return -1;
+
+    if (!(vm = qemuDomainObjFromDomain(dom)))
+        goto cleanup;
+
+    if (virDomainGetGuestInfoEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    ret = qemuDomainGetGuestInfoVM(driver, vm, supportedTypes, types != 0,
+                                   params, nparams);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
+/* Upper bound of the threads querying guest agents for
+ * qemuDomainListGetGuestInfo */
+#define QEMU_DOMAIN_GUEST_INFO_WORKERS 16
+
+typedef struct _qemuDomainListGetGuestInfoData qemuDomainListGetGuestInfoData;
+struct _qemuDomainListGetGuestInfoData {
+    virConnectPtr conn;
+    virQEMUDriverPtr driver;
+    virDomainObjPtr *vms;
+    virDomainStatsRecordPtr *records;
+    size_t nvms;
+    unsigned int supportedTypes;
+    bool report_unsupported;
+    int next;
+};
+
+
+static void
+qemuDomainListGetGuestInfoWorker(void *opaque)
+{
+    qemuDomainListGetGuestInfoData *job = opaque;
+    int idx;
+
+    while ((idx = g_atomic_int_add(&job->next, 1)) < (int) job->nvms) {
+        virDomainObjPtr vm = job->vms[idx];
+        virDomainPtr dom;
+        virTypedParameterPtr params = NULL;
+        int nparams = 0;
+
+        virObjectLock(vm);
+
+        if (!virDomainObjIsActive(vm)) {
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        if (qemuDomainGetGuestInfoVM(job->driver, vm, job->supportedTypes,
+                                     job->report_unsupported,
+                                     &params, &nparams) < 0) {
+            VIR_WARN("Unable to get guest info of domain '%s': %s",
+                     vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+            virTypedParamsFree(params, nparams);
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        if (!(dom = virGetDomain(job->conn, vm->def->name,
+                                 vm->def->uuid, vm->def->id))) {
+            virResetLastError();
+            virTypedParamsFree(params, nparams);
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        job->records[idx] = g_new0(virDomainStatsRecord, 1);
+        job->records[idx]->dom = dom;
+        job->records[idx]->params = params;
+        job->records[idx]->nparams = nparams;
+
+        virObjectUnlock(vm);
+    }
+}
+
+
+static int
+qemuDomainListGetGuestInfo(virConnectPtr conn,
+                           virDomainPtr *doms,
+                           unsigned int ndoms,
+                           unsigned int types,
+                           virDomainStatsRecordPtr **retInfo,
+                           unsigned int flags)
+{
+    qemuDomainListGetGuestInfoData job = {
+        .conn = conn,
+        .driver = conn->privateData,
+        .report_unsupported = types != 0,
+    };
+    g_autofree virThread *threads = NULL;
+    virDomainStatsRecordPtr *tmpinfo = NULL;
+    size_t nworkers;
+    size_t nthreads;
+    int ninfo = 0;
+    size_t i;
+
+    virCheckFlags(0, -1);
+
+    if (virDomainListGetGuestInfoEnsureACL(conn) < 0)
+        return -1;
+
+    if (qemuDomainGetGuestInfoCheckSupport(types, &job.supportedTypes) < 0)
+        return -1;
+
+    if (virDomainObjListConvert(job.driver->domains, conn, doms, ndoms,
+                                &job.vms, &job.nvms,
+                                virDomainListGetGuestInfoCheckACL,
+                                0, true) < 0)
+        return -1;
+
+    job.records = g_new0(virDomainStatsRecordPtr, job.nvms);
+
+    /* Agents of different domains are queried in parallel, agent jobs of
+     * the individual domains still serialize the commands for each of
+     * them with any other agent commands. */
+    nworkers = MAX(1, MIN(job.nvms, QEMU_DOMAIN_GUEST_INFO_WORKERS));
+    threads = g_new0(virThread, nworkers);
+
+    for (nthreads = 0; nthreads < nworkers; nthreads++) {
+        if (virThreadCreateFull(&threads[nthreads], true,
+                                qemuDomainListGetGuestInfoWorker,
+                                "qemu-guest-info", false, &job) < 0) {
+            VIR_WARN("Unable to create guest info thread: %s",
+                     g_strerror(errno));
+            break;
+        }
+    }
+
+    if (nthreads == 0)
+        qemuDomainListGetGuestInfoWorker(&job);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    tmpinfo = g_new0(virDomainStatsRecordPtr, job.nvms + 1);
+    for (i = 0; i < job.nvms; i++) {
+        if (job.records[i])
+            tmpinfo[ninfo++] = job.records[i];
+    }
+
+    *retInfo = tmpinfo;
+
+    g_free(job.records);
+    virObjectListFreeCount(job.vms, job.nvms);
+
+    return ninfo;
+}
+
+
 static int
 qemuDomainAgentSetResponseTimeout(virDomainPtr dom,
                                   int timeout,
@@ -20579,6 +20935,7 @@ static virHypervisorDriver qemuHypervisorDriver = {
     .domainAuthorizedSSHKeysGet = qemuDomainAuthorizedSSHKeysGet, /* 6.10.0 */
     .domainAuthorizedSSHKeysSet = qemuDomainAuthorizedSSHKeysSet, /* 6.10.0 */
     .domainGetMessages = qemuDomainGetMessages, /* 7.1.0 */
+    .domainListGetGuestInfo = qemuDomainListGetGuestInfo, /* 7.2.0 */
 };
 
 
@@ -6026,6 +6026,433 @@ qemuMigrationSrcToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     return ret;
 }
 
+/* How long to wait for QEMU to connect a migration channel (ms) */
+#define QEMU_MIGRATION_CHANNEL_TIMEOUT 30000
+
+/**
+ * qemuMigrationChannelsParams:
+ * @nchannels: number of multifd channels
+ * @party: source or destination of the migration
+ *
+ * Returns migration parameters enabling multifd migration with
+ * @nchannels channels and unlimited bandwidth.
+ */
+static qemuMigrationParamsPtr
+qemuMigrationChannelsParams(size_t nchannels,
+                            qemuMigrationParty party)
+{
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int maxparams = 0;
+
+    if (virTypedParamsAddInt(&params, &nparams, &maxparams,
+                             VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                             nchannels) < 0)
+        return NULL;
+
+    migParams = qemuMigrationParamsFromFlags(params, nparams,
+                                             VIR_MIGRATE_PARALLEL, party);
+    virTypedParamsFree(params, nparams);
+    if (!migParams)
+        return NULL;
+
+    if (party == QEMU_MIGRATION_SOURCE &&
+        qemuMigrationParamsSetULL(migParams,
+                                  QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
+                                  QEMU_DOMAIN_MIG_BANDWIDTH_MAX * 1024 * 1024) < 0)
+        return NULL;
+
+    return g_steal_pointer(&migParams);
+}
+
+
+/* Disables multifd again so that other jobs using migration internally
+ * are not affected, and restores the bandwidth limit on the source. */
+static void
+qemuMigrationChannelsResetParams(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 qemuDomainAsyncJob asyncJob,
+                                 qemuMigrationParty party,
+                                 unsigned long bandwidth)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    g_autoptr(qemuMigrationParams) migParams = qemuMigrationParamsNew();
+    virErrorPtr orig_err;
+
+    if (!virDomainObjIsActive(vm))
+        return;
+
+    virErrorPreserveLast(&orig_err);
+
+    if (party == QEMU_MIGRATION_SOURCE &&
+        qemuMigrationParamsSetULL(migParams,
+                                  QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
+                                  bandwidth * 1024 * 1024) == 0)
+        priv->migMaxBandwidth = bandwidth;
+
+    ignore_value(qemuMigrationParamsApply(driver, vm, asyncJob, migParams));
+
+    virErrorRestore(&orig_err);
+}
+
+
+static int
+qemuMigrationChannelAccept(virDomainObjPtr vm,
+                           virNetSocketPtr sock,
+                           int *fd)
+{
+    struct pollfd pfd = { .fd = virNetSocketGetFD(sock), .events = POLLIN };
+    g_autoptr(virNetSocket) client = NULL;
+    int rc;
+
+    /* Don't block event processing for @vm, QEMU might die meanwhile */
+    virObjectUnlock(vm);
+    do {
+        rc = poll(&pfd, 1, QEMU_MIGRATION_CHANNEL_TIMEOUT);
+    } while (rc < 0 && errno == EINTR);
+    virObjectLock(vm);
+
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to wait for migration channel"));
+        return -1;
+    }
+
+    if (rc == 0 || !virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("QEMU did not connect migration channel"));
+        return -1;
+    }
+
+    if (virNetSocketAccept(sock, &client) < 0)
+        return -1;
+
+    if (!client) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("failed to accept migration channel"));
+        return -1;
+    }
+
+    if ((*fd = virNetSocketDupFD(client, true)) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuMigrationChannelConnect(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            const char *sockpath,
+                            int *fd)
+{
+    g_autoptr(virNetSocket) sock = NULL;
+    int rc;
+
+    if (qemuSecuritySetSocketLabel(driver->securityManager, vm->def) < 0)
+        return -1;
+
+    rc = virNetSocketNewConnectUNIX(sockpath, false, NULL, &sock);
+
+    if (qemuSecurityClearSocketLabel(driver->securityManager, vm->def) < 0 ||
+        rc < 0)
+        return -1;
+
+    if ((*fd = virNetSocketDupFD(sock, true)) < 0)
+        return -1;
+
+    if (virSetBlocking(*fd, true) < 0) {
+        virReportSystemError(errno, _("Unable to set FD %d blocking"), *fd);
+        VIR_FORCE_CLOSE(*fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Waits for the iohelpers copying the channels. If @error is true,
+ * the channels are shut down first so that the helpers don't block
+ * on a peer which is gone. */
+static int
+qemuMigrationChannelsFinish(virFileWrapperFdPtr *wrappers,
+                            int *socks,
+                            size_t nchannels,
+                            bool error)
+{
+    virErrorPtr orig_err = NULL;
+    int ret = 0;
+    size_t i;
+
+    if (error)
+        virErrorPreserveLast(&orig_err);
+
+    for (i = 0; i < nchannels; i++) {
+        if (error && socks[i] >= 0)
+            shutdown(socks[i], SHUT_RDWR);
+        VIR_FORCE_CLOSE(socks[i]);
+    }
+
+    for (i = 0; i < nchannels; i++) {
+        if (virFileWrapperFdClose(wrappers[i]) < 0)
+            ret = -1;
+        virFileWrapperFdFree(wrappers[i]);
+        wrappers[i] = NULL;
+    }
+
+    virErrorRestore(&orig_err);
+    return ret;
+}
+
+
+/**
+ * qemuMigrationSrcToFiles:
+ * @driver: qemu driver
+ * @vm: domain object
+ * @sockpath: UNIX socket to pass the migration channels through
+ * @fds: files to write the channels to
+ * @paths: names of @fds, for diagnostics
+ * @nfds: number of elements in @fds and @paths
+ * @asyncJob: async job
+ *
+ * Migrates @vm into files using multifd migration with @nfds - 1
+ * parallel channels. The main migration stream is written to @fds[0],
+ * each multifd channel to one of the remaining files. QEMU connects
+ * all channels to @sockpath, which has to be accessible by QEMU, and
+ * each of them is copied by a separate iohelper process.
+ *
+ * On success, all of @fds are closed and set to -1.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+qemuMigrationSrcToFiles(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm,
+                        const char *sockpath,
+                        int *fds,
+                        const char **paths,
+                        size_t nfds,
+                        qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+    g_autoptr(virNetSocket) sock = NULL;
+    g_autofree virFileWrapperFdPtr *wrappers = g_new0(virFileWrapperFdPtr, nfds);
+    g_autofree int *socks = g_new(int, nfds);
+    unsigned long saveMigBandwidth = priv->migMaxBandwidth;
+    bool started = false;
+    bool finished = false;
+    virErrorPtr orig_err = NULL;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    for (i = 0; i < nfds; i++)
+        socks[i] = -1;
+
+    if (!qemuMigrationCapsGet(vm, QEMU_MIGRATION_CAP_MULTIFD)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("parallel save is not supported by this QEMU binary"));
+        return -1;
+    }
+
+    if (qemuMigrationSetDBusVMState(driver, vm) < 0)
+        return -1;
+
+    if (!(migParams = qemuMigrationChannelsParams(nfds - 1,
+                                                  QEMU_MIGRATION_SOURCE)))
+        return -1;
+
+    if (qemuMigrationParamsApply(driver, vm, asyncJob, migParams) < 0)
+        goto cleanup;
+
+    priv->migMaxBandwidth = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+
+    if (qemuSecuritySetSocketLabel(driver->securityManager, vm->def) < 0)
+        goto cleanup;
+
+    rc = virNetSocketNewListenUNIX(sockpath, 0700, cfg->user, cfg->group, &sock);
+
+    if (qemuSecurityClearSocketLabel(driver->securityManager, vm->def) < 0 ||
+        rc < 0)
+        goto cleanup;
+
+    if (virNetSocketListen(sock, nfds) < 0 ||
+        qemuSecurityDomainSetPathLabel(driver, vm, sockpath, false) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        goto cleanup;
+    rc = qemuMonitorMigrateToSocket(priv->mon, QEMU_MONITOR_MIGRATE_BACKGROUND,
+                                    sockpath);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto cleanup;
+
+    started = true;
+
+    /* QEMU connects the main channel first and only then the multifd
+     * channels, so the order of accepting them is deterministic. */
+    for (i = 0; i < nfds; i++) {
+        int fd = -1;
+
+        if (qemuMigrationChannelAccept(vm, sock, &socks[i]) < 0)
+            goto cleanup;
+
+        if ((fd = dup(socks[i])) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to duplicate migration channel"));
+            goto cleanup;
+        }
+
+        if (!(wrappers[i] = virFileWrapperFdNewPeer(&fds[i], &fd, paths[i]))) {
+            VIR_FORCE_CLOSE(fd);
+            goto cleanup;
+        }
+    }
+
+    rc = qemuMigrationSrcWaitForCompletion(driver, vm, asyncJob, NULL, 0);
+    finished = rc != -2;
+    if (rc < 0)
+        goto cleanup;
+
+    if (qemuMigrationChannelsFinish(wrappers, socks, nfds, false) < 0)
+        goto cleanup;
+
+    qemuDomainEventEmitJobCompleted(driver, vm);
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virErrorPreserveLast(&orig_err);
+
+        if (started && !finished && virDomainObjIsActive(vm) &&
+            qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) == 0) {
+            qemuMonitorMigrateCancel(priv->mon);
+            ignore_value(qemuDomainObjExitMonitor(driver, vm));
+        }
+
+        ignore_value(qemuMigrationChannelsFinish(wrappers, socks, nfds, true));
+    }
+
+    qemuMigrationChannelsResetParams(driver, vm, asyncJob,
+                                     QEMU_MIGRATION_SOURCE, saveMigBandwidth);
+
+    if (sock && unlink(sockpath) < 0 && errno != ENOENT)
+        VIR_WARN("failed to remove migration socket %s", sockpath);
+
+    virErrorRestore(&orig_err);
+    return ret;
+}
+
+
+/**
+ * qemuMigrationDstRunFromFiles:
+ * @driver: qemu driver
+ * @vm: domain object
+ * @sockpath: UNIX socket QEMU is supposed to listen on
+ * @fds: files to read the channels from
+ * @paths: names of @fds, for diagnostics
+ * @nfds: number of elements in @fds and @paths
+ * @asyncJob: async job
+ *
+ * Counterpart of qemuMigrationSrcToFiles. Starts incoming multifd
+ * migration with @nfds - 1 channels in a QEMU process started with
+ * deferred incoming migration, connects all the channels to @sockpath
+ * and feeds them from @fds in parallel. @fds[0] has to contain the
+ * main migration stream.
+ *
+ * On success, all of @fds are closed and set to -1.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+qemuMigrationDstRunFromFiles(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             const char *sockpath,
+                             int *fds,
+                             const char **paths,
+                             size_t nfds,
+                             qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+    g_autofree virFileWrapperFdPtr *wrappers = g_new0(virFileWrapperFdPtr, nfds);
+    g_autofree int *socks = g_new(int, nfds);
+    g_autofree char *uri = g_strdup_printf("unix:%s", sockpath);
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    for (i = 0; i < nfds; i++)
+        socks[i] = -1;
+
+    if (!qemuMigrationCapsGet(vm, QEMU_MIGRATION_CAP_MULTIFD)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("parallel restore is not supported by this QEMU binary"));
+        return -1;
+    }
+
+    if (!(migParams = qemuMigrationChannelsParams(nfds - 1,
+                                                  QEMU_MIGRATION_DESTINATION)))
+        return -1;
+
+    if (qemuMigrationParamsApply(driver, vm, asyncJob, migParams) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Setting up incoming migration with URI %s", uri);
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        goto cleanup;
+
+    rc = qemuMonitorSetDBusVMStateIdList(priv->mon, priv->dbusVMStateIds);
+    if (rc == 0)
+        rc = qemuMonitorMigrateIncoming(priv->mon, uri);
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto cleanup;
+
+    /* QEMU treats the first connection as the main channel */
+    for (i = 0; i < nfds; i++) {
+        int fd = -1;
+
+        if (qemuMigrationChannelConnect(driver, vm, sockpath, &socks[i]) < 0)
+            goto cleanup;
+
+        if ((fd = dup(socks[i])) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to duplicate migration channel"));
+            goto cleanup;
+        }
+
+        if (!(wrappers[i] = virFileWrapperFdNewPeer(&fds[i], &fd, paths[i]))) {
+            VIR_FORCE_CLOSE(fd);
+            goto cleanup;
+        }
+    }
+
+    if (qemuMigrationDstWaitForCompletion(driver, vm, asyncJob, false) < 0)
+        goto cleanup;
+
+    if (qemuMigrationChannelsFinish(wrappers, socks, nfds, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        ignore_value(qemuMigrationChannelsFinish(wrappers, socks, nfds, true));
+
+    qemuMigrationChannelsResetParams(driver, vm, asyncJob,
+                                     QEMU_MIGRATION_DESTINATION, 0);
+
+    if (unlink(sockpath) < 0 && errno != ENOENT)
+        VIR_WARN("failed to remove migration socket %s", sockpath);
+
+    return ret;
+}
+
 
 int
 qemuMigrationSrcCancel(virQEMUDriverPtr driver,
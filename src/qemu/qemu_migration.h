@@ -212,6 +212,28 @@ qemuMigrationSrcToFile(virQEMUDriverPtr driver,
                        qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
 
+int
+qemuMigrationSrcToFiles(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm,
+                        const char *sockpath,
+                        int *fds,
+                        const char **paths,
+                        size_t nfds,
+                        qemuDomainAsyncJob asyncJob)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5) G_GNUC_WARN_UNUSED_RESULT;
+
+int
+qemuMigrationDstRunFromFiles(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             const char *sockpath,
+                             int *fds,
+                             const char **paths,
+                             size_t nfds,
+                             qemuDomainAsyncJob asyncJob)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5) G_GNUC_WARN_UNUSED_RESULT;
+
 int
 qemuMigrationSrcCancel(virQEMUDriverPtr driver,
                        virDomainObjPtr vm);
@@ -83,9 +83,10 @@ struct _qemuMonitor {
     qemuMonitorCallbacksPtr cb;
     void *callbackOpaque;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
-    qemuMonitorMessagePtr msg;
+    /* Commands being transmitted or waiting for their reply, in the
+     * order they were submitted */
+    qemuMonitorMessagePtr *msgs;
+    size_t nmsgs;
 
     /* Buffer incoming data ready for Text/QMP monitor
      * code to process & find message boundaries */
@@ -99,6 +100,9 @@ struct _qemuMonitor {
 
     int nextSerial;
 
+    /* Per-command timing statistics, name -> qemuMonitorCommandStats */
+    GHashTable *commandStats;
+
     bool waitGreeting;
 
     /* If found, path to the virtio memballoon driver */
@@ -222,6 +226,24 @@ qemuMonitorEscapeNonPrintable(const char *text)
 #endif
 
 
+void
+qemuMonitorCommandStatsFree(qemuMonitorCommandStatsPtr stats)
+{
+    if (!stats)
+        return;
+
+    g_free(stats->name);
+    g_free(stats);
+}
+
+
+static void
+qemuMonitorCommandStatsHashFree(void *data)
+{
+    qemuMonitorCommandStatsFree(data);
+}
+
+
 static void
 qemuMonitorDispose(void *obj)
 {
@@ -237,6 +259,8 @@ qemuMonitorDispose(void *obj)
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
     g_free(mon->buffer);
+    g_free(mon->msgs);
+    virHashFree(mon->commandStats);
     g_free(mon->balloonpath);
 }
 
@@ -309,6 +333,79 @@ qemuMonitorOpenUnix(const char *monitor,
 }
 
 
+/*
+ * Returns the first message which was not completely transmitted yet.
+ * Call this function while holding the monitor lock.
+ */
+static qemuMonitorMessagePtr
+qemuMonitorGetTxMessage(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (mon->msgs[i]->txOffset < mon->msgs[i]->txLength)
+            return mon->msgs[i];
+    }
+
+    return NULL;
+}
+
+
+/**
+ * qemuMonitorGetReplyMessage:
+ * @mon: monitor object
+ * @id: ID of the command a reply was received for, or NULL
+ *
+ * Looks up the message a reply from QEMU belongs to. If @id is NULL
+ * the oldest message which was completely transmitted and is still
+ * waiting for its reply is returned. Call this function while holding
+ * the monitor lock.
+ *
+ * Returns the message or NULL if no such message exists.
+ */
+qemuMonitorMessagePtr
+qemuMonitorGetReplyMessage(qemuMonitorPtr mon,
+                           const char *id)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        qemuMonitorMessagePtr msg = mon->msgs[i];
+
+        if (msg->finished || msg->txOffset < msg->txLength)
+            continue;
+
+        if (!id || STREQ_NULLABLE(msg->id, id))
+            return msg;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Marks all messages which are still waiting for their reply as finished.
+ * Call this function while holding the monitor lock.
+ *
+ * Returns true if there was any such message.
+ */
+static bool
+qemuMonitorFinishMessages(qemuMonitorPtr mon)
+{
+    bool ret = false;
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (!mon->msgs[i]->finished) {
+            mon->msgs[i]->finished = true;
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -317,18 +414,14 @@ static int
 qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
-    qemuMonitorMessagePtr msg = NULL;
-
-    /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    size_t i;
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
+    qemuMonitorMessagePtr msg = qemuMonitorGetReplyMessage(mon, NULL);
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
     char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    VIR_ERROR(_("Process %d %zu %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->nmsgs, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
@@ -340,8 +433,7 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
                 mon, mon->buffer, mon->bufferOffset);
 
     len = qemuMonitorJSONIOProcess(mon,
-                                   mon->buffer, mon->bufferOffset,
-                                   msg);
+                                   mon->buffer, mon->bufferOffset);
     if (len < 0)
         return -1;
 
@@ -360,10 +452,14 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 #endif
 
     /* As the monitor mutex was unlocked in qemuMonitorJSONIOProcess()
-     * while dealing with qemu event, mon->msg could be changed which
-     * means the above 'msg' may be invalid, thus we use 'mon->msg' here */
-    if (mon->msg && mon->msg->finished)
-        virCondBroadcast(&mon->notify);
+     * while dealing with qemu event, mon->msgs could be changed so we
+     * need to look at them only now */
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (mon->msgs[i]->finished) {
+            virCondBroadcast(&mon->notify);
+            break;
+        }
+    }
     return len;
 }
 
@@ -420,26 +516,27 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
     int done;
     char *buf;
     size_t len;
+    qemuMonitorMessagePtr msg = qemuMonitorGetTxMessage(mon);
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
+    /* If no message is waiting to be transmitted, the no-op */
+    if (!msg)
         return 0;
 
-    buf = mon->msg->txBuffer + mon->msg->txOffset;
-    len = mon->msg->txLength - mon->msg->txOffset;
-    if (mon->msg->txFD == -1)
+    buf = msg->txBuffer + msg->txOffset;
+    len = msg->txLength - msg->txOffset;
+    if (msg->txFD == -1)
         done = write(mon->fd, buf, len);
     else
-        done = qemuMonitorIOWriteWithFD(mon, buf, len, mon->msg->txFD);
+        done = qemuMonitorIOWriteWithFD(mon, buf, len, msg->txFD);
 
     PROBE(QEMU_MONITOR_IO_WRITE,
           "mon=%p buf=%s len=%zu ret=%d errno=%d",
           mon, buf, len, done, done < 0 ? errno : 0);
 
-    if (mon->msg->txFD != -1) {
+    if (msg->txFD != -1) {
         PROBE(QEMU_MONITOR_IO_SEND_FD,
               "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, done < 0 ? errno : 0);
+              mon, msg->txFD, done, done < 0 ? errno : 0);
     }
 
     if (done < 0) {
@@ -450,7 +547,9 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
                              _("Unable to write to monitor"));
         return -1;
     }
-    mon->msg->txOffset += done;
+    msg->txOffset += done;
+    if (msg->txOffset == msg->txLength)
+        msg->txTime = g_get_monotonic_time();
     return done;
 }
 
@@ -620,12 +719,10 @@ qemuMonitorIO(GSocket *socket G_GNUC_UNUSED,
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
-         * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = true;
-            virCondSignal(&mon->notify);
-        }
+        /* If IO process resulted in an error & we have messages,
+         * then wakeup their waiters */
+        if (qemuMonitorFinishMessages(mon))
+            virCondBroadcast(&mon->notify);
     }
 
     qemuMonitorUpdateWatch(mon);
@@ -638,7 +735,7 @@ qemuMonitorIO(GSocket *socket G_GNUC_UNUSED,
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -648,7 +745,7 @@ qemuMonitorIO(GSocket *socket G_GNUC_UNUSED,
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -697,6 +794,7 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
     mon->fd = fd;
     mon->context = g_main_context_ref(context);
     mon->vm = virObjectRef(vm);
+    mon->commandStats = virHashNew(qemuMonitorCommandStatsHashFree);
     mon->waitGreeting = true;
     mon->cb = cb;
     mon->callbackOpaque = opaque;
@@ -830,7 +928,7 @@ qemuMonitorRegister(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         cond |= G_IO_IN;
 
-        if ((mon->msg && mon->msg->txOffset < mon->msg->txLength) &&
+        if (qemuMonitorGetTxMessage(mon) &&
             !mon->waitGreeting)
             cond |= G_IO_OUT;
     }
@@ -888,7 +986,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
     /* In case another thread is waiting for its monitor command to be
      * processed, we need to wake it up with appropriate error set.
      */
-    if (mon->msg) {
+    if (mon->nmsgs > 0) {
         if (mon->lastError.code == VIR_ERR_OK) {
             virErrorPtr err;
 
@@ -902,8 +1000,8 @@ qemuMonitorClose(qemuMonitorPtr mon)
             else
                 virResetLastError();
         }
-        mon->msg->finished = true;
-        virCondSignal(&mon->notify);
+        qemuMonitorFinishMessages(mon);
+        virCondBroadcast(&mon->notify);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -935,10 +1033,148 @@ qemuMonitorResetCommandID(qemuMonitorPtr mon)
 }
 
 
+static void
+qemuMonitorRemoveMessage(qemuMonitorPtr mon,
+                         qemuMonitorMessagePtr msg)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (mon->msgs[i] == msg) {
+            VIR_DELETE_ELEMENT(mon->msgs, i, mon->nmsgs);
+            return;
+        }
+    }
+}
+
+
+static size_t
+qemuMonitorCommandStatsBucket(unsigned long long time)
+{
+    unsigned long long limit = 100;
+    size_t i;
+
+    for (i = 0; i < QEMU_MONITOR_COMMAND_STATS_BUCKETS - 1; i++) {
+        if (time < limit)
+            return i;
+        limit *= 10;
+    }
+
+    return QEMU_MONITOR_COMMAND_STATS_BUCKETS - 1;
+}
+
+
+/*
+ * Accounts the round trip of a finished @msg in the per-command statistics.
+ * Call this function while holding the monitor lock.
+ */
+static void
+qemuMonitorCommandStatsUpdate(qemuMonitorPtr mon,
+                              qemuMonitorMessagePtr msg)
+{
+    qemuMonitorCommandStatsPtr stats;
+    unsigned long long total;
+
+    if (!msg->name || msg->rxTime < msg->submitTime)
+        return;
+
+    if (!(stats = virHashLookup(mon->commandStats, msg->name))) {
+        stats = g_new0(qemuMonitorCommandStats, 1);
+        stats->name = g_strdup(msg->name);
+        if (virHashAddEntry(mon->commandStats, msg->name, stats) < 0) {
+            qemuMonitorCommandStatsFree(stats);
+            return;
+        }
+    }
+
+    total = msg->rxTime - msg->submitTime;
+
+    stats->calls++;
+    stats->totalTime += total;
+    stats->maxTime = MAX(stats->maxTime, total);
+    if (msg->txTime >= msg->submitTime)
+        stats->queuedTime += msg->txTime - msg->submitTime;
+    stats->parseTime += msg->parseTime;
+    stats->histogram[qemuMonitorCommandStatsBucket(total)]++;
+}
+
+
+static int
+qemuMonitorCommandStatsCompare(const void *a,
+                               const void *b)
+{
+    const qemuMonitorCommandStats *sa = *(const qemuMonitorCommandStats **)a;
+    const qemuMonitorCommandStats *sb = *(const qemuMonitorCommandStats **)b;
+
+    return strcmp(sa->name, sb->name);
+}
+
+
+/**
+ * qemuMonitorGetCommandStats:
+ * @mon: monitor object
+ * @stats: filled with a list of per-command statistics
+ * @nstats: filled with the number of elements in @stats
+ *
+ * Returns a copy of the timing statistics of all commands issued on @mon so
+ * far, sorted by the command name. The caller doesn't need to hold the
+ * monitor lock and has to free @stats.
+ *
+ * Returns 0 on success, -1 on error.
+ */
 int
-qemuMonitorSend(qemuMonitorPtr mon,
-                qemuMonitorMessagePtr msg)
+qemuMonitorGetCommandStats(qemuMonitorPtr mon,
+                           qemuMonitorCommandStatsPtr **stats,
+                           size_t *nstats)
 {
+    GHashTableIter iter;
+    qemuMonitorCommandStatsPtr entry;
+    size_t i = 0;
+
+    QEMU_CHECK_MONITOR(mon);
+
+    virObjectLock(mon);
+
+    *nstats = g_hash_table_size(mon->commandStats);
+    *stats = g_new0(qemuMonitorCommandStatsPtr, *nstats);
+
+    g_hash_table_iter_init(&iter, mon->commandStats);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &entry)) {
+        qemuMonitorCommandStatsPtr copy = g_new0(qemuMonitorCommandStats, 1);
+
+        *copy = *entry;
+        copy->name = g_strdup(entry->name);
+        (*stats)[i++] = copy;
+    }
+
+    virObjectUnlock(mon);
+
+    qsort(*stats, *nstats, sizeof(**stats), qemuMonitorCommandStatsCompare);
+
+    return 0;
+}
+
+
+/**
+ * qemuMonitorSendBatch:
+ * @mon: monitor object
+ * @msgs: messages to send
+ * @nmsgs: number of messages in @msgs
+ *
+ * Submits all of @msgs to QEMU without waiting for replies to the previous
+ * ones so that the round trips of independent commands overlap. Replies are
+ * matched to messages using the command ID. The caller has to hold the
+ * monitor lock.
+ *
+ * Returns 0 once replies to all messages were received, -1 on error.
+ */
+int
+qemuMonitorSendBatch(qemuMonitorPtr mon,
+                     qemuMonitorMessagePtr *msgs,
+                     size_t nmsgs)
+{
+    size_t nadded = 0;
+    size_t i;
     int ret = -1;
 
     /* Check whether qemu quit unexpectedly */
@@ -949,18 +1185,28 @@ qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
-    mon->msg = msg;
-    qemuMonitorUpdateWatch(mon);
-
-    PROBE(QEMU_MONITOR_SEND_MSG,
-          "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+    for (nadded = 0; nadded < nmsgs; nadded++) {
+        qemuMonitorMessagePtr msg = msgs[nadded];
 
-    while (!mon->msg->finished) {
-        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Unable to wait on monitor condition"));
+        if (VIR_APPEND_ELEMENT_COPY(mon->msgs, mon->nmsgs, msg) < 0)
             goto cleanup;
+
+        msg->submitTime = g_get_monotonic_time();
+
+        PROBE(QEMU_MONITOR_SEND_MSG,
+              "mon=%p msg=%s fd=%d",
+              mon, msg->txBuffer, msg->txFD);
+    }
+
+    qemuMonitorUpdateWatch(mon);
+
+    for (i = 0; i < nmsgs; i++) {
+        while (!msgs[i]->finished) {
+            if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Unable to wait on monitor condition"));
+                goto cleanup;
+            }
         }
     }
 
@@ -971,16 +1217,28 @@ qemuMonitorSend(qemuMonitorPtr mon,
         goto cleanup;
     }
 
+    for (i = 0; i < nmsgs; i++)
+        qemuMonitorCommandStatsUpdate(mon, msgs[i]);
+
     ret = 0;
 
  cleanup:
-    mon->msg = NULL;
+    for (i = 0; i < nadded; i++)
+        qemuMonitorRemoveMessage(mon, msgs[i]);
     qemuMonitorUpdateWatch(mon);
 
     return ret;
 }
 
 
+int
+qemuMonitorSend(qemuMonitorPtr mon,
+                qemuMonitorMessagePtr msg)
+{
+    return qemuMonitorSendBatch(mon, &msg, 1);
+}
+
+
 /**
  * This function returns a new virError object; the caller is responsible
  * for freeing it.
@@ -2201,6 +2459,34 @@ qemuMonitorBlockStatsUpdateCapacityBlockdev(qemuMonitorPtr mon,
 }
 
 
+/* Like qemuMonitorGetAllBlockStatsInfo followed by
+ * qemuMonitorBlockStatsUpdateCapacityBlockdev in a single round trip.
+ * A failure to fetch the capacity only leaves @capacity false. */
+int
+qemuMonitorGetAllBlockStatsInfoBlockdev(qemuMonitorPtr mon,
+                                        GHashTable **ret_stats,
+                                        bool backingChain,
+                                        bool *capacity)
+{
+    int ret;
+    VIR_DEBUG("ret_stats=%p, backing=%d", ret_stats, backingChain);
+
+    QEMU_CHECK_MONITOR(mon);
+
+    *ret_stats = virHashNew(g_free);
+
+    ret = qemuMonitorJSONGetAllBlockStatsInfoBlockdev(mon, *ret_stats,
+                                                      backingChain, capacity);
+
+    if (ret < 0) {
+        virHashFree(*ret_stats);
+        *ret_stats = NULL;
+    }
+
+    return ret;
+}
+
+
 /**
  * qemuMonitorBlockGetNamedNodeData:
  * @mon: monitor object
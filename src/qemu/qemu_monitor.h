@@ -40,6 +40,11 @@ typedef struct _qemuMonitorMessage qemuMonitorMessage;
 typedef qemuMonitorMessage *qemuMonitorMessagePtr;
 
 struct _qemuMonitorMessage {
+    /* ID of the command used to match the reply */
+    const char *id;
+    /* Name of the command used for accounting in command statistics */
+    const char *name;
+
     int txFD;
 
     char *txBuffer;
@@ -56,8 +61,35 @@ struct _qemuMonitorMessage {
      * fatal error occurred on the monitor channel
      */
     bool finished;
+
+    /* Monotonic timestamps (in microseconds) of submitting the message,
+     * finishing its transmission and receiving the reply, and the time
+     * spent parsing the reply */
+    unsigned long long submitTime;
+    unsigned long long txTime;
+    unsigned long long rxTime;
+    unsigned long long parseTime;
+};
+
+/* Upper bounds of the command latency histogram buckets are
+ * 100us, 1ms, 10ms, 100ms, 1s and unbounded */
+#define QEMU_MONITOR_COMMAND_STATS_BUCKETS 6
+
+typedef struct _qemuMonitorCommandStats qemuMonitorCommandStats;
+typedef qemuMonitorCommandStats *qemuMonitorCommandStatsPtr;
+struct _qemuMonitorCommandStats {
+    char *name;
+    unsigned long long calls;
+    /* all times are in microseconds */
+    unsigned long long totalTime; /* submission to reply */
+    unsigned long long maxTime;
+    unsigned long long queuedTime; /* submission to end of transmission */
+    unsigned long long parseTime; /* parsing of the reply */
+    unsigned long long histogram[QEMU_MONITOR_COMMAND_STATS_BUCKETS];
 };
 
+void qemuMonitorCommandStatsFree(qemuMonitorCommandStatsPtr stats);
+
 typedef enum {
     QEMU_MONITOR_EVENT_PANIC_INFO_TYPE_NONE = 0,
     QEMU_MONITOR_EVENT_PANIC_INFO_TYPE_HYPERV,
@@ -440,10 +472,19 @@ int qemuMonitorSetLink(qemuMonitorPtr mon,
                        virDomainNetInterfaceLinkState state)
     ATTRIBUTE_NONNULL(2);
 
+int qemuMonitorGetCommandStats(qemuMonitorPtr mon,
+                               qemuMonitorCommandStatsPtr **stats,
+                               size_t *nstats);
+
 /* These APIs are for use by the internal Text/JSON monitor impl code only */
 char *qemuMonitorNextCommandID(qemuMonitorPtr mon);
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg) G_GNUC_NO_INLINE;
+int qemuMonitorSendBatch(qemuMonitorPtr mon,
+                         qemuMonitorMessagePtr *msgs,
+                         size_t nmsgs);
+qemuMonitorMessagePtr qemuMonitorGetReplyMessage(qemuMonitorPtr mon,
+                                                 const char *id);
 int qemuMonitorUpdateVideoMemorySize(qemuMonitorPtr mon,
                                      virDomainVideoDefPtr video,
                                      const char *videoName)
@@ -707,6 +748,11 @@ int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
 int qemuMonitorBlockStatsUpdateCapacityBlockdev(qemuMonitorPtr mon,
                                                 GHashTable *stats)
     ATTRIBUTE_NONNULL(2);
+int qemuMonitorGetAllBlockStatsInfoBlockdev(qemuMonitorPtr mon,
+                                            GHashTable **ret_stats,
+                                            bool backingChain,
+                                            bool *capacity)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
 
 typedef struct _qemuBlockNamedNodeDataBitmap qemuBlockNamedNodeDataBitmap;
 typedef qemuBlockNamedNodeDataBitmap *qemuBlockNamedNodeDataBitmapPtr;
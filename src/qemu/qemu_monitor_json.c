@@ -217,6 +217,7 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              qemuMonitorMessagePtr msg)
 {
     virJSONValuePtr obj = NULL;
+    unsigned long long rxTime = g_get_monotonic_time();
     int ret = -1;
 
     VIR_DEBUG("Line [%s]", line);
@@ -238,9 +239,19 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
         ret = qemuMonitorJSONIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
+        const char *id = virJSONValueObjectGetString(obj, "id");
+
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
+
+        /* QEMU replies in order, but let's not rely on that when
+         * multiple commands are in flight */
+        if (msg && id && STRNEQ_NULLABLE(msg->id, id))
+            msg = qemuMonitorGetReplyMessage(mon, id);
+
         if (msg) {
+            msg->rxTime = rxTime;
+            msg->parseTime = g_get_monotonic_time() - rxTime;
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
@@ -261,8 +272,7 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
                              const char *data,
-                             size_t len,
-                             qemuMonitorMessagePtr msg)
+                             size_t len)
 {
     int used = 0;
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
@@ -276,7 +286,10 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
             line = g_strndup(data + used, got);
             used += got + strlen(LINE_ENDING);
             line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
+            /* Processing an event may unlock the monitor, thus the
+             * message the reply belongs to is looked up for each line */
+            if (qemuMonitorJSONIOProcessLine(mon, line,
+                                             qemuMonitorGetReplyMessage(mon, NULL)) < 0) {
                 VIR_FREE(line);
                 return -1;
             }
@@ -295,37 +308,54 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONMessageInit(qemuMonitorPtr mon,
+                           qemuMonitorMessagePtr msg,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           char **id)
 {
-    int ret = -1;
-    qemuMonitorMessage msg;
     g_auto(virBuffer) cmdbuf = VIR_BUFFER_INITIALIZER;
-    char *id = NULL;
-
-    *reply = NULL;
 
-    memset(&msg, 0, sizeof(msg));
+    memset(msg, 0, sizeof(*msg));
 
     if (virJSONValueObjectHasKey(cmd, "execute") == 1) {
-        if (!(id = qemuMonitorNextCommandID(mon)))
-            goto cleanup;
-        if (virJSONValueObjectAppendString(cmd, "id", id) < 0) {
+        if (!(*id = qemuMonitorNextCommandID(mon)))
+            return -1;
+        if (virJSONValueObjectAppendString(cmd, "id", *id) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to append command 'id' string"));
-            goto cleanup;
+            return -1;
         }
     }
 
     if (virJSONValueToBuffer(cmd, &cmdbuf, false) < 0)
-        goto cleanup;
+        return -1;
     virBufferAddLit(&cmdbuf, "\r\n");
 
-    msg.txLength = virBufferUse(&cmdbuf);
-    msg.txBuffer = virBufferContentAndReset(&cmdbuf);
-    msg.txFD = scm_fd;
+    msg->id = *id;
+    msg->name = virJSONValueObjectGetString(cmd, "execute");
+    msg->txLength = virBufferUse(&cmdbuf);
+    msg->txBuffer = virBufferContentAndReset(&cmdbuf);
+    msg->txFD = scm_fd;
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    int ret = -1;
+    qemuMonitorMessage msg;
+    char *id = NULL;
+
+    *reply = NULL;
+
+    if (qemuMonitorJSONMessageInit(mon, &msg, cmd, scm_fd, &id) < 0)
+        goto cleanup;
 
     ret = qemuMonitorSend(mon, &msg);
 
@@ -347,6 +377,67 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorJSONCommandBatch:
+ * @mon: monitor object
+ * @cmds: commands to execute
+ * @ncmds: number of commands in @cmds
+ * @replies: array of @ncmds items filled with replies to @cmds
+ *
+ * Executes all of @cmds without waiting for each reply before sending the
+ * next command. This is meant for independent commands, QEMU executes them
+ * in the order they are listed in @cmds. The caller is responsible for
+ * checking each of @replies for errors and freeing them.
+ *
+ * Returns 0 on success, -1 if the commands couldn't be executed or some of
+ * the replies is missing, in which case no replies are returned.
+ */
+int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            size_t ncmds,
+                            virJSONValuePtr *replies)
+{
+    g_autofree qemuMonitorMessage *msgs = g_new0(qemuMonitorMessage, ncmds);
+    g_autofree qemuMonitorMessagePtr *msgptrs = g_new0(qemuMonitorMessagePtr, ncmds);
+    char **ids = g_new0(char *, ncmds + 1);
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < ncmds; i++) {
+        replies[i] = NULL;
+        msgptrs[i] = &msgs[i];
+
+        if (qemuMonitorJSONMessageInit(mon, &msgs[i], cmds[i], -1, &ids[i]) < 0)
+            goto cleanup;
+    }
+
+    if (qemuMonitorSendBatch(mon, msgptrs, ncmds) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!msgs[i].rxObject) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ncmds; i++)
+        replies[i] = g_steal_pointer(&msgs[i].rxObject);
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncmds; i++) {
+        virJSONValueFree(msgs[i].rxObject);
+        g_free(msgs[i].txBuffer);
+    }
+    g_strfreev(ids);
+    return ret;
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -396,12 +487,15 @@ qemuMonitorJSONCheckErrorFull(virJSONValuePtr cmd,
 {
     if (virJSONValueObjectHasKey(reply, "error")) {
         virJSONValuePtr error = virJSONValueObjectGet(reply, "error");
-        g_autofree char *cmdstr = virJSONValueToString(cmd, false);
-        g_autofree char *replystr = virJSONValueToString(reply, false);
 
         /* Log the full JSON formatted command & error */
-        VIR_DEBUG("unable to execute QEMU command %s: %s",
-                  NULLSTR(cmdstr), NULLSTR(replystr));
+        if (VIR_LOG_ENABLED(VIR_LOG_DEBUG)) {
+            g_autofree char *cmdstr = virJSONValueToString(cmd, false);
+            g_autofree char *replystr = virJSONValueToString(reply, false);
+
+            VIR_DEBUG("unable to execute QEMU command %s: %s",
+                      NULLSTR(cmdstr), NULLSTR(replystr));
+        }
 
         if (!report)
             return -1;
@@ -419,11 +513,13 @@ qemuMonitorJSONCheckErrorFull(virJSONValuePtr cmd,
 
         return -1;
     } else if (!virJSONValueObjectHasKey(reply, "return")) {
-        g_autofree char *cmdstr = virJSONValueToString(cmd, false);
-        g_autofree char *replystr = virJSONValueToString(reply, false);
+        if (VIR_LOG_ENABLED(VIR_LOG_DEBUG)) {
+            g_autofree char *cmdstr = virJSONValueToString(cmd, false);
+            g_autofree char *replystr = virJSONValueToString(reply, false);
 
-        VIR_DEBUG("Neither 'return' nor 'error' is set in the JSON reply %s: %s",
-                  NULLSTR(cmdstr), NULLSTR(replystr));
+            VIR_DEBUG("Neither 'return' nor 'error' is set in the JSON reply %s: %s",
+                      NULLSTR(cmdstr), NULLSTR(replystr));
+        }
 
         if (!report)
             return -1;
@@ -457,11 +553,13 @@ qemuMonitorJSONCheckReply(virJSONValuePtr cmd,
 
     data = virJSONValueObjectGet(reply, "return");
     if (virJSONValueGetType(data) != type) {
-        g_autofree char *cmdstr = virJSONValueToString(cmd, false);
-        g_autofree char *retstr = virJSONValueToString(data, false);
+        if (VIR_LOG_ENABLED(VIR_LOG_DEBUG)) {
+            g_autofree char *cmdstr = virJSONValueToString(cmd, false);
+            g_autofree char *retstr = virJSONValueToString(data, false);
 
-        VIR_DEBUG("Unexpected return type %d (expecting %d) for command %s: %s",
-                  virJSONValueGetType(data), type, cmdstr, retstr);
+            VIR_DEBUG("Unexpected return type %d (expecting %d) for command %s: %s",
+                      virJSONValueGetType(data), type, cmdstr, retstr);
+        }
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected type returned by QEMU command '%s'"),
                        qemuMonitorJSONCommandName(cmd));
@@ -2681,18 +2779,14 @@ qemuMonitorJSONQueryBlockstats(qemuMonitorPtr mon)
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
-                                    GHashTable *hash,
-                                    bool backingChain)
+static int
+qemuMonitorJSONGetAllBlockStatsInfoData(virJSONValuePtr devices,
+                                        GHashTable *hash,
+                                        bool backingChain)
 {
     int nstats = 0;
     int rc;
     size_t i;
-    g_autoptr(virJSONValue) devices = NULL;
-
-    if (!(devices = qemuMonitorJSONQueryBlockstats(mon)))
-        return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
@@ -2729,6 +2823,20 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    GHashTable *hash,
+                                    bool backingChain)
+{
+    g_autoptr(virJSONValue) devices = NULL;
+
+    if (!(devices = qemuMonitorJSONQueryBlockstats(mon)))
+        return -1;
+
+    return qemuMonitorJSONGetAllBlockStatsInfoData(devices, hash, backingChain);
+}
+
+
 static int
 qemuMonitorJSONBlockStatsUpdateCapacityData(virJSONValuePtr image,
                                             const char *name,
@@ -2888,6 +2996,83 @@ qemuMonitorJSONBlockStatsUpdateCapacityBlockdev(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorJSONGetAllBlockStatsInfoBlockdev:
+ * @mon: monitor object
+ * @hash: hash table to fill with statistics
+ * @backingChain: whether to report statistics of backing images too
+ * @capacity: set to true if capacity data was filled in
+ *
+ * Equivalent to qemuMonitorJSONGetAllBlockStatsInfo followed by
+ * qemuMonitorJSONBlockStatsUpdateCapacityBlockdev, but both queries are
+ * submitted at once so that only one round trip to QEMU is needed.
+ *
+ * The replies are handled independently. If only the capacity query
+ * fails, the statistics are still returned, @capacity is false and the
+ * error is left set for the caller to report or ignore.
+ *
+ * Returns the maximum number of statistics of a device on success, -1 on
+ * error.
+ */
+int
+qemuMonitorJSONGetAllBlockStatsInfoBlockdev(qemuMonitorPtr mon,
+                                            GHashTable *hash,
+                                            bool backingChain,
+                                            bool *capacity)
+{
+    virJSONValuePtr cmds[2] = { NULL, NULL };
+    virJSONValuePtr replies[G_N_ELEMENTS(cmds)] = { NULL, NULL };
+    virJSONValuePtr devices;
+    virJSONValuePtr nodes;
+    size_t i;
+    int nstats;
+    int ret = -1;
+
+    if (!(cmds[0] = qemuMonitorJSONMakeCommand("query-blockstats", NULL)) ||
+        !(cmds[1] = qemuMonitorJSONMakeCommand("query-named-block-nodes",
+                                               "B:flat", false,
+                                               NULL)))
+        goto cleanup;
+
+    *capacity = false;
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, G_N_ELEMENTS(cmds), replies) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckReply(cmds[0], replies[0],
+                                  VIR_JSON_TYPE_ARRAY) < 0)
+        goto cleanup;
+
+    devices = virJSONValueObjectGetArray(replies[0], "return");
+
+    if ((nstats = qemuMonitorJSONGetAllBlockStatsInfoData(devices, hash,
+                                                          backingChain)) < 0)
+        goto cleanup;
+
+    ret = nstats;
+
+    if (qemuMonitorJSONCheckReply(cmds[1], replies[1],
+                                  VIR_JSON_TYPE_ARRAY) < 0)
+        goto cleanup;
+
+    nodes = virJSONValueObjectGetArray(replies[1], "return");
+
+    if (virJSONValueArrayForeachSteal(nodes,
+                                      qemuMonitorJSONBlockStatsUpdateCapacityBlockdevWorker,
+                                      hash) < 0)
+        goto cleanup;
+
+    *capacity = true;
+
+ cleanup:
+    for (i = 0; i < G_N_ELEMENTS(cmds); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    return ret;
+}
+
+
 static void
 qemuMonitorJSONBlockNamedNodeDataBitmapFree(qemuBlockNamedNodeDataBitmapPtr bitmap)
 {
@@ -34,8 +34,12 @@ int qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
                              const char *data,
-                             size_t len,
-                             qemuMonitorMessagePtr msg);
+                             size_t len);
+
+int qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                                virJSONValuePtr *cmds,
+                                size_t ncmds,
+                                virJSONValuePtr *replies);
 
 int qemuMonitorJSONHumanCommand(qemuMonitorPtr mon,
                                 const char *cmd,
@@ -84,6 +88,10 @@ int qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                             bool backingChain);
 int qemuMonitorJSONBlockStatsUpdateCapacityBlockdev(qemuMonitorPtr mon,
                                                     GHashTable *stats);
+int qemuMonitorJSONGetAllBlockStatsInfoBlockdev(qemuMonitorPtr mon,
+                                                GHashTable *hash,
+                                                bool backingChain,
+                                                bool *capacity);
 
 GHashTable *
 qemuMonitorJSONBlockGetNamedNodeDataJSON(virJSONValuePtr nodes);
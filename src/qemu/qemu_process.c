@@ -7337,6 +7337,8 @@ qemuProcessStart(virConnectPtr conn,
                  const char *migrateFrom,
                  int migrateFd,
                  const char *migratePath,
+                 qemuProcessIncomingRunFunc incomingRun,
+                 void *incomingOpaque,
                  virDomainMomentObjPtr snapshot,
                  virNetDevVPortProfileOp vmop,
                  unsigned int flags)
@@ -7374,6 +7376,17 @@ qemuProcessStart(virConnectPtr conn,
                                              migrateFd, migratePath);
         if (!incoming)
             goto stop;
+
+        if (incomingRun) {
+            if (!incoming->deferredURI) {
+                virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                               _("deferred incoming migration is not supported by this QEMU binary"));
+                goto stop;
+            }
+
+            incoming->run = incomingRun;
+            incoming->runOpaque = incomingOpaque;
+        }
     }
 
     if (qemuProcessPrepareDomain(driver, vm, flags) < 0)
@@ -7398,9 +7411,14 @@ qemuProcessStart(virConnectPtr conn,
     relabel = true;
 
     if (incoming) {
-        if (incoming->deferredURI &&
-            qemuMigrationDstRun(driver, vm, incoming->deferredURI, asyncJob) < 0)
+        if (incoming->run) {
+            if (incoming->run(driver, vm, asyncJob, incoming->runOpaque) < 0)
+                goto stop;
+        } else if (incoming->deferredURI &&
+                   qemuMigrationDstRun(driver, vm, incoming->deferredURI,
+                                       asyncJob) < 0) {
             goto stop;
+        }
     } else {
         /* Refresh state of devices from QEMU. During migration this happens
          * in qemuMigrationDstFinish to ensure that state information is fully
@@ -7909,6 +7927,8 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
     qemuSecurityReleaseLabel(driver->securityManager, vm->def);
 
+    qemuDomainCloseVcpuStatFiles(vm);
+
     /* clear all private data entries which are no longer needed */
     qemuDomainObjPrivateDataClear(priv);
 
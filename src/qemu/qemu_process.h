@@ -49,6 +49,13 @@ int qemuProcessDestroyMemoryBackingPath(virQEMUDriverPtr driver,
 
 void qemuProcessReconnectAll(virQEMUDriverPtr driver);
 
+/* Starts a deferred incoming migration in a freshly launched QEMU
+ * instead of calling migrate-incoming with the deferred URI */
+typedef int (*qemuProcessIncomingRunFunc)(virQEMUDriverPtr driver,
+                                          virDomainObjPtr vm,
+                                          qemuDomainAsyncJob asyncJob,
+                                          void *opaque);
+
 typedef struct _qemuProcessIncomingDef qemuProcessIncomingDef;
 typedef qemuProcessIncomingDef *qemuProcessIncomingDefPtr;
 struct _qemuProcessIncomingDef {
@@ -57,6 +64,8 @@ struct _qemuProcessIncomingDef {
     char *deferredURI; /* used when calling migrate-incoming QMP command */
     int fd; /* for fd:N URI */
     const char *path; /* path associated with fd */
+    qemuProcessIncomingRunFunc run; /* replaces migrate-incoming with deferredURI */
+    void *runOpaque;
 };
 
 qemuProcessIncomingDefPtr qemuProcessIncomingDefNew(virQEMUCapsPtr qemuCaps,
@@ -92,6 +101,8 @@ int qemuProcessStart(virConnectPtr conn,
                      const char *migrateFrom,
                      int stdin_fd,
                      const char *stdin_path,
+                     qemuProcessIncomingRunFunc incomingRun,
+                     void *incomingOpaque,
                      virDomainMomentObjPtr snapshot,
                      virNetDevVPortProfileOp vmop,
                      unsigned int flags);
@@ -19,6 +19,8 @@
 #include <config.h>
 
 #include "qemu_saveimage.h"
+#define LIBVIRT_QEMU_SAVEIMAGEPRIV_H_ALLOW
+#include "qemu_saveimagepriv.h"
 #include "qemu_domain.h"
 #include "qemu_migration.h"
 #include "qemu_process.h"
@@ -30,6 +32,7 @@
 #include "virlog.h"
 #include "viralloc.h"
 #include "virqemu.h"
+#include "configmake.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -49,6 +52,7 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    QEMU_SAVE_FORMAT_ZSTD = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -64,9 +68,10 @@ VIR_ENUM_IMPL(qemuSaveCompression,
               "bzip2",
               "xz",
               "lzop",
+              "zstd",
 );
 
-static inline void
+void
 qemuSaveImageBswapHeader(virQEMUSaveHeaderPtr hdr)
 {
     hdr->version = GUINT32_SWAP_LE_BE(hdr->version);
@@ -74,6 +79,44 @@ qemuSaveImageBswapHeader(virQEMUSaveHeaderPtr hdr)
     hdr->was_running = GUINT32_SWAP_LE_BE(hdr->was_running);
     hdr->compressed = GUINT32_SWAP_LE_BE(hdr->compressed);
     hdr->cookieOffset = GUINT32_SWAP_LE_BE(hdr->cookieOffset);
+    hdr->channels = GUINT32_SWAP_LE_BE(hdr->channels);
+}
+
+
+/* Converts @header, which has a valid magic, to host byte order and
+ * validates the rest of it */
+int
+qemuSaveImageHeaderCheck(virQEMUSaveHeaderPtr header)
+{
+    if (header->version > QEMU_SAVE_VERSION_PARALLEL) {
+        /* convert endianness and try again */
+        qemuSaveImageBswapHeader(header);
+    }
+
+    if (header->version > QEMU_SAVE_VERSION_PARALLEL) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("image version is not supported (%d > %d)"),
+                       header->version, QEMU_SAVE_VERSION_PARALLEL);
+        return -1;
+    }
+
+    if (header->version < QEMU_SAVE_VERSION_PARALLEL)
+        header->channels = 0;
+
+    if (header->channels > 255) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("invalid number of save image channels: %u"),
+                       header->channels);
+        return -1;
+    }
+
+    if (header->data_len <= 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("invalid header data length: %d"), header->data_len);
+        return -1;
+    }
+
+    return 0;
 }
 
 
@@ -90,6 +133,65 @@ virQEMUSaveDataFree(virQEMUSaveDataPtr data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(virQEMUSaveData, virQEMUSaveDataFree);
 
+
+/**
+ * virQEMUSaveDataSetChannels:
+ * @data: save image data
+ * @channels: number of multifd channels
+ *
+ * Makes the image be saved through @channels parallel multifd channels
+ * in addition to the main migration stream. Each channel is stored in
+ * a separate file, see qemuSaveImageGetChannelPath().
+ */
+void
+virQEMUSaveDataSetChannels(virQEMUSaveDataPtr data,
+                           unsigned int channels)
+{
+    data->header.channels = channels;
+    data->header.version = channels > 0 ? QEMU_SAVE_VERSION_PARALLEL :
+                                          QEMU_SAVE_VERSION;
+}
+
+
+/**
+ * qemuSaveImageGetChannelPath:
+ * @path: path of the save image
+ * @channel: channel number, starting from 1
+ *
+ * Returns the path of the file holding multifd channel @channel of the
+ * save image at @path.
+ */
+char *
+qemuSaveImageGetChannelPath(const char *path,
+                            size_t channel)
+{
+    return g_strdup_printf("%s.channel%zu", path, channel);
+}
+
+
+/**
+ * qemuSaveImageRemoveChannels:
+ * @path: path of the save image
+ *
+ * Removes files holding multifd channels of the save image at @path,
+ * if there are any.
+ */
+void
+qemuSaveImageRemoveChannels(const char *path)
+{
+    size_t i;
+
+    for (i = 1; ; i++) {
+        g_autofree char *chpath = qemuSaveImageGetChannelPath(path, i);
+
+        if (unlink(chpath) < 0) {
+            if (errno != ENOENT)
+                VIR_WARN("Failed to remove save image channel %s", chpath);
+            break;
+        }
+    }
+}
+
 /**
  * This function steals @domXML on success.
  */
@@ -226,6 +328,82 @@ virQEMUSaveDataFinish(virQEMUSaveDataPtr data,
 }
 
 
+/* Saves @vm through @nchannels multifd channels. The main migration
+ * stream is written to @fd, which is consumed, each of the channels to
+ * a separate file next to @path. */
+static int
+qemuSaveImageCreateChannels(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            const char *path,
+                            int *fd,
+                            unsigned int nchannels,
+                            int directFlag,
+                            qemuDomainAsyncJob asyncJob)
+{
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t nfds = nchannels + 1;
+    g_autofree int *fds = g_new(int, nfds);
+    g_autofree bool *needUnlink = g_new0(bool, nfds);
+    g_auto(GStrv) paths = g_new0(char *, nfds + 1);
+    g_autofree char *sockpath = g_strdup_printf("%s/save.sock", priv->libDir);
+    size_t i;
+    int ret = -1;
+
+    fds[0] = *fd;
+    *fd = -1;
+    paths[0] = g_strdup(path);
+    for (i = 1; i < nfds; i++)
+        fds[i] = -1;
+
+    qemuSaveImageRemoveChannels(path);
+
+    for (i = 1; i < nfds; i++) {
+        paths[i] = qemuSaveImageGetChannelPath(path, i);
+
+        fds[i] = virQEMUFileOpenAs(cfg->user, cfg->group, false, paths[i],
+                                   O_WRONLY | O_TRUNC | O_CREAT | directFlag,
+                                   &needUnlink[i]);
+        if (fds[i] < 0)
+            goto cleanup;
+    }
+
+    if (qemuMigrationSrcToFiles(driver, vm, sockpath, fds,
+                                (const char **) paths, nfds, asyncJob) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nfds; i++) {
+        VIR_FORCE_CLOSE(fds[i]);
+        if (ret < 0 && needUnlink[i])
+            unlink(paths[i]);
+    }
+
+    return ret;
+}
+
+
+#if WITH_ZSTD
+/* The zstd format is handled by the iohelper itself, which compresses
+ * and decompresses the image in parallel instead of running an
+ * external program. */
+static virCommandPtr
+qemuSaveImageGetBuiltinCompressionCommand(const char *action)
+{
+    g_autofree char *iohelper_path = NULL;
+
+    if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
+                                              abs_top_builddir "/src",
+                                              LIBEXECDIR)))
+        return NULL;
+
+    return virCommandNewArgList(iohelper_path, action, "zstd", NULL);
+}
+#endif /* WITH_ZSTD */
+
+
 static virCommandPtr
 qemuSaveImageGetCompressionCommand(virQEMUSaveFormat compression)
 {
@@ -239,6 +417,16 @@ qemuSaveImageGetCompressionCommand(virQEMUSaveFormat compression)
         return NULL;
     }
 
+    if (compression == QEMU_SAVE_FORMAT_ZSTD) {
+#if WITH_ZSTD
+        return qemuSaveImageGetBuiltinCompressionCommand("--decompress");
+#else
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("zstd compressed save images are not supported by this build"));
+        return NULL;
+#endif
+    }
+
     ret = virCommandNew(prog);
     virCommandAddArg(ret, "-dc");
 
@@ -296,8 +484,15 @@ qemuSaveImageCreate(virQEMUDriverPtr driver,
         goto cleanup;
 
     /* Perform the migration */
-    if (qemuMigrationSrcToFile(driver, vm, fd, compressor, asyncJob) < 0)
-        goto cleanup;
+    if (data->header.channels > 0) {
+        if (qemuSaveImageCreateChannels(driver, vm, path, &fd,
+                                        data->header.channels, directFlag,
+                                        asyncJob) < 0)
+            goto cleanup;
+    } else {
+        if (qemuMigrationSrcToFile(driver, vm, fd, compressor, asyncJob) < 0)
+            goto cleanup;
+    }
 
     /* Touch up file header to mark image complete. */
 
@@ -371,6 +566,16 @@ qemuSaveImageGetCompressionProgram(const char *imageFormat,
     if (ret == QEMU_SAVE_FORMAT_RAW)
         return QEMU_SAVE_FORMAT_RAW;
 
+    if (ret == QEMU_SAVE_FORMAT_ZSTD) {
+#if WITH_ZSTD
+        if (!(*compressor = qemuSaveImageGetBuiltinCompressionCommand("--compress")))
+            goto error;
+        return ret;
+#else
+        goto error;
+#endif
+    }
+
     if (!(prog = virFindFileInPath(imageFormat)))
         goto error;
 
@@ -510,23 +715,8 @@ qemuSaveImageOpen(virQEMUDriverPtr driver,
         return -1;
     }
 
-    if (header->version > QEMU_SAVE_VERSION) {
-        /* convert endianness and try again */
-        qemuSaveImageBswapHeader(header);
-    }
-
-    if (header->version > QEMU_SAVE_VERSION) {
-        virReportError(VIR_ERR_OPERATION_FAILED,
-                       _("image version is not supported (%d > %d)"),
-                       header->version, QEMU_SAVE_VERSION);
+    if (qemuSaveImageHeaderCheck(header) < 0)
         return -1;
-    }
-
-    if (header->data_len <= 0) {
-        virReportError(VIR_ERR_OPERATION_FAILED,
-                       _("invalid header data length: %d"), header->data_len);
-        return -1;
-    }
 
     if (header->cookieOffset)
         xml_len = header->cookieOffset;
@@ -568,6 +758,93 @@ qemuSaveImageOpen(virQEMUDriverPtr driver,
     return ret;
 }
 
+typedef struct _qemuSaveImageChannels qemuSaveImageChannels;
+struct _qemuSaveImageChannels {
+    int *fds;
+    const char **paths;
+    size_t nfds;
+};
+
+
+/* Feeds the save image channels to QEMU through a socket in the private
+ * directory of @vm, which is only known once the domain is prepared */
+static int
+qemuSaveImageRunChannels(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainAsyncJob asyncJob,
+                         void *opaque)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuSaveImageChannels *channels = opaque;
+    g_autofree char *sockpath = g_strdup_printf("%s/restore.sock",
+                                                priv->libDir);
+
+    return qemuMigrationDstRunFromFiles(driver, vm, sockpath,
+                                        channels->fds, channels->paths,
+                                        channels->nfds, asyncJob);
+}
+
+
+/* Starts @vm and restores its state from a save image written through
+ * @nchannels multifd channels. The main migration stream is read from
+ * @fd, which is consumed, the channels from their files next to @path. */
+static int
+qemuSaveImageStartChannels(virConnectPtr conn,
+                           virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           virCPUDefPtr updatedCPU,
+                           int *fd,
+                           const char *path,
+                           unsigned int nchannels,
+                           bool bypass_cache,
+                           qemuDomainAsyncJob asyncJob)
+{
+    size_t nfds = nchannels + 1;
+    g_autofree int *fds = g_new(int, nfds);
+    g_auto(GStrv) paths = g_new0(char *, nfds + 1);
+    qemuSaveImageChannels channels = { fds, (const char **) paths, nfds };
+    int oflags = O_RDONLY;
+    size_t i;
+    int ret = -1;
+
+    fds[0] = *fd;
+    *fd = -1;
+    paths[0] = g_strdup(path);
+    for (i = 1; i < nfds; i++)
+        fds[i] = -1;
+
+    if (bypass_cache) {
+        int directFlag = virFileDirectFdFlag();
+        if (directFlag < 0) {
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("bypass cache unsupported by this system"));
+            goto cleanup;
+        }
+        oflags |= directFlag;
+    }
+
+    for (i = 1; i < nfds; i++) {
+        paths[i] = qemuSaveImageGetChannelPath(path, i);
+
+        if ((fds[i] = qemuDomainOpenFile(driver, NULL, paths[i],
+                                         oflags, NULL)) < 0)
+            goto cleanup;
+    }
+
+    ret = qemuProcessStart(conn, driver, vm, updatedCPU, asyncJob,
+                           "unix", -1, NULL,
+                           qemuSaveImageRunChannels, &channels, NULL,
+                           VIR_NETDEV_VPORT_PROFILE_OP_RESTORE,
+                           VIR_QEMU_PROCESS_START_PAUSED |
+                           VIR_QEMU_PROCESS_START_GEN_VMID);
+
+ cleanup:
+    for (i = 0; i < nfds; i++)
+        VIR_FORCE_CLOSE(fds[i]);
+    return ret;
+}
+
+
 int
 qemuSaveImageStartVM(virConnectPtr conn,
                      virQEMUDriverPtr driver,
@@ -576,6 +853,7 @@ qemuSaveImageStartVM(virConnectPtr conn,
                      virQEMUSaveDataPtr data,
                      const char *path,
                      bool start_paused,
+                     bool bypass_cache,
                      qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
@@ -594,7 +872,14 @@ qemuSaveImageStartVM(virConnectPtr conn,
                                  virDomainXMLOptionGetSaveCookie(driver->xmlopt)) < 0)
         goto cleanup;
 
-    if ((header->version == 2) &&
+    if (header->channels > 0 &&
+        header->compressed != QEMU_SAVE_FORMAT_RAW) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("compressed save images with parallel channels are not supported"));
+        goto cleanup;
+    }
+
+    if ((header->version >= 2) &&
         (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
         if (!(cmd = qemuSaveImageGetCompressionCommand(header->compressed)))
             goto cleanup;
@@ -624,12 +909,20 @@ qemuSaveImageStartVM(virConnectPtr conn,
     if (cookie && !cookie->slirpHelper)
         priv->disableSlirp = true;
 
-    if (qemuProcessStart(conn, driver, vm, cookie ? cookie->cpu : NULL,
-                         asyncJob, "stdio", *fd, path, NULL,
-                         VIR_NETDEV_VPORT_PROFILE_OP_RESTORE,
-                         VIR_QEMU_PROCESS_START_PAUSED |
-                         VIR_QEMU_PROCESS_START_GEN_VMID) == 0)
+    if (header->channels > 0) {
+        if (qemuSaveImageStartChannels(conn, driver, vm,
+                                       cookie ? cookie->cpu : NULL,
+                                       fd, path, header->channels,
+                                       bypass_cache, asyncJob) == 0)
+            started = true;
+    } else if (qemuProcessStart(conn, driver, vm, cookie ? cookie->cpu : NULL,
+                                asyncJob, "stdio", *fd, path,
+                                NULL, NULL, NULL,
+                                VIR_NETDEV_VPORT_PROFILE_OP_RESTORE,
+                                VIR_QEMU_PROCESS_START_PAUSED |
+                                VIR_QEMU_PROCESS_START_GEN_VMID) == 0) {
         started = true;
+    }
 
     if (intermediatefd != -1) {
         virErrorPtr orig_err = NULL;
@@ -31,6 +31,9 @@
 #define QEMU_SAVE_MAGIC   "LibvirtQemudSave"
 #define QEMU_SAVE_PARTIAL "LibvirtQemudPart"
 #define QEMU_SAVE_VERSION 2
+/* Images saved through parallel channels use a separate version so
+ * that older libvirt refuses to restore them */
+#define QEMU_SAVE_VERSION_PARALLEL 3
 
 G_STATIC_ASSERT(sizeof(QEMU_SAVE_MAGIC) == sizeof(QEMU_SAVE_PARTIAL));
 
@@ -43,7 +46,8 @@ struct _virQEMUSaveHeader {
     uint32_t was_running;
     uint32_t compressed;
     uint32_t cookieOffset;
-    uint32_t unused[14];
+    uint32_t channels; /* number of multifd channel files */
+    uint32_t unused[13];
 };
 
 
@@ -69,6 +73,7 @@ qemuSaveImageStartVM(virConnectPtr conn,
                      virQEMUSaveDataPtr data,
                      const char *path,
                      bool start_paused,
+                     bool bypass_cache,
                      qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5) ATTRIBUTE_NONNULL(6);
 
@@ -100,6 +105,13 @@ qemuSaveImageCreate(virQEMUDriverPtr driver,
                     unsigned int flags,
                     qemuDomainAsyncJob asyncJob);
 
+char *
+qemuSaveImageGetChannelPath(const char *path,
+                            size_t channel);
+
+void
+qemuSaveImageRemoveChannels(const char *path);
+
 int
 virQEMUSaveDataWrite(virQEMUSaveDataPtr data,
                      int fd,
@@ -112,5 +124,9 @@ virQEMUSaveDataNew(char *domXML,
                    int compressed,
                    virDomainXMLOptionPtr xmlopt);
 
+void
+virQEMUSaveDataSetChannels(virQEMUSaveDataPtr data,
+                           unsigned int channels);
+
 void
 virQEMUSaveDataFree(virQEMUSaveDataPtr data);
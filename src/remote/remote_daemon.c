@@ -795,6 +795,7 @@ int main(int argc, char **argv) {
     bool implicit_conf = false;
     char *run_dir = NULL;
     mode_t old_umask;
+    const char *logAsyncEnv;
 
     struct option opts[] = {
         { "verbose", no_argument, &verbose, 'v'},
@@ -982,6 +983,16 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The log writer thread would not survive the fork, so asynchronous
+     * logging is only enabled in the process which keeps running */
+    if ((logAsyncEnv = getenv("LIBVIRT_LOG_ASYNC")) && *logAsyncEnv)
+        config->log_async = STRNEQ(logAsyncEnv, "0");
+
+    if (config->log_async &&
+        virLogSetAsync(true) < 0)
+        VIR_WARN("Unable to enable asynchronous logging: %s",
+                 virGetLastErrorMessage());
+
     /* Try to claim the pidfile, exiting if we can't */
     if ((pid_file_fd = virPidFileAcquirePath(pid_file, false, getpid())) < 0) {
         ret = VIR_DAEMON_ERR_PIDFILE;
@@ -1254,6 +1265,10 @@ int main(int argc, char **argv) {
     VIR_FREE(pid_file);
 
     VIR_FREE(remote_config_file);
+
+    /* write out messages still queued by asynchronous logging */
+    ignore_value(virLogSetAsync(false));
+
     daemonConfigFree(config);
 
     return ret;
@@ -7505,3 +7505,77 @@ remoteDispatchDomainGetMessages(virNetServerPtr server G_GNUC_UNUSED,
 
     return rv;
 }
+
+
+static int
+remoteDispatchDomainListGetGuestInfo(virNetServerPtr server G_GNUC_UNUSED,
+                                     virNetServerClientPtr client,
+                                     virNetMessagePtr msg G_GNUC_UNUSED,
+                                     virNetMessageErrorPtr rerr,
+                                     remote_domain_list_get_guest_info_args *args,
+                                     remote_domain_list_get_guest_info_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    virDomainStatsRecordPtr *retInfo = NULL;
+    int nrecords = 0;
+    virDomainPtr *doms = NULL;
+    virConnectPtr conn = remoteGetHypervisorConn(client);
+
+    if (!conn)
+        goto cleanup;
+
+    doms = g_new0(virDomainPtr, args->doms.doms_len + 1);
+
+    for (i = 0; i < args->doms.doms_len; i++) {
+        if (!(doms[i] = get_nonnull_domain(conn, args->doms.doms_val[i])))
+            goto cleanup;
+    }
+
+    if ((nrecords = virDomainListGetGuestInfo(doms,
+                                              args->types,
+                                              &retInfo,
+                                              args->flags)) < 0)
+        goto cleanup;
+
+    if (nrecords > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of guest info records is %d, "
+                         "which exceeds max limit: %d"),
+                       nrecords, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (nrecords) {
+        ret->retInfo.retInfo_val = g_new0(remote_domain_stats_record, nrecords);
+        ret->retInfo.retInfo_len = nrecords;
+
+        for (i = 0; i < nrecords; i++) {
+            remote_domain_stats_record *dst = ret->retInfo.retInfo_val + i;
+
+            make_nonnull_domain(&dst->dom, retInfo[i]->dom);
+
+            if (virTypedParamsSerialize(retInfo[i]->params,
+                                        retInfo[i]->nparams,
+                                        REMOTE_DOMAIN_GUEST_INFO_PARAMS_MAX,
+                                        (virTypedParameterRemotePtr *) &dst->params.params_val,
+                                        &dst->params.params_len,
+                                        VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t)xdr_remote_domain_list_get_guest_info_ret,
+                 (char *) ret);
+    }
+
+    virDomainStatsRecordListFree(retInfo);
+    virObjectListFree(doms);
+
+    return rv;
+}
@@ -8137,6 +8137,89 @@ remoteDomainGetMessages(virDomainPtr domain,
     return rv;
 }
 
+
+static int
+remoteDomainListGetGuestInfo(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int types,
+                             virDomainStatsRecordPtr **retInfo,
+                             unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i;
+    remote_domain_list_get_guest_info_args args;
+    remote_domain_list_get_guest_info_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    memset(&args, 0, sizeof(args));
+
+    args.doms.doms_val = g_new0(remote_nonnull_domain, ndoms);
+    for (i = 0; i < ndoms; i++)
+        make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    args.doms.doms_len = ndoms;
+
+    args.types = types;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LIST_GET_GUEST_INFO,
+             (xdrproc_t)xdr_remote_domain_list_get_guest_info_args, (char *)&args,
+             (xdrproc_t)xdr_remote_domain_list_get_guest_info_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    remoteDriverUnlock(priv);
+
+    if (ret.retInfo.retInfo_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of guest info entries is %d, which exceeds max limit: %d"),
+                       ret.retInfo.retInfo_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    *retInfo = NULL;
+
+    tmpret = g_new0(virDomainStatsRecordPtr, ret.retInfo.retInfo_len + 1);
+
+    for (i = 0; i < ret.retInfo.retInfo_len; i++) {
+        remote_domain_stats_record *rec = ret.retInfo.retInfo_val + i;
+
+        elem = g_new0(virDomainStatsRecord, 1);
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        if (virTypedParamsDeserialize((virTypedParameterRemotePtr) rec->params.params_val,
+                                      rec->params.params_len,
+                                      REMOTE_DOMAIN_GUEST_INFO_PARAMS_MAX,
+                                      &elem->params,
+                                      &elem->nparams))
+            goto cleanup;
+
+        tmpret[i] = g_steal_pointer(&elem);
+    }
+
+    *retInfo = g_steal_pointer(&tmpret);
+    rv = ret.retInfo.retInfo_len;
+
+ cleanup:
+    if (elem) {
+        virObjectUnref(elem->dom);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    VIR_FREE(args.doms.doms_val);
+    xdr_free((xdrproc_t)xdr_remote_domain_list_get_guest_info_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
  * (name, uuid) pair into virDomainPtr or virNetworkPtr object.
  * These can return NULL if underlying memory allocations fail,
@@ -8571,6 +8654,7 @@ static virHypervisorDriver hypervisor_driver = {
     .domainAuthorizedSSHKeysGet = remoteDomainAuthorizedSSHKeysGet, /* 6.10.0 */
     .domainAuthorizedSSHKeysSet = remoteDomainAuthorizedSSHKeysSet, /* 6.10.0 */
     .domainGetMessages = remoteDomainGetMessages, /* 7.1.0 */
+    .domainListGetGuestInfo = remoteDomainListGetGuestInfo, /* 7.2.0 */
 };
 
 static virNetworkDriver network_driver = {
@@ -3811,6 +3811,16 @@ struct remote_domain_get_messages_ret {
     remote_nonnull_string msgs<REMOTE_DOMAIN_MESSAGES_MAX>;
 };
 
+struct remote_domain_list_get_guest_info_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int types;
+    unsigned int flags;
+};
+
+struct remote_domain_list_get_guest_info_ret {
+    remote_domain_stats_record retInfo<REMOTE_DOMAIN_LIST_MAX>;
+};
+
 
 /*----- Protocol. -----*/
 
@@ -6733,5 +6743,12 @@ enum remote_procedure {
      * @generate: none
      * @acl: domain:read
      */
-    REMOTE_PROC_DOMAIN_GET_MESSAGES = 426
+    REMOTE_PROC_DOMAIN_GET_MESSAGES = 426,
+
+    /**
+     * @generate: none
+     * @acl: connect:search_domains
+     * @aclfilter: domain:write
+     */
+    REMOTE_PROC_DOMAIN_LIST_GET_GUEST_INFO = 427
 };
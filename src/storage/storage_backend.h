@@ -105,6 +105,9 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    /* refreshPool updates the volumes already known instead of expecting
+     * the storage driver to clear them beforehand */
+    bool refreshPoolIncremental;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
@@ -630,6 +630,7 @@ virStorageBackend virStorageBackendDirectory = {
     .buildPool = virStorageBackendFileSystemBuild,
     .checkPool = virStorageBackendFileSystemCheck,
     .refreshPool = virStorageBackendRefreshLocal,
+    .refreshPoolIncremental = true,
     .deletePool = virStorageBackendDeleteLocal,
     .buildVol = virStorageBackendVolBuildLocal,
     .buildVolFrom = virStorageBackendVolBuildFromLocal,
@@ -650,6 +651,7 @@ virStorageBackend virStorageBackendFileSystem = {
     .checkPool = virStorageBackendFileSystemCheck,
     .startPool = virStorageBackendFileSystemStart,
     .refreshPool = virStorageBackendRefreshLocal,
+    .refreshPoolIncremental = true,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendDeleteLocal,
     .buildVol = virStorageBackendVolBuildLocal,
@@ -670,6 +672,7 @@ virStorageBackend virStorageBackendNetFileSystem = {
     .startPool = virStorageBackendFileSystemStart,
     .findPoolSources = virStorageBackendFileSystemNetFindPoolSources,
     .refreshPool = virStorageBackendRefreshLocal,
+    .refreshPoolIncremental = true,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendDeleteLocal,
     .buildVol = virStorageBackendVolBuildLocal,
@@ -161,6 +161,7 @@ virStorageBackend virStorageBackendVstorage = {
     .stopPool = virStorageBackendVzPoolStop,
     .deletePool = virStorageBackendDeleteLocal,
     .refreshPool = virStorageBackendRefreshLocal,
+    .refreshPoolIncremental = true,
     .checkPool = virStorageBackendVzCheck,
     .buildVol = virStorageBackendVolBuildLocal,
     .buildVolFrom = virStorageBackendVolBuildFromLocal,
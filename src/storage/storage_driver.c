@@ -30,6 +30,9 @@
 #if WITH_PWD_H
 # include <pwd.h>
 #endif
+#if WITH_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "virerror.h"
 #include "datatypes.h"
@@ -50,6 +53,8 @@
 #include "viraccessapicheck.h"
 #include "storage_util.h"
 #include "virutil.h"
+#include "virthreadpool.h"
+#include "viruuid.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -99,7 +104,8 @@ storagePoolRefreshImpl(virStorageBackendPtr backend,
                        virStoragePoolObjPtr obj,
                        const char *stateFile)
 {
-    virStoragePoolObjClearVols(obj);
+    if (!backend->refreshPoolIncremental)
+        virStoragePoolObjClearVols(obj);
     if (backend->refreshPool(obj) < 0) {
         storagePoolRefreshFailCleanup(backend, obj, stateFile);
         return -1;
@@ -128,6 +134,441 @@ virStoragePoolUpdateInactive(virStoragePoolObjPtr obj)
 }
 
 
+#if WITH_SYS_INOTIFY_H
+
+/* Changes noticed in a pool directory are collected for this long
+ * before the pool is refreshed, so that a burst of changes, e.g.
+ * an image being copied in, results in a single refresh. */
+# define STORAGE_POOL_WATCH_DELAY_MS 500
+
+/* IN_MODIFY is deliberately left out, it fires on every write into
+ * an image used by a running guest. Size changes are picked up once
+ * the writer closes the file. */
+# define STORAGE_POOL_WATCH_EVENTS \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+     IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | \
+     IN_ONLYDIR)
+
+typedef struct _virStoragePoolWatch virStoragePoolWatch;
+struct _virStoragePoolWatch {
+    virMutex lock;
+    int fd;                 /* inotify instance */
+    int watch;              /* event loop handle watching @fd */
+    int timer;              /* delayed refresh of @pending pools */
+    bool armed;             /* @timer is enabled */
+    GHashTable *wds;        /* watch descriptor -> pool UUID string */
+    GHashTable *pools;      /* pool UUID string -> watch descriptor */
+    GHashTable *pending;    /* UUID strings of pools to be refreshed */
+    virThreadPoolPtr worker;
+};
+
+static virStoragePoolWatch *storageWatch;
+
+
+static void
+storagePoolWatchFree(virStoragePoolWatch *w)
+{
+    if (!w)
+        return;
+
+    if (w->watch >= 0)
+        virEventRemoveHandle(w->watch);
+    if (w->timer >= 0)
+        virEventRemoveTimeout(w->timer);
+    if (w->worker)
+        virThreadPoolFree(w->worker);
+    VIR_FORCE_CLOSE(w->fd);
+    if (w->wds)
+        g_hash_table_unref(w->wds);
+    if (w->pools)
+        g_hash_table_unref(w->pools);
+    if (w->pending)
+        g_hash_table_unref(w->pending);
+    virMutexDestroy(&w->lock);
+    g_free(w);
+}
+
+
+/* Must be called with the watch lock held */
+static void
+storagePoolWatchQueueLocked(const char *uuidstr)
+{
+    g_hash_table_add(storageWatch->pending, g_strdup(uuidstr));
+
+    if (!storageWatch->armed) {
+        virEventUpdateTimeout(storageWatch->timer, STORAGE_POOL_WATCH_DELAY_MS);
+        storageWatch->armed = true;
+    }
+}
+
+
+static void
+storagePoolWatchQueue(const char *uuidstr)
+{
+    virMutexLock(&storageWatch->lock);
+    storagePoolWatchQueueLocked(uuidstr);
+    virMutexUnlock(&storageWatch->lock);
+}
+
+
+/**
+ * storagePoolWatchAdd:
+ * @obj: locked pool object
+ *
+ * Start watching the target directory of an active local directory or
+ * filesystem pool so that its volume list follows changes made behind
+ * libvirt's back. Failing to set up the watch is not fatal, the pool
+ * then has to be refreshed explicitly as before.
+ */
+static void
+storagePoolWatchAdd(virStoragePoolObjPtr obj)
+{
+    virStoragePoolDefPtr def = virStoragePoolObjGetDef(obj);
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    int wd;
+
+    if (!storageWatch)
+        return;
+
+    /* Changes made by other NFS clients are not reported by inotify,
+     * so netfs pools are not watched. */
+    if (def->type != VIR_STORAGE_POOL_DIR &&
+        def->type != VIR_STORAGE_POOL_FS)
+        return;
+
+    virUUIDFormat(def->uuid, uuidstr);
+
+    virMutexLock(&storageWatch->lock);
+
+    if (g_hash_table_contains(storageWatch->pools, uuidstr))
+        goto cleanup;
+
+    if ((wd = inotify_add_watch(storageWatch->fd, def->target.path,
+                                STORAGE_POOL_WATCH_EVENTS)) < 0) {
+        VIR_WARN("Unable to watch directory '%s' of storage pool '%s': %s",
+                 def->target.path, def->name, g_strerror(errno));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Watching directory '%s' of storage pool '%s'",
+              def->target.path, def->name);
+
+    g_hash_table_insert(storageWatch->wds, GINT_TO_POINTER(wd),
+                        g_strdup(uuidstr));
+    g_hash_table_insert(storageWatch->pools, g_strdup(uuidstr),
+                        GINT_TO_POINTER(wd));
+
+ cleanup:
+    virMutexUnlock(&storageWatch->lock);
+}
+
+
+static void
+storagePoolWatchRemove(virStoragePoolObjPtr obj)
+{
+    virStoragePoolDefPtr def = virStoragePoolObjGetDef(obj);
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    gpointer wd;
+
+    if (!storageWatch)
+        return;
+
+    virUUIDFormat(def->uuid, uuidstr);
+
+    virMutexLock(&storageWatch->lock);
+
+    if (g_hash_table_lookup_extended(storageWatch->pools, uuidstr,
+                                     NULL, &wd)) {
+        VIR_DEBUG("Not watching storage pool '%s' anymore", def->name);
+
+        inotify_rm_watch(storageWatch->fd, GPOINTER_TO_INT(wd));
+        g_hash_table_remove(storageWatch->wds, wd);
+        g_hash_table_remove(storageWatch->pools, uuidstr);
+    }
+
+    g_hash_table_remove(storageWatch->pending, uuidstr);
+
+    virMutexUnlock(&storageWatch->lock);
+}
+
+
+/* Must be called with the watch lock held */
+static void
+storagePoolWatchProcessEvent(const struct inotify_event *ev)
+{
+    const char *uuidstr;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        GHashTableIter iter;
+        gpointer key;
+
+        VIR_DEBUG("Storage pool change events overflowed");
+
+        g_hash_table_iter_init(&iter, storageWatch->pools);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+            storagePoolWatchQueueLocked(key);
+        return;
+    }
+
+    if (!(uuidstr = g_hash_table_lookup(storageWatch->wds,
+                                        GINT_TO_POINTER(ev->wd))))
+        return;
+
+    VIR_DEBUG("Storage pool %s: change 0x%x of '%s'",
+              uuidstr, ev->mask, ev->len ? ev->name : "");
+
+    storagePoolWatchQueueLocked(uuidstr);
+
+    /* The directory itself is gone or was unmounted. The refresh
+     * queued above deactivates the pool. */
+    if (ev->mask & IN_IGNORED) {
+        g_hash_table_remove(storageWatch->pools, uuidstr);
+        g_hash_table_remove(storageWatch->wds, GINT_TO_POINTER(ev->wd));
+    }
+}
+
+
+static void
+storagePoolWatchHandle(int watch G_GNUC_UNUSED,
+                       int fd,
+                       int events G_GNUC_UNUSED,
+                       void *opaque G_GNUC_UNUSED)
+{
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } data;
+
+    virMutexLock(&storageWatch->lock);
+
+    while (true) {
+        ssize_t len = read(fd, &data, sizeof(data));
+        const struct inotify_event *ev;
+        char *p;
+
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                VIR_WARN("Unable to read storage pool changes: %s",
+                         g_strerror(errno));
+            break;
+        }
+
+        if (len == 0)
+            break;
+
+        for (p = data.buf; p < data.buf + len; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *) (void *) p;
+            storagePoolWatchProcessEvent(ev);
+        }
+    }
+
+    virMutexUnlock(&storageWatch->lock);
+}
+
+
+static void
+storagePoolWatchTimer(int timer G_GNUC_UNUSED,
+                      void *opaque G_GNUC_UNUSED)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    virMutexLock(&storageWatch->lock);
+
+    virEventUpdateTimeout(storageWatch->timer, -1);
+    storageWatch->armed = false;
+
+    g_hash_table_iter_init(&iter, storageWatch->pending);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_hash_table_iter_steal(&iter);
+
+        if (virThreadPoolSendJob(storageWatch->worker, 0, key) < 0) {
+            VIR_WARN("Unable to queue refresh of storage pool %s",
+                     (const char *) key);
+            g_free(key);
+        }
+    }
+
+    virMutexUnlock(&storageWatch->lock);
+}
+
+
+/* Refreshes a pool whose directory changed. Thanks to the incremental
+ * refresh of directory pools only added, removed and modified files
+ * are probed. */
+static void
+storagePoolWatchRefresh(void *jobdata,
+                        void *opaque G_GNUC_UNUSED)
+{
+    g_autofree char *uuidstr = jobdata;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virStoragePoolObjPtr obj = NULL;
+    virStoragePoolDefPtr def;
+    virStorageBackendPtr backend;
+    virObjectEventPtr event = NULL;
+    g_autofree char *stateFile = NULL;
+
+    if (virUUIDParse(uuidstr, uuid) < 0 ||
+        !(obj = virStoragePoolObjFindByUUID(driver->pools, uuid)))
+        return;
+    def = virStoragePoolObjGetDef(obj);
+
+    if (!virStoragePoolObjIsActive(obj) ||
+        virStoragePoolObjIsStarting(obj))
+        goto cleanup;
+
+    /* Volumes being created, uploaded or wiped keep changing until the
+     * job is over, look again later. */
+    if (virStoragePoolObjGetAsyncjobs(obj) > 0) {
+        storagePoolWatchQueue(uuidstr);
+        goto cleanup;
+    }
+
+    if (!(backend = virStorageBackendForType(def->type)))
+        goto cleanup;
+
+    VIR_DEBUG("Refreshing changed storage pool '%s'", def->name);
+
+    stateFile = virFileBuildPath(driver->stateDir, def->name, ".xml");
+    if (storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+        VIR_WARN("Failed to refresh storage pool '%s': %s",
+                 def->name, virGetLastErrorMessage());
+
+        event = virStoragePoolEventLifecycleNew(def->name,
+                                                def->uuid,
+                                                VIR_STORAGE_POOL_EVENT_STOPPED,
+                                                0);
+        storagePoolWatchRemove(obj);
+        virStoragePoolObjSetActive(obj, false);
+
+        virStoragePoolUpdateInactive(obj);
+
+        goto cleanup;
+    }
+
+    event = virStoragePoolEventRefreshNew(def->name,
+                                          def->uuid);
+
+ cleanup:
+    virObjectEventStateQueue(driver->storageEventState, event);
+    virStoragePoolObjEndAPI(&obj);
+}
+
+
+static void
+storagePoolWatchAddCallback(virStoragePoolObjPtr obj,
+                            const void *opaque G_GNUC_UNUSED)
+{
+    if (virStoragePoolObjIsActive(obj))
+        storagePoolWatchAdd(obj);
+}
+
+
+/**
+ * storagePoolWatchInit:
+ *
+ * Set up watching of the active directory and filesystem pools. Any
+ * failure only disables the watching, pools can still be refreshed
+ * explicitly.
+ */
+static void
+storagePoolWatchInit(void)
+{
+    virStoragePoolWatch *w = g_new0(virStoragePoolWatch, 1);
+
+    w->fd = -1;
+    w->watch = -1;
+    w->timer = -1;
+
+    if (virMutexInit(&w->lock) < 0) {
+        g_free(w);
+        return;
+    }
+
+    if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        VIR_WARN("Unable to initialize inotify, storage pools will not be "
+                 "watched for changes: %s", g_strerror(errno));
+        goto error;
+    }
+
+    w->wds = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                   NULL, g_free);
+    w->pools = virHashNew(NULL);
+    w->pending = virHashNew(NULL);
+
+    if (!(w->worker = virThreadPoolNewFull(0, 1, 0, storagePoolWatchRefresh,
+                                           "storage-watch", NULL)))
+        goto error;
+
+    if ((w->timer = virEventAddTimeout(-1, storagePoolWatchTimer,
+                                       NULL, NULL)) < 0 ||
+        (w->watch = virEventAddHandle(w->fd, VIR_EVENT_HANDLE_READABLE,
+                                      storagePoolWatchHandle,
+                                      NULL, NULL)) < 0) {
+        VIR_WARN("Unable to register storage pool watch: %s",
+                 virGetLastErrorMessage());
+        goto error;
+    }
+
+    storageWatch = w;
+
+    virStoragePoolObjListForEach(driver->pools,
+                                 storagePoolWatchAddCallback,
+                                 NULL);
+    return;
+
+ error:
+    storagePoolWatchFree(w);
+}
+
+
+static void
+storagePoolWatchCleanup(void)
+{
+    if (!storageWatch)
+        return;
+
+    /* The event loop no longer dispatches at this point, so no new
+     * refresh can be submitted. A refresh that is already running
+     * goes through storageWatch and may re-arm the timer, so join
+     * the worker before tearing anything else down. */
+    virThreadPoolFree(storageWatch->worker);
+    storageWatch->worker = NULL;
+
+    storagePoolWatchFree(storageWatch);
+    storageWatch = NULL;
+}
+
+#else /* !WITH_SYS_INOTIFY_H */
+
+static void
+storagePoolWatchAdd(virStoragePoolObjPtr obj G_GNUC_UNUSED)
+{
+}
+
+
+static void
+storagePoolWatchRemove(virStoragePoolObjPtr obj G_GNUC_UNUSED)
+{
+}
+
+
+static void
+storagePoolWatchInit(void)
+{
+}
+
+
+static void
+storagePoolWatchCleanup(void)
+{
+}
+
+#endif /* !WITH_SYS_INOTIFY_H */
+
+
 static void
 storagePoolUpdateStateCallback(virStoragePoolObjPtr obj,
                                const void *opaque G_GNUC_UNUSED)
@@ -224,6 +665,7 @@ storageDriverAutostartCallback(virStoragePoolObjPtr obj,
                            def->name, virGetLastErrorMessage());
         } else {
             virStoragePoolObjSetActive(obj, true);
+            storagePoolWatchAdd(obj);
         }
     }
 
@@ -328,6 +770,8 @@ storageStateInitialize(bool privileged,
     if (!(driver->caps = virStorageBackendGetCapabilities()))
         goto error;
 
+    storagePoolWatchInit();
+
     storageDriverUnlock();
 
     return VIR_DRV_STATE_INIT_COMPLETE;
@@ -374,6 +818,8 @@ storageStateCleanup(void)
     if (!driver)
         return -1;
 
+    storagePoolWatchCleanup();
+
     storageDriverLock();
 
     virObjectUnref(driver->caps);
@@ -788,6 +1234,7 @@ storagePoolCreateXML(virConnectPtr conn,
 
     VIR_INFO("Creating storage pool '%s'", def->name);
     virStoragePoolObjSetActive(obj, true);
+    storagePoolWatchAdd(obj);
 
     pool = virGetStoragePool(conn, def->name, def->uuid, NULL, NULL);
 
@@ -997,6 +1444,7 @@ storagePoolCreate(virStoragePoolPtr pool,
                                             0);
 
     virStoragePoolObjSetActive(obj, true);
+    storagePoolWatchAdd(obj);
     ret = 0;
 
  cleanup:
@@ -1123,6 +1571,7 @@ storagePoolDestroy(virStoragePoolPtr pool)
         backend->stopPool(obj) < 0)
         goto cleanup;
 
+    storagePoolWatchRemove(obj);
     virStoragePoolObjClearVols(obj);
 
     event = virStoragePoolEventLifecycleNew(def->name,
@@ -1262,6 +1711,7 @@ storagePoolRefresh(virStoragePoolPtr pool,
                                                 def->uuid,
                                                 VIR_STORAGE_POOL_EVENT_STOPPED,
                                                 0);
+        storagePoolWatchRemove(obj);
         virStoragePoolObjSetActive(obj, false);
 
         virStoragePoolUpdateInactive(obj);
@@ -1566,24 +2016,11 @@ storageVolLookupByName(virStoragePoolPtr pool,
 
 
 struct storageVolLookupData {
-    const char *key;
     char *cleanpath;
     const char *path;
     virStorageVolDefPtr voldef;
 };
 
-static bool
-storageVolLookupByKeyCallback(virStoragePoolObjPtr obj,
-                              const void *opaque)
-{
-    struct storageVolLookupData *data = (struct storageVolLookupData *)opaque;
-
-    if (virStoragePoolObjIsActive(obj))
-        data->voldef = virStorageVolDefFindByKey(obj, data->key);
-
-    return !!data->voldef;
-}
-
 
 static virStorageVolPtr
 storageVolLookupByKey(virConnectPtr conn,
@@ -1591,17 +2028,14 @@ storageVolLookupByKey(virConnectPtr conn,
 {
     virStoragePoolObjPtr obj;
     virStoragePoolDefPtr def;
-    struct storageVolLookupData data = {
-        .key = key, .voldef = NULL };
+    virStorageVolDefPtr voldef;
     virStorageVolPtr vol = NULL;
 
-    if ((obj = virStoragePoolObjListSearch(driver->pools,
-                                           storageVolLookupByKeyCallback,
-                                           &data)) && data.voldef) {
+    if ((obj = virStoragePoolObjListFindVolByKey(driver->pools, key, &voldef))) {
         def = virStoragePoolObjGetDef(obj);
-        if (virStorageVolLookupByKeyEnsureACL(conn, def, data.voldef) == 0) {
+        if (virStorageVolLookupByKeyEnsureACL(conn, def, voldef) == 0) {
             vol = virGetStorageVol(conn, def->name,
-                                   data.voldef->name, data.voldef->key,
+                                   voldef->name, voldef->key,
                                    NULL, NULL);
         }
         virStoragePoolObjEndAPI(&obj);
@@ -1659,6 +2093,11 @@ storageVolLookupByPathCallback(virStoragePoolObjPtr obj,
         return false;
     }
 
+    /* Paths used verbatim were already looked up in the volume index */
+    if (STREQ(stable_path, data->cleanpath) ||
+        STREQ(stable_path, data->path))
+        return false;
+
     data->voldef = virStorageVolDefFindByPath(obj, stable_path);
 
     return !!data->voldef;
@@ -1678,9 +2117,23 @@ storageVolLookupByPath(virConnectPtr conn,
     if (!(data.cleanpath = virFileSanitizePath(path)))
         return NULL;
 
-    if ((obj = virStoragePoolObjListSearch(driver->pools,
-                                           storageVolLookupByPathCallback,
-                                           &data)) && data.voldef) {
+    /* Most paths are given exactly as the volumes know them, only
+     * search the pools one by one for the rest. */
+    if (!(obj = virStoragePoolObjListFindVolByPath(driver->pools,
+                                                   data.cleanpath,
+                                                   &data.voldef)) &&
+        STRNEQ(path, data.cleanpath)) {
+        obj = virStoragePoolObjListFindVolByPath(driver->pools, path,
+                                                 &data.voldef);
+    }
+
+    if (!obj) {
+        obj = virStoragePoolObjListSearch(driver->pools,
+                                          storageVolLookupByPathCallback,
+                                          &data);
+    }
+
+    if (obj && data.voldef) {
         def = virStoragePoolObjGetDef(obj);
 
         if (virStorageVolLookupByPathEnsureACL(conn, def, data.voldef) == 0) {
@@ -64,6 +64,8 @@
 #include "virstoragefile.h"
 #include "storage_file_probe.h"
 #include "storage_util.h"
+#define LIBVIRT_STORAGE_UTIL_PRIV_H_ALLOW
+#include "storage_util_priv.h"
 #include "storage_source.h"
 #include "storage_source_conf.h"
 #include "virlog.h"
@@ -2566,29 +2568,233 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
+/* Zeroing is split into up to this many ranges written in parallel,
+ * but only when each of them is at least VIR_STORAGE_WIPE_RANGE_MIN
+ * long, small wipes are not worth the threads */
+#define VIR_STORAGE_WIPE_WORKERS 4
+#define VIR_STORAGE_WIPE_RANGE_MIN (64 * 1024 * 1024)
+#define VIR_STORAGE_WIPE_BUFLEN (1024 * 1024)
+/* Alignment required to write with O_DIRECT */
+#define VIR_STORAGE_WIPE_ALIGN 4096
+
+typedef struct _virStorageBackendWipeRange virStorageBackendWipeRange;
+struct _virStorageBackendWipeRange {
+    int fd;
+    const char *buf;        /* VIR_STORAGE_WIPE_BUFLEN zeroes, shared */
+    off_t offset;
+    unsigned long long len;
+    unsigned long long done;
+    int err;                /* errno of the failed write, or 0 */
+};
+
+
+static void
+storageBackendWipeRangeWorker(void *opaque)
+{
+    virStorageBackendWipeRange *range = opaque;
+
+    while (range->done < range->len) {
+        size_t write_size = MIN(VIR_STORAGE_WIPE_BUFLEN,
+                                range->len - range->done);
+        ssize_t written = pwrite(range->fd, range->buf, write_size,
+                                 range->offset + range->done);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0) {
+            range->err = written < 0 ? errno : ENOSPC;
+            return;
+        }
+
+        range->done += written;
+    }
+
+    VIR_DEBUG("Zeroed %llu bytes at offset %lld",
+              range->len, (long long)range->offset);
+}
+
+
+/*
+ * Write zeroes to @len bytes of @path starting at @offset. The range is
+ * split among several threads and written with O_DIRECT if possible so
+ * that wiping large volumes neither takes forever nor thrashes the host
+ * page cache.
+ *
+ * Returns 0 on success, -1 with error reported on failure.
+ */
+static int
+storageBackendWipeParallel(const char *path,
+                           int fd,
+                           off_t offset,
+                           unsigned long long len)
+{
+    virStorageBackendWipeRange ranges[VIR_STORAGE_WIPE_WORKERS] = { 0 };
+    virThread threads[VIR_STORAGE_WIPE_WORKERS];
+    g_autofree char *base = NULL;
+    const char *buf;
+    VIR_AUTOCLOSE directfd = -1;
+    int directFlag = virFileDirectFdFlag();
+    int wfd = fd;
+    unsigned long long rangelen;
+    size_t nranges;
+    size_t nthreads;
+    size_t i;
+
+    /* O_DIRECT needs every write to be aligned, which holds for all the
+     * chunks if it holds for the whole range */
+    if (directFlag > 0 &&
+        offset % VIR_STORAGE_WIPE_ALIGN == 0 &&
+        len % VIR_STORAGE_WIPE_ALIGN == 0) {
+        if ((directfd = open(path, O_WRONLY | directFlag)) < 0)
+            VIR_DEBUG("Unable to open '%s' with O_DIRECT: %s",
+                      path, g_strerror(errno));
+        else
+            wfd = directfd;
+    }
+
+    base = g_new0(char, VIR_STORAGE_WIPE_BUFLEN + VIR_STORAGE_WIPE_ALIGN - 1);
+    buf = (char *) VIR_ROUND_UP((uintptr_t) base, VIR_STORAGE_WIPE_ALIGN);
+
+    rangelen = VIR_DIV_UP(len, VIR_STORAGE_WIPE_WORKERS);
+    rangelen = MAX(rangelen, VIR_STORAGE_WIPE_RANGE_MIN);
+    rangelen = VIR_ROUND_UP(rangelen, VIR_STORAGE_WIPE_ALIGN);
+    nranges = VIR_DIV_UP(len, rangelen);
+
+    for (i = 0; i < nranges; i++) {
+        ranges[i].fd = wfd;
+        ranges[i].buf = buf;
+        ranges[i].offset = offset + i * rangelen;
+        ranges[i].len = MIN(rangelen, len - i * rangelen);
+    }
+
+    VIR_DEBUG("Zeroing %llu bytes of '%s' in %zu ranges%s",
+              len, path, nranges, wfd == directfd ? " with O_DIRECT" : "");
+
+    /* The calling thread writes the first range and any range a thread
+     * could not be spawned for */
+    for (nthreads = 1; nthreads < nranges; nthreads++) {
+        if (virThreadCreateFull(&threads[nthreads], true,
+                                storageBackendWipeRangeWorker,
+                                "vol-wipe", false, &ranges[nthreads]) < 0) {
+            VIR_WARN("Unable to create volume wipe thread: %s",
+                     g_strerror(errno));
+            break;
+        }
+    }
+
+    storageBackendWipeRangeWorker(&ranges[0]);
+    for (i = nthreads; i < nranges; i++)
+        storageBackendWipeRangeWorker(&ranges[i]);
+
+    for (i = 1; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    for (i = 0; i < nranges; i++) {
+        if (ranges[i].err != 0) {
+            virReportSystemError(ranges[i].err,
+                                 _("Failed to write %llu bytes to "
+                                   "storage volume with path '%s'"),
+                                 ranges[i].len - ranges[i].done, path);
+            return -1;
+        }
+    }
+
+    if (virFileDataSync(wfd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Let the kernel zero, or discard if @discard is true, @len bytes of
+ * @path starting at @offset without transferring any data. Block
+ * devices use BLKZEROOUT/BLKDISCARD, which the device can usually
+ * handle by itself, and regular files deallocate the range.
+ *
+ * Returns 0 on success, 1 if the volume does not support it and -1 with
+ * error reported on failure.
+ */
+static int
+storageBackendWipeKernel(const char *path,
+                         int fd G_GNUC_UNUSED,
+                         struct stat *st G_GNUC_UNUSED,
+                         off_t offset G_GNUC_UNUSED,
+                         unsigned long long len,
+                         bool discard)
+{
+    int rc = 1;
+
+#ifdef __linux__
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2] = { offset, len };
+
+        if (discard)
+            rc = ioctl(fd, BLKDISCARD, range);
+# ifdef BLKZEROOUT
+        else
+            rc = ioctl(fd, BLKZEROOUT, range);
+# endif
+    }
+#endif
+
+/* Avoid issues with older kernel's <linux/fs.h> namespace pollution. */
+#if WITH_FALLOCATE - 0 && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_ZERO_RANGE)
+    if (S_ISREG(st->st_mode)) {
+        int mode = FALLOC_FL_KEEP_SIZE;
+
+        mode |= discard ? FALLOC_FL_PUNCH_HOLE : FALLOC_FL_ZERO_RANGE;
+        rc = fallocate(fd, mode, offset, len);
+    }
+#endif
+
+    if (rc == 0) {
+        VIR_DEBUG("Kernel %s %llu bytes of volume with path '%s'",
+                  discard ? "discarded" : "zeroed", len, path);
+        return 0;
+    }
+
+    if (rc > 0 ||
+        errno == EOPNOTSUPP || errno == ENOTTY ||
+        errno == EINVAL || errno == ENOSYS) {
+        VIR_DEBUG("Volume with path '%s' cannot be %s by the kernel",
+                  path, discard ? "discarded" : "zeroed");
+        return 1;
+    }
+
+    if (discard)
+        virReportSystemError(errno,
+                             _("Failed to discard %llu bytes of "
+                               "storage volume with path '%s'"),
+                             len, path);
+    else
+        virReportSystemError(errno,
+                             _("Failed to zero %llu bytes of "
+                               "storage volume with path '%s'"),
+                             len, path);
+    return -1;
+}
+
+
 static int
 storageBackendWipeLocal(const char *path,
                         int fd,
+                        struct stat *st,
                         unsigned long long wipe_len,
-                        size_t writebuf_length,
+                        bool discard,
                         bool zero_end)
 {
-    unsigned long long remaining = 0;
-    off_t size;
-    g_autofree char *writebuf = NULL;
-
-    writebuf = g_new0(char, writebuf_length);
+    off_t offset = 0;
+    int rc;
 
-    if (!zero_end) {
-        if ((size = lseek(fd, 0, SEEK_SET)) < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to seek to the start in volume "
-                                   "with path '%s'"),
-                                 path);
-            return -1;
-        }
-    } else {
-        if ((size = lseek(fd, -wipe_len, SEEK_END)) < 0) {
+    if (zero_end) {
+        if ((offset = lseek(fd, -wipe_len, SEEK_END)) < 0) {
             virReportSystemError(errno,
                                  _("Failed to seek to %llu bytes to the end "
                                    "in volume with path '%s'"),
@@ -2597,23 +2803,26 @@ storageBackendWipeLocal(const char *path,
         }
     }
 
-    VIR_DEBUG("wiping start: %zd len: %llu", (ssize_t)size, wipe_len);
+    VIR_DEBUG("wiping start: %lld len: %llu", (long long)offset, wipe_len);
 
-    remaining = wipe_len;
-    while (remaining > 0) {
-        size_t write_size = MIN(writebuf_length, remaining);
-        int written = safewrite(fd, writebuf, write_size);
+    if (wipe_len == 0)
+        return 0;
 
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, path);
+    if ((rc = storageBackendWipeKernel(path, fd, st, offset,
+                                       wipe_len, discard)) < 0)
+        return -1;
 
+    if (rc > 0) {
+        /* Unlike zeroes, a discard cannot be emulated by writing */
+        if (discard) {
+            virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                           _("'trim' algorithm not supported by volume "
+                             "with path '%s'"),
+                           path);
             return -1;
         }
 
-        remaining -= written;
+        return storageBackendWipeParallel(path, fd, offset, wipe_len);
     }
 
     if (virFileDataSync(fd) < 0) {
@@ -2623,8 +2832,6 @@ storageBackendWipeLocal(const char *path,
         return -1;
     }
 
-    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
-
     return 0;
 }
 
@@ -2684,9 +2891,8 @@ storageBackendVolWipeLocalFile(const char *path,
         alg_char = "random";
         break;
     case VIR_STORAGE_VOL_WIPE_ALG_TRIM:
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
-                       _("'trim' algorithm not supported"));
-        return -1;
+        alg_char = "trim";
+        break;
     case VIR_STORAGE_VOL_WIPE_ALG_LAST:
         virReportError(VIR_ERR_INVALID_ARG,
                        _("unsupported algorithm %d"),
@@ -2696,6 +2902,15 @@ storageBackendVolWipeLocalFile(const char *path,
 
     VIR_DEBUG("Wiping file '%s' with algorithm '%s'", path, alg_char);
 
+    if (algorithm == VIR_STORAGE_VOL_WIPE_ALG_TRIM) {
+        /* Unlike block devices, files can be trimmed past their allocation */
+        if (S_ISREG(st.st_mode))
+            allocation = st.st_size;
+
+        return storageBackendWipeLocal(path, fd, &st, allocation, true,
+                                       zero_end);
+    }
+
     if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
         cmd = virCommandNew(SCRUB);
         virCommandAddArgList(cmd, "-f", "-p", alg_char, path, NULL);
@@ -2706,7 +2921,7 @@ storageBackendVolWipeLocalFile(const char *path,
     if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE))
         return storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
 
-    return storageBackendWipeLocal(path, fd, allocation, st.st_blksize,
+    return storageBackendWipeLocal(path, fd, &st, allocation, false,
                                    zero_end);
 }
 
@@ -3551,62 +3766,420 @@ virStorageBackendRefreshVolTargetUpdate(virStorageVolDefPtr vol)
 }
 
 
-/**
- * Iterate over the pool's directory and enumerate all disk images
- * within it. This is non-recursive.
+/* Number of threads probing volumes concurrently during a refresh */
+#define VIR_STORAGE_BACKEND_REFRESH_WORKERS 8
+
+typedef struct _virStorageBackendRefreshEntry virStorageBackendRefreshEntry;
+typedef virStorageBackendRefreshEntry *virStorageBackendRefreshEntryPtr;
+struct _virStorageBackendRefreshEntry {
+    char *name;
+    struct stat sb;
+    bool haveStat;
+    bool unchanged;     /* same as the known volume, no need to probe */
+    int rc;             /* result of virStorageBackendRefreshVolTargetUpdate */
+    virStorageVolDefPtr vol;
+    virErrorPtr err;
+};
+
+typedef struct _virStorageBackendRefreshData virStorageBackendRefreshData;
+struct _virStorageBackendRefreshData {
+    const char *path;
+    virStorageBackendRefreshEntryPtr *probes;
+    size_t nprobes;
+    int next;
+};
+
+
+static void
+virStorageBackendRefreshEntryFree(virStorageBackendRefreshEntryPtr entry)
+{
+    if (!entry)
+        return;
+
+    g_free(entry->name);
+    virStorageVolDefFree(entry->vol);
+    virFreeError(entry->err);
+    g_free(entry);
+}
+
+
+static void
+virStorageBackendStampFromStat(virStorageVolStampPtr stamp,
+                               const struct stat *sb)
+{
+    stamp->valid = true;
+    stamp->dev = sb->st_dev;
+    stamp->ino = sb->st_ino;
+    stamp->size = sb->st_size;
+#ifdef __APPLE__
+    stamp->mtime = sb->st_mtimespec;
+    stamp->ctime = sb->st_ctimespec;
+#else /* ! __APPLE__ */
+    stamp->mtime = sb->st_mtim;
+    stamp->ctime = sb->st_ctim;
+#endif /* ! __APPLE__ */
+}
+
+
+static bool
+virStorageBackendStampEqual(const virStorageVolStamp *a,
+                            const virStorageVolStamp *b)
+{
+    return a->valid && b->valid &&
+        a->dev == b->dev &&
+        a->ino == b->ino &&
+        a->size == b->size &&
+        a->mtime.tv_sec == b->mtime.tv_sec &&
+        a->mtime.tv_nsec == b->mtime.tv_nsec &&
+        a->ctime.tv_sec == b->ctime.tv_sec &&
+        a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+
+static void
+virStorageBackendRefreshProbe(virStorageBackendRefreshEntryPtr entry,
+                              const char *path)
+{
+    g_autoptr(virStorageVolDef) vol = g_new0(virStorageVolDef, 1);
+
+    vol->name = g_strdup(entry->name);
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.path = g_strdup_printf("%s/%s", path, vol->name);
+
+    vol->key = g_strdup(vol->target.path);
+
+    if ((entry->rc = virStorageBackendRefreshVolTargetUpdate(vol)) < 0) {
+        if (entry->rc == -1)
+            virErrorPreserveLast(&entry->err);
+        return;
+    }
+
+    if (entry->haveStat)
+        virStorageBackendStampFromStat(&vol->stamp, &entry->sb);
+
+    entry->vol = g_steal_pointer(&vol);
+}
+
+
+static void
+virStorageBackendRefreshWorker(void *opaque)
+{
+    virStorageBackendRefreshData *data = opaque;
+    int i;
+
+    while ((i = g_atomic_int_add(&data->next, 1)) < (int) data->nprobes)
+        virStorageBackendRefreshProbe(data->probes[i], data->path);
+}
+
+
+static void
+virStorageBackendRefreshProbeAll(virStorageBackendRefreshData *data)
+{
+    size_t nworkers = MIN(data->nprobes, VIR_STORAGE_BACKEND_REFRESH_WORKERS);
+    g_autofree virThread *threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (nworkers > 1)
+        threads = g_new0(virThread, nworkers - 1);
+
+    /* The calling thread probes too, so failing to spawn additional
+     * workers only makes the refresh slower */
+    for (i = 0; i + 1 < nworkers; i++) {
+        if (virThreadCreateFull(&threads[nthreads], true,
+                                virStorageBackendRefreshWorker,
+                                "vol-refresh", false, data) < 0) {
+            VIR_WARN("Unable to create volume refresh thread: %s",
+                     g_strerror(errno));
+            break;
+        }
+        nthreads++;
+    }
+
+    virStorageBackendRefreshWorker(data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+}
+
+
+/*
+ * List the pool directory and probe the entries which are not known
+ * yet or changed since they were last probed according to @stamps.
+ * This is called without the pool lock held.
  */
-int
-virStorageBackendRefreshLocal(virStoragePoolObjPtr pool)
+static int
+virStorageBackendRefreshScan(const char *path,
+                             GHashTable *stamps,
+                             GPtrArray *entries)
 {
-    virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
+    virStorageBackendRefreshData data = { .path = path };
+    g_autofree virStorageBackendRefreshEntryPtr *probes = NULL;
     g_autoptr(DIR) dir = NULL;
     struct dirent *ent;
-    struct statvfs sb;
-    struct stat statbuf;
     int direrr;
-    g_autoptr(virStorageVolDef) vol = NULL;
-    VIR_AUTOCLOSE fd = -1;
-    g_autoptr(virStorageSource) target = NULL;
+    size_t i;
 
-    if (virDirOpen(&dir, def->target.path) < 0)
+    if (virDirOpen(&dir, path) < 0)
         return -1;
 
-    while ((direrr = virDirRead(dir, &ent, def->target.path)) > 0) {
-        int err;
+    while ((direrr = virDirRead(dir, &ent, path)) > 0) {
+        virStorageBackendRefreshEntryPtr entry;
+        virStorageVolStampPtr stamp;
+        virStorageVolStamp current = { 0 };
+        g_autofree char *filepath = NULL;
 
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file '%s' with control characters under '%s'",
-                     ent->d_name, def->target.path);
+                     ent->d_name, path);
             continue;
         }
 
-        vol = g_new0(virStorageVolDef, 1);
+        entry = g_new0(virStorageBackendRefreshEntry, 1);
+        entry->name = g_strdup(ent->d_name);
+        g_ptr_array_add(entries, entry);
 
-        vol->name = g_strdup(ent->d_name);
+        filepath = g_strdup_printf("%s/%s", path, entry->name);
+        if (stat(filepath, &entry->sb) == 0) {
+            entry->haveStat = true;
+            virStorageBackendStampFromStat(&current, &entry->sb);
+        }
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.path = g_strdup_printf("%s/%s", def->target.path, vol->name);
+        if ((stamp = virHashLookup(stamps, entry->name)) &&
+            virStorageBackendStampEqual(stamp, &current))
+            entry->unchanged = true;
+    }
+    if (direrr < 0)
+        return -1;
 
-        vol->key = g_strdup(vol->target.path);
+    probes = g_new0(virStorageBackendRefreshEntryPtr, entries->len);
+    for (i = 0; i < entries->len; i++) {
+        virStorageBackendRefreshEntryPtr entry = g_ptr_array_index(entries, i);
 
-        if ((err = virStorageBackendRefreshVolTargetUpdate(vol)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            }
+        if (!entry->unchanged)
+            probes[data.nprobes++] = entry;
+    }
+    data.probes = probes;
+
+    VIR_DEBUG("Probing %zu of %u entries under '%s'",
+              data.nprobes, entries->len, path);
+
+    virStorageBackendRefreshProbeAll(&data);
+
+    return 0;
+}
+
+
+/*
+ * Merge the results of virStorageBackendRefreshScan into the volume
+ * list of @pool. Volumes which are being built or are in use are left
+ * alone, they are going to be updated by whoever is using them.
+ *
+ * If volumes were created or deleted while the directory was scanned,
+ * as indicated by @changed, the volume list of @pool is trusted over
+ * the scan for those volumes.
+ */
+static int
+virStorageBackendRefreshApply(virStoragePoolObjPtr pool,
+                              GHashTable *stamps,
+                              GPtrArray *entries,
+                              bool changed)
+{
+    g_autoptr(GHashTable) seen = virHashNew(NULL);
+    GHashTableIter htitr;
+    void *name;
+    size_t i;
+
+    for (i = 0; i < entries->len; i++) {
+        virStorageBackendRefreshEntryPtr entry = g_ptr_array_index(entries, i);
+        virStorageVolDefPtr vol;
+
+        if (entry->rc == -1) {
+            virErrorRestore(&entry->err);
             return -1;
         }
 
-        if (virStoragePoolObjAddVol(pool, vol) < 0)
+        if (virHashAddEntry(seen, entry->name, entry) < 0)
             return -1;
-        vol = NULL;
+
+        vol = virStorageVolDefFindByName(pool, entry->name);
+        if (vol && (vol->building || vol->in_use > 0))
+            continue;
+
+        /* Created or deleted after the scan started */
+        if (changed && virHashHasEntry(stamps, entry->name) != !!vol)
+            continue;
+
+        if (entry->unchanged) {
+            /* Reading a file only changes its access time */
+            if (vol && vol->target.timestamps) {
+#ifdef __APPLE__
+                vol->target.timestamps->atime = entry->sb.st_atimespec;
+#else /* ! __APPLE__ */
+                vol->target.timestamps->atime = entry->sb.st_atim;
+#endif /* ! __APPLE__ */
+            }
+            continue;
+        }
+
+        if (vol)
+            virStoragePoolObjRemoveVol(pool, vol);
+
+        /* Silently ignore non-regular files,
+         * eg 'lost+found', dangling symbolic link */
+        if (!entry->vol)
+            continue;
+
+        if (virStoragePoolObjAddVol(pool, entry->vol) < 0)
+            return -1;
+        entry->vol = NULL;
     }
-    if (direrr < 0)
+
+    /* Forget volumes whose files are gone */
+    g_hash_table_iter_init(&htitr, stamps);
+    while (g_hash_table_iter_next(&htitr, &name, NULL)) {
+        virStorageVolDefPtr vol;
+
+        if (virHashHasEntry(seen, name))
+            continue;
+
+        if (!(vol = virStorageVolDefFindByName(pool, name)) ||
+            vol->building || vol->in_use > 0)
+            continue;
+
+        /* The volume may have been deleted and created again after the
+         * scan passed its name */
+        if (changed && virFileExists(vol->target.path))
+            continue;
+
+        virStoragePoolObjRemoveVol(pool, vol);
+    }
+
+    return 0;
+}
+
+
+static int
+virStorageBackendRefreshStampCallback(virStorageVolDefPtr vol,
+                                      const void *opaque)
+{
+    GHashTable *stamps = (GHashTable *) opaque;
+    virStorageVolStampPtr stamp = g_new0(virStorageVolStamp, 1);
+
+    *stamp = vol->stamp;
+    return virHashAddEntry(stamps, vol->name, stamp);
+}
+
+
+struct _virStorageBackendRefreshJob {
+    GHashTable *stamps;             /* volumes known when the scan started */
+    GPtrArray *entries;             /* results of the scan */
+    unsigned long long volgen;      /* volume list generation at that time */
+};
+
+
+void
+virStorageBackendRefreshJobFree(virStorageBackendRefreshJob *job)
+{
+    if (!job)
+        return;
+
+    virHashFree(job->stamps);
+    if (job->entries)
+        g_ptr_array_unref(job->entries);
+    g_free(job);
+}
+
+
+/*
+ * First phase of refreshing a local pool, which lists the directory
+ * and probes new or changed files. The pool lock is released for the
+ * scan, the async job keeps the pool from being stopped, deleted or
+ * refreshed again meanwhile. Volumes may still be created or deleted
+ * though, virStorageBackendRefreshLocalApply takes care of that.
+ *
+ * Returns the scan results to be applied, NULL on error.
+ */
+virStorageBackendRefreshJob *
+virStorageBackendRefreshLocalScan(virStoragePoolObjPtr pool)
+{
+    virStoragePoolDefPtr def = virStoragePoolObjGetDef(pool);
+    g_autofree char *path = g_strdup(def->target.path);
+    g_autoptr(virStorageBackendRefreshJob) job = g_new0(virStorageBackendRefreshJob, 1);
+    int rc;
+
+    job->stamps = virHashNew(g_free);
+    job->entries = g_ptr_array_new_with_free_func((GDestroyNotify) virStorageBackendRefreshEntryFree);
+
+    if (virStoragePoolObjForEachVolume(pool,
+                                       virStorageBackendRefreshStampCallback,
+                                       job->stamps) < 0)
+        return NULL;
+
+    job->volgen = virStoragePoolObjGetVolGeneration(pool);
+
+    virStoragePoolObjIncrAsyncjobs(pool);
+    virObjectUnlock(pool);
+
+    rc = virStorageBackendRefreshScan(path, job->stamps, job->entries);
+
+    virObjectLock(pool);
+    virStoragePoolObjDecrAsyncjobs(pool);
+
+    if (rc < 0)
+        return NULL;
+
+    return g_steal_pointer(&job);
+}
+
+
+/*
+ * Second phase of refreshing a local pool, which updates the volume
+ * list of @pool according to @job.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStorageBackendRefreshLocalApply(virStoragePoolObjPtr pool,
+                                   virStorageBackendRefreshJob *job)
+{
+    bool changed = job->volgen != virStoragePoolObjGetVolGeneration(pool);
+
+    if (changed)
+        VIR_DEBUG("Volumes of pool '%s' changed during the scan",
+                  virStoragePoolObjGetDef(pool)->name);
+
+    return virStorageBackendRefreshApply(pool, job->stamps, job->entries,
+                                         changed);
+}
+
+
+/**
+ * Iterate over the pool's directory and enumerate all disk images
+ * within it. This is non-recursive.
+ *
+ * Volumes already known are only probed again if their file changed
+ * since. The directory is scanned and the files are probed concurrently
+ * without holding the pool lock, so that the pool remains usable while
+ * a big pool is refreshed.
+ */
+int
+virStorageBackendRefreshLocal(virStoragePoolObjPtr pool)
+{
+    virStoragePoolDefPtr def;
+    g_autoptr(virStorageBackendRefreshJob) job = NULL;
+    struct statvfs sb;
+    struct stat statbuf;
+    VIR_AUTOCLOSE fd = -1;
+    g_autoptr(virStorageSource) target = NULL;
+
+    if (!(job = virStorageBackendRefreshLocalScan(pool)) ||
+        virStorageBackendRefreshLocalApply(pool, job) < 0)
         return -1;
 
+    def = virStoragePoolObjGetDef(pool);
+
     target = virStorageSourceNew();
 
     if ((fd = open(def->target.path, O_RDONLY)) < 0) {
@@ -0,0 +1,259 @@
+/*
+ * storage_file_cache.c: cache of image headers
+ *
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "storage_file_cache.h"
+#include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_STORAGE
+
+VIR_LOG_INIT("storage_file.storage_file_cache");
+
+/*
+ * Probing the metadata of an image only depends on its path and the
+ * first VIR_STORAGE_MAX_HEADER bytes of its contents. Images shared by
+ * many domains, e.g. the base images of golden image deployments, are
+ * probed again on every domain start and every pool refresh, so their
+ * headers are kept here and the metadata is probed from the copy.
+ *
+ * Only regular files are cached. A file is identified by its device
+ * and inode and assumed unchanged as long as its size and modification
+ * time stay the same. Since the modification time has a limited
+ * granularity, files modified very recently are not cached at all,
+ * a write in the same tick as our read would go unnoticed otherwise.
+ */
+
+/* Files modified less than this many seconds ago are not cached */
+#define VIR_STORAGE_FILE_HEADER_CACHE_SETTLE 2
+
+typedef struct _virStorageFileHeaderCacheEntry virStorageFileHeaderCacheEntry;
+struct _virStorageFileHeaderCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    char *buf;
+    size_t len;
+};
+
+static virMutex cacheLock = VIR_MUTEX_INITIALIZER;
+static GHashTable *cacheEntries;
+static GQueue cacheOrder = G_QUEUE_INIT;
+static unsigned long long cacheHits;
+static unsigned long long cacheMisses;
+
+
+static guint
+virStorageFileHeaderCacheHash(gconstpointer key)
+{
+    const virStorageFileHeaderCacheEntry *entry = key;
+    guint64 hash = entry->ino;
+
+    hash = hash * 31 + entry->dev;
+    hash = hash * 31 + entry->size;
+    hash = hash * 31 + entry->mtime.tv_sec;
+    hash = hash * 31 + entry->mtime.tv_nsec;
+
+    return hash ^ (hash >> 32);
+}
+
+
+static gboolean
+virStorageFileHeaderCacheEqual(gconstpointer a,
+                               gconstpointer b)
+{
+    const virStorageFileHeaderCacheEntry *ea = a;
+    const virStorageFileHeaderCacheEntry *eb = b;
+
+    return ea->dev == eb->dev &&
+        ea->ino == eb->ino &&
+        ea->size == eb->size &&
+        ea->mtime.tv_sec == eb->mtime.tv_sec &&
+        ea->mtime.tv_nsec == eb->mtime.tv_nsec;
+}
+
+
+static void
+virStorageFileHeaderCacheEntryFree(void *opaque)
+{
+    virStorageFileHeaderCacheEntry *entry = opaque;
+
+    g_free(entry->buf);
+    g_free(entry);
+}
+
+
+static bool
+virStorageFileHeaderCacheFillKey(virStorageFileHeaderCacheEntry *key,
+                                 const struct stat *sb)
+{
+    if (!S_ISREG(sb->st_mode))
+        return false;
+
+    key->dev = sb->st_dev;
+    key->ino = sb->st_ino;
+    key->size = sb->st_size;
+#ifdef __APPLE__
+    key->mtime = sb->st_mtimespec;
+#else /* ! __APPLE__ */
+    key->mtime = sb->st_mtim;
+#endif /* ! __APPLE__ */
+
+    return true;
+}
+
+
+/**
+ * virStorageFileHeaderCacheLookup:
+ * @path: path of the image, for debugging only
+ * @sb: result of stat() on the image
+ * @buf: filled with a copy of the cached header
+ * @len: filled with the length of @buf
+ *
+ * Returns true and fills @buf and @len if the header of the file
+ * described by @sb is cached, false otherwise.
+ */
+bool
+virStorageFileHeaderCacheLookup(const char *path,
+                                const struct stat *sb,
+                                char **buf,
+                                size_t *len)
+{
+    virStorageFileHeaderCacheEntry key = { 0 };
+    virStorageFileHeaderCacheEntry *entry = NULL;
+
+    if (!virStorageFileHeaderCacheFillKey(&key, sb))
+        return false;
+
+    virMutexLock(&cacheLock);
+
+    if (cacheEntries)
+        entry = g_hash_table_lookup(cacheEntries, &key);
+
+    if (entry) {
+        *buf = g_new0(char, entry->len);
+        memcpy(*buf, entry->buf, entry->len);
+        *len = entry->len;
+        cacheHits++;
+    } else {
+        cacheMisses++;
+    }
+
+    VIR_DEBUG("path=%s %s hits=%llu misses=%llu",
+              NULLSTR(path), entry ? "hit" : "miss", cacheHits, cacheMisses);
+
+    virMutexUnlock(&cacheLock);
+
+    return !!entry;
+}
+
+
+/**
+ * virStorageFileHeaderCacheAdd:
+ * @path: path of the image, for debugging only
+ * @sb: result of stat() on the image before @buf was read
+ * @buf: header of the image
+ * @len: length of @buf
+ *
+ * Remember the header of the file described by @sb, evicting the
+ * oldest entry if the cache is full.
+ */
+void
+virStorageFileHeaderCacheAdd(const char *path,
+                             const struct stat *sb,
+                             const char *buf,
+                             size_t len)
+{
+    virStorageFileHeaderCacheEntry *entry;
+    virStorageFileHeaderCacheEntry key = { 0 };
+
+    if (len == 0 ||
+        !virStorageFileHeaderCacheFillKey(&key, sb))
+        return;
+
+    if (key.mtime.tv_sec + VIR_STORAGE_FILE_HEADER_CACHE_SETTLE >
+        g_get_real_time() / G_USEC_PER_SEC) {
+        VIR_DEBUG("Not caching recently modified '%s'", NULLSTR(path));
+        return;
+    }
+
+    virMutexLock(&cacheLock);
+
+    if (!cacheEntries) {
+        cacheEntries = g_hash_table_new_full(virStorageFileHeaderCacheHash,
+                                             virStorageFileHeaderCacheEqual,
+                                             NULL,
+                                             virStorageFileHeaderCacheEntryFree);
+    }
+
+    if (g_hash_table_contains(cacheEntries, &key))
+        goto cleanup;
+
+    while (g_hash_table_size(cacheEntries) >= VIR_STORAGE_FILE_HEADER_CACHE_SIZE)
+        g_hash_table_remove(cacheEntries, g_queue_pop_head(&cacheOrder));
+
+    entry = g_new0(virStorageFileHeaderCacheEntry, 1);
+    *entry = key;
+    entry->buf = g_new0(char, len);
+    memcpy(entry->buf, buf, len);
+    entry->len = len;
+
+    g_hash_table_add(cacheEntries, entry);
+    g_queue_push_tail(&cacheOrder, entry);
+
+ cleanup:
+    virMutexUnlock(&cacheLock);
+}
+
+
+/**
+ * virStorageFileHeaderCacheGetStats:
+ * @hits: filled with the number of lookups served from the cache
+ * @misses: filled with the number of lookups which were not
+ */
+void
+virStorageFileHeaderCacheGetStats(unsigned long long *hits,
+                                  unsigned long long *misses)
+{
+    virMutexLock(&cacheLock);
+    *hits = cacheHits;
+    *misses = cacheMisses;
+    virMutexUnlock(&cacheLock);
+}
+
+
+/**
+ * virStorageFileHeaderCacheClear:
+ *
+ * Drop all cached headers and reset the statistics.
+ */
+void
+virStorageFileHeaderCacheClear(void)
+{
+    virMutexLock(&cacheLock);
+    g_queue_clear(&cacheOrder);
+    g_clear_pointer(&cacheEntries, g_hash_table_unref);
+    cacheHits = 0;
+    cacheMisses = 0;
+    virMutexUnlock(&cacheLock);
+}
@@ -0,0 +1,47 @@
+/*
+ * storage_file_cache.h: cache of image headers
+ *
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include "internal.h"
+
+/* Maximum number of image headers kept in the cache */
+#define VIR_STORAGE_FILE_HEADER_CACHE_SIZE 256
+
+bool
+virStorageFileHeaderCacheLookup(const char *path,
+                                const struct stat *sb,
+                                char **buf,
+                                size_t *len);
+
+void
+virStorageFileHeaderCacheAdd(const char *path,
+                             const struct stat *sb,
+                             const char *buf,
+                             size_t len);
+
+void
+virStorageFileHeaderCacheGetStats(unsigned long long *hits,
+                                  unsigned long long *misses);
+
+void
+virStorageFileHeaderCacheClear(void);
@@ -26,6 +26,7 @@
 
 #include "internal.h"
 #include "storage_file_backend.h"
+#include "storage_file_cache.h"
 #include "storage_file_probe.h"
 #include "storage_source.h"
 #include "storage_source_backingstore.h"
@@ -155,6 +156,7 @@ virStorageSourceGetMetadataFromFD(const char *path,
 
 {
     ssize_t len = VIR_STORAGE_MAX_HEADER;
+    size_t headerLen;
     struct stat sb;
     g_autofree char *buf = NULL;
     g_autoptr(virStorageSource) meta = NULL;
@@ -176,14 +178,20 @@ virStorageSourceGetMetadataFromFD(const char *path,
         return g_steal_pointer(&meta);
     }
 
-    if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
-        virReportSystemError(errno, _("cannot seek to start of '%s'"), meta->path);
-        return NULL;
-    }
+    if (virStorageFileHeaderCacheLookup(path, &sb, &buf, &headerLen)) {
+        len = headerLen;
+    } else {
+        if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+            virReportSystemError(errno, _("cannot seek to start of '%s'"), meta->path);
+            return NULL;
+        }
 
-    if ((len = virFileReadHeaderFD(fd, len, &buf)) < 0) {
-        virReportSystemError(errno, _("cannot read header '%s'"), meta->path);
-        return NULL;
+        if ((len = virFileReadHeaderFD(fd, len, &buf)) < 0) {
+            virReportSystemError(errno, _("cannot read header '%s'"), meta->path);
+            return NULL;
+        }
+
+        virStorageFileHeaderCacheAdd(path, &sb, buf, len);
     }
 
     if (virStorageFileProbeGetMetadata(meta, buf, len) < 0)
@@ -1303,6 +1311,8 @@ virStorageSourceGetMetadataRecurseReadHeader(virStorageSourcePtr src,
     int ret = -1;
     const char *uniqueName;
     ssize_t len;
+    struct stat sb;
+    bool cacheable = false;
 
     if (virStorageSourceInitAs(src, uid, gid) < 0)
         return -1;
@@ -1325,9 +1335,29 @@ virStorageSourceGetMetadataRecurseReadHeader(virStorageSourcePtr src,
     if (virHashAddEntry(cycle, uniqueName, NULL) < 0)
         goto cleanup;
 
+    /* Headers of local images shared by many chains are cached */
+    if (virStorageSourceGetActualType(src) == VIR_STORAGE_TYPE_FILE &&
+        virStorageSourceStat(src, &sb) == 0) {
+        cacheable = true;
+
+        /* The cache is shared by all users, so make sure @uid:@gid
+         * could read the header themselves */
+        if (virStorageFileHeaderCacheLookup(src->path, &sb, buf, headerLen)) {
+            if (virStorageSourceAccess(src, R_OK) == 0) {
+                ret = 0;
+                goto cleanup;
+            }
+
+            VIR_FREE(*buf);
+        }
+    }
+
     if ((len = virStorageSourceRead(src, 0, VIR_STORAGE_MAX_HEADER, buf)) < 0)
         goto cleanup;
 
+    if (cacheable)
+        virStorageFileHeaderCacheAdd(src->path, &sb, *buf, len);
+
     *headerLen = len;
     ret = 0;
 
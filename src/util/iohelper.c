@@ -21,6 +21,7 @@
  *   - Read existing file
  *   - Write existing file
  *   - Create & write new file
+ *   - Compress or decompress stdin to stdout
  */
 
 #include <config.h>
@@ -28,6 +29,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#if WITH_ZSTD
+# include <zstd.h>
+#endif
 
 #include "virthread.h"
 #include "virfile.h"
@@ -43,35 +47,198 @@
 # define O_DIRECT 0
 #endif
 
+/* Data is read into a ring of buffers by the main thread and written
+ * out by a separate thread, so that reading from QEMU and writing to
+ * the disk overlap instead of taking turns. */
+#define IOHELPER_NBUFS 8
+#define IOHELPER_BUFLEN (1024 * 1024)
+#define IOHELPER_ALIGN (64 * 1024)
+
+typedef enum {
+    RUN_IO_WRITE_OK = 0,
+    RUN_IO_WRITE_FAILED,
+    RUN_IO_TRUNCATE_FAILED,
+} runIOWriteStatus;
+
+typedef struct _runIOBuf runIOBuf;
+struct _runIOBuf {
+    void *base;         /* Location to be freed */
+    char *data;         /* Aligned location within base */
+    ssize_t len;
+};
+
+typedef struct _runIOData runIOData;
+struct _runIOData {
+    virMutex lock;
+    virCond cond;
+
+    runIOBuf bufs[IOHELPER_NBUFS];
+    size_t head;        /* next buffer to be filled by the reader */
+    size_t tail;        /* next buffer to be written by the writer */
+    size_t nfull;       /* buffers filled but not yet written */
+    bool eof;           /* the reader has read everything */
+    bool failed;        /* either side failed, stop as soon as possible */
+
+    int fdout;
+    bool directWrite;   /* @fdout is our file opened with O_DIRECT */
+
+    /* Errors are thread local, the writer leaves its error here for
+     * the main thread to report */
+    runIOWriteStatus writeStatus;
+    int writeErrno;
+};
+
+
+static void
+runIOBufAlloc(runIOBuf *buf)
+{
+#if WITH_POSIX_MEMALIGN
+    if (posix_memalign(&buf->base, IOHELPER_ALIGN, IOHELPER_BUFLEN))
+        abort();
+    buf->data = buf->base;
+#else
+    buf->base = g_new0(char, IOHELPER_BUFLEN + IOHELPER_ALIGN - 1);
+    buf->data = (char *) (((intptr_t) buf->base + IOHELPER_ALIGN - 1) &
+                          ~((intptr_t) IOHELPER_ALIGN - 1));
+#endif
+}
+
+
+static void
+runIOWriteFail(runIOData *data,
+               runIOWriteStatus status)
+{
+    virMutexLock(&data->lock);
+    data->writeStatus = status;
+    data->writeErrno = errno;
+    data->failed = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+runIOWriter(void *opaque)
+{
+    runIOData *data = opaque;
+    unsigned long long total = 0;
+
+    while (true) {
+        runIOBuf *buf;
+
+        virMutexLock(&data->lock);
+        while (data->nfull == 0 && !data->eof && !data->failed) {
+            if (virCondWait(&data->cond, &data->lock) < 0) {
+                virMutexUnlock(&data->lock);
+                runIOWriteFail(data, RUN_IO_WRITE_FAILED);
+                return;
+            }
+        }
+
+        if (data->failed || data->nfull == 0) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+
+        buf = &data->bufs[data->tail];
+        virMutexUnlock(&data->lock);
+
+        total += buf->len;
+
+        /* handle last write size align in direct case */
+        if (buf->len < IOHELPER_BUFLEN && data->directWrite) {
+            ssize_t aligned_len = (buf->len + IOHELPER_ALIGN - 1) &
+                                  ~((ssize_t) IOHELPER_ALIGN - 1);
+
+            memset(buf->data + buf->len, 0, aligned_len - buf->len);
+
+            if (safewrite(data->fdout, buf->data, aligned_len) < 0) {
+                runIOWriteFail(data, RUN_IO_WRITE_FAILED);
+                return;
+            }
+
+            if (ftruncate(data->fdout, total) < 0) {
+                runIOWriteFail(data, RUN_IO_TRUNCATE_FAILED);
+                return;
+            }
+        } else if (safewrite(data->fdout, buf->data, buf->len) < 0) {
+            runIOWriteFail(data, RUN_IO_WRITE_FAILED);
+            return;
+        }
+
+        virMutexLock(&data->lock);
+        data->tail = (data->tail + 1) % IOHELPER_NBUFS;
+        data->nfull--;
+        virCondBroadcast(&data->cond);
+        virMutexUnlock(&data->lock);
+    }
+}
+
+
+/* Returns the next free buffer or NULL if the writer failed */
+static runIOBuf *
+runIOReaderGetBuf(runIOData *data)
+{
+    runIOBuf *buf = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->nfull == IOHELPER_NBUFS && !data->failed) {
+        if (virCondWait(&data->cond, &data->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait on condition"));
+            data->failed = true;
+            virCondBroadcast(&data->cond);
+        }
+    }
+
+    if (!data->failed)
+        buf = &data->bufs[data->head];
+    virMutexUnlock(&data->lock);
+
+    return buf;
+}
+
+
+/* Hands @buf filled with @got bytes over to the writer, or signals the
+ * end of input if @got is zero or the reader failed if it is negative */
+static void
+runIOReaderPutBuf(runIOData *data,
+                  runIOBuf *buf,
+                  ssize_t got)
+{
+    virMutexLock(&data->lock);
+    if (got < 0) {
+        data->failed = true;
+    } else if (got == 0) {
+        data->eof = true;
+    } else {
+        buf->len = got;
+        data->head = (data->head + 1) % IOHELPER_NBUFS;
+        data->nfull++;
+    }
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
 static int
 runIO(const char *path, int fd, int oflags)
 {
-    g_autofree void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
-    intptr_t alignMask = 64*1024 - 1;
+    runIOData data = { 0 };
+    virThread writer;
+    bool locksInitialized = false;
     int ret = -1;
-    int fdin, fdout;
+    int fdin;
     const char *fdinname, *fdoutname;
-    unsigned long long total = 0;
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     off_t end = 0;
-
-#if WITH_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen))
-        abort();
-    buf = base;
-#else
-    buf = g_new0(char, buflen + alignMask);
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
-#endif
+    size_t i;
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
         fdin = fd;
         fdinname = path;
-        fdout = STDOUT_FILENO;
+        data.fdout = STDOUT_FILENO;
         fdoutname = "stdout";
         /* To make the implementation simpler, we give up on any
          * attempt to use O_DIRECT in a non-trivial manner.  */
@@ -84,8 +251,9 @@ runIO(const char *path, int fd, int oflags)
     case O_WRONLY:
         fdin = STDIN_FILENO;
         fdinname = "stdin";
-        fdout = fd;
+        data.fdout = fd;
         fdoutname = path;
+        data.directWrite = direct;
         /* To make the implementation simpler, we give up on any
          * attempt to use O_DIRECT in a non-trivial manner.  */
         if (direct && (end = lseek(fd, 0, SEEK_END)) != 0) {
@@ -103,9 +271,33 @@ runIO(const char *path, int fd, int oflags)
         goto cleanup;
     }
 
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize condition"));
+        virMutexDestroy(&data.lock);
+        goto cleanup;
+    }
+    locksInitialized = true;
+
+    for (i = 0; i < IOHELPER_NBUFS; i++)
+        runIOBufAlloc(&data.bufs[i]);
+
+    if (virThreadCreate(&writer, true, runIOWriter, &data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create writer thread"));
+        goto cleanup;
+    }
+
     while (1) {
+        runIOBuf *buf;
         ssize_t got;
 
+        if (!(buf = runIOReaderGetBuf(&data)))
+            break;
+
         /* If we read with O_DIRECT from file we can't use saferead as
          * it can lead to unaligned read after reading last bytes.
          * If we write with O_DIRECT use should use saferead so that
@@ -113,49 +305,40 @@ runIO(const char *path, int fd, int oflags)
          * In other cases using saferead reduces number of syscalls.
          */
         if (fdin == fd && direct) {
-            if ((got = read(fdin, buf, buflen)) < 0 &&
+            if ((got = read(fdin, buf->data, IOHELPER_BUFLEN)) < 0 &&
                 errno == EINTR)
                 continue;
         } else {
-            got = saferead(fdin, buf, buflen);
+            got = saferead(fdin, buf->data, IOHELPER_BUFLEN);
         }
 
-        if (got < 0) {
+        if (got < 0)
             virReportSystemError(errno, _("Unable to read %s"), fdinname);
-            goto cleanup;
-        }
-        if (got == 0)
-            break;
-
-        total += got;
-
-        /* handle last write size align in direct case */
-        if (got < buflen && direct && fdout == fd) {
-            ssize_t aligned_got = (got + alignMask) & ~alignMask;
 
-            memset(buf + got, 0, aligned_got - got);
-
-            if (safewrite(fdout, buf, aligned_got) < 0) {
-                virReportSystemError(errno, _("Unable to write %s"), fdoutname);
-                goto cleanup;
-            }
-
-            if (ftruncate(fd, total) < 0) {
-                virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
-                goto cleanup;
-            }
+        runIOReaderPutBuf(&data, buf, got);
 
+        if (got <= 0)
             break;
-        }
+    }
 
-        if (safewrite(fdout, buf, got) < 0) {
-            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
-            goto cleanup;
-        }
+    virThreadJoin(&writer);
+
+    switch (data.writeStatus) {
+    case RUN_IO_WRITE_OK:
+        break;
+    case RUN_IO_WRITE_FAILED:
+        virReportSystemError(data.writeErrno, _("Unable to write %s"), fdoutname);
+        goto cleanup;
+    case RUN_IO_TRUNCATE_FAILED:
+        virReportSystemError(data.writeErrno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
     }
 
+    if (data.failed)
+        goto cleanup;
+
     /* Ensure all data is written */
-    if (virFileDataSync(fdout) < 0) {
+    if (virFileDataSync(data.fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
             /* fdatasync() may fail on some special FDs, e.g. pipes */
             virReportSystemError(errno, _("unable to fsync %s"), fdoutname);
@@ -166,6 +349,12 @@ runIO(const char *path, int fd, int oflags)
     ret = 0;
 
  cleanup:
+    for (i = 0; i < IOHELPER_NBUFS; i++)
+        g_free(data.bufs[i].base);
+    if (locksInitialized) {
+        virCondDestroy(&data.cond);
+        virMutexDestroy(&data.lock);
+    }
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
@@ -174,6 +363,510 @@ runIO(const char *path, int fd, int oflags)
     return ret;
 }
 
+#if WITH_ZSTD
+/* Compressed streams consist of independent zstd frames holding up to
+ * IOHELPER_BUFLEN bytes of data each, so that several threads can
+ * compress or decompress them at once. The stream ends with a seek
+ * table in the zstd seekable format, which lets other tools access the
+ * data at random. Since decompression has to find frame boundaries and
+ * sizes upfront, only streams produced this way can be decompressed. */
+# define IOHELPER_ZSTD_MAX_WORKERS 16
+# define IOHELPER_ZSTD_LEVEL 3
+
+# define IOHELPER_ZSTD_SKIPPABLE_MAGIC 0x184D2A50U
+# define IOHELPER_ZSTD_SKIPPABLE_MASK 0xFFFFFFF0U
+# define IOHELPER_ZSTD_SEEK_TABLE_MAGIC 0x184D2A5EU
+# define IOHELPER_ZSTD_SEEKABLE_MAGIC 0x8F92EAB1U
+
+typedef struct _runZstdChunk runZstdChunk;
+struct _runZstdChunk {
+    char *in;
+    size_t inlen;
+    char *out;
+    size_t outlen;
+    bool done;          /* @out holds the processed contents of @in */
+};
+
+typedef struct _runZstdData runZstdData;
+struct _runZstdData {
+    virMutex lock;
+    virCond cond;
+
+    bool decompress;
+
+    runZstdChunk *chunks;
+    size_t nchunks;
+    size_t bufsize;     /* size of both buffers of each chunk */
+    size_t head;        /* next chunk to be filled by the reader */
+    size_t next;        /* next chunk to be processed by a worker */
+    size_t tail;        /* next chunk to be written by the writer */
+    size_t nfull;       /* chunks filled but not yet written */
+    size_t ntodo;       /* chunks filled but not yet picked by a worker */
+    bool eof;           /* the reader has read everything */
+    bool failed;        /* any thread failed, stop as soon as possible */
+
+    /* Errors are thread local, the first thread to fail leaves its
+     * error here for the main thread to report */
+    const char *errmsg;
+    int errnum;
+};
+
+
+static void
+runZstdFailLocked(runZstdData *data,
+                  const char *errmsg,
+                  int errnum)
+{
+    if (!data->failed) {
+        data->errmsg = errmsg;
+        data->errnum = errnum;
+        data->failed = true;
+    }
+    virCondBroadcast(&data->cond);
+}
+
+
+static void
+runZstdFail(runZstdData *data,
+            const char *errmsg,
+            int errnum)
+{
+    virMutexLock(&data->lock);
+    runZstdFailLocked(data, errmsg, errnum);
+    virMutexUnlock(&data->lock);
+}
+
+
+static void
+runZstdWait(runZstdData *data)
+{
+    if (virCondWait(&data->cond, &data->lock) < 0)
+        runZstdFailLocked(data, _("failed to wait on condition"), errno);
+}
+
+
+static uint32_t
+runZstdGetLE32(const char *buf)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static void
+runZstdPutLE32(char *buf,
+               uint32_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+    buf[2] = (val >> 16) & 0xff;
+    buf[3] = (val >> 24) & 0xff;
+}
+
+
+static void
+runZstdWorker(void *opaque)
+{
+    runZstdData *data = opaque;
+    ZSTD_CCtx *cctx = NULL;
+    ZSTD_DCtx *dctx = NULL;
+
+    if (data->decompress)
+        dctx = ZSTD_createDCtx();
+    else
+        cctx = ZSTD_createCCtx();
+
+    if (!cctx && !dctx) {
+        runZstdFail(data, _("failed to create zstd context"), ENOMEM);
+        return;
+    }
+
+    while (true) {
+        runZstdChunk *chunk;
+        size_t rc;
+
+        virMutexLock(&data->lock);
+        while (data->ntodo == 0 && !data->eof && !data->failed)
+            runZstdWait(data);
+
+        if (data->failed || data->ntodo == 0) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+
+        chunk = &data->chunks[data->next];
+        data->next = (data->next + 1) % data->nchunks;
+        data->ntodo--;
+        virMutexUnlock(&data->lock);
+
+        if (data->decompress)
+            rc = ZSTD_decompressDCtx(dctx, chunk->out, data->bufsize,
+                                     chunk->in, chunk->inlen);
+        else
+            rc = ZSTD_compressCCtx(cctx, chunk->out, data->bufsize,
+                                   chunk->in, chunk->inlen,
+                                   IOHELPER_ZSTD_LEVEL);
+
+        if (ZSTD_isError(rc)) {
+            runZstdFail(data, ZSTD_getErrorName(rc), 0);
+            break;
+        }
+
+        virMutexLock(&data->lock);
+        chunk->outlen = rc;
+        chunk->done = true;
+        virCondBroadcast(&data->cond);
+        virMutexUnlock(&data->lock);
+    }
+
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+
+/* Writes the seek table of a compressed stream whose frames have sizes
+ * described by @entries, a pair of compressed and decompressed size
+ * per frame. */
+static int
+runZstdWriteSeekTable(uint32_t *entries,
+                      size_t nframes)
+{
+    size_t len = 8 + nframes * 8 + 9;
+    g_autofree char *buf = g_new0(char, len);
+    char *p = buf;
+    size_t i;
+
+    runZstdPutLE32(p, IOHELPER_ZSTD_SEEK_TABLE_MAGIC);
+    runZstdPutLE32(p + 4, len - 8);
+    p += 8;
+
+    for (i = 0; i < nframes * 2; i++, p += 4)
+        runZstdPutLE32(p, entries[i]);
+
+    /* number of frames, descriptor without checksums, magic */
+    runZstdPutLE32(p, nframes);
+    p[4] = 0;
+    runZstdPutLE32(p + 5, IOHELPER_ZSTD_SEEKABLE_MAGIC);
+
+    return safewrite(STDOUT_FILENO, buf, len);
+}
+
+
+static void
+runZstdWriter(void *opaque)
+{
+    runZstdData *data = opaque;
+    g_autofree uint32_t *entries = NULL;
+    size_t nframes = 0;
+    size_t nentries = 0;
+
+    while (true) {
+        runZstdChunk *chunk;
+
+        virMutexLock(&data->lock);
+        while (!data->failed &&
+               !(data->nfull > 0 && data->chunks[data->tail].done) &&
+               !(data->eof && data->nfull == 0))
+            runZstdWait(data);
+
+        if (data->failed) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+
+        if (data->nfull == 0) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+
+        chunk = &data->chunks[data->tail];
+        virMutexUnlock(&data->lock);
+
+        if (safewrite(STDOUT_FILENO, chunk->out, chunk->outlen) < 0) {
+            runZstdFail(data, _("Unable to write stdout"), errno);
+            return;
+        }
+
+        if (!data->decompress) {
+            if (nframes * 2 == nentries) {
+                nentries = MAX(nentries * 2, 64);
+                entries = g_renew(uint32_t, entries, nentries);
+            }
+            entries[nframes * 2] = chunk->outlen;
+            entries[nframes * 2 + 1] = chunk->inlen;
+            nframes++;
+        }
+
+        virMutexLock(&data->lock);
+        chunk->done = false;
+        data->tail = (data->tail + 1) % data->nchunks;
+        data->nfull--;
+        virCondBroadcast(&data->cond);
+        virMutexUnlock(&data->lock);
+    }
+
+    if (!data->decompress &&
+        runZstdWriteSeekTable(entries, nframes) < 0)
+        runZstdFail(data, _("Unable to write stdout"), errno);
+}
+
+
+/* Returns the next free chunk or NULL if another thread failed */
+static runZstdChunk *
+runZstdGetChunk(runZstdData *data)
+{
+    runZstdChunk *chunk = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->nfull == data->nchunks && !data->failed)
+        runZstdWait(data);
+
+    if (!data->failed)
+        chunk = &data->chunks[data->head];
+    virMutexUnlock(&data->lock);
+
+    return chunk;
+}
+
+
+/* Hands @chunk filled with @len bytes over to the workers */
+static void
+runZstdPutChunk(runZstdData *data,
+                runZstdChunk *chunk,
+                size_t len)
+{
+    virMutexLock(&data->lock);
+    chunk->inlen = len;
+    data->head = (data->head + 1) % data->nchunks;
+    data->nfull++;
+    data->ntodo++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Tells other threads that the reader either read everything or
+ * failed, in which case it has already reported an error */
+static void
+runZstdStop(runZstdData *data,
+            bool failed)
+{
+    virMutexLock(&data->lock);
+    if (failed)
+        data->failed = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static int
+runZstdReadChunks(runZstdData *data)
+{
+    while (true) {
+        runZstdChunk *chunk;
+        ssize_t got;
+
+        if (!(chunk = runZstdGetChunk(data)))
+            return -1;
+
+        if ((got = saferead(STDIN_FILENO, chunk->in, IOHELPER_BUFLEN)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+
+        if (got == 0)
+            return 0;
+
+        runZstdPutChunk(data, chunk, got);
+    }
+}
+
+
+/* Splits the compressed input into frames and hands them over to the
+ * workers, skipping the seek table and any other skippable frames */
+static int
+runZstdReadFrames(runZstdData *data)
+{
+    size_t accsize = data->bufsize + IOHELPER_BUFLEN;
+    g_autofree char *acc = g_new0(char, accsize);
+    size_t acclen = 0;
+    unsigned long long skip = 0;
+    bool eof = false;
+
+    while (!eof) {
+        size_t off = 0;
+        ssize_t got;
+
+        if ((got = saferead(STDIN_FILENO, acc + acclen, accsize - acclen)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+
+        eof = got == 0;
+        acclen += got;
+
+        while (off < acclen) {
+            const char *frame = acc + off;
+            size_t len = acclen - off;
+            unsigned long long size;
+            size_t framelen;
+            runZstdChunk *chunk;
+
+            if (skip > 0) {
+                size_t n = MIN(skip, len);
+
+                skip -= n;
+                off += n;
+                continue;
+            }
+
+            if (len < 8)
+                break;
+
+            if ((runZstdGetLE32(frame) & IOHELPER_ZSTD_SKIPPABLE_MASK) ==
+                IOHELPER_ZSTD_SKIPPABLE_MAGIC) {
+                skip = 8 + (unsigned long long) runZstdGetLE32(frame + 4);
+                continue;
+            }
+
+            /* The frame is most likely just incomplete, unless there is
+             * no more data or it would not fit into a chunk anyway */
+            framelen = ZSTD_findFrameCompressedSize(frame, len);
+            if (ZSTD_isError(framelen)) {
+                if (!eof && len < data->bufsize)
+                    break;
+
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("malformed compressed stream: %s"),
+                               ZSTD_getErrorName(framelen));
+                return -1;
+            }
+
+            /* Frames written by libvirt always fit into a chunk, but a
+             * frame padded with raw or empty blocks can be larger */
+            size = ZSTD_getFrameContentSize(frame, framelen);
+            if (framelen > data->bufsize ||
+                size == ZSTD_CONTENTSIZE_UNKNOWN ||
+                size == ZSTD_CONTENTSIZE_ERROR ||
+                size > IOHELPER_BUFLEN) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("compressed stream was not produced by libvirt"));
+                return -1;
+            }
+
+            if (!(chunk = runZstdGetChunk(data)))
+                return -1;
+
+            memcpy(chunk->in, frame, framelen);
+            runZstdPutChunk(data, chunk, framelen);
+            off += framelen;
+        }
+
+        memmove(acc, acc + off, acclen - off);
+        acclen -= off;
+    }
+
+    if (acclen > 0 || skip > 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("compressed stream is truncated"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+runZstd(bool decompress)
+{
+    runZstdData data = { 0 };
+    g_autofree virThread *workers = NULL;
+    virThread writer;
+    size_t nworkers = MIN(g_get_num_processors(), IOHELPER_ZSTD_MAX_WORKERS);
+    size_t nstarted = 0;
+    bool writerStarted = false;
+    int rc = -1;
+    int ret = -1;
+    size_t i;
+
+    data.decompress = decompress;
+    data.bufsize = ZSTD_compressBound(IOHELPER_BUFLEN);
+    data.nchunks = 2 * nworkers + 2;
+    data.chunks = g_new0(runZstdChunk, data.nchunks);
+    for (i = 0; i < data.nchunks; i++) {
+        data.chunks[i].in = g_new0(char, data.bufsize);
+        data.chunks[i].out = g_new0(char, data.bufsize);
+    }
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize condition"));
+        virMutexDestroy(&data.lock);
+        goto cleanup;
+    }
+
+    workers = g_new0(virThread, nworkers);
+    for (i = 0; i < nworkers; i++) {
+        if (virThreadCreate(&workers[i], true, runZstdWorker, &data) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create worker thread"));
+            goto join;
+        }
+        nstarted++;
+    }
+
+    if (virThreadCreate(&writer, true, runZstdWriter, &data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create writer thread"));
+        goto join;
+    }
+    writerStarted = true;
+
+    if (decompress)
+        rc = runZstdReadFrames(&data);
+    else
+        rc = runZstdReadChunks(&data);
+
+ join:
+    runZstdStop(&data, rc < 0);
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i]);
+    if (writerStarted)
+        virThreadJoin(&writer);
+
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+
+    if (data.errmsg) {
+        if (data.errnum)
+            virReportSystemError(data.errnum, "%s", data.errmsg);
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s", data.errmsg);
+        goto cleanup;
+    }
+
+    if (data.failed)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < data.nchunks; i++) {
+        g_free(data.chunks[i].in);
+        g_free(data.chunks[i].out);
+    }
+    g_free(data.chunks);
+    return ret;
+}
+#endif /* WITH_ZSTD */
+
 static const char *program_name;
 
 G_GNUC_NORETURN static void
@@ -182,7 +875,9 @@ usage(int status)
     if (status) {
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
-        printf(_("Usage: %s FILENAME FD"), program_name);
+        printf(_("Usage: %s FILENAME FD\n"
+                 "       %s --compress|--decompress FORMAT"),
+               program_name, program_name);
     }
     exit(status);
 }
@@ -206,7 +901,25 @@ main(int argc, char **argv)
 
     if (argc > 1 && STREQ(argv[1], "--help"))
         usage(EXIT_SUCCESS);
-    if (argc == 3) { /* FILENAME FD */
+    if (argc == 3 &&
+        (STREQ(argv[1], "--compress") || STREQ(argv[1], "--decompress"))) {
+        /* --compress|--decompress FORMAT */
+        path = "stdin";
+        if (STRNEQ(argv[2], "zstd")) {
+            fprintf(stderr, _("%s: unsupported compression format %s"),
+                    program_name, argv[2]);
+            exit(EXIT_FAILURE);
+        }
+#if WITH_ZSTD
+        if (runZstd(STREQ(argv[1], "--decompress")) < 0)
+            goto error;
+        return 0;
+#else
+        fprintf(stderr, _("%s: zstd support is not available"),
+                program_name);
+        exit(EXIT_FAILURE);
+#endif
+    } else if (argc == 3) { /* FILENAME FD */
         if (virStrToLong_i(argv[2], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
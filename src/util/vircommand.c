@@ -32,6 +32,10 @@
 #endif
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef __linux__
+# include <sched.h>
+# include <sys/syscall.h>
+#endif
 
 #if WITH_CAPNG
 # include <cap-ng.h>
@@ -609,6 +613,304 @@ virCommandMassClose(virCommandPtr cmd,
 
 # endif /* ! __FreeBSD__ */
 
+# if defined(__linux__) && defined(__NR_close_range)
+#  define VIR_EXEC_SPAWN 1
+
+#  define VIR_EXEC_SPAWN_STACK_SIZE (64 * 1024)
+
+/* Steps of virExecSpawnChild, the one which failed tells the parent which
+ * error a forked child would report */
+typedef enum {
+    VIR_EXEC_SPAWN_STAGE_SIGNALS,
+    VIR_EXEC_SPAWN_STAGE_STDIN,
+    VIR_EXEC_SPAWN_STAGE_STDOUT,
+    VIR_EXEC_SPAWN_STAGE_STDERR,
+    VIR_EXEC_SPAWN_STAGE_CLOSE,
+    VIR_EXEC_SPAWN_STAGE_KEEPFD,
+    VIR_EXEC_SPAWN_STAGE_CHDIR,
+    VIR_EXEC_SPAWN_STAGE_SIGMASK,
+    VIR_EXEC_SPAWN_STAGE_EXEC,
+} virExecSpawnStage;
+
+typedef struct _virExecSpawnData virExecSpawnData;
+struct _virExecSpawnData {
+    virCommandPtr cmd;
+    const char *binary;
+    int childin;
+    int childout;
+    int childerr;
+    int *keepfds; /* sorted FDs above STDERR_FILENO to keep open */
+    size_t nkeepfds;
+    virExecSpawnStage stage; /* step the child is at, or failed at */
+    int err; /* errno of the failed step in the child */
+    int failfd; /* FD which could not be kept open */
+};
+
+
+static int
+virExecCloseRange(unsigned int first,
+                  unsigned int last)
+{
+    return syscall(__NR_close_range, first, last, 0);
+}
+
+
+static bool
+virExecSpawnSupported(void)
+{
+    static int supported = -1;
+
+    /* close_range() was introduced in Linux 5.9, an invalid range tells
+     * whether the syscall is there without closing anything */
+    if (supported < 0)
+        supported = !(virExecCloseRange(1, 0) < 0 && errno == ENOSYS);
+
+    return supported == 1;
+}
+
+
+/*
+ * Whether the child of @cmd needs nothing but file descriptors, working
+ * directory and umask set up before exec. Anything else, like running
+ * hooks, changing credentials or security labels, needs a forked child.
+ */
+static bool
+virExecCanSpawn(virCommandPtr cmd)
+{
+    if (cmd->hook ||
+        cmd->pidfile ||
+        cmd->handshake ||
+        (cmd->flags & (VIR_EXEC_DAEMON | VIR_EXEC_CLEAR_CAPS)) ||
+        cmd->uid != (uid_t)-1 ||
+        cmd->gid != (gid_t)-1 ||
+        cmd->capabilities ||
+        cmd->setMaxMemLock ||
+        cmd->setMaxProcesses ||
+        cmd->setMaxFiles ||
+        cmd->setMaxCore)
+        return false;
+
+#  if defined(WITH_SECDRIVER_SELINUX)
+    if (cmd->seLinuxLabel)
+        return false;
+#  endif
+#  if defined(WITH_SECDRIVER_APPARMOR)
+    if (cmd->appArmorProfile)
+        return false;
+#  endif
+
+    return virExecSpawnSupported();
+}
+
+
+/*
+ * The child of virExecSpawn, running on the memory of the parent which is
+ * suspended until exec. Therefore only async-signal-safe functions may be
+ * called here and nothing but @opaque may be modified.
+ */
+static int
+virExecSpawnChild(void *opaque)
+{
+    virExecSpawnData *data = opaque;
+    virCommandPtr cmd = data->cmd;
+    struct sigaction sig_action = { 0 };
+    sigset_t mask;
+    unsigned int next = STDERR_FILENO + 1;
+    size_t i;
+
+    /* Signal handlers of the parent must never run here */
+    data->stage = VIR_EXEC_SPAWN_STAGE_SIGNALS;
+    sig_action.sa_handler = SIG_DFL;
+    sigemptyset(&sig_action.sa_mask);
+    for (i = 1; i < NSIG; i++)
+        ignore_value(sigaction(i, &sig_action, NULL));
+
+    if (cmd->mask)
+        umask(cmd->mask);
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_STDIN;
+    if (prepareStdFd(data->childin, STDIN_FILENO) < 0)
+        goto error;
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_STDOUT;
+    if (data->childout > 0 &&
+        prepareStdFd(data->childout, STDOUT_FILENO) < 0)
+        goto error;
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_STDERR;
+    if (data->childerr > 0 &&
+        prepareStdFd(data->childerr, STDERR_FILENO) < 0)
+        goto error;
+
+    for (i = 0; i < data->nkeepfds; i++) {
+        unsigned int fd = data->keepfds[i];
+
+        data->stage = VIR_EXEC_SPAWN_STAGE_CLOSE;
+        if (fd > next && virExecCloseRange(next, fd - 1) < 0)
+            goto error;
+
+        data->stage = VIR_EXEC_SPAWN_STAGE_KEEPFD;
+        data->failfd = fd;
+        if (virSetInherit(fd, true) < 0)
+            goto error;
+        next = fd + 1;
+    }
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_CLOSE;
+    if (virExecCloseRange(next, ~0U) < 0)
+        goto error;
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_CHDIR;
+    if (cmd->pwd && chdir(cmd->pwd) < 0)
+        goto error;
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_SIGMASK;
+    sigemptyset(&mask);
+    if (sigprocmask(SIG_SETMASK, &mask, NULL) < 0)
+        goto error;
+
+    data->stage = VIR_EXEC_SPAWN_STAGE_EXEC;
+    if (cmd->env)
+        execve(data->binary, cmd->args, cmd->env);
+    else
+        execv(data->binary, cmd->args);
+
+ error:
+    data->err = errno;
+
+    /* Same exit codes as a forked child in virExec */
+    if (data->stage != VIR_EXEC_SPAWN_STAGE_EXEC)
+        _exit(EXIT_CANCELED);
+    _exit(data->err == ENOENT ? EXIT_ENOENT : EXIT_CANNOT_INVOKE);
+}
+
+
+/*
+ * Formats the error a forked child of @cmd would report if it failed at
+ * the same step as the spawned child described by @data.
+ */
+static char *
+virExecSpawnFormatError(virCommandPtr cmd,
+                        virExecSpawnData *data)
+{
+    g_autofree char *msg = NULL;
+
+    switch (data->stage) {
+    case VIR_EXEC_SPAWN_STAGE_SIGNALS:
+    case VIR_EXEC_SPAWN_STAGE_SIGMASK:
+        msg = g_strdup(_("cannot unblock signals"));
+        break;
+    case VIR_EXEC_SPAWN_STAGE_STDIN:
+        msg = g_strdup(_("failed to setup stdin file handle"));
+        break;
+    case VIR_EXEC_SPAWN_STAGE_STDOUT:
+        msg = g_strdup(_("failed to setup stdout file handle"));
+        break;
+    case VIR_EXEC_SPAWN_STAGE_STDERR:
+        msg = g_strdup(_("failed to setup stderr file handle"));
+        break;
+    case VIR_EXEC_SPAWN_STAGE_CLOSE:
+        msg = g_strdup(_("failed to close file descriptors"));
+        break;
+    case VIR_EXEC_SPAWN_STAGE_KEEPFD:
+        msg = g_strdup_printf(_("failed to preserve fd %d"), data->failfd);
+        break;
+    case VIR_EXEC_SPAWN_STAGE_CHDIR:
+        msg = g_strdup_printf(_("Unable to change to %s"), cmd->pwd);
+        break;
+    case VIR_EXEC_SPAWN_STAGE_EXEC:
+        msg = g_strdup_printf(_("cannot execute binary %s"), cmd->args[0]);
+        break;
+    }
+
+    /* What virDefaultErrorFunc prints for a VIR_FROM_NONE error */
+    return g_strdup_printf("libvirt:  %s : %s: %s\n",
+                           _("error"), msg, g_strerror(data->err));
+}
+
+
+static int
+virExecSpawnCompareFD(const void *a,
+                      const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+
+/*
+ * Starts the child of @cmd using clone(CLONE_VM | CLONE_VFORK), which
+ * unlike fork() doesn't copy page tables of the parent, and close_range()
+ * instead of walking /proc/self/fd.
+ *
+ * Returns the PID of the child, or -1 on error.
+ */
+static pid_t
+virExecSpawn(virCommandPtr cmd,
+             const char *binary,
+             int childin,
+             int childout,
+             int childerr)
+{
+    virExecSpawnData data = {
+        .cmd = cmd,
+        .binary = binary,
+        .childin = childin,
+        .childout = childout,
+        .childerr = childerr,
+    };
+    g_autofree int *keepfds = NULL;
+    g_autofree char *stack = NULL;
+    sigset_t oldmask, newmask;
+    int saved_errno;
+    pid_t pid;
+    size_t i;
+
+    keepfds = g_new0(int, cmd->npassfd);
+    for (i = 0; i < cmd->npassfd; i++) {
+        if (cmd->passfd[i].fd > STDERR_FILENO)
+            keepfds[data.nkeepfds++] = cmd->passfd[i].fd;
+    }
+    qsort(keepfds, data.nkeepfds, sizeof(*keepfds), virExecSpawnCompareFD);
+    data.keepfds = keepfds;
+
+    stack = g_new0(char, VIR_EXEC_SPAWN_STACK_SIZE);
+
+    /* Block signals so that no handler runs in the child before it
+     * resets them */
+    sigfillset(&newmask);
+    if (pthread_sigmask(SIG_SETMASK, &newmask, &oldmask) != 0) {
+        virReportSystemError(errno, "%s", _("cannot block signals"));
+        return -1;
+    }
+
+    pid = clone(virExecSpawnChild, stack + VIR_EXEC_SPAWN_STACK_SIZE,
+                CLONE_VM | CLONE_VFORK | SIGCHLD, &data);
+    saved_errno = errno;
+
+    ignore_value(pthread_sigmask(SIG_SETMASK, &oldmask, NULL));
+
+    if (pid < 0) {
+        virReportSystemError(saved_errno, "%s",
+                             _("cannot fork child process"));
+        return -1;
+    }
+
+    VIR_DEBUG("Spawned child %lld for %s", (long long) pid, binary);
+
+    if (data.err != 0) {
+        /* The child exited already, let the error reach its stderr as if
+         * it reported the error itself so that callers see no difference
+         * compared to a forked child. */
+        g_autofree char *msg = virExecSpawnFormatError(cmd, &data);
+
+        if (childerr > 0)
+            ignore_value(safewrite(childerr, msg, strlen(msg)));
+    }
+
+    return pid;
+}
+# endif /* defined(__linux__) && defined(__NR_close_range) */
+
 /*
  * virExec:
  * @cmd virCommandPtr containing all information about the program to
@@ -629,7 +931,7 @@ virExec(virCommandPtr cmd)
     const char *binary = NULL;
     int ret;
     g_autofree gid_t *groups = NULL;
-    int ngroups;
+    int ngroups = 0;
 
     if (cmd->args[0][0] != '/') {
         if (!(binary = binarystr = virFindFileInPath(cmd->args[0]))) {
@@ -694,10 +996,17 @@ virExec(virCommandPtr cmd)
         childerr = null;
     }
 
-    if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
-        goto cleanup;
+# ifdef VIR_EXEC_SPAWN
+    if (virExecCanSpawn(cmd)) {
+        pid = virExecSpawn(cmd, binary, childin, childout, childerr);
+    } else
+# endif
+    {
+        if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
+            goto cleanup;
 
-    pid = virFork();
+        pid = virFork();
+    }
 
     if (pid < 0)
         goto cleanup;
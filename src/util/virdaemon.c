@@ -27,6 +27,7 @@
 #endif
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
 #include <stdbool.h>
 
 #include "virdaemon.h"
@@ -145,6 +146,39 @@ virDaemonForkIntoBackground(const char *argv0)
 }
 
 
+static void
+virDaemonCrashHandler(int sig)
+{
+    /* SA_RESETHAND restored the default action for the re-raised signal */
+    virLogDumpMemoryOnCrash();
+    raise(sig);
+}
+
+
+/*
+ * Write out the messages kept by the memory log output when the daemon
+ * crashes. The handler is only installed if the configured memory log
+ * output has a dump file, otherwise the default actions are kept.
+ */
+static void
+virDaemonSetupCrashHandler(void)
+{
+    struct sigaction sig_action = { 0 };
+    int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    size_t i;
+
+    if (!virLogHasMemoryDumpFile())
+        return;
+
+    sig_action.sa_handler = virDaemonCrashHandler;
+    sig_action.sa_flags = SA_RESETHAND;
+    sigemptyset(&sig_action.sa_mask);
+
+    for (i = 0; i < G_N_ELEMENTS(signals); i++)
+        ignore_value(sigaction(signals[i], &sig_action, NULL));
+}
+
+
 /*
  * Set up the logging environment
  * By default if daemonized all errors go to the logfile libvirtd.log,
@@ -195,6 +229,8 @@ virDaemonSetupLogging(const char *daemon_name,
 
     if (virLogGetNbOutputs() == 0)
         virLogSetOutputs(virLogGetDefaultOutput());
+
+    virDaemonSetupCrashHandler();
 }
 
 
@@ -41,6 +41,7 @@
 #include "virtime.h"
 #include "virprocess.h"
 #include "virsocket.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
@@ -109,6 +110,8 @@ struct virFDStreamData {
     bool threadAbort;
     bool threadDoRead;
     virFDStreamMsgPtr msg;
+    size_t msgCount;    /* number of messages in @msg */
+    size_t msgBytes;    /* bytes of data messages in @msg */
 };
 
 static virClassPtr virFDStreamDataClass;
@@ -150,6 +153,10 @@ virFDStreamMsgQueuePush(virFDStreamDataPtr fdst,
     while (*tmp)
         tmp = &(*tmp)->next;
 
+    fdst->msgCount++;
+    if ((*msg)->type == VIR_FDSTREAM_MSG_TYPE_DATA)
+        fdst->msgBytes += (*msg)->stream.data.len;
+
     *tmp = g_steal_pointer(msg);
     virCondSignal(&fdst->threadCond);
 
@@ -175,6 +182,10 @@ virFDStreamMsgQueuePop(virFDStreamDataPtr fdst,
     if (tmp) {
         fdst->msg = tmp->next;
         tmp->next = NULL;
+
+        fdst->msgCount--;
+        if (tmp->type == VIR_FDSTREAM_MSG_TYPE_DATA)
+            fdst->msgBytes -= tmp->stream.data.len;
     }
 
     virCondSignal(&fdst->threadCond);
@@ -399,6 +410,7 @@ struct _virFDStreamThreadData {
     bool doRead;
     bool sparse;
     bool isBlock;
+    bool readAhead;     /* @fdin supports reading at arbitrary offsets */
     int fdin;
     char *fdinname;
     int fdout;
@@ -419,8 +431,282 @@ virFDStreamThreadDataFree(virFDStreamThreadDataPtr data)
 }
 
 
+/* Files and block devices are read ahead of the stream by a pool of
+ * workers, each reading a different range, so that neither the storage
+ * nor the stream wait for each other. Data sections are read in chunks
+ * which grow from VIR_FDSTREAM_BUFLEN_MIN up to VIR_FDSTREAM_BUFLEN_MAX
+ * as long as the data section continues. */
+#define VIR_FDSTREAM_READ_WORKERS 4
+#define VIR_FDSTREAM_READ_AHEAD (32 * 1024 * 1024)
+#define VIR_FDSTREAM_READ_AHEAD_MSGS 1024
+#define VIR_FDSTREAM_BUFLEN_MIN (256 * 1024)
+#define VIR_FDSTREAM_BUFLEN_MAX (4 * 1024 * 1024)
+
+typedef struct _virFDStreamReadAhead virFDStreamReadAhead;
+typedef virFDStreamReadAhead *virFDStreamReadAheadPtr;
+
+typedef struct _virFDStreamReadReq virFDStreamReadReq;
+typedef virFDStreamReadReq *virFDStreamReadReqPtr;
+struct _virFDStreamReadReq {
+    virFDStreamReadReqPtr next;
+    virFDStreamReadAheadPtr ra;
+
+    virFDStreamMsgPtr msg;
+    unsigned long long offset;  /* where to read the data from */
+    size_t len;                 /* how much data to read */
+    bool done;
+    virErrorPtr err;
+};
+
+/* All members are protected by the lock of @fdst */
+struct _virFDStreamReadAhead {
+    virFDStreamDataPtr fdst;
+    virThreadPoolPtr pool;
+
+    int fdin;
+    const char *fdinname;
+    int fdout;
+    const char *fdoutname;
+
+    unsigned long long offset;  /* offset of the next request */
+
+    /* requests in the stream order */
+    virFDStreamReadReqPtr head;
+    virFDStreamReadReqPtr tail;
+    size_t nreqs;
+    size_t pending;             /* bytes requested but not yet queued */
+
+    bool eof;                   /* a read hit the end of @fdin */
+    virErrorPtr err;            /* the first failure */
+};
+
+
+static void
+virFDStreamReadReqFree(virFDStreamReadReqPtr req)
+{
+    if (!req)
+        return;
+
+    virFDStreamMsgFree(req->msg);
+    virFreeError(req->err);
+    g_free(req);
+}
+
+
+static void
+virFDStreamReadAheadPush(virFDStreamReadAheadPtr ra,
+                         virFDStreamMsgPtr *msg)
+{
+    if (virFDStreamMsgQueuePush(ra->fdst, msg, ra->fdout, ra->fdoutname) < 0)
+        ra->err = virSaveLastError();
+}
+
+
+/* Queues messages of requests which are done, in the stream order.
+ * Once a read comes up short, the message is followed by an empty one
+ * marking the end of the stream and the following requests are
+ * discarded. */
+static void
+virFDStreamReadAheadFlush(virFDStreamReadAheadPtr ra)
+{
+    virFDStreamReadReqPtr req;
+
+    while ((req = ra->head) && req->done) {
+        g_autoptr(virFDStreamMsg) msg = g_steal_pointer(&req->msg);
+        size_t len = req->len;
+
+        if (!(ra->head = req->next))
+            ra->tail = NULL;
+        ra->nreqs--;
+        ra->pending -= len;
+
+        if (req->err && !ra->err)
+            ra->err = g_steal_pointer(&req->err);
+        virFDStreamReadReqFree(req);
+
+        if (ra->err || ra->eof)
+            continue;
+
+        if (msg->type == VIR_FDSTREAM_MSG_TYPE_DATA &&
+            msg->stream.data.len < len) {
+            bool empty = msg->stream.data.len == 0;
+
+            ra->eof = true;
+            virFDStreamReadAheadPush(ra, &msg);
+            if (!empty && !ra->err) {
+                msg = g_new0(virFDStreamMsg, 1);
+                msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
+                virFDStreamReadAheadPush(ra, &msg);
+            }
+        } else {
+            virFDStreamReadAheadPush(ra, &msg);
+        }
+    }
+
+    virCondSignal(&ra->fdst->threadCond);
+}
+
+
+static void
+virFDStreamReadAheadWorker(void *jobdata,
+                           void *opaque G_GNUC_UNUSED)
+{
+    virFDStreamReadReqPtr req = jobdata;
+    virFDStreamReadAheadPtr ra = req->ra;
+    char *buf = req->msg->stream.data.buf;
+    virErrorPtr err = NULL;
+    size_t got = 0;
+
+    while (got < req->len) {
+        ssize_t r = pread(ra->fdin, buf + got, req->len - got,
+                          req->offset + got);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, _("Unable to read %s"),
+                                 ra->fdinname);
+            err = virSaveLastError();
+            break;
+        }
+
+        if (r == 0)
+            break;
+
+        got += r;
+    }
+
+    virObjectLock(ra->fdst);
+    req->msg->stream.data.len = got;
+    req->err = err;
+    req->done = true;
+    virFDStreamReadAheadFlush(ra);
+    virObjectUnlock(ra->fdst);
+}
+
+
+/* Appends @msg to the requests. Data messages are handed over to the
+ * pool to be read at @offset, others are queued as soon as all the
+ * preceding requests are. Called with the lock of @fdst held. */
+static int
+virFDStreamReadAheadSubmit(virFDStreamReadAheadPtr ra,
+                           virFDStreamMsgPtr *msg)
+{
+    virFDStreamReadReqPtr req = g_new0(virFDStreamReadReq, 1);
+
+    req->ra = ra;
+    req->msg = g_steal_pointer(msg);
+    req->offset = ra->offset;
+
+    if (ra->tail)
+        ra->tail->next = req;
+    else
+        ra->head = req;
+    ra->tail = req;
+    ra->nreqs++;
+
+    if (req->msg->type == VIR_FDSTREAM_MSG_TYPE_DATA) {
+        req->len = req->msg->stream.data.len;
+        ra->offset += req->len;
+        ra->pending += req->len;
+
+        if (req->len > 0) {
+            if (virThreadPoolSendJob(ra->pool, 0, req) < 0) {
+                req->err = virSaveLastError();
+                req->done = true;
+                virFDStreamReadAheadFlush(ra);
+                return -1;
+            }
+            return 0;
+        }
+    } else {
+        ra->offset += req->msg->stream.hole.len;
+    }
+
+    req->done = true;
+    virFDStreamReadAheadFlush(ra);
+    return 0;
+}
+
+
+static int
+virFDStreamReadAheadInit(virFDStreamReadAheadPtr ra,
+                         virFDStreamDataPtr fdst,
+                         virFDStreamThreadDataPtr data)
+{
+    off_t offset;
+
+    if ((offset = lseek(data->fdin, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, _("unable to seek in %s"),
+                             data->fdinname);
+        return -1;
+    }
+
+    ra->fdst = fdst;
+    ra->fdin = data->fdin;
+    ra->fdinname = data->fdinname;
+    ra->fdout = data->fdout;
+    ra->fdoutname = data->fdoutname;
+    ra->offset = offset;
+
+    if (!(ra->pool = virThreadPoolNewFull(VIR_FDSTREAM_READ_WORKERS,
+                                          VIR_FDSTREAM_READ_WORKERS,
+                                          0, virFDStreamReadAheadWorker,
+                                          "fd-stream-read", NULL)))
+        return -1;
+
+    return 0;
+}
+
+
+/* Must be called without the lock of @fdst held so that the workers can
+ * finish */
+static void
+virFDStreamReadAheadClear(virFDStreamReadAheadPtr ra)
+{
+    virThreadPoolFree(ra->pool);
+    ra->pool = NULL;
+
+    while (ra->head) {
+        virFDStreamReadReqPtr req = ra->head;
+
+        ra->head = req->next;
+        virFDStreamReadReqFree(req);
+    }
+    ra->tail = NULL;
+
+    virFreeError(ra->err);
+    ra->err = NULL;
+}
+
+
+/* Whether the thread has read far enough ahead of the stream */
+static bool
+virFDStreamThreadReadAheadFull(virFDStreamDataPtr fdst,
+                               virFDStreamReadAheadPtr ra)
+{
+    size_t count = fdst->msgCount;
+    size_t bytes = fdst->msgBytes;
+
+    if (ra) {
+        if (ra->err || ra->eof)
+            return false;
+
+        count += ra->nreqs;
+        bytes += ra->pending;
+    }
+
+    return count >= VIR_FDSTREAM_READ_AHEAD_MSGS ||
+           bytes >= VIR_FDSTREAM_READ_AHEAD;
+}
+
+
+/* Called with the lock of @fdst held, which is released while reading
+ * from @fdin. If @ra is not NULL the data is not read here but handed
+ * over to the read ahead workers. */
 static ssize_t
 virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
+                        virFDStreamReadAheadPtr ra,
                         bool sparse,
                         bool isBlock,
                         const int fdin,
@@ -430,12 +716,13 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
                         size_t length,
                         size_t total,
                         size_t *dataLen,
-                        size_t buflen)
+                        size_t *buflenp)
 {
     g_autoptr(virFDStreamMsg) msg = NULL;
     int inData = 0;
     long long sectionLen = 0;
     g_autofree char *buf = NULL;
+    size_t buflen = *buflenp;
     ssize_t got;
 
     if (sparse && *dataLen == 0) {
@@ -450,6 +737,15 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
             inData = 1;
             sectionLen = 1 * 1024 * 1024;
         } else {
+            /* The read ahead workers don't move the file offset */
+            if (ra &&
+                lseek(fdin, ra->offset, SEEK_SET) == (off_t) -1) {
+                virReportSystemError(errno,
+                                     _("unable to seek in %s"),
+                                     fdinname);
+                return -1;
+            }
+
             if (virFileInData(fdin, &inData, &sectionLen) < 0)
                 return -1;
         }
@@ -472,6 +768,13 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
         msg->type = VIR_FDSTREAM_MSG_TYPE_HOLE;
         msg->stream.hole.len = sectionLen;
         got = sectionLen;
+        *buflenp = VIR_FDSTREAM_BUFLEN_MIN;
+
+        if (ra) {
+            if (virFDStreamReadAheadSubmit(ra, &msg) < 0)
+                return -1;
+            return got;
+        }
 
         /* HACK: The message queue is one directional. So caller
          * cannot make us skip the hole. Do that for them instead. */
@@ -489,18 +792,37 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
 
         buf = g_new0(char, buflen);
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno,
-                                 _("Unable to read %s"),
-                                 fdinname);
-            return -1;
+        msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
+
+        if (ra) {
+            msg->stream.data.buf = g_steal_pointer(&buf);
+            msg->stream.data.len = buflen;
+            got = buflen;
+            if (virFDStreamReadAheadSubmit(ra, &msg) < 0)
+                return -1;
+        } else {
+            virObjectUnlock(fdst);
+            got = saferead(fdin, buf, buflen);
+            if (got < 0)
+                virReportSystemError(errno,
+                                     _("Unable to read %s"),
+                                     fdinname);
+            virObjectLock(fdst);
+            if (got < 0)
+                return -1;
+
+            msg->stream.data.buf = g_steal_pointer(&buf);
+            msg->stream.data.len = got;
         }
 
-        msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
-        msg->stream.data.buf = g_steal_pointer(&buf);
-        msg->stream.data.len = got;
         if (sparse)
             *dataLen -= got;
+
+        if (got == *buflenp && *buflenp < VIR_FDSTREAM_BUFLEN_MAX)
+            *buflenp *= 2;
+
+        if (ra)
+            return got;
     }
 
     virFDStreamMsgQueuePush(fdst, &msg, fdout, fdoutname);
@@ -509,6 +831,8 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
 }
 
 
+/* Called with the lock of @fdst held, which is released while writing
+ * into @fdout. */
 static ssize_t
 virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
                          bool sparse,
@@ -524,15 +848,18 @@ virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
 
     switch (msg->type) {
     case VIR_FDSTREAM_MSG_TYPE_DATA:
+        /* Only this thread ever removes messages from the queue */
+        virObjectUnlock(fdst);
         got = safewrite(fdout,
                         msg->stream.data.buf + msg->stream.data.offset,
                         msg->stream.data.len - msg->stream.data.offset);
-        if (got < 0) {
+        if (got < 0)
             virReportSystemError(errno,
                                  _("Unable to write %s"),
                                  fdoutname);
+        virObjectLock(fdst);
+        if (got < 0)
             return -1;
-        }
 
         msg->stream.data.offset += got;
 
@@ -618,17 +945,26 @@ virFDStreamThread(void *opaque)
     char *fdoutname = data->fdoutname;
     virFDStreamDataPtr fdst = st->privateData;
     bool doRead = fdst->threadDoRead;
-    size_t buflen = 256 * 1024;
+    virFDStreamReadAhead readAhead = { 0 };
+    virFDStreamReadAheadPtr ra = NULL;
+    size_t buflen = VIR_FDSTREAM_BUFLEN_MIN;
     size_t total = 0;
     size_t dataLen = 0;
 
     virObjectRef(fdst);
     virObjectLock(fdst);
 
+    if (doRead && data->readAhead) {
+        if (virFDStreamReadAheadInit(&readAhead, fdst, data) < 0)
+            goto error;
+        ra = &readAhead;
+    }
+
     while (1) {
         ssize_t got;
 
-        while (doRead == (fdst->msg != NULL) &&
+        while ((doRead ? virFDStreamThreadReadAheadFull(fdst, ra) :
+                         !fdst->msg) &&
                !fdst->threadQuit) {
             if (virCondWait(&fdst->threadCond, &fdst->parent.lock)) {
                 virReportSystemError(errno, "%s",
@@ -643,16 +979,19 @@ virFDStreamThread(void *opaque)
                 goto cleanup;
 
             /* Otherwise flush buffers and quit gracefully. */
-            if (doRead == (fdst->msg != NULL))
+            if (doRead == (fdst->msg != NULL) || (ra && ra->head))
                 break;
         }
 
+        if (ra && (ra->err || ra->eof))
+            break;
+
         if (doRead)
-            got = virFDStreamThreadDoRead(fdst, sparse, isBlock,
+            got = virFDStreamThreadDoRead(fdst, ra, sparse, isBlock,
                                           fdin, fdout,
                                           fdinname, fdoutname,
                                           length, total,
-                                          &dataLen, buflen);
+                                          &dataLen, &buflen);
         else
             got = virFDStreamThreadDoWrite(fdst, sparse, isBlock,
                                            fdin, fdout,
@@ -667,9 +1006,25 @@ virFDStreamThread(void *opaque)
         total += got;
     }
 
+    /* Wait for the outstanding reads to be queued */
+    while (ra && ra->head && !ra->err && !fdst->threadAbort) {
+        if (virCondWait(&fdst->threadCond, &fdst->parent.lock)) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait on condition"));
+            goto error;
+        }
+    }
+
+    if (ra && ra->err) {
+        virSetError(ra->err);
+        goto error;
+    }
+
  cleanup:
     fdst->threadQuit = true;
     virObjectUnlock(fdst);
+    if (ra)
+        virFDStreamReadAheadClear(ra);
     virFDStreamDataDisposed = false;
     virObjectUnref(fdst);
     if (virFDStreamDataDisposed)
@@ -1316,6 +1671,7 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         threadData->length = length;
         threadData->sparse = sparse;
         threadData->isBlock = !!S_ISBLK(sb.st_mode);
+        threadData->readAhead = S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode);
 
         if ((oflags & O_ACCMODE) == O_RDONLY) {
             threadData->fdin = fd;
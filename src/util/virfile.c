@@ -201,6 +201,71 @@ struct _virFileWrapperFd {
 };
 
 #ifndef WIN32
+/* Determine whether @fd is to be written or read by the iohelper */
+static int
+virFileWrapperFdGetDirection(int fd,
+                             const char *name,
+                             bool *output)
+{
+    int mode = fcntl(fd, F_GETFL);
+
+    if (mode < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("invalid fd %d for %s"),
+                       fd, name);
+        return -1;
+    } else if ((mode & O_ACCMODE) == O_WRONLY) {
+        *output = true;
+    } else if ((mode & O_ACCMODE) == O_RDONLY) {
+        *output = false;
+    } else {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("unexpected mode 0x%x for %s"),
+                       mode & O_ACCMODE, name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Spawn an iohelper copying data between @fd and @peerfd, in the
+ * direction given by @output */
+static int
+virFileWrapperFdRun(virFileWrapperFdPtr wfd,
+                    const char *name,
+                    bool output,
+                    int *fd,
+                    int *peerfd)
+{
+    g_autofree char *iohelper_path = NULL;
+
+    if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
+                                              abs_top_builddir "/src",
+                                              LIBEXECDIR)))
+        return -1;
+
+    wfd->cmd = virCommandNewArgList(iohelper_path, name, NULL);
+
+    if (output) {
+        virCommandSetInputFD(wfd->cmd, *peerfd);
+        virCommandSetOutputFD(wfd->cmd, fd);
+        virCommandAddArg(wfd->cmd, "1");
+    } else {
+        virCommandSetInputFD(wfd->cmd, *fd);
+        virCommandSetOutputFD(wfd->cmd, peerfd);
+        virCommandAddArg(wfd->cmd, "0");
+    }
+
+    /* In order to catch iohelper stderr, we must change
+     * iohelper's env so virLog functions print to stderr
+     */
+    virCommandAddEnvPair(wfd->cmd, "LIBVIRT_LOG_OUTPUTS", "1:stderr");
+    virCommandSetErrorBuffer(wfd->cmd, &wfd->err_msg);
+    virCommandDoAsyncIO(wfd->cmd);
+
+    return virCommandRunAsync(wfd->cmd, NULL);
+}
+
+
 /**
  * virFileWrapperFdNew:
  * @fd: pointer to fd to wrap
@@ -234,8 +299,6 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     virFileWrapperFdPtr ret = NULL;
     bool output = false;
     int pipefd[2] = { -1, -1 };
-    int mode = -1;
-    g_autofree char *iohelper_path = NULL;
 
     if (!flags) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -258,48 +321,13 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
 
     ret = g_new0(virFileWrapperFd, 1);
 
-    mode = fcntl(*fd, F_GETFL);
-
-    if (mode < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, _("invalid fd %d for %s"),
-                       *fd, name);
+    if (virFileWrapperFdGetDirection(*fd, name, &output) < 0)
         goto error;
-    } else if ((mode & O_ACCMODE) == O_WRONLY) {
-        output = true;
-    } else if ((mode & O_ACCMODE) != O_RDONLY) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, _("unexpected mode 0x%x for %s"),
-                       mode & O_ACCMODE, name);
-        goto error;
-    }
 
     if (virPipe(pipefd) < 0)
         goto error;
 
-    if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
-                                              abs_top_builddir "/src",
-                                              LIBEXECDIR)))
-        goto error;
-
-    ret->cmd = virCommandNewArgList(iohelper_path, name, NULL);
-
-    if (output) {
-        virCommandSetInputFD(ret->cmd, pipefd[0]);
-        virCommandSetOutputFD(ret->cmd, fd);
-        virCommandAddArg(ret->cmd, "1");
-    } else {
-        virCommandSetInputFD(ret->cmd, *fd);
-        virCommandSetOutputFD(ret->cmd, &pipefd[1]);
-        virCommandAddArg(ret->cmd, "0");
-    }
-
-    /* In order to catch iohelper stderr, we must change
-     * iohelper's env so virLog functions print to stderr
-     */
-    virCommandAddEnvPair(ret->cmd, "LIBVIRT_LOG_OUTPUTS", "1:stderr");
-    virCommandSetErrorBuffer(ret->cmd, &ret->err_msg);
-    virCommandDoAsyncIO(ret->cmd);
-
-    if (virCommandRunAsync(ret->cmd, NULL) < 0)
+    if (virFileWrapperFdRun(ret, name, output, fd, &pipefd[!output]) < 0)
         goto error;
 
     if (VIR_CLOSE(pipefd[!output]) < 0) {
@@ -317,6 +345,44 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     virFileWrapperFdFree(ret);
     return NULL;
 }
+
+
+/**
+ * virFileWrapperFdNewPeer:
+ * @fd: pointer to fd of the file to read or write
+ * @peerfd: pointer to fd the data is copied to or from
+ * @name: name of @fd, for diagnostics
+ *
+ * Spawn a helper process which copies data between the file @fd and
+ * @peerfd, e.g. a socket, without passing it through the calling
+ * process. If @fd is O_WRONLY, everything read from @peerfd until EOF
+ * is written to the file; if it is O_RDONLY, the rest of the file is
+ * written to @peerfd. The same rules as for virFileWrapperFdNew()
+ * apply to @fd, so it can also be used to bypass the file system
+ * cache.
+ *
+ * On success, both @fd and @peerfd are closed and set to -1, and the
+ * new wrapper object is returned which must be passed to
+ * virFileWrapperFdClose() to wait for the copy to finish. On failure,
+ * the descriptors are unchanged, an error message is output, and NULL
+ * is returned.
+ */
+virFileWrapperFdPtr
+virFileWrapperFdNewPeer(int *fd, int *peerfd, const char *name)
+{
+    g_autoptr(virFileWrapperFd) ret = g_new0(virFileWrapperFd, 1);
+    bool output = false;
+
+    if (virFileWrapperFdGetDirection(*fd, name, &output) < 0)
+        return NULL;
+
+    if (virFileWrapperFdRun(ret, name, output, fd, peerfd) < 0)
+        return NULL;
+
+    VIR_FORCE_CLOSE(*fd);
+    VIR_FORCE_CLOSE(*peerfd);
+    return g_steal_pointer(&ret);
+}
 #else /* WIN32 */
 virFileWrapperFdPtr
 virFileWrapperFdNew(int *fd G_GNUC_UNUSED,
@@ -327,6 +393,16 @@ virFileWrapperFdNew(int *fd G_GNUC_UNUSED,
                    _("virFileWrapperFd unsupported on this platform"));
     return NULL;
 }
+
+virFileWrapperFdPtr
+virFileWrapperFdNewPeer(int *fd G_GNUC_UNUSED,
+                        int *peerfd G_GNUC_UNUSED,
+                        const char *name G_GNUC_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("virFileWrapperFd unsupported on this platform"));
+    return NULL;
+}
 #endif /* WIN32 */
 
 /**
@@ -1439,6 +1515,63 @@ virFileReadLimFD(int fd, int maxlen, char **buf)
     return len;
 }
 
+/**
+ * virFilePReadLimFD:
+ * @fd: file descriptor to read from
+ * @maxlen: maximum number of bytes to read
+ * @buf: filled with the NUL terminated contents of the file
+ *
+ * Like virFileReadLimFD, but reads the file from its beginning using pread()
+ * regardless of the current file offset. This allows repeated reads of
+ * pseudo files such as those in /proc or cgroup file systems through a
+ * single file descriptor kept open across reads.
+ *
+ * Returns the number of bytes read, or -1 with errno set on failure.
+ */
+int
+virFilePReadLimFD(int fd, int maxlen, char **buf)
+{
+    g_autofree char *s = NULL;
+    size_t alloc = 0;
+    size_t size = 0;
+
+    if (maxlen <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t count;
+
+        if (size + BUFSIZ + 1 > alloc) {
+            alloc = MAX(alloc + alloc / 2, size + BUFSIZ + 1);
+            s = g_renew(char, s, alloc);
+        }
+
+        count = pread(fd, s + size, MIN(maxlen + 1 - size, alloc - size - 1),
+                      size);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        size += count;
+
+        if (size > maxlen) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        if (count == 0)
+            break;
+    }
+
+    s[size] = '\0';
+    *buf = g_steal_pointer(&s);
+    return size;
+}
+
 int
 virFileReadAll(const char *path, int maxlen, char **buf)
 {
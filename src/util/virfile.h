@@ -115,6 +115,12 @@ virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
                                         unsigned int flags)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
 
+virFileWrapperFdPtr virFileWrapperFdNewPeer(int *fd,
+                                            int *peerfd,
+                                            const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    G_GNUC_WARN_UNUSED_RESULT;
+
 int virFileWrapperFdClose(virFileWrapperFdPtr dfd);
 
 void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
@@ -159,6 +165,8 @@ int virFileReadHeaderQuiet(const char *path, int maxlen, char **buf)
     G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
 int virFileReadLimFD(int fd, int maxlen, char **buf)
     G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(3);
+int virFilePReadLimFD(int fd, int maxlen, char **buf)
+    G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(3);
 int virFileReadAll(const char *path, int maxlen, char **buf)
     G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
 int virFileReadAllQuiet(const char *path, int maxlen, char **buf)
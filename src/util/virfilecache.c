@@ -34,6 +34,7 @@
 #include "virlog.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -49,6 +50,11 @@ struct _virFileCache {
 
     GHashTable *table;
 
+    /* names of data being created by virFileCachePopulate() without
+     * holding the lock, @cond is signalled once they are finished */
+    GHashTable *pending;
+    virCond cond;
+
     char *dir;
     char *suffix;
 
@@ -78,6 +84,9 @@ virFileCacheDispose(void *obj)
     g_free(cache->suffix);
 
     virHashFree(cache->table);
+    if (cache->pending)
+        g_hash_table_unref(cache->pending);
+    virCondDestroy(&cache->cond);
 
     virFileCachePrivFree(cache);
 }
@@ -242,9 +251,18 @@ virFileCacheNew(const char *dir,
     if (!(cache = virObjectNew(virFileCacheClass)))
         return NULL;
 
+    if (virCondInit(&cache->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize file cache condition"));
+        goto cleanup;
+    }
+
     if (!(cache->table = virHashNew(virObjectFreeHashData)))
         goto cleanup;
 
+    cache->pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, NULL);
+
     cache->dir = g_strdup(dir);
 
     cache->suffix = g_strdup(suffix);
@@ -264,6 +282,19 @@ virFileCacheValidate(virFileCachePtr cache,
                      const char *name,
                      void **data)
 {
+    if (name && g_hash_table_contains(cache->pending, name)) {
+        /* Someone is already creating the data, wait for them rather
+         * than creating (and saving) it once more in parallel. */
+        while (g_hash_table_contains(cache->pending, name)) {
+            VIR_DEBUG("Waiting for data for '%s' being created", name);
+            if (virCondWait(&cache->cond, &cache->parent.lock) < 0) {
+                VIR_WARN("Unable to wait on file cache condition");
+                break;
+            }
+        }
+        *data = virHashLookup(cache->table, name);
+    }
+
     if (*data && !cache->handlers.isValid(*data, cache->priv)) {
         VIR_DEBUG("Cached data '%p' no longer valid for '%s'",
                   *data, NULLSTR(name));
@@ -347,6 +378,153 @@ virFileCacheLookupByFunc(virFileCachePtr cache,
 }
 
 
+typedef struct _virFileCachePopulateData virFileCachePopulateData;
+struct _virFileCachePopulateData {
+    virFileCachePtr cache;
+    char **names;
+    void **data;
+    size_t nnames;
+    int next;
+};
+
+
+static void
+virFileCachePopulateWorker(void *opaque)
+{
+    virFileCachePopulateData *job = opaque;
+    int idx;
+
+    while ((idx = g_atomic_int_add(&job->next, 1)) < (int) job->nnames) {
+        const char *name = job->names[idx];
+
+        VIR_DEBUG("Creating data for '%s'", name);
+
+        if (!(job->data[idx] = virFileCacheNewData(job->cache, name))) {
+            VIR_WARN("Failed to create cached data for '%s': %s",
+                     name, virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+}
+
+
+/**
+ * virFileCachePopulate:
+ * @cache: existing cache object
+ * @names: list of names of the data to populate
+ * @nnames: number of items in @names
+ * @nworkers: maximum number of threads to use
+ *
+ * Makes sure that valid data exists in the cache for all of @names.
+ * Unlike virFileCacheLookup() the data which is missing or no longer
+ * valid is loaded or created concurrently by up to @nworkers threads
+ * without holding the cache lock, so lookups of other data are not
+ * blocked while it's being created.  Lookups of the data which is
+ * being created wait until it's finished instead of creating it
+ * once more.  Failure to create data for any
+ * particular name is not fatal, it's just logged and the next lookup
+ * of such name will try again.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virFileCachePopulate(virFileCachePtr cache,
+                     const char **names,
+                     size_t nnames,
+                     size_t nworkers)
+{
+    virFileCachePopulateData job = { .cache = cache };
+    g_autofree virThread *threads = NULL;
+    size_t nthreads = 0;
+    size_t i;
+    int ret = -1;
+
+    job.names = g_new0(char *, nnames + 1);
+    job.data = g_new0(void *, nnames);
+
+    virObjectLock(cache);
+
+    for (i = 0; i < nnames; i++) {
+        void *data = virHashLookup(cache->table, names[i]);
+
+        if (data && cache->handlers.isValid(data, cache->priv))
+            continue;
+
+        if (g_hash_table_contains(cache->pending, names[i]))
+            continue;
+
+        g_hash_table_add(cache->pending, g_strdup(names[i]));
+        job.names[job.nnames++] = g_strdup(names[i]);
+    }
+
+    virObjectUnlock(cache);
+
+    if (job.nnames == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    nworkers = MAX(1, MIN(nworkers, job.nnames));
+    threads = g_new0(virThread, nworkers);
+
+    VIR_DEBUG("Populating %zu cache entries using %zu threads",
+              job.nnames, nworkers);
+
+    for (nthreads = 0; nthreads < nworkers; nthreads++) {
+        if (virThreadCreateFull(&threads[nthreads], true,
+                                virFileCachePopulateWorker,
+                                "file-cache-populate", false, &job) < 0) {
+            VIR_WARN("Unable to create cache populate thread: %s",
+                     g_strerror(errno));
+            break;
+        }
+    }
+
+    /* Whatever is left if we failed to create some threads is
+     * handled by the ones we managed to start (or by us). */
+    if (nthreads == 0)
+        virFileCachePopulateWorker(&job);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virObjectLock(cache);
+
+    ret = 0;
+    for (i = 0; i < job.nnames; i++) {
+        void *data = virHashLookup(cache->table, job.names[i]);
+
+        g_hash_table_remove(cache->pending, job.names[i]);
+
+        if (!job.data[i])
+            continue;
+
+        /* Don't replace data which was inserted in the meantime. */
+        if (data && cache->handlers.isValid(data, cache->priv)) {
+            VIR_DEBUG("Keeping data '%p' cached for '%s'", data, job.names[i]);
+            continue;
+        }
+
+        VIR_DEBUG("Caching data '%p' for '%s'", job.data[i], job.names[i]);
+        if (virHashUpdateEntry(cache->table, job.names[i], job.data[i]) < 0) {
+            ret = -1;
+            continue;
+        }
+        job.data[i] = NULL;
+    }
+
+    virCondBroadcast(&cache->cond);
+    virObjectUnlock(cache);
+
+ cleanup:
+    for (i = 0; i < job.nnames; i++)
+        virObjectUnref(job.data[i]);
+    g_free(job.data);
+    g_strfreev(job.names);
+    return ret;
+}
+
+
 /**
  * virFileCacheGetPriv:
  * @cache: existing cache object
@@ -126,6 +126,12 @@ virFileCacheLookupByFunc(virFileCachePtr cache,
                          virHashSearcher iter,
                          const void *iterData);
 
+int
+virFileCachePopulate(virFileCachePtr cache,
+                     const char **names,
+                     size_t nnames,
+                     size_t nworkers);
+
 void *
 virFileCacheGetPriv(virFileCachePtr cache);
 
@@ -48,6 +48,17 @@ VIR_ENUM_IMPL(virFirewallLayerCommand,
               IP6TABLES_PATH,
 );
 
+/* Tools able to apply a whole set of rules from a single invocation */
+static const struct {
+    const char *bin;
+    const char *lockArg; /* leading argument of every rule of the layer */
+    bool needLock; /* whether the tool needs -w to wait for the xtables lock */
+} virFirewallLayerRestore[VIR_FIREWALL_LAYER_LAST] = {
+    [VIR_FIREWALL_LAYER_ETHERNET] = { EBTABLES_RESTORE_PATH, "--concurrent", false },
+    [VIR_FIREWALL_LAYER_IPV4] = { IPTABLES_RESTORE_PATH, "-w", true },
+    [VIR_FIREWALL_LAYER_IPV6] = { IP6TABLES_RESTORE_PATH, "-w", true },
+};
+
 struct _virFirewallRule {
     virFirewallLayer layer;
 
@@ -84,13 +95,88 @@ struct _virFirewall {
 
 static virFirewallBackend currentBackend = VIR_FIREWALL_BACKEND_AUTOMATIC;
 static virMutex ruleLock = VIR_MUTEX_INITIALIZER;
+/* Whether rules of the layer may be batched, protected by ruleLock */
+static bool batchRules[VIR_FIREWALL_LAYER_LAST];
+/* Whether the restore tool of the layer has to be probed before its first
+ * use for batching, protected by ruleLock */
+static bool probeBatchRules[VIR_FIREWALL_LAYER_LAST];
 
 static int
 virFirewallValidateBackend(virFirewallBackend backend);
 
+/*
+ * virFirewallLayerIsNFTables:
+ * @layer: the firewall layer
+ *
+ * Check whether the tool of @layer is the nf_tables flavour, which
+ * turns the rules fed to its restore counterpart into a single netlink
+ * batch per table.
+ */
+static bool
+virFirewallLayerIsNFTables(virFirewallLayer layer)
+{
+    g_autoptr(virCommand) cmd = NULL;
+    g_autofree char *output = NULL;
+
+    cmd = virCommandNewArgList(virFirewallLayerCommandTypeToString(layer),
+                               "-V", NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+
+    if (virCommandRun(cmd, NULL) < 0) {
+        virResetLastError();
+        return false;
+    }
+
+    return output && strstr(output, "(nf_tables)");
+}
+
+static void
+virFirewallDetectBatching(void)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+        const char *bin = virFirewallLayerRestore[i].bin;
+
+        batchRules[i] = virFileIsExecutable(bin);
+        probeBatchRules[i] = batchRules[i] && i == VIR_FIREWALL_LAYER_ETHERNET;
+
+        VIR_DEBUG("Batching rules of layer %zu via %s: %d",
+                  i, bin, batchRules[i]);
+    }
+}
+
+/*
+ * virFirewallLayerCanBatch:
+ * @layer: the firewall layer
+ *
+ * Check whether rules of @layer may be batched. Which flavour of
+ * ebtables is installed is found out only once the first batch of
+ * ebtables rules is about to be built, so that the many users of
+ * virFirewall which never touch ebtables don't have to run it.
+ * Must be called with ruleLock held.
+ */
+static bool
+virFirewallLayerCanBatch(virFirewallLayer layer)
+{
+    if (probeBatchRules[layer]) {
+        /* The legacy ebtables-restore only understands the binary
+         * format produced by ebtables-save and can't append rules */
+        batchRules[layer] = virFirewallLayerIsNFTables(layer);
+        probeBatchRules[layer] = false;
+
+        VIR_DEBUG("Batching rules of layer %d via %s: %d",
+                  layer, virFirewallLayerRestore[layer].bin, batchRules[layer]);
+    }
+
+    return batchRules[layer];
+}
+
 static int
 virFirewallOnceInit(void)
 {
+    virFirewallDetectBatching();
+
     return virFirewallValidateBackend(currentBackend);
 }
 
@@ -142,6 +228,17 @@ virFirewallValidateBackend(virFirewallBackend backend)
     return 0;
 }
 
+/**
+ * virFirewallSetBackend:
+ * @backend: the backend to use
+ *
+ * Force the use of @backend. This is meant for the test suite only,
+ * therefore batching of rules is turned off as well so that every rule
+ * results in a separate command execution. Use virFirewallSetBatching
+ * to turn it back on.
+ *
+ * Returns 0 on success, -1 on error
+ */
 int
 virFirewallSetBackend(virFirewallBackend backend)
 {
@@ -150,9 +247,33 @@ virFirewallSetBackend(virFirewallBackend backend)
     if (virFirewallInitialize() < 0)
         return -1;
 
+    virFirewallSetBatching(false);
+
     return virFirewallValidateBackend(backend);
 }
 
+
+/**
+ * virFirewallSetBatching:
+ * @enable: whether to batch rules
+ *
+ * Turn applying consecutive rules via a single invocation of
+ * iptables-restore/ip6tables-restore/ebtables-restore on or off,
+ * regardless of whether the tools are actually present on the host.
+ * Whether ebtables is the nf_tables flavour is still probed before the
+ * first batch of ebtables rules.
+ */
+void
+virFirewallSetBatching(bool enable)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+        batchRules[i] = enable;
+        probeBatchRules[i] = enable && i == VIR_FIREWALL_LAYER_ETHERNET;
+    }
+}
+
 static virFirewallGroupPtr
 virFirewallGroupNew(void)
 {
@@ -709,23 +830,215 @@ virFirewallApplyRule(virFirewallPtr firewall,
     return 0;
 }
 
+
+/*
+ * virFirewallRuleIsBatchable:
+ * @rule: the rule to check
+ * @table: filled with the table the rule modifies
+ *
+ * A rule can be handed over to the restore tool only if it modifies
+ * chains (as opposed to querying them), nobody is interested in its
+ * output and its failure is fatal. The latter is required because
+ * the restore tools commit all rules of a table at once and there is
+ * no way to tell them to skip over rules which fail.
+ *
+ * Returns true if @rule can be batched, false otherwise
+ */
+static bool
+virFirewallRuleIsBatchable(virFirewallRulePtr rule,
+                           const char **table)
+{
+    const char *commands[] = {
+        "-A", "--append", "-I", "--insert", "-D", "--delete",
+        "-R", "--replace", "-N", "--new-chain", "-X", "--delete-chain",
+        "-F", "--flush", "-Z", "--zero", "-E", "--rename-chain", NULL
+    };
+    bool haveCommand = false;
+    size_t i;
+
+    if (!batchRules[rule->layer] || rule->queryCB || rule->ignoreErrors)
+        return false;
+
+    if (rule->argsLen < 2 ||
+        STRNEQ(rule->args[0], virFirewallLayerRestore[rule->layer].lockArg))
+        return false;
+
+    *table = "filter";
+    for (i = 1; i < rule->argsLen; i++) {
+        const char *arg = rule->args[i];
+
+        if (strchr(arg, '\n'))
+            return false;
+
+        if (STREQ(arg, "-t") || STREQ(arg, "--table")) {
+            if (++i == rule->argsLen)
+                return false;
+            *table = rule->args[i];
+        } else if (STRPREFIX(arg, "--table=") ||
+                   (STRPREFIX(arg, "-t") && arg[2] != '\0')) {
+            return false;
+        } else if (!haveCommand) {
+            if (!g_strv_contains(commands, arg))
+                return false;
+            haveCommand = true;
+        }
+    }
+
+    return haveCommand && virFirewallLayerCanBatch(rule->layer);
+}
+
+
+static void
+virFirewallRuleFormatRestore(virBufferPtr buf,
+                             virFirewallRulePtr rule)
+{
+    size_t i;
+    bool first = true;
+
+    /* skip the locking argument, the restore tool handles locking itself */
+    for (i = 1; i < rule->argsLen; i++) {
+        const char *arg = rule->args[i];
+        const char *p;
+
+        if (STREQ(arg, "-t") || STREQ(arg, "--table")) {
+            i++;
+            continue;
+        }
+
+        if (!first)
+            virBufferAddChar(buf, ' ');
+        first = false;
+
+        if (*arg && !strpbrk(arg, " \t\"'\\")) {
+            virBufferAdd(buf, arg, -1);
+            continue;
+        }
+
+        virBufferAddChar(buf, '"');
+        for (p = arg; *p; p++) {
+            if (*p == '"' || *p == '\\')
+                virBufferAddChar(buf, '\\');
+            virBufferAddChar(buf, *p);
+        }
+        virBufferAddChar(buf, '"');
+    }
+
+    virBufferAddChar(buf, '\n');
+}
+
+
+/*
+ * virFirewallApplyRuleBatch:
+ * @rules: the rules to apply
+ * @nrules: number of @rules
+ * @table: the table all @rules modify
+ *
+ * Apply @rules with a single iptables-restore/ip6tables-restore/
+ * ebtables-restore execution. The rules are committed at once, so if any of them fails,
+ * none of them is applied.
+ *
+ * Returns 0 on success, -1 on failure without reporting an error
+ */
+static int
+virFirewallApplyRuleBatch(virFirewallRulePtr *rules,
+                          size_t nrules,
+                          const char *table)
+{
+    const char *bin = virFirewallLayerRestore[rules[0]->layer].bin;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virCommand) cmd = NULL;
+    g_autofree char *input = NULL;
+    g_autofree char *error = NULL;
+    int status;
+    size_t i;
+
+    virBufferAsprintf(&buf, "*%s\n", table);
+    for (i = 0; i < nrules; i++) {
+        g_autofree char *str = virFirewallRuleToString(rules[i]);
+
+        VIR_INFO("Batching rule '%s'", NULLSTR(str));
+        virFirewallRuleFormatRestore(&buf, rules[i]);
+    }
+    virBufferAddLit(&buf, "COMMIT\n");
+    input = virBufferContentAndReset(&buf);
+
+    cmd = virCommandNew(bin);
+    if (virFirewallLayerRestore[rules[0]->layer].needLock)
+        virCommandAddArg(cmd, "-w");
+    virCommandAddArg(cmd, "--noflush");
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0) {
+        virResetLastError();
+        return -1;
+    }
+
+    if (status != 0) {
+        VIR_DEBUG("Failed to apply %zu rules via %s: %s",
+                  nrules, bin, NULLSTR(error));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 virFirewallApplyGroup(virFirewallPtr firewall,
                       size_t idx)
 {
     virFirewallGroupPtr group = firewall->groups[idx];
     bool ignoreErrors = (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
-    size_t i;
+    size_t i = 0;
+    size_t j;
 
     VIR_INFO("Starting transaction for firewall=%p group=%p flags=0x%x",
              firewall, group, group->actionFlags);
     firewall->currentGroup = idx;
     group->addingRollback = false;
-    for (i = 0; i < group->naction; i++) {
-        if (virFirewallApplyRule(firewall,
-                                 group->action[i],
-                                 ignoreErrors) < 0)
-            return -1;
+    while (i < group->naction) {
+        virFirewallRulePtr rule = group->action[i];
+        const char *table = NULL;
+        const char *nextTable = NULL;
+        size_t n = 1;
+
+        if (!ignoreErrors && virFirewallRuleIsBatchable(rule, &table)) {
+            while (i + n < group->naction &&
+                   group->action[i + n]->layer == rule->layer &&
+                   virFirewallRuleIsBatchable(group->action[i + n], &nextTable) &&
+                   STREQ(table, nextTable))
+                n++;
+        }
+
+        if (n == 1) {
+            if (virFirewallApplyRule(firewall, rule, ignoreErrors) < 0)
+                return -1;
+            i++;
+            continue;
+        }
+
+        if (virFirewallApplyRuleBatch(group->action + i, n, table) == 0) {
+            i += n;
+            continue;
+        }
+
+        /* Nothing was committed, so it is safe to apply the rules one by
+         * one to find out which one is at fault. */
+        VIR_DEBUG("Applying %zu rules individually", n);
+        for (j = 0; j < n; j++) {
+            if (virFirewallApplyRule(firewall, group->action[i + j],
+                                     ignoreErrors) < 0)
+                return -1;
+        }
+
+        /* All of the rules were accepted, the restore tool is not usable */
+        VIR_WARN("Disabling batching of firewall rules, %s failed to apply "
+                 "rules accepted by %s",
+                 virFirewallLayerRestore[rule->layer].bin,
+                 virFirewallLayerCommandTypeToString(rule->layer));
+        batchRules[rule->layer] = false;
+        i += n;
     }
     return 0;
 }
@@ -749,6 +1062,57 @@ virFirewallRollbackGroup(virFirewallPtr firewall,
 }
 
 
+/**
+ * virFirewallForEachRule:
+ * @firewall: the firewall ruleset
+ * @iter: callback to invoke for each rule
+ * @opaque: data passed into @iter
+ *
+ * Invoke @iter for all rules of all transactions of @firewall in the
+ * order they would be applied, without actually applying them. Rules
+ * with a query callback and rollback rules are skipped. The arguments
+ * passed to @iter don't include the locking argument which is added to
+ * every rule automatically. The ignoreErrors argument of @iter is true
+ * if a failure of the rule would be ignored, either because of the rule
+ * itself or because of the flags of its transaction.
+ *
+ * Returns 0 on success, -1 if @firewall is in an error state or @iter
+ * failed
+ */
+int
+virFirewallForEachRule(virFirewallPtr firewall,
+                       virFirewallRuleIterator iter,
+                       void *opaque)
+{
+    size_t i, j;
+
+    if (!firewall || firewall->err) {
+        virReportSystemError(firewall ? firewall->err : EINVAL, "%s",
+                             _("Unable to create rule"));
+        return -1;
+    }
+
+    for (i = 0; i < firewall->ngroups; i++) {
+        virFirewallGroupPtr group = firewall->groups[i];
+        bool ignoreErrors = (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
+
+        for (j = 0; j < group->naction; j++) {
+            virFirewallRulePtr rule = group->action[j];
+
+            if (rule->queryCB || rule->argsLen == 0)
+                continue;
+
+            if (iter(rule->layer, ignoreErrors || rule->ignoreErrors,
+                     (const char *const *)rule->args + 1, rule->argsLen - 1,
+                     opaque) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 int
 virFirewallApply(virFirewallPtr firewall)
 {
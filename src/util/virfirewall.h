@@ -111,6 +111,16 @@ void virFirewallStartRollback(virFirewallPtr firewall,
 
 int virFirewallApply(virFirewallPtr firewall);
 
+typedef int (*virFirewallRuleIterator)(virFirewallLayer layer,
+                                       bool ignoreErrors,
+                                       const char *const *args,
+                                       size_t nargs,
+                                       void *opaque);
+
+int virFirewallForEachRule(virFirewallPtr firewall,
+                           virFirewallRuleIterator iter,
+                           void *opaque);
+
 void virFirewallBackendSynchronize(void);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(virFirewall, virFirewallFree);
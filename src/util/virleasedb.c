@@ -0,0 +1,758 @@
+/*
+ * virleasedb.c: indexed DHCP lease database
+ *
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if WITH_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "virleasedb.h"
+#include "virleasedbformat.h"
+#include "virlease.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NETWORK
+
+VIR_LOG_INIT("util.virleasedb");
+
+G_STATIC_ASSERT(sizeof(virLeaseDBHeader) == 512);
+G_STATIC_ASSERT(sizeof(virLeaseDBRecord) % 8 == 0);
+
+struct _virLeaseDB {
+    char *path;
+    int fd;
+    size_t size;
+    virLeaseDBHeader *hdr;
+};
+
+
+/**
+ * virLeaseDBFileName:
+ * @dnsmasqStateDir: directory holding dnsmasq state files
+ * @bridge: bridge the leases belong to
+ *
+ * Returns the path of the lease database for @bridge.
+ */
+char *
+virLeaseDBFileName(const char *dnsmasqStateDir,
+                   const char *bridge)
+{
+    return g_strdup_printf("%s/%s.leasedb", dnsmasqStateDir, bridge);
+}
+
+
+#if WITH_MMAP
+static void
+virLeaseDBUnmap(virLeaseDBPtr db)
+{
+    if (db->hdr)
+        munmap(db->hdr, db->size);
+    db->hdr = NULL;
+    db->size = 0;
+    VIR_FORCE_CLOSE(db->fd);
+}
+
+
+/* Returns 0 on success, -1 on error and -2 if @path exists but does not
+ * contain a valid database. */
+static int
+virLeaseDBMap(virLeaseDBPtr db,
+              const char *path,
+              bool writable)
+{
+    struct stat sb;
+    void *map;
+
+    if ((db->fd = open(path, writable ? O_RDWR : O_RDONLY)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to open lease database '%s'"), path);
+        return -1;
+    }
+
+    if (fstat(db->fd, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to stat lease database '%s'"), path);
+        return -1;
+    }
+
+    if (sb.st_size < (off_t) sizeof(virLeaseDBHeader))
+        return -2;
+
+    map = mmap(NULL, sb.st_size, PROT_READ | (writable ? PROT_WRITE : 0),
+               MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) {
+        virReportSystemError(errno,
+                             _("Unable to map lease database '%s'"), path);
+        return -1;
+    }
+
+    db->hdr = map;
+    db->size = sb.st_size;
+
+    if (virLeaseDBValidate(db->hdr, db->size) < 0)
+        return -2;
+
+    return 0;
+}
+
+
+static virLeaseDBPtr
+virLeaseDBCreate(const char *path,
+                 uint32_t nbuckets)
+{
+    g_autoptr(virLeaseDB) db = g_new0(virLeaseDB, 1);
+    size_t size = virLeaseDBFileSize(nbuckets);
+    void *map;
+
+    db->fd = -1;
+    db->path = g_strdup(path);
+
+    if ((db->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create lease database '%s'"), path);
+        return NULL;
+    }
+
+    if (ftruncate(db->fd, size) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to resize lease database '%s'"), path);
+        return NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) {
+        virReportSystemError(errno,
+                             _("Unable to map lease database '%s'"), path);
+        return NULL;
+    }
+
+    db->hdr = map;
+    db->size = size;
+
+    memcpy(db->hdr->magic, VIR_LEASE_DB_MAGIC, sizeof(db->hdr->magic));
+    db->hdr->version = VIR_LEASE_DB_VERSION;
+    db->hdr->nbuckets = nbuckets;
+    db->hdr->maxrecords = nbuckets / 2;
+
+    return g_steal_pointer(&db);
+}
+#else /* !WITH_MMAP */
+static void
+virLeaseDBUnmap(virLeaseDBPtr db)
+{
+    VIR_FORCE_CLOSE(db->fd);
+}
+
+
+static int
+virLeaseDBMap(virLeaseDBPtr db G_GNUC_UNUSED,
+              const char *path,
+              bool writable G_GNUC_UNUSED)
+{
+    virReportSystemError(ENOSYS,
+                         _("Unable to map lease database '%s'"), path);
+    return -1;
+}
+
+
+static virLeaseDBPtr
+virLeaseDBCreate(const char *path,
+                 uint32_t nbuckets G_GNUC_UNUSED)
+{
+    virReportSystemError(ENOSYS,
+                         _("Unable to create lease database '%s'"), path);
+    return NULL;
+}
+#endif /* !WITH_MMAP */
+
+
+void
+virLeaseDBFree(virLeaseDBPtr db)
+{
+    if (!db)
+        return;
+
+    virLeaseDBUnmap(db);
+    g_free(db->path);
+    g_free(db);
+}
+
+
+static void
+virLeaseDBBeginUpdate(virLeaseDBHeader *hdr)
+{
+    __atomic_store_n(&hdr->generation, hdr->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void
+virLeaseDBEndUpdate(virLeaseDBHeader *hdr)
+{
+    __atomic_store_n(&hdr->generation, hdr->generation + 1, __ATOMIC_RELEASE);
+}
+
+
+static int
+virLeaseDBIndexAdd(virLeaseDBHeader *hdr,
+                   virLeaseDBIndexType type,
+                   const char *key,
+                   uint32_t bucket)
+{
+    uint32_t *index = virLeaseDBGetIndex(hdr, type);
+    uint32_t mask = hdr->nbuckets - 1;
+    uint32_t start = virLeaseDBHash(key) & mask;
+    uint32_t i;
+
+    for (i = 0; i < hdr->nbuckets; i++) {
+        uint32_t *slot = &index[(start + i) & mask];
+
+        if (*slot == 0) {
+            __atomic_store_n(slot, bucket, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("lease database index is full"));
+    return -1;
+}
+
+
+/* Append @rec and retire any older lease for the same address. The
+ * caller guarantees there is room left in the record table. */
+static int
+virLeaseDBAppend(virLeaseDBHeader *hdr,
+                 const virLeaseDBRecord *rec)
+{
+    virLeaseDBRecord *records = virLeaseDBGetRecords(hdr);
+    virLeaseDBRecord *newrec = &records[hdr->nrecords];
+    virLeaseDBRecord *old;
+    int64_t pos = -1;
+    size_t i;
+
+    *newrec = *rec;
+    newrec->live = 1;
+    hdr->nrecords++;
+
+    for (i = 0; i < VIR_LEASE_DB_INDEX_LAST; i++) {
+        const char *key = virLeaseDBRecordKey(newrec, i);
+
+        if (!*key)
+            continue;
+
+        if (virLeaseDBIndexAdd(hdr, i, key, hdr->nrecords) < 0)
+            return -1;
+    }
+
+    while ((old = virLeaseDBLookupNext(hdr, VIR_LEASE_DB_INDEX_IP,
+                                       newrec->ipaddr, &pos))) {
+        if (old == newrec)
+            continue;
+
+        old->live = 0;
+        hdr->nlive--;
+    }
+
+    hdr->nlive++;
+    return 0;
+}
+
+
+/* Records of a database that was not closed cleanly may be garbage,
+ * make sure their strings are terminated before using them as keys. */
+static void
+virLeaseDBRecordSanitize(virLeaseDBRecord *rec)
+{
+    rec->ipaddr[sizeof(rec->ipaddr) - 1] = '\0';
+    rec->mac[sizeof(rec->mac) - 1] = '\0';
+    rec->iaid[sizeof(rec->iaid) - 1] = '\0';
+    rec->hostname[sizeof(rec->hostname) - 1] = '\0';
+    rec->clientid[sizeof(rec->clientid) - 1] = '\0';
+}
+
+
+/**
+ * virLeaseDBRebuild:
+ * @db: lease database
+ *
+ * Write the live leases of @db into a new, appropriately sized file and
+ * atomically replace the old one with it. Readers which still have the
+ * old file mapped keep seeing a consistent, if slightly stale, view.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virLeaseDBRebuild(virLeaseDBPtr db)
+{
+    g_autofree char *tmppath = g_strdup_printf("%s.new", db->path);
+    g_autoptr(virLeaseDB) newdb = NULL;
+    virLeaseDBRecord *records = NULL;
+    uint32_t nrecords = 0;
+    uint32_t nlive = 0;
+    uint32_t nbuckets = VIR_LEASE_DB_MIN_BUCKETS;
+    size_t i;
+
+    if (db->hdr) {
+        records = virLeaseDBGetRecords(db->hdr);
+        nrecords = MIN(db->hdr->nrecords, db->hdr->maxrecords);
+
+        for (i = 0; i < nrecords; i++) {
+            if (records[i].live)
+                nlive++;
+        }
+    }
+
+    /* Leave the new table at most a quarter full so that the cost of
+     * the rebuild is amortized over many appends */
+    while (nbuckets / 4 < nlive + 1) {
+        if (nbuckets >= VIR_LEASE_DB_MAX_BUCKETS) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("too many leases in '%s'"), db->path);
+            return -1;
+        }
+        nbuckets *= 2;
+    }
+
+    VIR_DEBUG("Rebuilding lease database '%s' with %u leases and %u buckets",
+              db->path, nlive, nbuckets);
+
+    if (!(newdb = virLeaseDBCreate(tmppath, nbuckets)))
+        goto error;
+
+    if (db->hdr) {
+        memcpy(newdb->hdr->serverDUID, db->hdr->serverDUID,
+               sizeof(newdb->hdr->serverDUID));
+        newdb->hdr->serverDUID[sizeof(newdb->hdr->serverDUID) - 1] = '\0';
+        newdb->hdr->generation = (db->hdr->generation | 1) + 1;
+
+        for (i = 0; i < nrecords; i++) {
+            virLeaseDBRecord rec = records[i];
+
+            if (!rec.live)
+                continue;
+
+            virLeaseDBRecordSanitize(&rec);
+            if (virLeaseDBAppend(newdb->hdr, &rec) < 0)
+                goto error;
+        }
+    }
+
+    if (g_fsync(newdb->fd) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to sync lease database '%s'"), tmppath);
+        goto error;
+    }
+
+    if (rename(tmppath, db->path) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to replace lease database '%s'"),
+                             db->path);
+        goto error;
+    }
+
+    virLeaseDBUnmap(db);
+    db->fd = newdb->fd;
+    db->hdr = newdb->hdr;
+    db->size = newdb->size;
+    newdb->fd = -1;
+    newdb->hdr = NULL;
+    newdb->size = 0;
+
+    return 0;
+
+ error:
+    unlink(tmppath);
+    return -1;
+}
+
+
+static int
+virLeaseDBRecordSetString(char *dst,
+                          size_t dstlen,
+                          virJSONValuePtr lease,
+                          const char *key,
+                          bool required)
+{
+    const char *value = virJSONValueObjectGetString(lease, key);
+
+    if (!value) {
+        if (!required)
+            return 0;
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("lease is missing '%s'"), key);
+        return -1;
+    }
+
+    if (virStrcpy(dst, value, dstlen) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("lease '%s' value '%s' is too long"), key, value);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virLeaseDBRecordFromJSON(virLeaseDBRecord *rec,
+                         virJSONValuePtr lease)
+{
+    long long expirytime;
+
+    memset(rec, 0, sizeof(*rec));
+
+    if (virLeaseDBRecordSetString(rec->ipaddr, sizeof(rec->ipaddr),
+                                  lease, "ip-address", true) < 0 ||
+        virLeaseDBRecordSetString(rec->mac, sizeof(rec->mac),
+                                  lease, "mac-address", true) < 0 ||
+        virLeaseDBRecordSetString(rec->iaid, sizeof(rec->iaid),
+                                  lease, "iaid", false) < 0 ||
+        virLeaseDBRecordSetString(rec->hostname, sizeof(rec->hostname),
+                                  lease, "hostname", false) < 0 ||
+        virLeaseDBRecordSetString(rec->clientid, sizeof(rec->clientid),
+                                  lease, "client-id", false) < 0)
+        return -1;
+
+    if (virJSONValueObjectGetNumberLong(lease, "expiry-time", &expirytime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("lease is missing 'expiry-time'"));
+        return -1;
+    }
+    rec->expirytime = expirytime;
+
+    return 0;
+}
+
+
+static int
+virLeaseDBAppendJSONString(virJSONValuePtr lease,
+                           const char *key,
+                           const char *field,
+                           size_t len)
+{
+    g_autofree char *value = g_strndup(field, len);
+
+    if (!*value)
+        return 0;
+
+    return virJSONValueObjectAppendString(lease, key, value);
+}
+
+
+/* Export the live leases in the format of the custom lease file */
+static virJSONValuePtr
+virLeaseDBToJSON(virLeaseDBHeader *hdr)
+{
+    g_autoptr(virJSONValue) leases = virJSONValueNewArray();
+    virLeaseDBRecord *records = virLeaseDBGetRecords(hdr);
+    uint32_t nrecords = MIN(__atomic_load_n(&hdr->nrecords, __ATOMIC_ACQUIRE),
+                            hdr->maxrecords);
+    g_autofree char *server_duid = g_strndup(hdr->serverDUID,
+                                             sizeof(hdr->serverDUID));
+    size_t i;
+
+    for (i = 0; i < nrecords; i++) {
+        virLeaseDBRecord *rec = &records[i];
+        g_autoptr(virJSONValue) lease = NULL;
+
+        if (!rec->live)
+            continue;
+
+        lease = virJSONValueNewObject();
+
+        if (virLeaseDBAppendJSONString(lease, "iaid", rec->iaid,
+                                       sizeof(rec->iaid)) < 0 ||
+            virLeaseDBAppendJSONString(lease, "ip-address", rec->ipaddr,
+                                       sizeof(rec->ipaddr)) < 0 ||
+            virLeaseDBAppendJSONString(lease, "mac-address", rec->mac,
+                                       sizeof(rec->mac)) < 0 ||
+            virLeaseDBAppendJSONString(lease, "hostname", rec->hostname,
+                                       sizeof(rec->hostname)) < 0 ||
+            virLeaseDBAppendJSONString(lease, "client-id", rec->clientid,
+                                       sizeof(rec->clientid)) < 0)
+            return NULL;
+
+        if (*server_duid &&
+            memchr(rec->ipaddr, ':', sizeof(rec->ipaddr)) &&
+            virJSONValueObjectAppendString(lease, "server-duid", server_duid) < 0)
+            return NULL;
+
+        if (virJSONValueObjectAppendNumberLong(lease, "expiry-time",
+                                               rec->expirytime) < 0 ||
+            virJSONValueArrayAppend(leases, &lease) < 0)
+            return NULL;
+    }
+
+    return g_steal_pointer(&leases);
+}
+
+
+static int
+virLeaseDBImport(virLeaseDBPtr db,
+                 const char *legacy_file)
+{
+    g_autoptr(virJSONValue) leases = virJSONValueNewArray();
+    g_autofree char *server_duid = NULL;
+    size_t i;
+
+    VIR_DEBUG("Importing leases from '%s' into '%s'", legacy_file, db->path);
+
+    if (virLeaseReadCustomLeaseFile(leases, legacy_file, NULL, &server_duid) < 0)
+        return -1;
+
+    if (server_duid && virLeaseDBSetServerDUID(db, server_duid) < 0)
+        return -1;
+
+    for (i = 0; i < virJSONValueArraySize(leases); i++) {
+        if (virLeaseDBAdd(db, virJSONValueArrayGet(leases, i)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBOpen:
+ * @path: path of the lease database
+ * @legacy_file: path of the JSON custom lease file, or NULL
+ *
+ * Open the lease database at @path for updating, creating it if it
+ * does not exist yet. A newly created database is populated with the
+ * leases from @legacy_file, which is left in place. A database
+ * which was not updated cleanly is rebuilt from its live records and
+ * one which is not valid at all is replaced by an empty one.
+ *
+ * The caller must make sure there is only one writer at a time.
+ *
+ * Returns the database on success, NULL on error.
+ */
+virLeaseDBPtr
+virLeaseDBOpen(const char *path,
+               const char *legacy_file)
+{
+    g_autoptr(virLeaseDB) db = g_new0(virLeaseDB, 1);
+    int rc;
+
+    db->fd = -1;
+    db->path = g_strdup(path);
+
+    if (virFileExists(path)) {
+        if ((rc = virLeaseDBMap(db, path, true)) == -1)
+            return NULL;
+
+        if (rc == 0 && !(db->hdr->generation & 1))
+            return g_steal_pointer(&db);
+
+        if (rc == 0) {
+            VIR_WARN("Lease database '%s' was not updated cleanly, recovering",
+                     path);
+        } else {
+            VIR_WARN("Lease database '%s' is not valid, rewriting it", path);
+            virLeaseDBUnmap(db);
+        }
+
+        if (virLeaseDBRebuild(db) < 0)
+            return NULL;
+
+        return g_steal_pointer(&db);
+    }
+
+    if (virLeaseDBRebuild(db) < 0)
+        return NULL;
+
+    if (legacy_file && virFileExists(legacy_file) &&
+        virLeaseDBImport(db, legacy_file) < 0)
+        return NULL;
+
+    return g_steal_pointer(&db);
+}
+
+
+/**
+ * virLeaseDBAdd:
+ * @db: lease database
+ * @lease: lease as created by virLeaseNew()
+ *
+ * Append @lease to @db, replacing any lease for the same IP address.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBAdd(virLeaseDBPtr db,
+              virJSONValuePtr lease)
+{
+    virLeaseDBRecord rec;
+    int ret;
+
+    if (virLeaseDBRecordFromJSON(&rec, lease) < 0)
+        return -1;
+
+    if (db->hdr->nrecords >= db->hdr->maxrecords &&
+        virLeaseDBRebuild(db) < 0)
+        return -1;
+
+    virLeaseDBBeginUpdate(db->hdr);
+    ret = virLeaseDBAppend(db->hdr, &rec);
+    virLeaseDBEndUpdate(db->hdr);
+
+    return ret;
+}
+
+
+/**
+ * virLeaseDBRemove:
+ * @db: lease database
+ * @ip: IP address of the lease
+ *
+ * Remove the lease for @ip from @db, if there is any.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLeaseDBRemove(virLeaseDBPtr db,
+                 const char *ip)
+{
+    virLeaseDBRecord *rec;
+    int64_t pos = -1;
+
+    virLeaseDBBeginUpdate(db->hdr);
+    while ((rec = virLeaseDBLookupNext(db->hdr, VIR_LEASE_DB_INDEX_IP,
+                                       ip, &pos))) {
+        rec->live = 0;
+        db->hdr->nlive--;
+    }
+    virLeaseDBEndUpdate(db->hdr);
+
+    return 0;
+}
+
+
+const char *
+virLeaseDBGetServerDUID(virLeaseDBPtr db)
+{
+    const char *server_duid = db->hdr->serverDUID;
+
+    if (!memchr(server_duid, '\0', sizeof(db->hdr->serverDUID)) ||
+        !*server_duid)
+        return NULL;
+
+    return server_duid;
+}
+
+
+int
+virLeaseDBSetServerDUID(virLeaseDBPtr db,
+                        const char *server_duid)
+{
+    char buf[VIR_LEASE_DB_DUID_LEN] = { 0 };
+
+    if (STREQ_NULLABLE(virLeaseDBGetServerDUID(db), server_duid))
+        return 0;
+
+    if (virStrcpyStatic(buf, server_duid) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("server DUID '%s' is too long"), server_duid);
+        return -1;
+    }
+
+    virLeaseDBBeginUpdate(db->hdr);
+    memcpy(db->hdr->serverDUID, buf, sizeof(buf));
+    virLeaseDBEndUpdate(db->hdr);
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBGetLeases:
+ * @db: lease database opened by virLeaseDBOpen()
+ *
+ * Returns the live leases as a JSON array in the format of the custom
+ * lease file, or NULL on error.
+ */
+virJSONValuePtr
+virLeaseDBGetLeases(virLeaseDBPtr db)
+{
+    return virLeaseDBToJSON(db->hdr);
+}
+
+
+/**
+ * virLeaseDBReadLeases:
+ * @path: path of the lease database
+ *
+ * Read the live leases from the database at @path without taking any
+ * lock, retrying while the writer is modifying the database. If the
+ * writer appears to have died midway, the last read is used as is.
+ *
+ * Returns the leases as a JSON array in the format of the custom lease
+ * file, or NULL on error.
+ */
+virJSONValuePtr
+virLeaseDBReadLeases(const char *path)
+{
+    g_autoptr(virLeaseDB) db = g_new0(virLeaseDB, 1);
+    size_t i;
+    int rc;
+
+    db->fd = -1;
+
+    if ((rc = virLeaseDBMap(db, path, false)) < 0) {
+        if (rc == -2)
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("invalid lease database '%s'"), path);
+        return NULL;
+    }
+
+    for (i = 0; i < VIR_LEASE_DB_READ_RETRIES; i++) {
+        uint64_t generation = virLeaseDBReadBegin(db->hdr);
+        bool last = i == VIR_LEASE_DB_READ_RETRIES - 1;
+        g_autoptr(virJSONValue) leases = NULL;
+
+        if (!(generation & 1) || last) {
+            if (!(leases = virLeaseDBToJSON(db->hdr)))
+                return NULL;
+
+            if (!virLeaseDBReadRetry(db->hdr, generation))
+                return g_steal_pointer(&leases);
+
+            if (last) {
+                VIR_WARN("Lease database '%s' is being modified", path);
+                return g_steal_pointer(&leases);
+            }
+        }
+
+        g_usleep(1000);
+    }
+
+    return NULL;
+}
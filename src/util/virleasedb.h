@@ -0,0 +1,53 @@
+/*
+ * virleasedb.h: indexed DHCP lease database
+ *
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "internal.h"
+#include "virjson.h"
+
+typedef struct _virLeaseDB virLeaseDB;
+typedef virLeaseDB *virLeaseDBPtr;
+
+char *virLeaseDBFileName(const char *dnsmasqStateDir,
+                         const char *bridge);
+
+virLeaseDBPtr virLeaseDBOpen(const char *path,
+                             const char *legacy_file);
+
+void virLeaseDBFree(virLeaseDBPtr db);
+
+int virLeaseDBAdd(virLeaseDBPtr db,
+                  virJSONValuePtr lease);
+
+int virLeaseDBRemove(virLeaseDBPtr db,
+                     const char *ip);
+
+const char *virLeaseDBGetServerDUID(virLeaseDBPtr db);
+
+int virLeaseDBSetServerDUID(virLeaseDBPtr db,
+                            const char *server_duid);
+
+virJSONValuePtr virLeaseDBGetLeases(virLeaseDBPtr db);
+
+virJSONValuePtr virLeaseDBReadLeases(const char *path);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(virLeaseDB, virLeaseDBFree);
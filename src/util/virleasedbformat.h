@@ -0,0 +1,280 @@
+/*
+ * virleasedbformat.h: on-disk format of the indexed DHCP lease database
+ *
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+/* This header is shared between the leases helper, the network driver
+ * and the NSS plugin. The NSS plugin must not depend on glib nor on
+ * the rest of libvirt, so only plain C is allowed here. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The database is a single file, mapped into memory by both the writer
+ * (the leases helper, serialized by its pidfile) and any number of
+ * readers. Its layout is:
+ *
+ *   virLeaseDBHeader
+ *   uint32_t ipIndex[nbuckets]
+ *   uint32_t macIndex[nbuckets]
+ *   uint32_t hostnameIndex[nbuckets]
+ *   virLeaseDBRecord records[maxrecords]
+ *
+ * Records are only ever appended; replacing or deleting a lease clears
+ * the @live flag of the old record. Each index is an open addressing
+ * hash table with linear probing whose buckets hold the record number
+ * plus one, zero marking an empty bucket. Since records are never
+ * removed from the indexes, readers must check that a record found
+ * through an index is live and that its key matches. Once the record
+ * table is full, the writer compacts the live records into a new file
+ * which atomically replaces the old one.
+ *
+ * Modifications are bracketed by incrementing @generation, which is
+ * therefore odd while an update is in progress. Readers copy what they
+ * need and retry if the generation was odd or changed meanwhile.
+ */
+
+#define VIR_LEASE_DB_MAGIC "LVLEASDB"
+#define VIR_LEASE_DB_VERSION 1
+
+#define VIR_LEASE_DB_IPADDR_LEN 48
+#define VIR_LEASE_DB_MAC_LEN 24
+#define VIR_LEASE_DB_IAID_LEN 16
+#define VIR_LEASE_DB_HOSTNAME_LEN 256
+#define VIR_LEASE_DB_CLIENTID_LEN 256
+#define VIR_LEASE_DB_DUID_LEN 392
+
+#define VIR_LEASE_DB_MIN_BUCKETS 64
+#define VIR_LEASE_DB_MAX_BUCKETS (1U << 24)
+
+/* How many times readers retry when racing with the writer */
+#define VIR_LEASE_DB_READ_RETRIES 100
+
+typedef enum {
+    VIR_LEASE_DB_INDEX_IP,
+    VIR_LEASE_DB_INDEX_MAC,
+    VIR_LEASE_DB_INDEX_HOSTNAME,
+
+    VIR_LEASE_DB_INDEX_LAST
+} virLeaseDBIndexType;
+
+typedef struct _virLeaseDBHeader virLeaseDBHeader;
+struct _virLeaseDBHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nbuckets;      /* buckets per index, a power of two */
+    uint64_t generation;    /* odd while the writer modifies the file */
+    uint32_t maxrecords;    /* capacity of the record table */
+    uint32_t nrecords;      /* records appended so far, live or not */
+    uint32_t nlive;         /* live records */
+    uint32_t reserved0;
+    char serverDUID[VIR_LEASE_DB_DUID_LEN];
+    char reserved[80];
+};
+
+typedef struct _virLeaseDBRecord virLeaseDBRecord;
+struct _virLeaseDBRecord {
+    uint32_t live;
+    uint32_t reserved0;
+    int64_t expirytime;
+    char ipaddr[VIR_LEASE_DB_IPADDR_LEN];
+    char mac[VIR_LEASE_DB_MAC_LEN];
+    char iaid[VIR_LEASE_DB_IAID_LEN];
+    char hostname[VIR_LEASE_DB_HOSTNAME_LEN];
+    char clientid[VIR_LEASE_DB_CLIENTID_LEN];
+};
+
+
+/* FNV-1a, cheap and good enough for MACs, addresses and hostnames */
+static inline uint32_t
+virLeaseDBHash(const char *key)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *key; key++) {
+        hash ^= (unsigned char) *key;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+static inline size_t
+virLeaseDBFileSize(uint32_t nbuckets)
+{
+    return sizeof(virLeaseDBHeader) +
+        (size_t) nbuckets * VIR_LEASE_DB_INDEX_LAST * sizeof(uint32_t) +
+        (size_t) (nbuckets / 2) * sizeof(virLeaseDBRecord);
+}
+
+
+static inline uint32_t *
+virLeaseDBGetIndex(virLeaseDBHeader *hdr,
+                   virLeaseDBIndexType type)
+{
+    uint32_t *indexes = (uint32_t *) (hdr + 1);
+
+    return indexes + (size_t) hdr->nbuckets * type;
+}
+
+
+static inline virLeaseDBRecord *
+virLeaseDBGetRecords(virLeaseDBHeader *hdr)
+{
+    return (virLeaseDBRecord *) virLeaseDBGetIndex(hdr, VIR_LEASE_DB_INDEX_LAST);
+}
+
+
+static inline const char *
+virLeaseDBRecordKey(virLeaseDBRecord *rec,
+                    virLeaseDBIndexType type)
+{
+    switch (type) {
+    case VIR_LEASE_DB_INDEX_IP:
+        return rec->ipaddr;
+    case VIR_LEASE_DB_INDEX_MAC:
+        return rec->mac;
+    case VIR_LEASE_DB_INDEX_HOSTNAME:
+        return rec->hostname;
+    case VIR_LEASE_DB_INDEX_LAST:
+        break;
+    }
+
+    return NULL;
+}
+
+
+/* Compare a key stored in a record with @key, never looking further
+ * than the longest key field even if the record is not terminated. */
+static inline int
+virLeaseDBKeyEqual(const char *reckey,
+                   const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_LEASE_DB_HOSTNAME_LEN; i++) {
+        if (reckey[i] != key[i])
+            return 0;
+        if (!key[i])
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBValidate:
+ * @hdr: mapped database
+ * @size: size of the mapping
+ *
+ * Returns 0 if @hdr looks like a database this code understands,
+ * -1 otherwise.
+ */
+static inline int
+virLeaseDBValidate(virLeaseDBHeader *hdr,
+                   size_t size)
+{
+    if (size < sizeof(*hdr) ||
+        memcmp(hdr->magic, VIR_LEASE_DB_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != VIR_LEASE_DB_VERSION ||
+        hdr->nbuckets < VIR_LEASE_DB_MIN_BUCKETS ||
+        hdr->nbuckets > VIR_LEASE_DB_MAX_BUCKETS ||
+        (hdr->nbuckets & (hdr->nbuckets - 1)) != 0 ||
+        hdr->maxrecords != hdr->nbuckets / 2 ||
+        size < virLeaseDBFileSize(hdr->nbuckets))
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * virLeaseDBLookupNext:
+ * @hdr: mapped database
+ * @type: which index to search
+ * @key: key to look up
+ * @pos: iterator, initialize to -1 before the first call
+ *
+ * Iterate over live records whose @type key equals @key. The probe
+ * sequence is bounded so that a reader racing with the writer always
+ * terminates.
+ *
+ * Returns the next matching record or NULL when there are no more.
+ */
+static inline virLeaseDBRecord *
+virLeaseDBLookupNext(virLeaseDBHeader *hdr,
+                     virLeaseDBIndexType type,
+                     const char *key,
+                     int64_t *pos)
+{
+    uint32_t *index = virLeaseDBGetIndex(hdr, type);
+    virLeaseDBRecord *records = virLeaseDBGetRecords(hdr);
+    uint32_t mask = hdr->nbuckets - 1;
+    uint32_t start = virLeaseDBHash(key) & mask;
+    int64_t i;
+
+    for (i = *pos + 1; i < hdr->nbuckets; i++) {
+        uint32_t bucket = __atomic_load_n(&index[(start + i) & mask],
+                                          __ATOMIC_ACQUIRE);
+        virLeaseDBRecord *rec;
+        const char *reckey;
+
+        if (bucket == 0)
+            break;
+
+        if (bucket > hdr->maxrecords)
+            continue;
+
+        rec = &records[bucket - 1];
+        reckey = virLeaseDBRecordKey(rec, type);
+
+        if (rec->live && virLeaseDBKeyEqual(reckey, key)) {
+            *pos = i;
+            return rec;
+        }
+    }
+
+    *pos = hdr->nbuckets;
+    return NULL;
+}
+
+
+static inline uint64_t
+virLeaseDBReadBegin(virLeaseDBHeader *hdr)
+{
+    return __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+}
+
+
+/* Returns nonzero if data read since virLeaseDBReadBegin returned
+ * @generation may be inconsistent and has to be read again. */
+static inline int
+virLeaseDBReadRetry(virLeaseDBHeader *hdr,
+                    uint64_t generation)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (generation & 1) ||
+        __atomic_load_n(&hdr->generation, __ATOMIC_RELAXED) != generation;
+}
@@ -69,7 +69,7 @@ static GRegex *virLogRegex;
 VIR_ENUM_DECL(virLogDestination);
 VIR_ENUM_IMPL(virLogDestination,
               VIR_LOG_TO_OUTPUT_LAST,
-              "stderr", "syslog", "file", "journald",
+              "stderr", "syslog", "file", "journald", "memory",
 );
 
 /*
@@ -85,6 +85,13 @@ static int virLogFiltersSerial = 1;
 static virLogFilterPtr *virLogFilters;
 static size_t virLogNbFilters;
 
+/*
+ * Sources which emitted a message so far, their priority is updated
+ * whenever the filters or the default priority change. Modules are
+ * loaded with RTLD_NODELETE so the sources are never unmapped.
+ */
+static virLogSourcePtr virLogSources;
+
 /*
  * Outputs are used to emit the messages retained
  * after filtering, multiple output can be used simultaneously
@@ -108,8 +115,79 @@ static size_t virLogNbOutputs;
  */
 static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
+/*
+ * Asynchronous logging: every thread queues the formatted messages into its
+ * own single-producer single-consumer ring which is drained by a dedicated
+ * writer thread calling the outputs.
+ */
+#define VIR_LOG_ASYNC_RING_SIZE 1024 /* must be a power of 2 */
+#define VIR_LOG_ASYNC_IDLE_MS 100
+
+typedef struct _virLogAsyncEntry virLogAsyncEntry;
+typedef virLogAsyncEntry *virLogAsyncEntryPtr;
+struct _virLogAsyncEntry {
+    gsize seq;
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogMetadataPtr metadata;
+    char *str;
+    char *msg;
+};
+
+typedef struct _virLogAsyncRing virLogAsyncRing;
+typedef virLogAsyncRing *virLogAsyncRingPtr;
+struct _virLogAsyncRing {
+    unsigned int head; /* advanced only by the owning thread */
+    unsigned int tail; /* advanced only by the writer */
+    unsigned int dropped; /* messages dropped as the ring was full */
+    int orphaned; /* the owning thread has exited */
+    virLogAsyncEntryPtr entries[VIR_LOG_ASYNC_RING_SIZE];
+};
+
+static int virLogAsyncEnabled;
+static int virLogAsyncSleeping;
+static gsize virLogAsyncSeq;
+static unsigned int virLogAsyncDropped;
+static virThreadLocal virLogAsyncRingLocal;
+
+/* The following are protected by virLogAsyncMutex */
+static virMutex virLogAsyncMutex;
+static virCond virLogAsyncCond;
+static virLogAsyncRingPtr *virLogAsyncRings;
+static size_t virLogAsyncNRings;
+static virThread virLogAsyncThread;
+static bool virLogAsyncThreadRunning;
+static bool virLogAsyncQuit;
+
+/*
+ * In-memory log output ("flight recorder") keeping the most recent messages
+ * in a fixed size ring of bytes which is written out only on demand, on
+ * error messages or when the daemon crashes.
+ */
+#define VIR_LOG_MEMORY_MAX_MIB 4096
+
+typedef struct _virLogMemory virLogMemory;
+typedef virLogMemory *virLogMemoryPtr;
+struct _virLogMemory {
+    char *buf;
+    size_t size;
+    unsigned long long written; /* number of bytes ever written to @buf */
+    unsigned long long dumped; /* @written at the time of the last dump */
+    int fd; /* file the ring is dumped into on errors, or -1 */
+};
+
+/* The memory output currently defined, protected by virLogMutex. It is
+ * also read from fatal signal handlers, so it's always set atomically. */
+static virLogMemoryPtr virLogMemoryActive;
+
 static void virLogResetFilters(void);
 static void virLogResetOutputs(void);
+static void virLogAsyncRingRelease(void *opaque);
+static void virLogSourcesRefresh(void);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -247,7 +325,10 @@ virLogPriorityString(virLogPriority lvl)
 static int
 virLogOnceInit(void)
 {
-    if (virMutexInit(&virLogMutex) < 0)
+    if (virMutexInit(&virLogMutex) < 0 ||
+        virMutexInit(&virLogAsyncMutex) < 0 ||
+        virCondInit(&virLogAsyncCond) < 0 ||
+        virThreadLocalInit(&virLogAsyncRingLocal, virLogAsyncRingRelease) < 0)
         return -1;
 
     virLogLock();
@@ -283,10 +364,15 @@ virLogReset(void)
     if (virLogInitialize() < 0)
         return -1;
 
+    /* Messages are written synchronously after reset. This is also what
+     * makes a forked child, which has no writer thread, log directly. */
+    g_atomic_int_set(&virLogAsyncEnabled, 0);
+
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogSourcesRefresh();
     virLogUnlock();
     return 0;
 }
@@ -313,7 +399,11 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogLock();
     virLogDefaultPriority = priority;
+    virLogFiltersSerial++;
+    virLogSourcesRefresh();
+    virLogUnlock();
     return 0;
 }
 
@@ -373,6 +463,7 @@ virLogFilterListFree(virLogFilterPtr *list, int count)
 static void
 virLogResetOutputs(void)
 {
+    g_atomic_pointer_set(&virLogMemoryActive, NULL);
     virLogOutputListFree(virLogOutputs, virLogNbOutputs);
     virLogOutputs = NULL;
     virLogNbOutputs = 0;
@@ -457,95 +548,75 @@ virLogHostnameString(char **rawmsg,
 }
 
 
+/* Call this function while holding the log lock */
+static void
+virLogSourceEvaluate(virLogSourcePtr source)
+{
+    unsigned int priority = virLogDefaultPriority;
+    size_t i;
+
+    for (i = 0; i < virLogNbFilters; i++) {
+        if (g_pattern_match_simple(virLogFilters[i]->match, source->name)) {
+            priority = virLogFilters[i]->priority;
+            break;
+        }
+    }
+
+    source->priority = priority;
+    source->serial = virLogFiltersSerial;
+}
+
+
+/*
+ * Updates the priority of all sources which emitted a message so far,
+ * so that the check in VIR_LOG_SOURCE_ENABLED stays accurate. Call this
+ * function while holding the log lock.
+ */
+static void
+virLogSourcesRefresh(void)
+{
+    virLogSourcePtr source;
+
+    for (source = virLogSources; source; source = source->next)
+        virLogSourceEvaluate(source);
+}
+
+
 static void
 virLogSourceUpdate(virLogSourcePtr source)
 {
     virLogLock();
     if (source->serial < virLogFiltersSerial) {
-        unsigned int priority = virLogDefaultPriority;
-        size_t i;
-
-        for (i = 0; i < virLogNbFilters; i++) {
-            if (g_pattern_match_simple(virLogFilters[i]->match, source->name)) {
-                priority = virLogFilters[i]->priority;
-                break;
-            }
+        /* the first message emitted by @source */
+        if (source->serial == 0) {
+            source->next = virLogSources;
+            virLogSources = source;
         }
 
-        source->priority = priority;
-        source->serial = virLogFiltersSerial;
+        virLogSourceEvaluate(source);
     }
     virLogUnlock();
 }
 
 
-/**
- * virLogVMessage:
- * @source: where is that message coming from
- * @priority: the priority level
- * @filename: file where the message was emitted
- * @linenr: line where the message was emitted
- * @funcname: the function emitting the (debug) message
- * @metadata: NULL or metadata array, terminated by an item with NULL key
- * @fmt: the string format
- * @vargs: format args
- *
- * Call the libvirt logger with some information. Based on the configuration
- * the message may be stored, sent to output or just discarded
+/*
+ * Pushes the message to the outputs defined, if none exist then use
+ * stderr. Call this function while holding the log lock.
  */
 static void
-G_GNUC_PRINTF(7, 0)
-virLogVMessage(virLogSourcePtr source,
+virLogDispatch(virLogSourcePtr source,
                virLogPriority priority,
                const char *filename,
                int linenr,
                const char *funcname,
+               const char *timestamp,
                virLogMetadataPtr metadata,
-               const char *fmt,
-               va_list vargs)
+               const char *str,
+               const char *msg)
 {
     static bool logInitMessageStderr = true;
-    g_autofree char *str = NULL;
-    g_autofree char *msg = NULL;
-    char timestamp[VIR_TIME_STRING_BUFLEN];
     size_t i;
-    int saved_errno = errno;
-
-    if (virLogInitialize() < 0)
-        return;
 
-    if (fmt == NULL)
-        return;
-
-    /*
-     * 3 intentionally non-thread safe variable reads.
-     * Since writes to the variable are serialized on
-     * virLogLock, worst case result is a log message
-     * is accidentally dropped or emitted, if another
-     * thread is updating log filter list concurrently
-     * with a log message emission.
-     */
-    if (source->serial < virLogFiltersSerial)
-        virLogSourceUpdate(source);
-    if (priority < source->priority)
-        goto cleanup;
-
-    /*
-     * serialize the error message, add level and timestamp
-     */
-    str = g_strdup_vprintf(fmt, vargs);
-
-    virLogFormatString(&msg, linenr, funcname, priority, str);
-
-    if (virTimeStringNowRaw(timestamp) < 0)
-        timestamp[0] = '\0';
-
-    virLogLock();
-
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
     for (i = 0; i < virLogNbOutputs; i++) {
         if (priority >= virLogOutputs[i]->priority) {
             if (virLogOutputs[i]->logInitMessage) {
@@ -600,6 +671,426 @@ virLogVMessage(virLogSourcePtr source,
                          timestamp, metadata,
                          str, msg, (void *) STDERR_FILENO);
     }
+}
+
+
+static virLogMetadataPtr
+virLogMetadataCopy(virLogMetadataPtr metadata)
+{
+    virLogMetadataPtr ret;
+    size_t n = 0;
+    size_t i;
+
+    if (!metadata)
+        return NULL;
+
+    while (metadata[n].key)
+        n++;
+
+    ret = g_new0(virLogMetadata, n + 1);
+    for (i = 0; i < n; i++) {
+        ret[i].key = g_strdup(metadata[i].key);
+        ret[i].s = g_strdup(metadata[i].s);
+        ret[i].iv = metadata[i].iv;
+    }
+
+    return ret;
+}
+
+
+static void
+virLogMetadataFree(virLogMetadataPtr metadata)
+{
+    size_t i;
+
+    if (!metadata)
+        return;
+
+    for (i = 0; metadata[i].key; i++) {
+        g_free((char *) metadata[i].key);
+        g_free((char *) metadata[i].s);
+    }
+    g_free(metadata);
+}
+
+
+static void
+virLogAsyncEntryFree(virLogAsyncEntryPtr entry)
+{
+    virLogMetadataFree(entry->metadata);
+    g_free(entry->str);
+    g_free(entry->msg);
+    g_free(entry);
+}
+
+
+static int
+virLogAsyncEntryCompare(const void *a,
+                        const void *b)
+{
+    const virLogAsyncEntry *ea = *(const virLogAsyncEntry **)a;
+    const virLogAsyncEntry *eb = *(const virLogAsyncEntry **)b;
+
+    if (ea->seq < eb->seq)
+        return -1;
+    return ea->seq > eb->seq;
+}
+
+
+static void
+virLogAsyncRingRelease(void *opaque)
+{
+    virLogAsyncRingPtr ring = opaque;
+
+    /* The writer frees the ring once it drains it */
+    g_atomic_int_set(&ring->orphaned, 1);
+}
+
+
+/*
+ * Queues the message into the ring of the calling thread, taking ownership
+ * of @str and @msg. Only the first use in a thread takes a lock. If the ring
+ * is full the message is dropped and accounted for.
+ *
+ * Returns 0 if the message was consumed, -1 if it has to be logged
+ * synchronously.
+ */
+static int
+virLogAsyncEnqueue(virLogSourcePtr source,
+                   virLogPriority priority,
+                   const char *filename,
+                   int linenr,
+                   const char *funcname,
+                   const char *timestamp,
+                   virLogMetadataPtr metadata,
+                   char **str,
+                   char **msg)
+{
+    virLogAsyncRingPtr ring = virThreadLocalGet(&virLogAsyncRingLocal);
+    virLogAsyncEntryPtr entry;
+    unsigned int head;
+
+    if (!ring) {
+        ring = g_new0(virLogAsyncRing, 1);
+
+        if (virThreadLocalSet(&virLogAsyncRingLocal, ring) < 0) {
+            g_free(ring);
+            return -1;
+        }
+
+        virMutexLock(&virLogAsyncMutex);
+        ignore_value(VIR_APPEND_ELEMENT_COPY(virLogAsyncRings,
+                                             virLogAsyncNRings, ring));
+        virMutexUnlock(&virLogAsyncMutex);
+    }
+
+    head = ring->head;
+
+    if (head - (unsigned int) g_atomic_int_get(&ring->tail) >= VIR_LOG_ASYNC_RING_SIZE) {
+        g_atomic_int_inc(&ring->dropped);
+        g_atomic_int_inc(&virLogAsyncDropped);
+        return 0;
+    }
+
+    entry = g_new0(virLogAsyncEntry, 1);
+    entry->seq = g_atomic_pointer_add(&virLogAsyncSeq, 1);
+    entry->source = source;
+    entry->priority = priority;
+    entry->filename = filename;
+    entry->linenr = linenr;
+    entry->funcname = funcname;
+    if (virStrcpyStatic(entry->timestamp, timestamp) < 0)
+        entry->timestamp[0] = '\0';
+    entry->metadata = virLogMetadataCopy(metadata);
+    entry->str = g_steal_pointer(str);
+    entry->msg = g_steal_pointer(msg);
+
+    ring->entries[head & (VIR_LOG_ASYNC_RING_SIZE - 1)] = entry;
+    g_atomic_int_set(&ring->head, head + 1);
+
+    /* Wake up the writer if it went to sleep */
+    if (g_atomic_int_compare_and_exchange(&virLogAsyncSleeping, 1, 0)) {
+        virMutexLock(&virLogAsyncMutex);
+        virCondSignal(&virLogAsyncCond);
+        virMutexUnlock(&virLogAsyncMutex);
+    }
+
+    return 0;
+}
+
+
+/* Call this function while holding virLogAsyncMutex */
+static bool
+virLogAsyncPending(void)
+{
+    size_t i;
+
+    for (i = 0; i < virLogAsyncNRings; i++) {
+        virLogAsyncRingPtr ring = virLogAsyncRings[i];
+
+        if (g_atomic_int_get(&ring->head) != ring->tail ||
+            g_atomic_int_get(&ring->dropped) != 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Writes all messages queued so far to the outputs, ordered by the time
+ * they were emitted. Only one thread may call this at a time.
+ *
+ * Returns the number of messages written.
+ */
+static size_t
+virLogAsyncFlush(void)
+{
+    g_autofree virLogAsyncEntryPtr *entries = NULL;
+    size_t nentries = 0;
+    unsigned int dropped = 0;
+    size_t i;
+
+    virMutexLock(&virLogAsyncMutex);
+    for (i = 0; i < virLogAsyncNRings;) {
+        virLogAsyncRingPtr ring = virLogAsyncRings[i];
+        bool orphaned = g_atomic_int_get(&ring->orphaned);
+        unsigned int head = g_atomic_int_get(&ring->head);
+        unsigned int tail = ring->tail;
+        unsigned int ndropped = g_atomic_int_get(&ring->dropped);
+
+        if (head != tail) {
+            entries = g_renew(virLogAsyncEntryPtr, entries,
+                              nentries + (head - tail));
+            for (; tail != head; tail++)
+                entries[nentries++] = ring->entries[tail & (VIR_LOG_ASYNC_RING_SIZE - 1)];
+            g_atomic_int_set(&ring->tail, tail);
+        }
+
+        if (ndropped > 0) {
+            g_atomic_int_add(&ring->dropped, -(int) ndropped);
+            dropped += ndropped;
+        }
+
+        if (orphaned) {
+            g_free(ring);
+            VIR_DELETE_ELEMENT(virLogAsyncRings, i, virLogAsyncNRings);
+            continue;
+        }
+
+        i++;
+    }
+    virMutexUnlock(&virLogAsyncMutex);
+
+    if (nentries == 0 && dropped == 0)
+        return 0;
+
+    qsort(entries, nentries, sizeof(*entries), virLogAsyncEntryCompare);
+
+    virLogLock();
+
+    if (dropped > 0) {
+        g_autofree char *str = NULL;
+        g_autofree char *msg = NULL;
+        char timestamp[VIR_TIME_STRING_BUFLEN];
+
+        if (virTimeStringNowRaw(timestamp) < 0)
+            timestamp[0] = '\0';
+
+        str = g_strdup_printf("%u log messages were dropped as the "
+                              "asynchronous log queue was full", dropped);
+        virLogFormatString(&msg, __LINE__, __func__, VIR_LOG_WARN, str);
+        virLogDispatch(&virLogSelf, VIR_LOG_WARN, __FILE__, __LINE__,
+                       __func__, timestamp, NULL, str, msg);
+    }
+
+    for (i = 0; i < nentries; i++) {
+        virLogAsyncEntryPtr entry = entries[i];
+
+        virLogDispatch(entry->source, entry->priority,
+                       entry->filename, entry->linenr, entry->funcname,
+                       entry->timestamp, entry->metadata,
+                       entry->str, entry->msg);
+        virLogAsyncEntryFree(entry);
+    }
+
+    virLogUnlock();
+
+    return nentries + dropped;
+}
+
+
+static void
+virLogAsyncWriter(void *opaque G_GNUC_UNUSED)
+{
+    for (;;) {
+        unsigned long long now;
+
+        if (virLogAsyncFlush() > 0)
+            continue;
+
+        virMutexLock(&virLogAsyncMutex);
+
+        if (virLogAsyncQuit) {
+            virMutexUnlock(&virLogAsyncMutex);
+            break;
+        }
+
+        /* Producers check this flag after queuing a message, so either they
+         * see it set and signal the condition, or we see their message */
+        g_atomic_int_set(&virLogAsyncSleeping, 1);
+        if (!virLogAsyncPending() && virTimeMillisNow(&now) == 0)
+            ignore_value(virCondWaitUntil(&virLogAsyncCond, &virLogAsyncMutex,
+                                          now + VIR_LOG_ASYNC_IDLE_MS));
+        g_atomic_int_set(&virLogAsyncSleeping, 0);
+
+        virMutexUnlock(&virLogAsyncMutex);
+    }
+}
+
+
+/**
+ * virLogSetAsync:
+ * @async: whether messages should be logged asynchronously
+ *
+ * When enabled, threads emitting log messages only format them and queue
+ * them into a per-thread ring buffer. A dedicated thread then calls the
+ * outputs, so slow outputs don't serialize the emitting threads on the log
+ * lock. Messages which don't fit into a full ring buffer are dropped and
+ * their count is reported once there is room again. Disabling asynchronous
+ * logging writes out all queued messages before returning.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(bool async)
+{
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virLogAsyncMutex);
+
+    if (async) {
+        if (!virLogAsyncThreadRunning) {
+            virLogAsyncQuit = false;
+            if (virThreadCreateFull(&virLogAsyncThread, true,
+                                    virLogAsyncWriter, "log-writer",
+                                    false, NULL) < 0) {
+                virMutexUnlock(&virLogAsyncMutex);
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create log writer thread"));
+                return -1;
+            }
+            virLogAsyncThreadRunning = true;
+        }
+
+        g_atomic_int_set(&virLogAsyncEnabled, 1);
+        virMutexUnlock(&virLogAsyncMutex);
+        return 0;
+    }
+
+    g_atomic_int_set(&virLogAsyncEnabled, 0);
+
+    if (virLogAsyncThreadRunning) {
+        virLogAsyncQuit = true;
+        virCondSignal(&virLogAsyncCond);
+        virMutexUnlock(&virLogAsyncMutex);
+
+        virThreadJoin(&virLogAsyncThread);
+
+        virMutexLock(&virLogAsyncMutex);
+        virLogAsyncThreadRunning = false;
+    }
+
+    virMutexUnlock(&virLogAsyncMutex);
+
+    /* pick up messages queued while the writer was exiting */
+    virLogAsyncFlush();
+
+    return 0;
+}
+
+
+/**
+ * virLogGetAsyncDropped:
+ *
+ * Returns the number of messages dropped so far because the asynchronous
+ * log queue of the emitting thread was full.
+ */
+unsigned int
+virLogGetAsyncDropped(void)
+{
+    return g_atomic_int_get(&virLogAsyncDropped);
+}
+
+
+/**
+ * virLogVMessage:
+ * @source: where is that message coming from
+ * @priority: the priority level
+ * @filename: file where the message was emitted
+ * @linenr: line where the message was emitted
+ * @funcname: the function emitting the (debug) message
+ * @metadata: NULL or metadata array, terminated by an item with NULL key
+ * @fmt: the string format
+ * @vargs: format args
+ *
+ * Call the libvirt logger with some information. Based on the configuration
+ * the message may be stored, sent to output or just discarded
+ */
+static void
+G_GNUC_PRINTF(7, 0)
+virLogVMessage(virLogSourcePtr source,
+               virLogPriority priority,
+               const char *filename,
+               int linenr,
+               const char *funcname,
+               virLogMetadataPtr metadata,
+               const char *fmt,
+               va_list vargs)
+{
+    g_autofree char *str = NULL;
+    g_autofree char *msg = NULL;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    int saved_errno = errno;
+
+    if (virLogInitialize() < 0)
+        return;
+
+    if (fmt == NULL)
+        return;
+
+    /*
+     * 3 intentionally non-thread safe variable reads.
+     * Since writes to the variable are serialized on
+     * virLogLock, worst case result is a log message
+     * is accidentally dropped or emitted, if another
+     * thread is updating log filter list concurrently
+     * with a log message emission.
+     */
+    if (source->serial < virLogFiltersSerial)
+        virLogSourceUpdate(source);
+    if (priority < source->priority)
+        goto cleanup;
+
+    /*
+     * serialize the error message, add level and timestamp
+     */
+    str = g_strdup_vprintf(fmt, vargs);
+
+    virLogFormatString(&msg, linenr, funcname, priority, str);
+
+    if (virTimeStringNowRaw(timestamp) < 0)
+        timestamp[0] = '\0';
+
+    if (g_atomic_int_get(&virLogAsyncEnabled) &&
+        virLogAsyncEnqueue(source, priority, filename, linenr, funcname,
+                           timestamp, metadata, &str, &msg) == 0)
+        goto cleanup;
+
+    virLogLock();
+    virLogDispatch(source, priority, filename, linenr, funcname,
+                   timestamp, metadata, str, msg);
     virLogUnlock();
 
  cleanup:
@@ -703,6 +1194,246 @@ virLogNewOutputToFile(virLogPriority priority,
 }
 
 
+static void
+virLogMemoryAppend(virLogMemoryPtr mem,
+                   const char *data,
+                   size_t len)
+{
+    size_t off;
+    size_t chunk;
+
+    /* only the tail of a message larger than the whole ring fits in */
+    if (len > mem->size) {
+        mem->written += len - mem->size;
+        data += len - mem->size;
+        len = mem->size;
+    }
+
+    off = mem->written % mem->size;
+    chunk = MIN(len, mem->size - off);
+
+    memcpy(mem->buf + off, data, chunk);
+    memcpy(mem->buf, data + chunk, len - chunk);
+    mem->written += len;
+}
+
+
+/*
+ * Writes the messages recorded in @mem after @from into @fd. Messages
+ * which were overwritten in the meantime are skipped. This function has to
+ * be async-signal-safe as it's called from the crash handler.
+ *
+ * Returns 0 on success, -1 on error with errno set.
+ */
+static int
+virLogMemoryWrite(virLogMemoryPtr mem,
+                  int fd,
+                  unsigned long long from)
+{
+    unsigned long long written = mem->written;
+    size_t off;
+    size_t len;
+    size_t chunk;
+
+    if (written - from > mem->size) {
+        /* the oldest message was partially overwritten, skip its rest */
+        from = written - mem->size;
+        while (from < written && mem->buf[from % mem->size] != '\n')
+            from++;
+        if (from < written)
+            from++;
+    }
+
+    off = from % mem->size;
+    len = written - from;
+    chunk = MIN(len, mem->size - off);
+
+    if (safewrite(fd, mem->buf + off, chunk) < 0 ||
+        safewrite(fd, mem->buf, len - chunk) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+virLogOutputToMemory(virLogSourcePtr source G_GNUC_UNUSED,
+                     virLogPriority priority,
+                     const char *filename G_GNUC_UNUSED,
+                     int linenr G_GNUC_UNUSED,
+                     const char *funcname G_GNUC_UNUSED,
+                     const char *timestamp,
+                     virLogMetadataPtr metadata G_GNUC_UNUSED,
+                     const char *rawstr G_GNUC_UNUSED,
+                     const char *str,
+                     void *data)
+{
+    virLogMemoryPtr mem = data;
+
+    virLogMemoryAppend(mem, timestamp, strlen(timestamp));
+    virLogMemoryAppend(mem, ": ", 2);
+    virLogMemoryAppend(mem, str, strlen(str));
+
+    /* record the context which lead to the error */
+    if (priority >= VIR_LOG_ERROR && mem->fd >= 0) {
+        ignore_value(virLogMemoryWrite(mem, mem->fd, mem->dumped));
+        mem->dumped = mem->written;
+    }
+}
+
+
+static void
+virLogCloseMemory(void *data)
+{
+    virLogMemoryPtr mem = data;
+
+    VIR_LOG_CLOSE(mem->fd);
+    g_free(mem->buf);
+    g_free(mem);
+}
+
+
+static virLogOutputPtr
+virLogNewOutputToMemory(virLogPriority priority,
+                        unsigned int mib,
+                        const char *file)
+{
+    g_autofree char *name = NULL;
+    virLogMemoryPtr mem = NULL;
+    virLogOutputPtr ret = NULL;
+
+    if (file)
+        name = g_strdup_printf("%u:%s", mib, file);
+    else
+        name = g_strdup_printf("%u", mib);
+
+    mem = g_new0(virLogMemory, 1);
+    mem->size = (size_t) mib * 1024 * 1024;
+    mem->fd = -1;
+
+    if (file &&
+        (mem->fd = open(file, O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno, _("failed to open %s"), file);
+        g_free(mem);
+        return NULL;
+    }
+
+    mem->buf = g_new0(char, mem->size);
+
+    if (!(ret = virLogOutputNew(virLogOutputToMemory, virLogCloseMemory, mem,
+                                priority, VIR_LOG_TO_MEMORY, name))) {
+        virLogCloseMemory(mem);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/**
+ * virLogDumpMemory:
+ * @path: file to write the messages into, or NULL
+ *
+ * Writes the messages recorded by the memory log output into @path,
+ * or the dump file configured for the output if @path is NULL.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogDumpMemory(const char *path)
+{
+    int fd = -1;
+    int rc = 0;
+    int saved_errno = 0;
+    bool missing = false;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    if (path &&
+        (fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno, _("failed to open %s"), path);
+        return -1;
+    }
+
+    /* no error can be reported while holding the log lock */
+    virLogLock();
+    if (!virLogMemoryActive) {
+        missing = true;
+    } else if (path) {
+        rc = virLogMemoryWrite(virLogMemoryActive, fd, 0);
+    } else if (virLogMemoryActive->fd >= 0) {
+        rc = virLogMemoryWrite(virLogMemoryActive, virLogMemoryActive->fd,
+                               virLogMemoryActive->dumped);
+        virLogMemoryActive->dumped = virLogMemoryActive->written;
+    } else {
+        missing = true;
+    }
+    saved_errno = errno;
+    virLogUnlock();
+
+    if (missing) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       path ? _("no memory log output is defined") :
+                       _("no dump file is configured for the memory log output"));
+        rc = -1;
+    } else if (rc < 0) {
+        if (path)
+            virReportSystemError(saved_errno, _("failed to write %s"), path);
+        else
+            virReportSystemError(saved_errno, "%s",
+                                 _("failed to write the memory log dump file"));
+    }
+
+    if (fd >= 0 && VIR_CLOSE(fd) < 0 && rc == 0) {
+        virReportSystemError(errno, _("failed to write %s"), path);
+        rc = -1;
+    }
+
+    return rc;
+}
+
+
+/**
+ * virLogDumpMemoryOnCrash:
+ *
+ * Writes the messages recorded by the memory log output since the last
+ * dump into its dump file, if there is one. To be called from a handler
+ * of a fatal signal, therefore no lock is taken.
+ */
+void
+virLogDumpMemoryOnCrash(void)
+{
+    virLogMemoryPtr mem = g_atomic_pointer_get(&virLogMemoryActive);
+
+    if (mem && mem->fd >= 0)
+        ignore_value(virLogMemoryWrite(mem, mem->fd, mem->dumped));
+}
+
+
+/**
+ * virLogHasMemoryDumpFile:
+ *
+ * Returns true if a memory log output with a dump file is defined.
+ */
+bool
+virLogHasMemoryDumpFile(void)
+{
+    bool ret;
+
+    if (virLogInitialize() < 0)
+        return false;
+
+    virLogLock();
+    ret = virLogMemoryActive && virLogMemoryActive->fd >= 0;
+    virLogUnlock();
+
+    return ret;
+}
+
+
 #if WITH_SYSLOG_H || USE_JOURNALD
 
 /* Compat in case we build with journald, but no syslog */
@@ -1108,6 +1839,7 @@ virLogGetOutputs(void)
         switch (dest) {
             case VIR_LOG_TO_SYSLOG:
             case VIR_LOG_TO_FILE:
+            case VIR_LOG_TO_MEMORY:
                 virBufferAsprintf(&outputbuf, "%d:%s:%s",
                                   virLogOutputs[i]->priority,
                                   virLogDestinationTypeToString(dest),
@@ -1239,8 +1971,8 @@ bool virLogProbablyLogMessage(const char *str)
  * @data: extra data passed as first arg to functions @f and @c
  * @priority: minimal priority for this filter, use 0 for none
  * @dest: where to send output of this priority (see virLogDestination)
- * @name: additional data associated with syslog and file-based outputs (ident
- *        and filename respectively)
+ * @name: additional data associated with syslog, file-based and memory outputs
+ *        (ident, filename and size with optional dump filename respectively)
  *
  * Allocates and returns a new log output object. The object has to be later
  * defined, so that the output will be taken into account when emitting a
@@ -1259,7 +1991,8 @@ virLogOutputNew(virLogOutputFunc f,
     virLogOutputPtr ret = NULL;
     char *ndup = NULL;
 
-    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE) {
+    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE ||
+        dest == VIR_LOG_TO_MEMORY) {
         if (!name) {
             virReportError(VIR_ERR_INVALID_ARG, "%s",
                            _("Missing auxiliary data in output definition"));
@@ -1370,6 +2103,7 @@ virLogFindOutput(virLogOutputPtr *outputs, size_t noutputs,
 int
 virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
 {
+    size_t i;
 #if WITH_SYSLOG_H
     int id;
     char *tmp = NULL;
@@ -1399,6 +2133,11 @@ virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
     virLogOutputs = outputs;
     virLogNbOutputs = noutputs;
 
+    for (i = 0; i < noutputs; i++) {
+        if (outputs[i]->dest == VIR_LOG_TO_MEMORY)
+            g_atomic_pointer_set(&virLogMemoryActive, outputs[i]->data);
+    }
+
     virLogUnlock();
     return 0;
 }
@@ -1425,6 +2164,7 @@ virLogDefineFilters(virLogFilterPtr *filters, size_t nfilters)
     virLogResetFilters();
     virLogFilters = filters;
     virLogNbFilters = nfilters;
+    virLogSourcesRefresh();
     virLogUnlock();
 
     return 0;
@@ -1440,6 +2180,9 @@ virLogDefineFilters(virLogFilterPtr *filters, size_t nfilters)
  *    x:journald - output is sent to journald
  *    x:syslog:name - output is sent to syslog using 'name' as the message tag
  *    x:file:abs_file_path - output is sent to file specified by 'abs_file_path'
+ *    x:memory:size[:abs_file_path] - output is kept in a ring buffer of 'size'
+ *      MiB in memory, holding the most recent messages; the buffer is written
+ *      into 'abs_file_path' on error messages, on crash or when requested
  *
  *      'x' - minimal priority level which acts as a filter meaning that only
  *            messages with priority level greater than or equal to 'x' will be
@@ -1464,6 +2207,7 @@ virLogParseOutput(const char *src)
     size_t count = 0;
     virLogPriority prio;
     int dest;
+    unsigned int mib;
 
     VIR_DEBUG("output=%s", src);
 
@@ -1494,7 +2238,8 @@ virLogParseOutput(const char *src)
     if (((dest == VIR_LOG_TO_STDERR ||
           dest == VIR_LOG_TO_JOURNALD) && count != 2) ||
         ((dest == VIR_LOG_TO_FILE ||
-          dest == VIR_LOG_TO_SYSLOG) && count != 3)) {
+          dest == VIR_LOG_TO_SYSLOG) && count != 3) ||
+        (dest == VIR_LOG_TO_MEMORY && count != 3 && count != 4)) {
         virReportError(VIR_ERR_INVALID_ARG,
                        _("Output '%s' does not meet the format requirements "
                          "for destination type '%s'"), src, tokens[1]);
@@ -1521,6 +2266,19 @@ virLogParseOutput(const char *src)
         ret = virLogNewOutputToJournald(prio);
 #endif
         break;
+    case VIR_LOG_TO_MEMORY:
+        if (virStrToLong_uip(tokens[2], NULL, 10, &mib) < 0 ||
+            mib == 0 || mib > VIR_LOG_MEMORY_MAX_MIB) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Invalid size '%s' for output '%s'"),
+                           tokens[2], src);
+            goto cleanup;
+        }
+        if (count == 4 && virFileAbsPath(tokens[3], &abspath) < 0)
+            goto cleanup;
+        ret = virLogNewOutputToMemory(prio, mib, abspath);
+        VIR_FREE(abspath);
+        break;
     case VIR_LOG_TO_OUTPUT_LAST:
         break;
     }
@@ -53,6 +53,7 @@ typedef enum {
     VIR_LOG_TO_SYSLOG,
     VIR_LOG_TO_FILE,
     VIR_LOG_TO_JOURNALD,
+    VIR_LOG_TO_MEMORY,
     VIR_LOG_TO_OUTPUT_LAST,
 } virLogDestination;
 
@@ -63,28 +64,56 @@ struct _virLogSource {
     const char *name;
     unsigned int priority;
     unsigned int serial;
+    virLogSourcePtr next; /* list of sources which emitted a message */
 };
 
 /*
  * G_GNUC_UNUSED is to make gcc keep quiet if all the
  * log statements in a file are conditionally disabled
  * at compile time due to configure options.
+ *
+ * The priority of a source is not known until it emits its first
+ * message, hence let that message through to virLogMessage which
+ * evaluates the filters and keeps the priority up to date afterwards.
  */
 #define VIR_LOG_INIT(n) \
     static G_GNUC_UNUSED virLogSource virLogSelf = { \
         .name = "" n "", \
-        .priority = VIR_LOG_ERROR, \
+        .priority = VIR_LOG_DEBUG, \
         .serial = 0, \
+        .next = NULL, \
     }
 
+/*
+ * Cheap check whether a message of @prio emitted by @src may be logged,
+ * so that neither the arguments of messages which would be filtered out
+ * are evaluated nor virLogMessage is called for them.
+ */
+#define VIR_LOG_SOURCE_ENABLED(src, prio) \
+    ((unsigned int) (prio) >= (src)->priority)
+
+/*
+ * To be used around code computing values which are only logged,
+ * e.g. formatting a JSON object into a string for a debug message.
+ */
+#define VIR_LOG_ENABLED(prio) \
+    VIR_LOG_SOURCE_ENABLED(&virLogSelf, prio)
+
+#define VIR_LOG_MESSAGE_INT(src, prio, filename, linenr, funcname, ...) \
+    do { \
+        if (VIR_LOG_SOURCE_ENABLED(src, prio)) \
+            virLogMessage(src, prio, filename, linenr, funcname, NULL, \
+                          __VA_ARGS__); \
+    } while (0)
+
 #define VIR_DEBUG_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_DEBUG, filename, linenr, funcname, __VA_ARGS__)
 #define VIR_INFO_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_INFO, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_INFO, filename, linenr, funcname, __VA_ARGS__)
 #define VIR_WARN_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_WARN, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_WARN, filename, linenr, funcname, __VA_ARGS__)
 #define VIR_ERROR_INT(src, filename, linenr, funcname, ...) \
-    virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_ERROR, filename, linenr, funcname, __VA_ARGS__)
 
 #define VIR_DEBUG(...) \
     VIR_DEBUG_INT(&virLogSelf, __FILE__, __LINE__, __func__, __VA_ARGS__)
@@ -160,6 +189,11 @@ int virLogSetOutputs(const char *outputs);
 int virLogSetFilters(const char *filters);
 char *virLogGetDefaultOutput(void);
 void virLogSetDefaultOutput(const char *fname, bool godaemon, bool privileged);
+int virLogSetAsync(bool async);
+unsigned int virLogGetAsyncDropped(void);
+int virLogDumpMemory(const char *path);
+void virLogDumpMemoryOnCrash(void);
+bool virLogHasMemoryDumpFile(void);
 
 /*
  * Internal logging API
@@ -31,6 +31,12 @@
 #if WITH_SYS_MOUNT_H
 # include <sys/mount.h>
 #endif
+#if WITH_LINUX_TASKSTATS_H
+# include <sys/socket.h>
+# include <sys/time.h>
+# include <linux/genetlink.h>
+# include <linux/taskstats.h>
+#endif
 #if WITH_SETRLIMIT
 # include <sys/time.h>
 # include <sys/resource.h>
@@ -58,6 +64,8 @@
 #endif
 
 #include "virprocess.h"
+#define LIBVIRT_VIRPROCESSPRIV_H_ALLOW
+#include "virprocesspriv.h"
 #include "virerror.h"
 #include "viralloc.h"
 #include "virfile.h"
@@ -1108,6 +1116,387 @@ int virProcessGetStartTime(pid_t pid,
 #endif
 
 
+#if WITH_LINUX_TASKSTATS_H
+/* Maximum number of requests sent to the kernel at once. Replies to all of
+ * them have to fit into the receive buffer of the socket. */
+# define VIR_PROCESS_TASKSTATS_BATCH 32
+# define VIR_PROCESS_TASKSTATS_BUFSIZE 8192
+
+static int virProcessTaskstatsFamilyID;
+
+static size_t
+virProcessGenlMessageInit(char *buf,
+                          uint16_t family,
+                          uint8_t cmd,
+                          uint32_t seq,
+                          uint16_t attrType,
+                          const void *attr,
+                          size_t attrLen)
+{
+    struct nlmsghdr *n = (struct nlmsghdr *) buf;
+    struct genlmsghdr *g = NLMSG_DATA(n);
+    struct nlattr *nla = (struct nlattr *) ((char *) g + GENL_HDRLEN);
+
+    n->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + attrLen);
+    n->nlmsg_type = family;
+    n->nlmsg_flags = NLM_F_REQUEST;
+    n->nlmsg_seq = seq;
+    n->nlmsg_pid = 0;
+    g->cmd = cmd;
+    g->version = 1;
+    nla->nla_type = attrType;
+    nla->nla_len = NLA_HDRLEN + attrLen;
+    memcpy((char *) nla + NLA_HDRLEN, attr, attrLen);
+
+    return NLMSG_ALIGN(n->nlmsg_len);
+}
+
+
+static struct nlattr *
+virProcessGenlFindAttr(void *data,
+                       size_t len,
+                       uint16_t type)
+{
+    struct nlattr *nla = data;
+
+    while (len >= NLA_HDRLEN &&
+           nla->nla_len >= NLA_HDRLEN &&
+           nla->nla_len <= len) {
+        if ((nla->nla_type & NLA_TYPE_MASK) == type)
+            return nla;
+
+        if (NLA_ALIGN(nla->nla_len) >= len)
+            break;
+
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *) ((char *) nla + NLA_ALIGN(nla->nla_len));
+    }
+
+    return NULL;
+}
+
+
+/* Returns a pointer to the attributes of generic netlink message @n and
+ * stores their length in @len, or NULL if @n is not a valid reply. */
+static void *
+virProcessGenlReplyAttrs(struct nlmsghdr *n,
+                         size_t *len)
+{
+    if (n->nlmsg_type == NLMSG_ERROR ||
+        n->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+        return NULL;
+
+    *len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    return (char *) NLMSG_DATA(n) + GENL_HDRLEN;
+}
+
+
+static int
+virProcessTaskstatsGetFamily(int fd)
+{
+    char req[NLMSG_ALIGN(NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN +
+                                      NLA_ALIGN(sizeof(TASKSTATS_GENL_NAME))))] = { 0 };
+    g_autofree char *resp = g_new0(char, VIR_PROCESS_TASKSTATS_BUFSIZE);
+    struct nlmsghdr *n = (struct nlmsghdr *) resp;
+    struct nlattr *nla;
+    size_t reqlen;
+    size_t attrslen;
+    void *attrs;
+    ssize_t len;
+    uint16_t id;
+    int family;
+
+    if ((family = g_atomic_int_get(&virProcessTaskstatsFamilyID)) > 0)
+        return family;
+
+    reqlen = virProcessGenlMessageInit(req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0,
+                                       CTRL_ATTR_FAMILY_NAME,
+                                       TASKSTATS_GENL_NAME,
+                                       sizeof(TASKSTATS_GENL_NAME));
+
+    if (send(fd, req, reqlen, 0) != (ssize_t) reqlen ||
+        (len = recv(fd, resp, VIR_PROCESS_TASKSTATS_BUFSIZE, 0)) < 0 ||
+        !NLMSG_OK(n, len) ||
+        !(attrs = virProcessGenlReplyAttrs(n, &attrslen)) ||
+        !(nla = virProcessGenlFindAttr(attrs, attrslen, CTRL_ATTR_FAMILY_ID)) ||
+        nla->nla_len < NLA_HDRLEN + sizeof(uint16_t))
+        return -1;
+
+    memcpy(&id, (char *) nla + NLA_HDRLEN, sizeof(id));
+    family = id;
+
+    g_atomic_int_set(&virProcessTaskstatsFamilyID, family);
+    return family;
+}
+
+
+/**
+ * virProcessTaskstatsParse:
+ * @msg: taskstats reply message
+ * @len: length of @msg
+ * @stats: filled with the statistics of the thread
+ *
+ * Parses the statistics of a single thread out of the reply to a
+ * TASKSTATS_CMD_GET request.
+ *
+ * Returns 0 on success, -1 if @msg is not a valid reply. No error is
+ * reported.
+ */
+int
+virProcessTaskstatsParse(void *msg,
+                         size_t len,
+                         virProcessThreadStatsPtr stats)
+{
+    struct nlmsghdr *n = msg;
+    struct taskstats ts = { 0 };
+    struct nlattr *aggr;
+    struct nlattr *nla;
+    size_t attrslen;
+    void *attrs;
+
+    if (len < NLMSG_HDRLEN || n->nlmsg_len > len ||
+        !(attrs = virProcessGenlReplyAttrs(n, &attrslen)) ||
+        !(aggr = virProcessGenlFindAttr(attrs, attrslen,
+                                        TASKSTATS_TYPE_AGGR_PID)) ||
+        !(nla = virProcessGenlFindAttr((char *) aggr + NLA_HDRLEN,
+                                       aggr->nla_len - NLA_HDRLEN,
+                                       TASKSTATS_TYPE_STATS)))
+        return -1;
+
+    /* the structure is not guaranteed to be aligned within the message and
+     * older kernels may send a shorter version of it */
+    memcpy(&ts, (char *) nla + NLA_HDRLEN,
+           MIN(sizeof(ts), nla->nla_len - NLA_HDRLEN));
+
+    stats->cpuTime = (ts.ac_utime + ts.ac_stime) * 1000ull;
+    /* Delays are accounted only with delay accounting enabled in which case
+     * the number of times the thread was scheduled is reported as well */
+    stats->haveDelay = ts.cpu_count > 0;
+    stats->cpuDelay = ts.cpu_delay_total;
+    stats->lastCpu = -1;
+
+    return 0;
+}
+
+
+/*
+ * Queries statistics of all threads in @stats using the taskstats generic
+ * netlink interface. Requests for up to VIR_PROCESS_TASKSTATS_BATCH threads
+ * are sent to the kernel in a single message before collecting the replies.
+ * Querying taskstats requires CAP_NET_ADMIN.
+ *
+ * Returns 0 on success, -1 if taskstats are not usable. No error is
+ * reported.
+ */
+static int
+virProcessGetThreadStatsTaskstats(virProcessThreadStatsPtr stats,
+                                  size_t nstats)
+{
+    const size_t msglen = NLMSG_ALIGN(NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN +
+                                                   sizeof(uint32_t)));
+    g_autofree char *req = g_new0(char, msglen * VIR_PROCESS_TASKSTATS_BATCH);
+    g_autofree char *resp = g_new0(char, VIR_PROCESS_TASKSTATS_BUFSIZE);
+    struct timeval timeout = { .tv_sec = 1 };
+    VIR_AUTOCLOSE fd = -1;
+    size_t done = 0;
+    int family;
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) < 0)
+        return -1;
+
+    /* don't block forever if the kernel drops replies */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+        return -1;
+
+    if ((family = virProcessTaskstatsGetFamily(fd)) < 0)
+        return -1;
+
+    while (done < nstats) {
+        size_t batch = MIN(nstats - done, VIR_PROCESS_TASKSTATS_BATCH);
+        size_t received = 0;
+        size_t reqlen = 0;
+        size_t i;
+
+        for (i = 0; i < batch; i++) {
+            uint32_t tid = stats[done + i].tid;
+
+            reqlen += virProcessGenlMessageInit(req + reqlen, family,
+                                                TASKSTATS_CMD_GET, done + i,
+                                                TASKSTATS_CMD_ATTR_PID,
+                                                &tid, sizeof(tid));
+        }
+
+        if (send(fd, req, reqlen, 0) != (ssize_t) reqlen)
+            return -1;
+
+        while (received < batch) {
+            struct nlmsghdr *n = (struct nlmsghdr *) resp;
+            int len;
+
+            if ((len = recv(fd, resp, VIR_PROCESS_TASKSTATS_BUFSIZE, 0)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            for (; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+                if (n->nlmsg_seq < done || n->nlmsg_seq >= done + batch)
+                    continue;
+
+                if (virProcessTaskstatsParse(n, len, &stats[n->nlmsg_seq]) < 0) {
+                    VIR_DEBUG("Unable to get taskstats of thread %lld",
+                              (long long) stats[n->nlmsg_seq].tid);
+                    return -1;
+                }
+
+                received++;
+            }
+        }
+
+        done += batch;
+    }
+
+    return 0;
+}
+#else /* !WITH_LINUX_TASKSTATS_H */
+int
+virProcessTaskstatsParse(void *msg G_GNUC_UNUSED,
+                         size_t len G_GNUC_UNUSED,
+                         virProcessThreadStatsPtr stats G_GNUC_UNUSED)
+{
+    return -1;
+}
+#endif /* !WITH_LINUX_TASKSTATS_H */
+
+
+#ifdef __linux__
+static void
+virProcessGetThreadStatsSchedstat(pid_t pid,
+                                  virProcessThreadStatsPtr stats)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *buf = NULL;
+
+    path = g_strdup_printf("/proc/%d/task/%d/schedstat",
+                           (int) pid, (int) stats->tid);
+
+    /* This file might not exist (needs CONFIG_SCHED_INFO) */
+    stats->haveDelay = virFileReadAllQuiet(path, 1024, &buf) >= 0 &&
+                       sscanf(buf, "%*u %llu", &stats->cpuDelay) == 1;
+}
+
+
+static int
+virProcessGetThreadStatsProc(pid_t pid,
+                             virProcessThreadStatsPtr stats)
+{
+    g_autofree char *statpath = NULL;
+    g_autofree char *buf = NULL;
+    unsigned long long usertime;
+    unsigned long long systime;
+
+    /* In general, we cannot assume pid_t fits in int; but /proc parsing
+     * is specific to Linux where int works fine.  */
+    statpath = g_strdup_printf("/proc/%d/task/%d/stat",
+                               (int) pid, (int) stats->tid);
+
+    if (virFileReadAll(statpath, 4096, &buf) < 0)
+        return -1;
+
+    /* See 'man proc' for information about what all these fields are. */
+    if (sscanf(buf,
+               /* pid -> stime */
+               "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+               /* cutime -> endcode */
+               "%*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u"
+               /* startstack -> processor */
+               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+               &usertime, &systime, &stats->lastCpu) != 3) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s'"), statpath);
+        return -1;
+    }
+
+    stats->cpuTime = 1000ull * 1000ull * 1000ull * (usertime + systime)
+        / (unsigned long long) sysconf(_SC_CLK_TCK);
+
+    virProcessGetThreadStatsSchedstat(pid, stats);
+
+    return 0;
+}
+#else
+static int
+virProcessGetThreadStatsProc(pid_t pid G_GNUC_UNUSED,
+                             virProcessThreadStatsPtr stats G_GNUC_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Thread statistics are not supported "
+                           "on this platform"));
+    return -1;
+}
+#endif
+
+
+/**
+ * virProcessGetThreadStats:
+ * @pid: process whose threads to query
+ * @stats: array of threads to query, see virProcessThreadStats
+ * @nstats: number of elements in @stats
+ * @flags: bitwise-OR of virProcessThreadStatsFlags
+ *
+ * Fills in CPU time, scheduling delay and last used CPU of threads of @pid
+ * specified by the 'tid' field of each element of @stats. If possible, the
+ * statistics of all threads are queried in a batch using the taskstats
+ * interface of the kernel, which however doesn't report the last used CPU.
+ * Otherwise the per-thread files in /proc are read, unless
+ * VIR_PROCESS_THREAD_STATS_NO_FALLBACK is specified in @flags. Taskstats
+ * report scheduling delays only with delay accounting enabled in the kernel,
+ * the delay is read from /proc in that case, again unless
+ * VIR_PROCESS_THREAD_STATS_NO_FALLBACK is specified.
+ *
+ * Returns 0 on success, -2 if taskstats are not usable and
+ * VIR_PROCESS_THREAD_STATS_NO_FALLBACK was specified (no error is reported
+ * in that case), -1 on error.
+ */
+int
+virProcessGetThreadStats(pid_t pid,
+                         virProcessThreadStatsPtr stats,
+                         size_t nstats,
+                         unsigned int flags)
+{
+    size_t i;
+
+    virCheckFlags(VIR_PROCESS_THREAD_STATS_NO_FALLBACK, -1);
+
+    if (nstats == 0)
+        return 0;
+
+#if WITH_LINUX_TASKSTATS_H
+    if (virProcessGetThreadStatsTaskstats(stats, nstats) == 0) {
+        if (!(flags & VIR_PROCESS_THREAD_STATS_NO_FALLBACK)) {
+            for (i = 0; i < nstats; i++) {
+                if (!stats[i].haveDelay)
+                    virProcessGetThreadStatsSchedstat(pid, &stats[i]);
+            }
+        }
+        return 0;
+    }
+
+    VIR_DEBUG("taskstats of process %lld are not available", (long long) pid);
+#endif
+
+    if (flags & VIR_PROCESS_THREAD_STATS_NO_FALLBACK)
+        return -2;
+
+    for (i = 0; i < nstats; i++) {
+        if (virProcessGetThreadStatsProc(pid, &stats[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 #ifdef __linux__
 typedef struct _virProcessNamespaceHelperData virProcessNamespaceHelperData;
 struct _virProcessNamespaceHelperData {
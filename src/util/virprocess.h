@@ -67,6 +67,27 @@ int virProcessGetPids(pid_t pid, size_t *npids, pid_t **pids);
 int virProcessGetStartTime(pid_t pid,
                            unsigned long long *timestamp);
 
+typedef struct _virProcessThreadStats virProcessThreadStats;
+typedef virProcessThreadStats *virProcessThreadStatsPtr;
+struct _virProcessThreadStats {
+    pid_t tid; /* thread to query, filled in by the caller */
+
+    unsigned long long cpuTime; /* user and system time in nanoseconds */
+    bool haveDelay; /* whether @cpuDelay is known */
+    unsigned long long cpuDelay; /* time spent waiting for a CPU in ns */
+    int lastCpu; /* host CPU the thread last ran on, -1 if unknown */
+};
+
+typedef enum {
+    /* fail rather than reading /proc if taskstats are not usable */
+    VIR_PROCESS_THREAD_STATS_NO_FALLBACK = (1 << 0),
+} virProcessThreadStatsFlags;
+
+int virProcessGetThreadStats(pid_t pid,
+                             virProcessThreadStatsPtr stats,
+                             size_t nstats,
+                             unsigned int flags);
+
 int virProcessGetNamespaces(pid_t pid,
                             size_t *nfdlist,
                             int **fdlist);
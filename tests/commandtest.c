@@ -1157,6 +1157,172 @@ test28(const void *unused G_GNUC_UNUSED)
 }
 
 
+static int
+test29Hook(void *opaque G_GNUC_UNUSED)
+{
+    return 0;
+}
+
+
+/*
+ * Run @binary in @pwd once without and once with a hook, i.e. in a
+ * spawned child (if supported) and in a forked one, and check that both
+ * fail with @expectStatus and the same error containing @expectError.
+ */
+static int
+test29Compare(const char *binary,
+              const char *pwd,
+              int expectStatus,
+              const char *expectError)
+{
+    g_autofree char *spawnErr = NULL;
+    g_autofree char *forkErr = NULL;
+    int spawnStatus = -1;
+    int forkStatus = -1;
+    size_t i;
+
+    for (i = 0; i < 2; i++) {
+        g_autoptr(virCommand) cmd = virCommandNew(binary);
+
+        if (pwd)
+            virCommandSetWorkingDirectory(cmd, pwd);
+
+        /* a hook needs a forked child */
+        if (i == 1)
+            virCommandSetPreExecHook(cmd, test29Hook, NULL);
+
+        virCommandSetErrorBuffer(cmd, i == 0 ? &spawnErr : &forkErr);
+
+        if (virCommandRun(cmd, i == 0 ? &spawnStatus : &forkStatus) < 0) {
+            printf("Cannot run child %s\n", virGetLastErrorMessage());
+            return -1;
+        }
+    }
+
+    if (spawnStatus != expectStatus || forkStatus != expectStatus) {
+        printf("Unexpected exit status %d/%d, expected %d\n",
+               spawnStatus, forkStatus, expectStatus);
+        return -1;
+    }
+
+    if (!strstr(forkErr, expectError)) {
+        printf("Unexpected error '%s'\n", forkErr);
+        return -1;
+    }
+
+    if (STRNEQ(spawnErr, forkErr)) {
+        virTestDifference(stderr, forkErr, spawnErr);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Failure to change the working directory is reported the same way
+ * with or without a forked child.
+ */
+static int
+test29(const void *unused G_GNUC_UNUSED)
+{
+    const char *pwd = "/commandtest-doesnotexist";
+    g_autofree char *expect = g_strdup_printf("Unable to change to %s", pwd);
+
+    return test29Compare(abs_builddir "/commandhelper", pwd,
+                         EXIT_CANCELED, expect);
+}
+
+
+/*
+ * Failure to exec is reported the same way with or without a forked
+ * child.
+ */
+static int
+test30(const void *unused G_GNUC_UNUSED)
+{
+    return test29Compare(abs_builddir "/commandhelper-doesnotexist", NULL,
+                         EXIT_ENOENT, "cannot execute binary");
+}
+
+
+/*
+ * Run program with a passed FD and stdout redirected to a file, without
+ * and with a hook.  Only the passed FD may be inherited besides stdio,
+ * which must end up in the file, in both cases.
+ */
+static int
+test31(const void *unused G_GNUC_UNUSED)
+{
+    g_autofree char *outfile = g_strdup_printf("%s/commandhelper.out",
+                                               abs_builddir);
+    g_autofree char *logfile = g_strdup_printf("%s/commandhelper.log",
+                                               abs_builddir);
+    g_autofree char *spawnLog = NULL;
+    const char *expectOut = "BEGIN STDOUT\nEND STDOUT\n";
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < 2; i++) {
+        g_autoptr(virCommand) cmd = virCommandNew(abs_builddir "/commandhelper");
+        g_autofree char *log = NULL;
+        g_autofree char *out = NULL;
+        g_autofree char *passed = NULL;
+        g_autofree char *kept = NULL;
+        VIR_AUTOCLOSE passfd = dup(STDERR_FILENO);
+        VIR_AUTOCLOSE keepfd = dup(STDERR_FILENO);
+        VIR_AUTOCLOSE outfd = -1;
+
+        if ((outfd = open(outfile, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0) {
+            printf("Cannot create %s\n", outfile);
+            goto cleanup;
+        }
+
+        virCommandPassFD(cmd, passfd, 0);
+        virCommandSetOutputFD(cmd, &outfd);
+
+        /* a hook needs a forked child */
+        if (i == 1)
+            virCommandSetPreExecHook(cmd, test29Hook, NULL);
+
+        if (virCommandRun(cmd, NULL) < 0) {
+            printf("Cannot run child %s\n", virGetLastErrorMessage());
+            goto cleanup;
+        }
+
+        if (virFileReadAll(logfile, 1024 * 64, &log) < 0 ||
+            virFileReadAll(outfile, 1024, &out) < 0)
+            goto cleanup;
+
+        passed = g_strdup_printf("FD:%d\n", passfd);
+        kept = g_strdup_printf("FD:%d\n", keepfd);
+
+        if (!strstr(log, passed) || strstr(log, kept)) {
+            printf("Unexpected FDs in the child:\n%s", log);
+            goto cleanup;
+        }
+
+        if (STRNEQ(out, expectOut)) {
+            virTestDifference(stderr, expectOut, out);
+            goto cleanup;
+        }
+
+        if (i == 0) {
+            spawnLog = g_steal_pointer(&log);
+        } else if (STRNEQ(spawnLog, log)) {
+            virTestDifference(stderr, log, spawnLog);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    unlink(outfile);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -1255,6 +1421,9 @@ mymain(void)
     DO_TEST(test26);
     DO_TEST(test27);
     DO_TEST(test28);
+    DO_TEST(test29);
+    DO_TEST(test30);
+    DO_TEST(test31);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -308,12 +308,326 @@ static int testFDStreamWriteNonblock(const void *data)
     return testFDStreamWriteCommon(data, false);
 }
 
+
+/* Large enough to be read in several chunks of growing size by
+ * multiple workers, with a short read at the end */
+#define READ_AHEAD_LEN (10 * 1024 * 1024 + 123)
+
+static int testFDStreamReadAhead(const void *data)
+{
+    const char *scratchdir = data;
+    g_autofree char *file = g_strdup_printf("%s/readahead.data", scratchdir);
+    g_autofree char *pattern = g_new0(char, READ_AHEAD_LEN);
+    g_autofree char *buf = g_new0(char, READ_AHEAD_LEN);
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    size_t offset = 0;
+    size_t i;
+    char c;
+    int fd = -1;
+    int got;
+    int ret = -1;
+
+    for (i = 0; i < READ_AHEAD_LEN; i++)
+        pattern[i] = i * 7 + i / 4096;
+
+    if ((fd = open(file, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0)
+        goto cleanup;
+
+    if (safewrite(fd, pattern, READ_AHEAD_LEN) != READ_AHEAD_LEN)
+        goto cleanup;
+
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (!(st = virStreamNew(conn, VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (virFDStreamOpenFile(st, file, 0, 0, O_RDONLY) < 0)
+        goto cleanup;
+
+    while (offset < READ_AHEAD_LEN) {
+        got = st->driver->streamRecv(st, buf + offset,
+                                     MIN(64 * 1024, READ_AHEAD_LEN - offset));
+        if (got == -2) {
+            g_usleep(1000);
+            continue;
+        }
+
+        if (got <= 0) {
+            fprintf(stderr, "Failed to read stream at %zu: %s\n",
+                    offset, virGetLastErrorMessage());
+            goto cleanup;
+        }
+
+        offset += got;
+    }
+
+    if ((got = st->driver->streamRecv(st, &c, 1)) != 0) {
+        fprintf(stderr, "Expected EOF, got %d\n", got);
+        goto cleanup;
+    }
+
+    if (memcmp(buf, pattern, READ_AHEAD_LEN) != 0) {
+        fprintf(stderr, "Mismatched read ahead data\n");
+        goto cleanup;
+    }
+
+    if (st->driver->streamFinish(st) != 0) {
+        fprintf(stderr, "Failed to finish stream: %s\n",
+                virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (st)
+        virStreamFree(st);
+    VIR_FORCE_CLOSE(fd);
+    unlink(file);
+    if (conn)
+        virConnectClose(conn);
+    return ret;
+}
+
+
+/* Sparse file made of these sections, positive lengths are data and
+ * negative ones are holes. All but the last one are aligned so that
+ * filesystems report the holes exactly. */
+#define SPARSE_MIB (1024 * 1024)
+static const long long sparseLayout[] = {
+    3 * SPARSE_MIB, -2 * SPARSE_MIB, 5 * SPARSE_MIB, -3 * SPARSE_MIB,
+    SPARSE_MIB + 123,
+};
+
+struct testFDStreamSparseData {
+    const char *scratchdir;
+    bool sparse;
+    unsigned long long offset;
+    unsigned long long length;
+    const long long *sections;  /* expected sections, like sparseLayout */
+    size_t nsections;
+};
+
+
+/* Creates @file according to sparseLayout and fills @pattern with its
+ * contents. Returns 0 on success, 1 if the filesystem doesn't report
+ * holes and -1 on error. */
+static int
+testFDStreamSparseCreate(const char *file,
+                         char *pattern,
+                         size_t len)
+{
+    VIR_AUTOCLOSE fd = -1;
+    size_t offset = 0;
+    size_t i;
+
+    memset(pattern, 0, len);
+
+    if ((fd = open(file, O_CREAT|O_WRONLY|O_TRUNC, 0600)) < 0)
+        return -1;
+
+    for (i = 0; i < G_N_ELEMENTS(sparseLayout); i++) {
+        size_t seclen = ABS(sparseLayout[i]);
+
+        if (sparseLayout[i] > 0) {
+            size_t j;
+
+            for (j = offset; j < offset + seclen; j++)
+                pattern[j] = j * 7 + j / 4096 + 1;
+
+            if (pwrite(fd, pattern + offset, seclen, offset) != (ssize_t) seclen)
+                return -1;
+        }
+
+        offset += seclen;
+    }
+
+    if (ftruncate(fd, len) < 0)
+        return -1;
+
+    if (lseek(fd, sparseLayout[0], SEEK_DATA) !=
+        sparseLayout[0] - sparseLayout[1])
+        return 1;
+
+    return 0;
+}
+
+
+/* Reads the whole stream, storing data at their offset in @buf and the
+ * lengths of consecutive data and hole sections in @sections */
+static int
+testFDStreamSparseRead(virStreamPtr st,
+                       char *buf,
+                       size_t buflen,
+                       long long *sections,
+                       size_t *nsections,
+                       size_t maxsections)
+{
+    size_t offset = 0;
+    char c;
+    int got;
+
+    *nsections = 0;
+
+    while (true) {
+        int inData;
+        long long len;
+        long long sec;
+
+        if (st->driver->streamInData(st, &inData, &len) < 0) {
+            fprintf(stderr, "Failed to check for data at %zu: %s\n",
+                    offset, virGetLastErrorMessage());
+            return -1;
+        }
+
+        if (len == 0)
+            break;
+
+        if (inData) {
+            if (offset + len > buflen) {
+                fprintf(stderr, "Too much data at %zu\n", offset);
+                return -1;
+            }
+
+            if ((got = st->driver->streamRecv(st, buf + offset, len)) <= 0) {
+                fprintf(stderr, "Failed to read stream at %zu: %s\n",
+                        offset, virGetLastErrorMessage());
+                return -1;
+            }
+            sec = got;
+        } else {
+            if (st->driver->streamSendHole(st, len, 0) < 0) {
+                fprintf(stderr, "Failed to skip hole at %zu: %s\n",
+                        offset, virGetLastErrorMessage());
+                return -1;
+            }
+            sec = -len;
+        }
+
+        offset += ABS(sec);
+
+        if (*nsections > 0 &&
+            (sections[*nsections - 1] > 0) == (sec > 0)) {
+            sections[*nsections - 1] += sec;
+        } else {
+            if (*nsections == maxsections) {
+                fprintf(stderr, "Too many sections at %zu\n", offset);
+                return -1;
+            }
+            sections[(*nsections)++] = sec;
+        }
+    }
+
+    if ((got = st->driver->streamRecv(st, &c, 1)) != 0) {
+        fprintf(stderr, "Expected EOF, got %d\n", got);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int testFDStreamReadAheadSparse(const void *opaque)
+{
+    const struct testFDStreamSparseData *data = opaque;
+    g_autofree char *file = g_strdup_printf("%s/sparse.data", data->scratchdir);
+    long long sections[G_N_ELEMENTS(sparseLayout) + 1];
+    size_t nsections;
+    size_t len = 0;
+    size_t want;
+    g_autofree char *pattern = NULL;
+    g_autofree char *buf = NULL;
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    for (i = 0; i < G_N_ELEMENTS(sparseLayout); i++)
+        len += ABS(sparseLayout[i]);
+    want = data->length ? data->length : len - data->offset;
+
+    pattern = g_new0(char, len);
+    buf = g_new0(char, len);
+
+    if ((rc = testFDStreamSparseCreate(file, pattern, len)) != 0) {
+        if (rc > 0) {
+            VIR_TEST_DEBUG("holes are not reported by the filesystem");
+            ret = EXIT_AM_SKIP;
+        }
+        goto cleanup;
+    }
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (!(st = virStreamNew(conn, VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (virFDStreamOpenBlockDevice(st, file, data->offset, data->length,
+                                   data->sparse, O_RDONLY) < 0)
+        goto cleanup;
+
+    if (testFDStreamSparseRead(st, buf, len, sections, &nsections,
+                               G_N_ELEMENTS(sections)) < 0)
+        goto cleanup;
+
+    if (nsections != data->nsections ||
+        memcmp(sections, data->sections, nsections * sizeof(*sections)) != 0) {
+        fprintf(stderr, "Mismatched sections:");
+        for (i = 0; i < nsections; i++)
+            fprintf(stderr, " %lld", sections[i]);
+        fprintf(stderr, "\n");
+        goto cleanup;
+    }
+
+    if (memcmp(buf, pattern + data->offset, want) != 0) {
+        fprintf(stderr, "Mismatched read ahead data\n");
+        goto cleanup;
+    }
+
+    if (st->driver->streamFinish(st) != 0) {
+        fprintf(stderr, "Failed to finish stream: %s\n",
+                virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (st)
+        virStreamFree(st);
+    unlink(file);
+    if (conn)
+        virConnectClose(conn);
+    return ret;
+}
+
+
 #define SCRATCHDIRTEMPLATE abs_builddir "/fdstreamdir-XXXXXX"
 
 static int
 mymain(void)
 {
     char scratchdir[] = SCRATCHDIRTEMPLATE;
+    /* The limited reads start within the first data section and end
+     * within the second one */
+    const unsigned long long limitedLength = 6 * SPARSE_MIB + SPARSE_MIB / 2 + 777;
+    const long long limitedSparse[] = {
+        2 * SPARSE_MIB, -2 * SPARSE_MIB, 2 * SPARSE_MIB + SPARSE_MIB / 2 + 777,
+    };
+    const long long limitedDense[] = { limitedLength };
+    struct testFDStreamSparseData sparseData[] = {
+        { scratchdir, true, 0, 0,
+          sparseLayout, G_N_ELEMENTS(sparseLayout) },
+        { scratchdir, true, SPARSE_MIB, limitedLength,
+          limitedSparse, G_N_ELEMENTS(limitedSparse) },
+        { scratchdir, false, SPARSE_MIB, limitedLength,
+          limitedDense, G_N_ELEMENTS(limitedDense) },
+    };
     int ret = 0;
 
     if (!g_mkdtemp(scratchdir)) {
@@ -329,6 +643,17 @@ mymain(void)
         ret = -1;
     if (virTestRun("Stream write non-blocking ", testFDStreamWriteNonblock, scratchdir) < 0)
         ret = -1;
+    if (virTestRun("Stream read ahead ", testFDStreamReadAhead, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("Stream read ahead sparse ", testFDStreamReadAheadSparse,
+                   &sparseData[0]) < 0)
+        ret = -1;
+    if (virTestRun("Stream read ahead sparse with length ",
+                   testFDStreamReadAheadSparse, &sparseData[1]) < 0)
+        ret = -1;
+    if (virTestRun("Stream read ahead dense with length ",
+                   testFDStreamReadAheadSparse, &sparseData[2]) < 0)
+        ret = -1;
 
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(scratchdir);
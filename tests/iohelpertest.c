@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library;  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifndef WIN32
+
+# include <fcntl.h>
+# include <sys/socket.h>
+
+# include "vircommand.h"
+# include "virfile.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define IOHELPER abs_top_builddir "/src/libvirt_iohelper"
+
+/* More than a few chunks of the helper, not a multiple of their size */
+# define DATA_LEN (3 * 1024 * 1024 + 12345)
+
+/* Enough empty blocks to make a frame larger than a compressed chunk */
+# define PADDING_BLOCKS (400 * 1000)
+
+
+/* Fills @data with DATA_LEN bytes which are compressible, but not
+ * trivially so */
+static void
+testIOHelperFill(char *data)
+{
+    size_t i;
+
+    for (i = 0; i < DATA_LEN; i++)
+        data[i] = ((i / 4096) % 7) ^ (i % 13);
+}
+
+
+static int
+testIOHelperWrite(const char *path,
+                  const char *buf,
+                  size_t len)
+{
+    g_autoptr(GError) err = NULL;
+
+    if (!g_file_set_contents(path, buf, len, &err)) {
+        fprintf(stderr, "cannot write '%s': %s\n", path, err->message);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct testIOHelperPeerData {
+    const char *scratchdir;
+    bool output;
+};
+
+
+/* virFileWrapperFdNewPeer copies a file opened O_RDONLY to the peer and
+ * everything read from the peer to a file opened O_WRONLY */
+static int
+testIOHelperPeer(const void *opaque)
+{
+    const struct testIOHelperPeerData *data = opaque;
+    g_autofree char *path = g_strdup_printf("%s/peer", data->scratchdir);
+    g_autofree char *buf = g_new0(char, DATA_LEN);
+    g_autofree char *rbuf = NULL;
+    g_autoptr(virFileWrapperFd) wfd = NULL;
+    int sv[2] = { -1, -1 };
+    VIR_AUTOCLOSE fd = -1;
+    VIR_AUTOCLOSE peerfd = -1;
+    VIR_AUTOCLOSE localfd = -1;
+    ssize_t rlen;
+
+    testIOHelperFill(buf);
+
+    if (data->output) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    } else {
+        if (testIOHelperWrite(path, buf, DATA_LEN) < 0)
+            return -1;
+        fd = open(path, O_RDONLY);
+    }
+
+    if (fd < 0) {
+        fprintf(stderr, "cannot open '%s'\n", path);
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        fprintf(stderr, "cannot create socket pair\n");
+        return -1;
+    }
+    localfd = sv[0];
+    peerfd = sv[1];
+
+    if (!(wfd = virFileWrapperFdNewPeer(&fd, &peerfd, path)))
+        return -1;
+
+    if (fd != -1 || peerfd != -1) {
+        fprintf(stderr, "descriptors were not handed over to the helper\n");
+        return -1;
+    }
+
+    if (data->output) {
+        if (safewrite(localfd, buf, DATA_LEN) != DATA_LEN) {
+            fprintf(stderr, "cannot write to the peer\n");
+            return -1;
+        }
+        VIR_FORCE_CLOSE(localfd);
+
+        if (virFileWrapperFdClose(wfd) < 0)
+            return -1;
+
+        if ((rlen = virFileReadAll(path, DATA_LEN + 1, &rbuf)) < 0)
+            return -1;
+    } else {
+        rbuf = g_new0(char, DATA_LEN + 1);
+
+        if ((rlen = saferead(localfd, rbuf, DATA_LEN + 1)) < 0) {
+            fprintf(stderr, "cannot read from the peer\n");
+            return -1;
+        }
+
+        if (virFileWrapperFdClose(wfd) < 0)
+            return -1;
+    }
+
+    if (rlen != DATA_LEN || memcmp(buf, rbuf, DATA_LEN) != 0) {
+        fprintf(stderr, "copied data differs from the original\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+# if WITH_ZSTD
+
+/* Runs the helper with @action filtering @in into @out and returns its
+ * exit status, or -1 if it could not be run at all */
+static int
+testIOHelperRun(const char *action,
+                const char *in,
+                const char *out)
+{
+    g_autoptr(virCommand) cmd = NULL;
+    g_autofree char *errbuf = NULL;
+    VIR_AUTOCLOSE infd = -1;
+    VIR_AUTOCLOSE outfd = -1;
+    int status;
+
+    if ((infd = open(in, O_RDONLY)) < 0 ||
+        (outfd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        fprintf(stderr, "cannot open '%s' or '%s'\n", in, out);
+        return -1;
+    }
+
+    cmd = virCommandNewArgList(IOHELPER, action, "zstd", NULL);
+    virCommandSetInputFD(cmd, infd);
+    virCommandSetOutputFD(cmd, &outfd);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0)
+        return -1;
+
+    if (status != 0)
+        VIR_TEST_DEBUG("%s failed: %s", action, NULLSTR(errbuf));
+
+    return status;
+}
+
+
+static int
+testIOHelperRoundTrip(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *plain = g_strdup_printf("%s/roundtrip", scratchdir);
+    g_autofree char *compressed = g_strdup_printf("%s/roundtrip.zst", scratchdir);
+    g_autofree char *result = g_strdup_printf("%s/roundtrip.out", scratchdir);
+    g_autofree char *data = g_new0(char, DATA_LEN);
+    g_autofree char *zdata = NULL;
+    g_autofree char *rdata = NULL;
+    int zlen;
+    int rlen;
+
+    testIOHelperFill(data);
+
+    if (testIOHelperWrite(plain, data, DATA_LEN) < 0)
+        return -1;
+
+    if (testIOHelperRun("--compress", plain, compressed) != 0 ||
+        testIOHelperRun("--decompress", compressed, result) != 0)
+        return -1;
+
+    if ((zlen = virFileReadAll(compressed, DATA_LEN, &zdata)) < 0 ||
+        (rlen = virFileReadAll(result, DATA_LEN + 1, &rdata)) < 0)
+        return -1;
+
+    if (zlen >= DATA_LEN) {
+        fprintf(stderr, "data was not compressed\n");
+        return -1;
+    }
+
+    if (rlen != DATA_LEN || memcmp(data, rdata, DATA_LEN) != 0) {
+        fprintf(stderr, "decompressed data differs from the original\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testIOHelperTruncated(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *compressed = g_strdup_printf("%s/roundtrip.zst", scratchdir);
+    g_autofree char *truncated = g_strdup_printf("%s/truncated.zst", scratchdir);
+    g_autofree char *result = g_strdup_printf("%s/truncated.out", scratchdir);
+    g_autofree char *zdata = NULL;
+    int zlen;
+
+    /* reuses the output of the round trip test */
+    if ((zlen = virFileReadAll(compressed, DATA_LEN, &zdata)) < 0)
+        return -1;
+
+    if (testIOHelperWrite(truncated, zdata, zlen / 2) < 0)
+        return -1;
+
+    if (testIOHelperRun("--decompress", truncated, result) == 0) {
+        fprintf(stderr, "truncated stream was decompressed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testIOHelperOversizedFrame(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *crafted = g_strdup_printf("%s/oversized.zst", scratchdir);
+    g_autofree char *result = g_strdup_printf("%s/oversized.out", scratchdir);
+    size_t len = 4 + 2 + 3 * (PADDING_BLOCKS + 1);
+    g_autofree char *frame = g_new0(char, len);
+    char *p = frame;
+
+    /* frame magic */
+    memcpy(p, "\x28\xB5\x2F\xFD", 4);
+    p += 4;
+
+    /* single segment frame with empty content */
+    *p++ = 0x20;
+    *p++ = 0;
+
+    /* all blocks are empty raw blocks, already zeroed, the last one
+     * is marked as such */
+    p[3 * PADDING_BLOCKS] = 1;
+
+    if (testIOHelperWrite(crafted, frame, len) < 0)
+        return -1;
+
+    if (testIOHelperRun("--decompress", crafted, result) == 0) {
+        fprintf(stderr, "oversized frame was accepted\n");
+        return -1;
+    }
+
+    return 0;
+}
+# endif /* WITH_ZSTD */
+
+
+# define SCRATCHDIRTEMPLATE abs_builddir "/iohelperdir-XXXXXX"
+
+static int
+mymain(void)
+{
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+    struct testIOHelperPeerData peerRead = { scratchdir, false };
+    struct testIOHelperPeerData peerWrite = { scratchdir, true };
+    int ret = 0;
+
+    if (!virFileIsExecutable(IOHELPER)) {
+        fprintf(stderr, "%s is not built\n", IOHELPER);
+        return EXIT_AM_SKIP;
+    }
+
+    if (!g_mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create iohelperdir");
+        abort();
+    }
+
+    if (virTestRun("peer copy from file", testIOHelperPeer, &peerRead) < 0)
+        ret = -1;
+    if (virTestRun("peer copy to file", testIOHelperPeer, &peerWrite) < 0)
+        ret = -1;
+
+# if WITH_ZSTD
+    if (virTestRun("zstd round trip", testIOHelperRoundTrip, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("zstd truncated stream", testIOHelperTruncated, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("zstd oversized frame", testIOHelperOversizedFrame, scratchdir) < 0)
+        ret = -1;
+# endif /* WITH_ZSTD */
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WIN32 */
@@ -408,8 +408,72 @@ static int testCompareXMLToArgvFiles(const char *xml,
     return ret;
 }
 
+
+/* Instantiate the filter of @xml and check that updating it to the
+ * filter of @updatexml changes only the rules which differ. */
+static int
+testCompareUpdateToArgvFiles(const char *xml,
+                             const char *updatexml,
+                             const char *cmdline)
+{
+    g_autofree char *actualargv = NULL;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    GHashTable *vars = virHashNew(virNWFilterVarValueHashFree);
+    virNWFilterInst inst;
+    virNWFilterInst updateInst;
+    int ret = -1;
+
+    memset(&inst, 0, sizeof(inst));
+    memset(&updateInst, 0, sizeof(updateInst));
+
+    virCommandSetDryRun(&buf, NULL, NULL);
+
+    if (!vars)
+        goto cleanup;
+
+    if (testSetDefaultParameters(vars) < 0)
+        goto cleanup;
+
+    if (virNWFilterDefToInst(xml, vars, &inst) < 0 ||
+        virNWFilterDefToInst(updatexml, vars, &updateInst) < 0)
+        goto cleanup;
+
+    if (ebiptables_driver.allTeardown("vnet0") < 0 ||
+        ebiptables_driver.applyNewRules("vnet0", inst.rules, inst.nrules) < 0 ||
+        ebiptables_driver.tearOldRules("vnet0") < 0)
+        goto cleanup;
+
+    virBufferFreeAndReset(&buf);
+
+    if (ebiptables_driver.updateRules("vnet0", updateInst.rules,
+                                      updateInst.nrules) != 1) {
+        fprintf(stderr, "rules were not updated in place\n");
+        goto cleanup;
+    }
+
+    /* there are no temporary chains to switch to */
+    if (ebiptables_driver.tearOldRules("vnet0") < 0)
+        goto cleanup;
+
+    actualargv = virBufferContentAndReset(&buf);
+    virTestClearCommandPath(actualargv);
+
+    if (virTestCompareToFile(actualargv, cmdline) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virNWFilterInstReset(&inst);
+    virNWFilterInstReset(&updateInst);
+    virHashFree(vars);
+    return ret;
+}
+
 struct testInfo {
     const char *name;
+    unsigned int ipsetMinValues;
 };
 
 
@@ -426,13 +490,33 @@ testCompareXMLToIPTablesHelper(const void *data)
     args = g_strdup_printf("%s/nwfilterxml2firewalldata/%s-%s.args",
                            abs_srcdir, info->name, RULESTYPE);
 
+    ebiptablesSetIPSetMinValues(info->ipsetMinValues);
     result = testCompareXMLToArgvFiles(xml, args);
+    ebiptablesSetIPSetMinValues(0);
 
     VIR_FREE(xml);
     VIR_FREE(args);
     return result;
 }
 
+static int
+testCompareUpdateToIPTablesHelper(const void *data)
+{
+    const struct testInfo *info = data;
+    g_autofree char *xml = NULL;
+    g_autofree char *updatexml = NULL;
+    g_autofree char *args = NULL;
+
+    xml = g_strdup_printf("%s/nwfilterxml2firewalldata/%s.xml",
+                          abs_srcdir, info->name);
+    updatexml = g_strdup_printf("%s/nwfilterxml2firewalldata/%s-update.xml",
+                                abs_srcdir, info->name);
+    args = g_strdup_printf("%s/nwfilterxml2firewalldata/%s-update-%s.args",
+                           abs_srcdir, info->name, RULESTYPE);
+
+    return testCompareUpdateToArgvFiles(xml, updatexml, args);
+}
+
 static bool
 hasNetfilterTools(void)
 {
@@ -447,16 +531,32 @@ mymain(void)
 {
     int ret = 0;
 
-# define DO_TEST(name) \
+# define DO_TEST_FULL(name, ipsetMinValues) \
     do { \
         static struct testInfo info = { \
-            name, \
+            name, ipsetMinValues, \
         }; \
         if (virTestRun("NWFilter XML-2-firewall " name, \
                        testCompareXMLToIPTablesHelper, &info) < 0) \
             ret = -1; \
     } while (0)
 
+# define DO_TEST(name) \
+    DO_TEST_FULL(name, 0)
+
+# define DO_TEST_IPSET(name) \
+    DO_TEST_FULL(name, 2)
+
+# define DO_TEST_UPDATE(name) \
+    do { \
+        static struct testInfo info = { \
+            name, \
+        }; \
+        if (virTestRun("NWFilter XML-2-firewall update " name, \
+                       testCompareUpdateToIPTablesHelper, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
     if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_DIRECT) < 0) {
         if (!hasNetfilterTools()) {
             fprintf(stderr, "iptables/ip6tables/ebtables tools not present");
@@ -505,6 +605,12 @@ mymain(void)
     DO_TEST("udplite-ipv6");
     DO_TEST("vlan");
 
+    DO_TEST_IPSET("ipset-list");
+    /* $A iterates along with $B */
+    DO_TEST_IPSET("iter1");
+
+    DO_TEST_UPDATE("mac");
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -215,6 +215,72 @@ testQemuAgentFSThaw(const void *data)
 }
 
 
+static int
+testQemuAgentBatch(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewAgent(xmlopt);
+    qemuAgentPtr agent;
+    int ret = -1;
+    int rc;
+
+    if (!test)
+        return -1;
+
+    agent = qemuMonitorTestGetAgent(test);
+
+    /* commands in a batch share one guest-sync ... */
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
+                               "{ \"return\" : 5 }") < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
+                               "{ \"return\" : 7 }") < 0)
+        goto cleanup;
+
+    /* ... while commands outside of a batch are synchronized again */
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
+                               "{ \"return\" : 9 }") < 0)
+        goto cleanup;
+
+    qemuAgentBatchBegin(agent);
+
+    if ((rc = qemuAgentFSThaw(agent)) != 5) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected 5 thawed filesystems, got %d", rc);
+        qemuAgentBatchEnd(agent);
+        goto cleanup;
+    }
+
+    if ((rc = qemuAgentFSThaw(agent)) != 7) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected 7 thawed filesystems, got %d", rc);
+        qemuAgentBatchEnd(agent);
+        goto cleanup;
+    }
+
+    qemuAgentBatchEnd(agent);
+
+    if ((rc = qemuAgentFSThaw(agent)) != 9) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected 9 thawed filesystems, got %d", rc);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 testQemuAgentFSTrim(const void *data)
 {
@@ -1493,6 +1559,7 @@ mymain(void)
 
     DO_TEST(FSFreeze);
     DO_TEST(FSThaw);
+    DO_TEST(Batch);
     DO_TEST(FSTrim);
     DO_TEST(GetFSInfo);
     DO_TEST(Suspend);
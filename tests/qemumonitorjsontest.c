@@ -239,6 +239,353 @@ testQemuMonitorJSONGetStatus(const void *opaque)
     return 0;
 }
 
+static int
+testQemuMonitorJSONCommandBatch(const void *opaque)
+{
+    const testGenericData *data = opaque;
+    virDomainXMLOptionPtr xmlopt = data->xmlopt;
+    const char *cmdstrs[] = {
+        "{\"execute\":\"query-status\"}",
+        "{\"execute\":\"query-name\"}",
+        "{\"execute\":\"query-uuid\"}",
+    };
+    virJSONValuePtr cmds[G_N_ELEMENTS(cmdstrs)] = { NULL };
+    virJSONValuePtr replies[G_N_ELEMENTS(cmdstrs)] = { NULL };
+    g_autoptr(qemuMonitorTest) test = NULL;
+    virJSONValuePtr ret;
+    const char *str;
+    size_t i;
+    int rc = -1;
+
+    if (!(test = qemuMonitorTestNewSchema(xmlopt, data->schema)))
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-status",
+                               "{\"return\": {\"status\": \"running\","
+                               "              \"singlestep\": false,"
+                               "              \"running\": true}}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-name",
+                               "{\"return\": {\"name\": \"batch\"}}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-uuid",
+                               "{\"error\": {\"class\": \"GenericError\","
+                               "             \"desc\": \"no uuid\"}}") < 0)
+        return -1;
+
+    for (i = 0; i < G_N_ELEMENTS(cmdstrs); i++) {
+        if (!(cmds[i] = virJSONValueFromString(cmdstrs[i])))
+            goto cleanup;
+    }
+
+    if (qemuMonitorJSONCommandBatch(qemuMonitorTestGetMonitor(test),
+                                    cmds, G_N_ELEMENTS(cmds), replies) < 0)
+        goto cleanup;
+
+    if (!(ret = virJSONValueObjectGetObject(replies[0], "return")) ||
+        !(str = virJSONValueObjectGetString(ret, "status")) ||
+        STRNEQ(str, "running")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected reply to 'query-status'");
+        goto cleanup;
+    }
+
+    if (!(ret = virJSONValueObjectGetObject(replies[1], "return")) ||
+        !(str = virJSONValueObjectGetString(ret, "name")) ||
+        STRNEQ(str, "batch")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected reply to 'query-name'");
+        goto cleanup;
+    }
+
+    if (!virJSONValueObjectHasKey(replies[2], "error")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "expected error reply to 'query-uuid'");
+        goto cleanup;
+    }
+
+    rc = 0;
+
+ cleanup:
+    for (i = 0; i < G_N_ELEMENTS(cmdstrs); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    return rc;
+}
+
+
+typedef struct _testQemuMonitorJSONOutOfOrderData testQemuMonitorJSONOutOfOrderData;
+struct _testQemuMonitorJSONOutOfOrderData {
+    char *firstid;
+};
+
+
+/* Remember the ID of the first command without replying to it */
+static int
+testQemuMonitorJSONOutOfOrderFirst(qemuMonitorTestPtr test G_GNUC_UNUSED,
+                                   qemuMonitorTestItemPtr item,
+                                   const char *cmdstr)
+{
+    testQemuMonitorJSONOutOfOrderData *data = qemuMonitorTestItemGetPrivateData(item);
+    g_autoptr(virJSONValue) cmd = NULL;
+
+    if (!(cmd = virJSONValueFromString(cmdstr)))
+        return -1;
+
+    data->firstid = g_strdup(virJSONValueObjectGetString(cmd, "id"));
+    return 0;
+}
+
+
+/* Reply to the second command and only then to the first one */
+static int
+testQemuMonitorJSONOutOfOrderSecond(qemuMonitorTestPtr test,
+                                    qemuMonitorTestItemPtr item,
+                                    const char *cmdstr)
+{
+    testQemuMonitorJSONOutOfOrderData *data = qemuMonitorTestItemGetPrivateData(item);
+    g_autoptr(virJSONValue) cmd = NULL;
+    g_autofree char *first = NULL;
+    g_autofree char *second = NULL;
+
+    if (!(cmd = virJSONValueFromString(cmdstr)) || !data->firstid)
+        return -1;
+
+    second = g_strdup_printf("{\"return\": {\"name\": \"second\"}, \"id\": \"%s\"}",
+                             virJSONValueObjectGetString(cmd, "id"));
+    first = g_strdup_printf("{\"return\": {\"name\": \"first\"}, \"id\": \"%s\"}",
+                            data->firstid);
+
+    if (qemuMonitorTestAddResponse(test, second) < 0 ||
+        qemuMonitorTestAddResponse(test, first) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testQemuMonitorJSONCommandBatchOutOfOrder(const void *opaque)
+{
+    const testGenericData *data = opaque;
+    virDomainXMLOptionPtr xmlopt = data->xmlopt;
+    testQemuMonitorJSONOutOfOrderData ooo = { NULL };
+    const char *expect[] = { "first", "second" };
+    virJSONValuePtr cmds[G_N_ELEMENTS(expect)] = { NULL };
+    virJSONValuePtr replies[G_N_ELEMENTS(expect)] = { NULL };
+    g_autoptr(qemuMonitorTest) test = NULL;
+    virJSONValuePtr ret;
+    const char *str;
+    size_t i;
+    int rc = -1;
+
+    if (!(test = qemuMonitorTestNewSchema(xmlopt, data->schema)))
+        return -1;
+
+    if (qemuMonitorTestAddHandler(test, "query-name",
+                                  testQemuMonitorJSONOutOfOrderFirst,
+                                  &ooo, NULL) < 0 ||
+        qemuMonitorTestAddHandler(test, "query-name",
+                                  testQemuMonitorJSONOutOfOrderSecond,
+                                  &ooo, NULL) < 0)
+        goto cleanup;
+
+    for (i = 0; i < G_N_ELEMENTS(cmds); i++) {
+        if (!(cmds[i] = virJSONValueFromString("{\"execute\":\"query-name\"}")))
+            goto cleanup;
+    }
+
+    if (qemuMonitorJSONCommandBatch(qemuMonitorTestGetMonitor(test),
+                                    cmds, G_N_ELEMENTS(cmds), replies) < 0)
+        goto cleanup;
+
+    for (i = 0; i < G_N_ELEMENTS(expect); i++) {
+        if (!(ret = virJSONValueObjectGetObject(replies[i], "return")) ||
+            !(str = virJSONValueObjectGetString(ret, "name")) ||
+            STRNEQ(str, expect[i])) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "reply %zu was not matched to its command", i);
+            goto cleanup;
+        }
+    }
+
+    rc = 0;
+
+ cleanup:
+    for (i = 0; i < G_N_ELEMENTS(cmds); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    g_free(ooo.firstid);
+    return rc;
+}
+
+
+/* A failed capacity query must not discard the block statistics */
+static int
+testQemuMonitorJSONGetAllBlockStatsInfoBlockdev(const void *opaque)
+{
+    const testGenericData *data = opaque;
+    virDomainXMLOptionPtr xmlopt = data->xmlopt;
+    const char *stats =
+        "{\"return\": ["
+        "    {\"device\": \"\","
+        "     \"node-name\": \"libvirt-1-format\","
+        "     \"qdev\": \"/machine/peripheral/virtio-disk0/virtio-backend\","
+        "     \"stats\": {\"rd_bytes\": 512, \"wr_bytes\": 0,"
+        "               \"rd_operations\": 1, \"wr_operations\": 0}}"
+        "]}";
+    const char *error =
+        "{\"error\": {\"class\": \"GenericError\","
+        "             \"desc\": \"failed\"}}";
+    g_autoptr(qemuMonitorTest) test = NULL;
+    g_autoptr(GHashTable) blockstats = virHashNew(g_free);
+    qemuBlockStatsPtr entry;
+    bool capacity = true;
+
+    if (!(test = qemuMonitorTestNewSchema(xmlopt, data->schema)))
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats", stats) < 0 ||
+        qemuMonitorTestAddItem(test, "query-named-block-nodes", error) < 0 ||
+        qemuMonitorTestAddItem(test, "query-blockstats", error) < 0 ||
+        qemuMonitorTestAddItem(test, "query-named-block-nodes", "{\"return\": []}") < 0)
+        return -1;
+
+    if (qemuMonitorJSONGetAllBlockStatsInfoBlockdev(qemuMonitorTestGetMonitor(test),
+                                                    blockstats, false,
+                                                    &capacity) < 0)
+        return -1;
+
+    if (capacity) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "capacity reported despite failed query");
+        return -1;
+    }
+
+    if (!(entry = virHashLookup(blockstats, "libvirt-1-format")) ||
+        entry->rd_bytes != 512) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block statistics were not returned");
+        return -1;
+    }
+
+    virResetLastError();
+    virHashRemoveAll(blockstats);
+
+    if (qemuMonitorJSONGetAllBlockStatsInfoBlockdev(qemuMonitorTestGetMonitor(test),
+                                                    blockstats, false,
+                                                    &capacity) >= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "failed block statistics query was ignored");
+        return -1;
+    }
+
+    virResetLastError();
+    return 0;
+}
+
+
+static int
+testQemuMonitorJSONCommandStats(const void *opaque)
+{
+    const testGenericData *data = opaque;
+    virDomainXMLOptionPtr xmlopt = data->xmlopt;
+    const char *cmdstrs[] = {
+        "{\"execute\":\"query-status\"}",
+        "{\"execute\":\"query-name\"}",
+        "{\"execute\":\"query-status\"}",
+    };
+    const char *expectNames[] = { "query-name", "query-status" };
+    unsigned long long expectCalls[] = { 1, 2 };
+    virJSONValuePtr cmds[G_N_ELEMENTS(cmdstrs)] = { NULL };
+    virJSONValuePtr replies[G_N_ELEMENTS(cmdstrs)] = { NULL };
+    g_autoptr(qemuMonitorTest) test = NULL;
+    qemuMonitorPtr mon;
+    qemuMonitorCommandStatsPtr *stats = NULL;
+    size_t nstats = 0;
+    size_t i;
+    size_t j;
+    int rc = -1;
+
+    if (!(test = qemuMonitorTestNewSchema(xmlopt, data->schema)))
+        return -1;
+
+    mon = qemuMonitorTestGetMonitor(test);
+
+    if (qemuMonitorTestAddItem(test, "query-status",
+                               "{\"return\": {\"status\": \"running\","
+                               "              \"singlestep\": false,"
+                               "              \"running\": true}}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-name",
+                               "{\"return\": {\"name\": \"stats\"}}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-status",
+                               "{\"return\": {\"status\": \"running\","
+                               "              \"singlestep\": false,"
+                               "              \"running\": true}}") < 0)
+        return -1;
+
+    for (i = 0; i < G_N_ELEMENTS(cmdstrs); i++) {
+        if (!(cmds[i] = virJSONValueFromString(cmdstrs[i])))
+            goto cleanup;
+    }
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, 2, replies) < 0 ||
+        qemuMonitorJSONCommandBatch(mon, cmds + 2, 1, replies + 2) < 0)
+        goto cleanup;
+
+    /* the test harness holds the monitor lock which the accessor takes */
+    virObjectUnlock(mon);
+    rc = qemuMonitorGetCommandStats(mon, &stats, &nstats);
+    virObjectLock(mon);
+    if (rc < 0)
+        goto cleanup;
+    rc = -1;
+
+    if (nstats != G_N_ELEMENTS(expectNames)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected %zu command stats, got %zu",
+                       G_N_ELEMENTS(expectNames), nstats);
+        goto cleanup;
+    }
+
+    for (i = 0; i < nstats; i++) {
+        unsigned long long histcalls = 0;
+
+        if (STRNEQ(stats[i]->name, expectNames[i]) ||
+            stats[i]->calls != expectCalls[i]) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "unexpected stats '%s' calls '%llu'",
+                           stats[i]->name, stats[i]->calls);
+            goto cleanup;
+        }
+
+        for (j = 0; j < QEMU_MONITOR_COMMAND_STATS_BUCKETS; j++)
+            histcalls += stats[i]->histogram[j];
+
+        if (histcalls != stats[i]->calls ||
+            stats[i]->maxTime > stats[i]->totalTime ||
+            stats[i]->queuedTime > stats[i]->totalTime) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "inconsistent timing stats of '%s'",
+                           stats[i]->name);
+            goto cleanup;
+        }
+    }
+
+    rc = 0;
+
+ cleanup:
+    for (i = 0; i < G_N_ELEMENTS(cmdstrs); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    for (i = 0; i < nstats; i++)
+        qemuMonitorCommandStatsFree(stats[i]);
+    g_free(stats);
+    return rc;
+}
+
+
 static int
 testQemuMonitorJSONGetVersion(const void *opaque)
 {
@@ -3078,6 +3425,10 @@ mymain(void)
 
     DO_TEST(GetStatus);
     DO_TEST(GetVersion);
+    DO_TEST(CommandBatch);
+    DO_TEST(CommandBatchOutOfOrder);
+    DO_TEST(GetAllBlockStatsInfoBlockdev);
+    DO_TEST(CommandStats);
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
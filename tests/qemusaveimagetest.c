@@ -0,0 +1,119 @@
+#include <config.h>
+
+#include "testutils.h"
+#include "qemu/qemu_saveimage.h"
+#define LIBVIRT_QEMU_SAVEIMAGEPRIV_H_ALLOW
+#include "qemu/qemu_saveimagepriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+struct testQEMUSaveHeaderData {
+    uint32_t version;
+    uint32_t channels;
+    bool swap;      /* header was written on a host of the other endianness */
+    bool fail;      /* header has to be rejected */
+    uint32_t expectChannels;
+};
+
+
+static void
+testQEMUSaveHeaderFill(virQEMUSaveHeaderPtr header,
+                       uint32_t version,
+                       uint32_t channels)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, QEMU_SAVE_MAGIC, sizeof(header->magic));
+    header->version = version;
+    header->data_len = 1234;
+    header->was_running = 1;
+    header->compressed = 0;
+    header->cookieOffset = 1000;
+    header->channels = channels;
+}
+
+
+static int
+testQEMUSaveHeader(const void *opaque)
+{
+    const struct testQEMUSaveHeaderData *data = opaque;
+    virQEMUSaveHeader header;
+    virQEMUSaveHeader orig;
+    int rc;
+
+    testQEMUSaveHeaderFill(&header, data->version, data->channels);
+    orig = header;
+
+    if (data->swap) {
+        qemuSaveImageBswapHeader(&header);
+
+        if (header.channels != GUINT32_SWAP_LE_BE(data->channels)) {
+            fprintf(stderr, "channels were not byte swapped\n");
+            return -1;
+        }
+    }
+
+    rc = qemuSaveImageHeaderCheck(&header);
+
+    if (data->fail) {
+        if (rc == 0) {
+            fprintf(stderr, "invalid header was accepted\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    orig.channels = data->expectChannels;
+    if (memcmp(&orig, &header, sizeof(header)) != 0) {
+        fprintf(stderr,
+                "header differs: version=%u data_len=%u was_running=%u "
+                "compressed=%u cookieOffset=%u channels=%u\n",
+                header.version, header.data_len, header.was_running,
+                header.compressed, header.cookieOffset, header.channels);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST_FULL(name, ver, chans, sw, fl, expect) \
+    do { \
+        struct testQEMUSaveHeaderData data = { ver, chans, sw, fl, expect }; \
+        if (virTestRun(name, testQEMUSaveHeader, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+#define DO_TEST(name, ver, chans, expect) \
+    do { \
+        DO_TEST_FULL(name, ver, chans, false, false, expect); \
+        DO_TEST_FULL(name " swapped", ver, chans, true, false, expect); \
+    } while (0)
+
+#define DO_TEST_FAIL(name, ver, chans) \
+    do { \
+        DO_TEST_FULL(name, ver, chans, false, true, 0); \
+        DO_TEST_FULL(name " swapped", ver, chans, true, true, 0); \
+    } while (0)
+
+    DO_TEST("v2", QEMU_SAVE_VERSION, 0, 0);
+    DO_TEST("v2 ignores channels", QEMU_SAVE_VERSION, 7, 0);
+    DO_TEST("v3 without channels", QEMU_SAVE_VERSION_PARALLEL, 0, 0);
+    DO_TEST("v3 channels", QEMU_SAVE_VERSION_PARALLEL, 4, 4);
+    DO_TEST("v3 max channels", QEMU_SAVE_VERSION_PARALLEL, 255, 255);
+    DO_TEST_FAIL("v3 too many channels", QEMU_SAVE_VERSION_PARALLEL, 256);
+    DO_TEST_FAIL("v3 huge channels", QEMU_SAVE_VERSION_PARALLEL, 0x01000000);
+    DO_TEST_FAIL("v4", QEMU_SAVE_VERSION_PARALLEL + 1, 0);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+VIR_TEST_MAIN(mymain)
@@ -196,6 +196,68 @@ testFileCache(const void *opaque)
 }
 
 
+struct _testFileCachePopulateData {
+    virFileCachePtr cache;
+    const char **names;
+    size_t nnames;
+    const char *newData;
+};
+typedef struct _testFileCachePopulateData testFileCachePopulateData;
+
+
+static int
+testFileCachePopulate(const void *opaque)
+{
+    const testFileCachePopulateData *data = opaque;
+    testFileCachePrivPtr testPriv = virFileCacheGetPriv(data->cache);
+    size_t i;
+
+    testPriv->dataSaved = false;
+    testPriv->newData = data->newData;
+    testPriv->expectData = data->newData;
+
+    if (virFileCachePopulate(data->cache, data->names, data->nnames, 2) < 0) {
+        fprintf(stderr, "Populating cache failed.\n");
+        return -1;
+    }
+
+    if (!testPriv->dataSaved) {
+        fprintf(stderr, "Expect data to be saved when populating cache.\n");
+        return -1;
+    }
+
+    testPriv->dataSaved = false;
+
+    for (i = 0; i < data->nnames; i++) {
+        testFileCacheObjPtr obj;
+        bool match;
+
+        if (!(obj = virFileCacheLookup(data->cache, data->names[i]))) {
+            fprintf(stderr, "Getting cached data for '%s' failed.\n",
+                    data->names[i]);
+            return -1;
+        }
+
+        if (!(match = STREQ_NULLABLE(data->newData, obj->data))) {
+            fprintf(stderr, "Expect data '%s' for '%s', cached data '%s'.\n",
+                    data->newData, data->names[i], NULLSTR(obj->data));
+        }
+
+        virObjectUnref(obj);
+
+        if (!match)
+            return -1;
+    }
+
+    if (testPriv->dataSaved) {
+        fprintf(stderr, "Populated data should not be created again.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 mymain(void)
 {
@@ -224,6 +286,16 @@ mymain(void)
     TEST_RUN("cacheInvalid", "bbb\n", "bbb\n", true);
     TEST_RUN("cacheMissing", "ccc\n", "ccc\n", true);
 
+    {
+        const char *names[] = { "cacheValid", "cacheMissing", "cachePopulate" };
+        testFileCachePopulateData data = {
+            cache, names, G_N_ELEMENTS(names), "ddd\n"
+        };
+
+        if (virTestRun("cachePopulate", testFileCachePopulate, &data) < 0)
+            ret = -1;
+    }
+
     virObjectUnref(cache);
 
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -309,6 +309,50 @@ testFileInData(const void *opaque)
 }
 
 
+static int
+testFilePReadLimFD(const void *opaque G_GNUC_UNUSED)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *expected = NULL;
+    VIR_AUTOCLOSE fd = -1;
+    int len;
+    size_t i;
+
+    path = g_strdup_printf("%s/virfiledata/mounts1.txt", abs_srcdir);
+
+    if ((len = virFileReadAll(path, 1024 * 1024, &expected)) < 0)
+        return -1;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return -1;
+    }
+
+    /* repeated reads through the same descriptor return the whole file */
+    for (i = 0; i < 2; i++) {
+        g_autofree char *actual = NULL;
+
+        if (virFilePReadLimFD(fd, 1024 * 1024, &actual) != len) {
+            fprintf(stderr, "Unexpected length of read %zu\n", i);
+            return -1;
+        }
+
+        if (STRNEQ(expected, actual)) {
+            virTestDifference(stderr, expected, actual);
+            return -1;
+        }
+    }
+
+    if (virFilePReadLimFD(fd, len - 1, &expected) >= 0 ||
+        errno != EOVERFLOW) {
+        fprintf(stderr, "Expected overflow when reading %d bytes\n", len - 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 struct testFileIsSharedFSType {
     const char *mtabFile;
     const char *filename;
@@ -447,6 +491,9 @@ mymain(void)
             ret = -1; \
     } while (0)
 
+    if (virTestRun("PReadLimFD", testFilePReadLimFD, NULL) < 0)
+        ret = -1;
+
     virTestCounterReset("testFileIsSharedFSType ");
     DO_TEST_FILE_IS_SHARED_FS_TYPE("mounts1.txt", "/boot/vmlinuz", false);
     DO_TEST_FILE_IS_SHARED_FS_TYPE("mounts2.txt", "/run/user/501/gvfs/some/file", false);
@@ -37,6 +37,8 @@
 
 static bool fwDisabled = true;
 static virBufferPtr fwBuf;
+/* Output of 'ebtables -V' */
+static const char *fwEbtablesVersion;
 static bool fwError;
 
 # define TEST_FILTER_TABLE_LIST \
@@ -1034,6 +1036,302 @@ testFirewallQuery(const void *opaque G_GNUC_UNUSED)
     return ret;
 }
 
+static void
+testFirewallBatchHook(const char *const*args,
+                      const char *const*env,
+                      const char *input,
+                      char **output,
+                      char **error,
+                      int *status,
+                      void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (STREQ(args[0], EBTABLES_PATH) && args[1] && STREQ(args[1], "-V")) {
+        *output = g_strdup(fwEbtablesVersion);
+        return;
+    }
+
+    if (!input) {
+        testFirewallRollbackHook(args, env, input, output, error, status, NULL);
+        return;
+    }
+
+    /* iptables-restore reads the rules from stdin */
+    virBufferAdd(buf, input, -1);
+
+    if (strstr(input, "192.168.122.255"))
+        *status = 1;
+}
+
+static int
+testFirewallBatch(const void *opaque)
+{
+    g_auto(virBuffer) cmdbuf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " -w --noflush\n"
+        "*filter\n"
+        "-A INPUT --source 192.168.122.1 --jump ACCEPT\n"
+        "-A INPUT -m comment --comment \"libvirt \\\"default\\\" network\" --jump REJECT\n"
+        "COMMIT\n"
+        IPTABLES_RESTORE_PATH " -w --noflush\n"
+        "*nat\n"
+        "-A POSTROUTING --source 192.168.122.0/24 --jump MASQUERADE\n"
+        "-A POSTROUTING --source 192.168.122.0/24 --jump RETURN\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -w -D INPUT --source 192.168.122.2 --jump ACCEPT\n"
+        IP6TABLES_PATH " -w -A INPUT --source ::1 --jump ACCEPT\n";
+    const struct testFirewallData *data = opaque;
+
+    fwDisabled = data->fwDisabled;
+    if (virFirewallSetBackend(data->tryBackend) < 0)
+        goto cleanup;
+
+    virFirewallSetBatching(true);
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "-m", "comment",
+                       "--comment", "libvirt \"default\" network",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--source", "192.168.122.0/24",
+                       "--jump", "MASQUERADE", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--source", "192.168.122.0/24",
+                       "--jump", "RETURN", NULL);
+
+    virFirewallAddRuleFull(fw, VIR_FIREWALL_LAYER_IPV4,
+                           true, NULL, NULL,
+                           "-D", "INPUT",
+                           "--source", "192.168.122.2",
+                           "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV6,
+                       "-A", "INPUT",
+                       "--source", "::1",
+                       "--jump", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexpected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    return ret;
+}
+
+static int
+testFirewallBatchEthernet(const void *opaque)
+{
+    g_auto(virBuffer) cmdbuf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        EBTABLES_PATH " -V\n"
+        EBTABLES_RESTORE_PATH " --noflush\n"
+        "*nat\n"
+        "-N libvirt-J-vnet0\n"
+        "-A libvirt-J-vnet0 -s ! 52:54:00:00:00:01 -j DROP\n"
+        "-A PREROUTING -i vnet0 -j libvirt-J-vnet0\n"
+        "COMMIT\n";
+    const struct testFirewallData *data = opaque;
+
+    fwDisabled = data->fwDisabled;
+    if (virFirewallSetBackend(data->tryBackend) < 0)
+        goto cleanup;
+
+    virFirewallSetBatching(true);
+    fwEbtablesVersion = "ebtables 1.8.7 (nf_tables)\n";
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-N", "libvirt-J-vnet0", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "libvirt-J-vnet0",
+                       "-s", "!", "52:54:00:00:00:01",
+                       "-j", "DROP", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "PREROUTING",
+                       "-i", "vnet0",
+                       "-j", "libvirt-J-vnet0", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexpected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    return ret;
+}
+
+static int
+testFirewallBatchEthernetLegacy(const void *opaque)
+{
+    g_auto(virBuffer) cmdbuf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        EBTABLES_PATH " -V\n"
+        EBTABLES_PATH " --concurrent -t nat -N libvirt-J-vnet0\n"
+        EBTABLES_PATH " --concurrent -t nat -A libvirt-J-vnet0 -s '!' 52:54:00:00:00:01 -j DROP\n"
+        EBTABLES_PATH " --concurrent -t nat -A PREROUTING -i vnet0 -j libvirt-J-vnet0\n";
+    const struct testFirewallData *data = opaque;
+
+    fwDisabled = data->fwDisabled;
+    if (virFirewallSetBackend(data->tryBackend) < 0)
+        goto cleanup;
+
+    virFirewallSetBatching(true);
+    fwEbtablesVersion = "ebtables 1.8.7 (legacy)\n";
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-N", "libvirt-J-vnet0", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "libvirt-J-vnet0",
+                       "-s", "!", "52:54:00:00:00:01",
+                       "-j", "DROP", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "PREROUTING",
+                       "-i", "vnet0",
+                       "-j", "libvirt-J-vnet0", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexpected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    return ret;
+}
+
+static int
+testFirewallBatchFallback(const void *opaque)
+{
+    g_auto(virBuffer) cmdbuf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virFirewall) fw = virFirewallNew();
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " -w --noflush\n"
+        "*filter\n"
+        "-A INPUT --source 192.168.122.1 --jump ACCEPT\n"
+        "-A INPUT --source 192.168.122.255 --jump REJECT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -w -A INPUT --source 192.168.122.1 --jump ACCEPT\n"
+        IPTABLES_PATH " -w -A INPUT --source 192.168.122.255 --jump REJECT\n"
+        IPTABLES_PATH " -w -D INPUT --source 192.168.122.1 --jump ACCEPT\n"
+        IPTABLES_PATH " -w -D INPUT --source 192.168.122.255 --jump REJECT\n";
+    const struct testFirewallData *data = opaque;
+
+    fwDisabled = data->fwDisabled;
+    if (virFirewallSetBackend(data->tryBackend) < 0)
+        goto cleanup;
+
+    virFirewallSetBatching(true);
+    virCommandSetDryRun(&cmdbuf, testFirewallBatchHook, &cmdbuf);
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallStartRollback(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    if (virFirewallApply(fw) == 0) {
+        fprintf(stderr, "Firewall apply unexpectedly worked\n");
+        goto cleanup;
+    }
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexpected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    return ret;
+}
+
 static bool
 hasNetfilterTools(void)
 {
@@ -1096,6 +1394,10 @@ mymain(void)
     RUN_TEST("many rollback", testFirewallManyRollback);
     RUN_TEST("chained rollback", testFirewallChainedRollback);
     RUN_TEST("query transaction", testFirewallQuery);
+    RUN_TEST("batch", testFirewallBatch);
+    RUN_TEST("batch ethernet", testFirewallBatchEthernet);
+    RUN_TEST("batch ethernet legacy", testFirewallBatchEthernetLegacy);
+    RUN_TEST("batch fallback", testFirewallBatchFallback);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#include "virfile.h"
+#include "virlease.h"
+#include "virleasedb.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/virleasedbdir-XXXXXX"
+
+
+static virJSONValuePtr
+testLeaseNew(const char *mac,
+             const char *ip,
+             const char *hostname,
+             const char *iaid,
+             long long expirytime)
+{
+    g_autoptr(virJSONValue) lease = virJSONValueNewObject();
+
+    if ((iaid && virJSONValueObjectAppendString(lease, "iaid", iaid) < 0) ||
+        virJSONValueObjectAppendString(lease, "ip-address", ip) < 0 ||
+        virJSONValueObjectAppendString(lease, "mac-address", mac) < 0 ||
+        (hostname && virJSONValueObjectAppendString(lease, "hostname", hostname) < 0) ||
+        virJSONValueObjectAppendNumberLong(lease, "expiry-time", expirytime) < 0)
+        return NULL;
+
+    return g_steal_pointer(&lease);
+}
+
+
+static int
+testLeaseDBAdd(virLeaseDBPtr db,
+               const char *mac,
+               const char *ip,
+               const char *hostname,
+               const char *iaid,
+               long long expirytime)
+{
+    g_autoptr(virJSONValue) lease = NULL;
+
+    if (!(lease = testLeaseNew(mac, ip, hostname, iaid, expirytime)))
+        return -1;
+
+    return virLeaseDBAdd(db, lease);
+}
+
+
+static int
+testLeaseDBCompare(virJSONValuePtr leases,
+                   const char *expect)
+{
+    g_autofree char *actual = NULL;
+
+    if (!leases)
+        return -1;
+
+    if (!(actual = virJSONValueToString(leases, false)))
+        return -1;
+
+    return virTestCompareToString(expect, actual);
+}
+
+
+static int
+testLeaseDBBasic(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *path = virLeaseDBFileName(scratchdir, "basic");
+    g_autoptr(virLeaseDB) db = NULL;
+    g_autoptr(virJSONValue) leases = NULL;
+    g_autoptr(virJSONValue) readLeases = NULL;
+    const char *expect =
+        "[{\"ip-address\":\"192.168.122.11\",\"mac-address\":\"52:54:00:00:00:02\","
+        "\"expiry-time\":2000000000},"
+        "{\"iaid\":\"1234\",\"ip-address\":\"2001:db8::10\","
+        "\"mac-address\":\"52:54:00:00:00:01\",\"hostname\":\"fedora\","
+        "\"server-duid\":\"00:01:00:01:aa:bb\",\"expiry-time\":2000000000},"
+        "{\"ip-address\":\"192.168.122.10\",\"mac-address\":\"52:54:00:00:00:01\","
+        "\"hostname\":\"fedora\",\"expiry-time\":2000000100}]";
+
+    if (!(db = virLeaseDBOpen(path, NULL)))
+        return -1;
+
+    if (virLeaseDBGetServerDUID(db)) {
+        fprintf(stderr, "new database has a server DUID\n");
+        return -1;
+    }
+
+    if (virLeaseDBSetServerDUID(db, "00:01:00:01:aa:bb") < 0 ||
+        testLeaseDBAdd(db, "52:54:00:00:00:01", "192.168.122.10",
+                       "fedora", NULL, 2000000000) < 0 ||
+        testLeaseDBAdd(db, "52:54:00:00:00:02", "192.168.122.11",
+                       NULL, NULL, 2000000000) < 0 ||
+        testLeaseDBAdd(db, "52:54:00:00:00:03", "192.168.122.12",
+                       "gentoo", NULL, 2000000000) < 0 ||
+        testLeaseDBAdd(db, "52:54:00:00:00:01", "2001:db8::10",
+                       "fedora", "1234", 2000000000) < 0 ||
+        /* renewal replaces the existing lease */
+        testLeaseDBAdd(db, "52:54:00:00:00:01", "192.168.122.10",
+                       "fedora", NULL, 2000000100) < 0 ||
+        virLeaseDBRemove(db, "192.168.122.12") < 0 ||
+        /* removing an unknown lease is not an error */
+        virLeaseDBRemove(db, "192.168.122.13") < 0)
+        return -1;
+
+    leases = virLeaseDBGetLeases(db);
+    if (testLeaseDBCompare(leases, expect) < 0)
+        return -1;
+
+    readLeases = virLeaseDBReadLeases(path);
+    if (testLeaseDBCompare(readLeases, expect) < 0)
+        return -1;
+
+    /* everything is persisted */
+    g_clear_pointer(&db, virLeaseDBFree);
+    g_clear_pointer(&leases, virJSONValueFree);
+
+    if (!(db = virLeaseDBOpen(path, NULL)))
+        return -1;
+
+    if (STRNEQ_NULLABLE(virLeaseDBGetServerDUID(db), "00:01:00:01:aa:bb")) {
+        fprintf(stderr, "unexpected server DUID '%s'\n",
+                NULLSTR(virLeaseDBGetServerDUID(db)));
+        return -1;
+    }
+
+    leases = virLeaseDBGetLeases(db);
+    return testLeaseDBCompare(leases, expect);
+}
+
+
+static int
+testLeaseDBImport(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *path = virLeaseDBFileName(scratchdir, "import");
+    g_autofree char *legacy = g_strdup_printf("%s/import.status", scratchdir);
+    g_autofree char *content = NULL;
+    g_autofree char *kept = NULL;
+    g_autofree char *expect = NULL;
+    g_autoptr(virJSONValue) legacyLeases = NULL;
+    g_autoptr(virJSONValue) leases = NULL;
+    g_autoptr(virLeaseDB) db = NULL;
+
+    if (virTestLoadFile(abs_srcdir "/nssdata/virbr0.status", &content) < 0 ||
+        virFileWriteStr(legacy, content, 0644) < 0)
+        return -1;
+
+    if (!(legacyLeases = virJSONValueFromString(content)) ||
+        !(expect = virJSONValueToString(legacyLeases, false)))
+        return -1;
+
+    if (!(db = virLeaseDBOpen(path, legacy)))
+        return -1;
+
+    /* older versions may still need the legacy lease file */
+    if (virFileReadAll(legacy, 1024 * 1024, &kept) < 0)
+        return -1;
+
+    if (STRNEQ(kept, content)) {
+        fprintf(stderr, "legacy lease file was modified\n");
+        return -1;
+    }
+
+    leases = virLeaseDBGetLeases(db);
+    return testLeaseDBCompare(leases, expect);
+}
+
+
+static int
+testLeaseDBGrow(const void *opaque)
+{
+    const char *scratchdir = opaque;
+    g_autofree char *path = virLeaseDBFileName(scratchdir, "grow");
+    g_autoptr(virLeaseDB) db = NULL;
+    g_autoptr(virJSONValue) leases = NULL;
+    const size_t nleases = 1000;
+    size_t round;
+    size_t i;
+
+    if (!(db = virLeaseDBOpen(path, NULL)))
+        return -1;
+
+    /* several rounds of renewals force the database to be compacted
+     * and grown a few times */
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < nleases; i++) {
+            g_autofree char *mac = g_strdup_printf("52:54:00:00:%02zx:%02zx",
+                                                   i / 256, i % 256);
+            g_autofree char *ip = g_strdup_printf("10.0.%zu.%zu",
+                                                  i / 256, i % 256);
+            g_autofree char *hostname = g_strdup_printf("guest%zu", i);
+
+            if (testLeaseDBAdd(db, mac, ip, hostname, NULL,
+                               2000000000 + round) < 0)
+                return -1;
+        }
+    }
+
+    for (i = 0; i < nleases; i += 2) {
+        g_autofree char *ip = g_strdup_printf("10.0.%zu.%zu", i / 256, i % 256);
+
+        if (virLeaseDBRemove(db, ip) < 0)
+            return -1;
+    }
+
+    if (!(leases = virLeaseDBReadLeases(path)))
+        return -1;
+
+    if (virJSONValueArraySize(leases) != nleases / 2) {
+        fprintf(stderr, "expected %zu leases, got %zu\n",
+                nleases / 2, virJSONValueArraySize(leases));
+        return -1;
+    }
+
+    for (i = 0; i < virJSONValueArraySize(leases); i++) {
+        virJSONValuePtr lease = virJSONValueArrayGet(leases, i);
+        long long expirytime;
+
+        if (virJSONValueObjectGetNumberLong(lease, "expiry-time", &expirytime) < 0 ||
+            expirytime != 2000000002) {
+            fprintf(stderr, "lease %zu was not renewed\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    if (!g_mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create virleasedbdir");
+        abort();
+    }
+
+    if (virTestRun("basic", testLeaseDBBasic, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("import", testLeaseDBImport, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("grow", testLeaseDBGrow, scratchdir) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
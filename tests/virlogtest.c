@@ -19,9 +19,20 @@
 
 #include <config.h>
 
+#include <unistd.h>
+
 #include "testutils.h"
 
+#include "virfile.h"
 #include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logtest");
+
+#define TEST_ASYNC_THREADS 4
+#define TEST_ASYNC_MESSAGES 500
 
 struct testLogData {
     const char *str;
@@ -107,6 +118,233 @@ testLogParseFilters(const void *opaque)
     return ret;
 }
 
+struct testLogAsyncData {
+    size_t count;
+    int last[TEST_ASYNC_THREADS];
+    bool misordered;
+};
+
+static void
+testLogAsyncOutput(virLogSourcePtr src G_GNUC_UNUSED,
+                   virLogPriority priority G_GNUC_UNUSED,
+                   const char *filename G_GNUC_UNUSED,
+                   int linenr G_GNUC_UNUSED,
+                   const char *funcname G_GNUC_UNUSED,
+                   const char *timestamp G_GNUC_UNUSED,
+                   virLogMetadataPtr metadata G_GNUC_UNUSED,
+                   const char *rawstr,
+                   const char *str G_GNUC_UNUSED,
+                   void *opaque)
+{
+    struct testLogAsyncData *data = opaque;
+    int thread;
+    int msg;
+
+    /* skip the version and host name messages */
+    if (sscanf(rawstr, "async %d %d", &thread, &msg) != 2 ||
+        thread < 0 || thread >= TEST_ASYNC_THREADS)
+        return;
+
+    if (msg != data->last[thread] + 1)
+        data->misordered = true;
+
+    data->last[thread] = msg;
+    data->count++;
+}
+
+static void
+testLogAsyncThread(void *opaque)
+{
+    int thread = *(int *)opaque;
+    int i;
+
+    for (i = 0; i < TEST_ASYNC_MESSAGES; i++)
+        VIR_WARN("async %d %d", thread, i);
+}
+
+static int
+testLogAsync(const void *opaque G_GNUC_UNUSED)
+{
+    struct testLogAsyncData data = { 0 };
+    virThread threads[TEST_ASYNC_THREADS];
+    int ids[TEST_ASYNC_THREADS];
+    virLogOutputPtr *outputs = g_new0(virLogOutputPtr, 1);
+    unsigned int dropped = virLogGetAsyncDropped();
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++)
+        data.last[i] = -1;
+
+    outputs[0] = virLogOutputNew(testLogAsyncOutput, NULL, &data,
+                                 VIR_LOG_WARN, VIR_LOG_TO_STDERR, NULL);
+    if (!outputs[0] ||
+        virLogDefineOutputs(outputs, 1) < 0) {
+        virLogOutputListFree(outputs, 1);
+        return -1;
+    }
+
+    if (virLogSetAsync(true) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++) {
+        ids[i] = i;
+        if (virThreadCreate(&threads[i], true, testLogAsyncThread, &ids[i]) < 0) {
+            while (i-- > 0)
+                virThreadJoin(&threads[i]);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++)
+        virThreadJoin(&threads[i]);
+
+    /* flushes the queued messages */
+    if (virLogSetAsync(false) < 0)
+        goto cleanup;
+
+    /* each thread queues fewer messages than fit into its ring */
+    if (virLogGetAsyncDropped() != dropped) {
+        VIR_TEST_DEBUG("%u messages were dropped",
+                       virLogGetAsyncDropped() - dropped);
+        goto cleanup;
+    }
+
+    if (data.count != TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES) {
+        VIR_TEST_DEBUG("Expected %d messages but got %zu",
+                       TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES, data.count);
+        goto cleanup;
+    }
+
+    if (data.misordered) {
+        VIR_TEST_DEBUG("Messages of a thread were written out of order");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    ignore_value(virLogSetAsync(false));
+    virLogReset();
+    return ret;
+}
+
+static int
+testLogMemory(const void *opaque G_GNUC_UNUSED)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *outputs = NULL;
+    g_autofree char *buf = NULL;
+    g_autofree char *last = NULL;
+    size_t i;
+    int ret = -1;
+
+    path = g_strdup_printf("%s/virlogtest-memory-%d.log",
+                           abs_builddir, (int) getpid());
+
+    if (virLogDumpMemory(path) == 0) {
+        VIR_TEST_DEBUG("Dump should have failed without a memory output");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    if (virLogSetOutputs("3:memory:1") < 0)
+        goto cleanup;
+
+    if (!(outputs = virLogGetOutputs()) ||
+        STRNEQ(outputs, "3:memory:1")) {
+        VIR_TEST_DEBUG("Unexpected outputs '%s'", NULLSTR(outputs));
+        goto cleanup;
+    }
+
+    /* wrap the 1 MiB ring several times */
+    for (i = 0; i < 50000; i++)
+        VIR_WARN("memory %zu", i);
+
+    if (virLogDumpMemory(path) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(path, 2 * 1024 * 1024, &buf) < 0)
+        goto cleanup;
+
+    if (strlen(buf) > 1024 * 1024) {
+        VIR_TEST_DEBUG("Dump exceeds the size of the ring");
+        goto cleanup;
+    }
+
+    /* the dump must start with a complete message */
+    if (!virLogProbablyLogMessage(buf)) {
+        VIR_TEST_DEBUG("Dump starts with a partial message");
+        goto cleanup;
+    }
+
+    last = g_strdup_printf("memory %zu\n", i - 1);
+    if (!virStringHasSuffix(buf, last)) {
+        VIR_TEST_DEBUG("Last message missing from the dump");
+        goto cleanup;
+    }
+
+    if (strstr(buf, "memory 0\n")) {
+        VIR_TEST_DEBUG("Overwritten message found in the dump");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    unlink(path);
+    virLogReset();
+    return ret;
+}
+
+static int testLogLazyCount;
+
+static int
+testLogLazyArg(void)
+{
+    return ++testLogLazyCount;
+}
+
+static int
+testLogLazy(const void *opaque G_GNUC_UNUSED)
+{
+    int ret = -1;
+
+    virLogReset();
+
+    /* the first message of a source always reaches virLogMessage */
+    VIR_DEBUG("lazy %d", testLogLazyArg());
+    testLogLazyCount = 0;
+
+    VIR_DEBUG("lazy %d", testLogLazyArg());
+    if (testLogLazyCount != 0) {
+        VIR_TEST_DEBUG("Arguments of a filtered out message were evaluated");
+        goto cleanup;
+    }
+
+    /* keep the output quiet while letting the message through the filter */
+    if (virLogSetOutputs("4:stderr") < 0 ||
+        virLogSetFilters("1:tests.logtest") < 0)
+        goto cleanup;
+
+    VIR_DEBUG("lazy %d", testLogLazyArg());
+    if (testLogLazyCount != 1) {
+        VIR_TEST_DEBUG("Message enabled by a filter was not emitted");
+        goto cleanup;
+    }
+
+    virLogReset();
+
+    VIR_DEBUG("lazy %d", testLogLazyArg());
+    if (testLogLazyCount != 1) {
+        VIR_TEST_DEBUG("Message was emitted after the filter was removed");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogReset();
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -141,9 +379,14 @@ mymain(void)
     TEST_LOG_MATCH_FAIL("libvirt:  error : cannot execute binary /usr/libexec/libvirt_lxc: No such file or directory");
     TEST_PARSE_OUTPUTS("1:file:/dev/null", 1);
     TEST_PARSE_OUTPUTS("1:file:/dev/null  2:stderr", 2);
+    TEST_PARSE_OUTPUTS("1:memory:1", 1);
+    TEST_PARSE_OUTPUTS("1:memory:1:/dev/null 3:stderr", 2);
     TEST_PARSE_OUTPUTS_FAIL("foo:stderr", 1);
     TEST_PARSE_OUTPUTS_FAIL("1:bar", 1);
     TEST_PARSE_OUTPUTS_FAIL("1:stderr:foobar", 1);
+    TEST_PARSE_OUTPUTS_FAIL("1:memory", 1);
+    TEST_PARSE_OUTPUTS_FAIL("1:memory:0", 1);
+    TEST_PARSE_OUTPUTS_FAIL("1:memory:foo", 1);
     TEST_PARSE_FILTERS("1:foo", 1);
     TEST_PARSE_FILTERS("1:foo 2:bar  3:foobar", 3);
     TEST_PARSE_FILTERS_FAIL("5:foo", 1);
@@ -151,6 +394,13 @@ mymain(void)
     TEST_PARSE_FILTERS_FAIL(":foo", 1);
     TEST_PARSE_FILTERS_FAIL("1:+", 1);
 
+    if (virTestRun("testLogAsync", testLogAsync, NULL) < 0)
+        ret = -1;
+    if (virTestRun("testLogMemory", testLogMemory, NULL) < 0)
+        ret = -1;
+    if (virTestRun("testLogLazy", testLogLazy, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
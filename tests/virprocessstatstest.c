@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "virfile.h"
+#include "virprocess.h"
+#define LIBVIRT_VIRPROCESSPRIV_H_ALLOW
+#include "virprocesspriv.h"
+
+#if WITH_LINUX_TASKSTATS_H
+# include <linux/genetlink.h>
+# include <linux/taskstats.h>
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_ITERATIONS 1000
+
+typedef struct _testThreadStatsData testThreadStatsData;
+struct _testThreadStatsData {
+    pid_t pid;
+    pid_t *tids;
+    size_t ntids;
+};
+
+
+static virProcessThreadStatsPtr
+testThreadStatsNew(const testThreadStatsData *data)
+{
+    virProcessThreadStatsPtr stats = g_new0(virProcessThreadStats, data->ntids);
+    size_t i;
+
+    for (i = 0; i < data->ntids; i++)
+        stats[i].tid = data->tids[i];
+
+    return stats;
+}
+
+
+#if WITH_LINUX_TASKSTATS_H
+typedef struct _testTaskstatsParseData testTaskstatsParseData;
+struct _testTaskstatsParseData {
+    /* contents of the reply */
+    bool error;
+    unsigned long long utime;
+    unsigned long long stime;
+    unsigned long long cpuCount;
+    unsigned long long cpuDelayTotal;
+    size_t truncate; /* number of bytes missing at the end of the reply */
+
+    /* expected results */
+    int rc;
+    unsigned long long cpuTime;
+    bool haveDelay;
+    unsigned long long cpuDelay;
+};
+
+
+/* Formats a reply to TASKSTATS_CMD_GET into @buf the way the kernel does:
+ * the statistics are nested in an aggregate attribute next to the thread
+ * ID. Returns the length of the message. */
+static size_t
+testTaskstatsFormatReply(char *buf,
+                         uint16_t type,
+                         const struct taskstats *ts)
+{
+    struct nlmsghdr *n = (struct nlmsghdr *) buf;
+    struct genlmsghdr *g = NLMSG_DATA(n);
+    struct nlattr *aggr = (struct nlattr *) ((char *) g + GENL_HDRLEN);
+    struct nlattr *pid = (struct nlattr *) ((char *) aggr + NLA_HDRLEN);
+    struct nlattr *stats;
+    uint32_t tid = 1234;
+
+    pid->nla_type = TASKSTATS_TYPE_PID;
+    pid->nla_len = NLA_HDRLEN + sizeof(tid);
+    memcpy((char *) pid + NLA_HDRLEN, &tid, sizeof(tid));
+
+    stats = (struct nlattr *) ((char *) pid + NLA_ALIGN(pid->nla_len));
+    stats->nla_type = TASKSTATS_TYPE_STATS;
+    stats->nla_len = NLA_HDRLEN + sizeof(*ts);
+    memcpy((char *) stats + NLA_HDRLEN, ts, sizeof(*ts));
+
+    aggr->nla_type = TASKSTATS_TYPE_AGGR_PID;
+    aggr->nla_len = NLA_HDRLEN + NLA_ALIGN(pid->nla_len) +
+                    NLA_ALIGN(stats->nla_len);
+
+    g->cmd = TASKSTATS_CMD_NEW;
+    g->version = TASKSTATS_GENL_VERSION;
+
+    n->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + aggr->nla_len);
+    n->nlmsg_type = type;
+
+    return n->nlmsg_len;
+}
+
+
+static int
+testTaskstatsParse(const void *opaque)
+{
+    const testTaskstatsParseData *data = opaque;
+    g_autofree char *buf = g_new0(char, 4096);
+    struct taskstats ts = { 0 };
+    virProcessThreadStats stats = { .tid = 1234 };
+    size_t len;
+    int rc;
+
+    ts.version = TASKSTATS_VERSION;
+    ts.ac_pid = 1234;
+    ts.ac_utime = data->utime;
+    ts.ac_stime = data->stime;
+    ts.cpu_count = data->cpuCount;
+    ts.cpu_delay_total = data->cpuDelayTotal;
+
+    len = testTaskstatsFormatReply(buf, data->error ? NLMSG_ERROR : 42, &ts);
+    len -= data->truncate;
+
+    if ((rc = virProcessTaskstatsParse(buf, len, &stats)) != data->rc) {
+        fprintf(stderr, "expected rc=%d, got %d\n", data->rc, rc);
+        return -1;
+    }
+
+    if (rc < 0)
+        return 0;
+
+    if (stats.cpuTime != data->cpuTime ||
+        stats.haveDelay != data->haveDelay ||
+        (stats.haveDelay && stats.cpuDelay != data->cpuDelay) ||
+        stats.lastCpu != -1) {
+        fprintf(stderr,
+                "expected cpuTime=%llu haveDelay=%d cpuDelay=%llu lastCpu=-1, "
+                "got cpuTime=%llu haveDelay=%d cpuDelay=%llu lastCpu=%d\n",
+                data->cpuTime, data->haveDelay, data->cpuDelay,
+                stats.cpuTime, stats.haveDelay, stats.cpuDelay,
+                stats.lastCpu);
+        return -1;
+    }
+
+    return 0;
+}
+#endif /* WITH_LINUX_TASKSTATS_H */
+
+
+/* The way the statistics were gathered before: each file of each thread
+ * is opened, read and closed separately. */
+static int
+testThreadStatsProcFiles(const testThreadStatsData *data)
+{
+    const char *files[] = { "stat", "schedstat" };
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < data->ntids; i++) {
+        for (j = 0; j < G_N_ELEMENTS(files); j++) {
+            g_autofree char *path = NULL;
+            g_autofree char *buf = NULL;
+
+            path = g_strdup_printf("/proc/%d/task/%d/%s", (int) data->pid,
+                                   (int) data->tids[i], files[j]);
+
+            if (virFileReadAllQuiet(path, 4096, &buf) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testThreadStatsBench(const void *opaque)
+{
+    const testThreadStatsData *data = opaque;
+    g_autofree virProcessThreadStatsPtr stats = testThreadStatsNew(data);
+    unsigned long long start;
+    unsigned long long procTime;
+    unsigned long long statsTime;
+    size_t i;
+
+    /* only run the benchmark when explicitly asked for output */
+    if (!virTestGetVerbose() && !virTestGetDebug())
+        return EXIT_AM_SKIP;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (testThreadStatsProcFiles(data) < 0)
+            return -1;
+    }
+    procTime = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (virProcessGetThreadStats(data->pid, stats, data->ntids, 0) < 0)
+            return -1;
+    }
+    statsTime = g_get_monotonic_time() - start;
+
+    fprintf(stderr, "\n%zu threads, %d iterations: "
+            "/proc files %lluus, virProcessGetThreadStats %lluus\n",
+            data->ntids, BENCH_ITERATIONS, procTime, statsTime);
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    testThreadStatsData data = { .pid = getpid() };
+    g_autofree pid_t *tids = NULL;
+    int ret = 0;
+
+#if WITH_LINUX_TASKSTATS_H
+# define DO_TEST_TASKSTATS(name, ...) \
+    do { \
+        testTaskstatsParseData tsdata = { __VA_ARGS__ }; \
+        if (virTestRun("taskstats " name, testTaskstatsParse, &tsdata) < 0) \
+            ret = -1; \
+    } while (0)
+
+    /* taskstats report times in microseconds */
+    DO_TEST_TASKSTATS("delayacct",
+                      .utime = 1500, .stime = 250,
+                      .cpuCount = 12, .cpuDelayTotal = 4321,
+                      .cpuTime = 1750000, .haveDelay = true,
+                      .cpuDelay = 4321);
+    /* without delay accounting the delay is reported as zero */
+    DO_TEST_TASKSTATS("no delayacct",
+                      .utime = 1500, .stime = 250,
+                      .cpuTime = 1750000, .haveDelay = false);
+    DO_TEST_TASKSTATS("truncated", .truncate = 8, .rc = -1);
+    DO_TEST_TASKSTATS("error", .error = true, .rc = -1);
+
+# undef DO_TEST_TASKSTATS
+#endif /* WITH_LINUX_TASKSTATS_H */
+
+    if (virProcessGetPids(data.pid, &data.ntids, &tids) < 0)
+        return EXIT_FAILURE;
+
+    data.tids = tids;
+
+    if (virTestRun("thread stats bench", testThreadStatsBench, &data) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -19,7 +19,9 @@
 #include <config.h>
 
 #include <unistd.h>
+#include <sys/time.h>
 
+#include "storage_file_cache.h"
 #include "storage_source.h"
 #include "testutils.h"
 #include "vircommand.h"
@@ -397,6 +399,115 @@ testStorageLookup(const void *args)
 }
 
 
+static int
+testStorageHeaderCacheCompare(virStorageSourcePtr a,
+                              virStorageSourcePtr b)
+{
+    for (; virStorageSourceIsBacking(a); a = a->backingStore, b = b->backingStore) {
+        if (!virStorageSourceIsBacking(b) ||
+            STRNEQ_NULLABLE(a->path, b->path) ||
+            STRNEQ_NULLABLE(a->backingStoreRaw, b->backingStoreRaw) ||
+            a->format != b->format ||
+            a->capacity != b->capacity) {
+            fprintf(stderr, "cached chain differs at '%s'\n", NULLSTR(a->path));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testStorageHeaderCacheRebase(const char *path,
+                             const char *backing)
+{
+    g_autoptr(virCommand) cmd = NULL;
+
+    cmd = virCommandNewArgList(qemuimg, "rebase", "-u", "-f", "qcow2",
+                               "-F", "raw", "-b", backing, path, NULL);
+
+    return virCommandRun(cmd, NULL);
+}
+
+
+static int
+testStorageHeaderCache(const void *args)
+{
+    const char *start = args;
+    const char *files[] = { "wrap", "qcow2", "raw" };
+    g_autoptr(virStorageSource) chain = NULL;
+    g_autoptr(virStorageSource) cached = NULL;
+    struct timeval times[2] = { 0 };
+    unsigned long long hits;
+    unsigned long long misses;
+    size_t i;
+
+    /* recently modified files are not cached */
+    times[0].tv_sec = times[1].tv_sec = time(NULL) - 3600;
+    for (i = 0; i < G_N_ELEMENTS(files); i++) {
+        if (utimes(files[i], times) < 0) {
+            fprintf(stderr, "unable to set times of '%s'\n", files[i]);
+            return -1;
+        }
+    }
+
+    virStorageFileHeaderCacheClear();
+
+    if (!(chain = testStorageFileGetMetadata(start, VIR_STORAGE_FILE_QCOW2, -1, -1)))
+        return -1;
+
+    virStorageFileHeaderCacheGetStats(&hits, &misses);
+    if (hits != 0 || misses != G_N_ELEMENTS(files)) {
+        fprintf(stderr, "cold cache: %llu hits, %llu misses\n", hits, misses);
+        return -1;
+    }
+
+    if (!(cached = testStorageFileGetMetadata(start, VIR_STORAGE_FILE_QCOW2, -1, -1)))
+        return -1;
+
+    virStorageFileHeaderCacheGetStats(&hits, &misses);
+    if (hits != G_N_ELEMENTS(files) || misses != G_N_ELEMENTS(files)) {
+        fprintf(stderr, "warm cache: %llu hits, %llu misses\n", hits, misses);
+        return -1;
+    }
+
+    if (testStorageHeaderCacheCompare(chain, cached) < 0)
+        return -1;
+
+    /* rewriting a header changes the modification time and must not
+     * return the stale copy */
+    if (testStorageHeaderCacheRebase("qcow2", absraw) < 0)
+        return -1;
+
+    times[0].tv_sec = times[1].tv_sec = time(NULL) - 1800;
+    if (utimes("qcow2", times) < 0) {
+        fprintf(stderr, "unable to set times of 'qcow2'\n");
+        return -1;
+    }
+
+    virObjectUnref(cached);
+    if (!(cached = testStorageFileGetMetadata(start, VIR_STORAGE_FILE_QCOW2, -1, -1)))
+        return -1;
+
+    virStorageFileHeaderCacheGetStats(&hits, &misses);
+    if (hits != 2 * G_N_ELEMENTS(files) - 1 ||
+        misses != G_N_ELEMENTS(files) + 1) {
+        fprintf(stderr, "rewritten header: %llu hits, %llu misses\n",
+                hits, misses);
+        return -1;
+    }
+
+    if (!virStorageSourceIsBacking(cached->backingStore) ||
+        STRNEQ_NULLABLE(cached->backingStore->backingStoreRaw, absraw)) {
+        fprintf(stderr, "stale backing store of 'qcow2'\n");
+        return -1;
+    }
+
+    return testStorageHeaderCacheRebase("qcow2", "raw");
+}
+
+
 struct testPathCanonicalizeData
 {
     const char *path;
@@ -1085,6 +1196,9 @@ mymain(void)
     TEST_LOOKUP_TARGET(80, "vda", chain3, "vda[2]", 0, NULL, NULL, NULL);
     TEST_LOOKUP_TARGET(81, "vda", NULL, "vda[3]", 0, NULL, NULL, NULL);
 
+    if (virTestRun("Header cache", testStorageHeaderCache, "sub/link2") < 0)
+        ret = -1;
+
 #define TEST_PATH_CANONICALIZE(id, PATH, EXPECT) \
     do { \
         data3.path = PATH; \
@@ -24,6 +24,8 @@
 #include "virstring.h"
 
 #include "storage/storage_util.h"
+#define LIBVIRT_STORAGE_UTIL_PRIV_H_ALLOW
+#include "storage/storage_util_priv.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -70,10 +72,196 @@ testGlusterExtractPoolSources(const void *opaque)
 }
 
 
+static virStorageVolDefPtr
+testRefreshVolNew(const char *dir,
+                  const char *name)
+{
+    virStorageVolDefPtr vol = g_new0(virStorageVolDef, 1);
+
+    vol->name = g_strdup(name);
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.path = g_strdup_printf("%s/%s", dir, name);
+    vol->key = g_strdup(vol->target.path);
+
+    return vol;
+}
+
+
+static int
+testRefreshWriteFile(const char *dir,
+                     const char *name,
+                     const char *content)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir, name);
+
+    if (virFileWriteStr(path, content, 0600) < 0) {
+        fprintf(stderr, "cannot write '%s'\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testRefreshUnlinkFile(const char *dir,
+                      const char *name)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir, name);
+
+    if (unlink(path) < 0) {
+        fprintf(stderr, "cannot remove '%s'\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testRefreshRun(virStoragePoolObjPtr pool)
+{
+    g_autoptr(virStorageBackendRefreshJob) job = NULL;
+
+    if (!(job = virStorageBackendRefreshLocalScan(pool)) ||
+        virStorageBackendRefreshLocalApply(pool, job) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testRefreshCheckVols(virStoragePoolObjPtr pool,
+                     const char *const *names)
+{
+    size_t n = 0;
+
+    for (; names[n]; n++) {
+        if (!virStorageVolDefFindByName(pool, names[n])) {
+            fprintf(stderr, "volume '%s' is missing\n", names[n]);
+            return -1;
+        }
+    }
+
+    if (virStoragePoolObjGetVolumesCount(pool) != n) {
+        fprintf(stderr, "expected %zu volumes, got %zu\n",
+                n, virStoragePoolObjGetVolumesCount(pool));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Volumes created and deleted through the API between the scan and the
+ * apply phases of a refresh must be neither resurrected nor dropped.
+ */
+static int
+testRefreshConcurrentVolChanges(const void *opaque)
+{
+    const char *dir = opaque;
+    virStoragePoolObjPtr pool = NULL;
+    virStoragePoolDefPtr def = g_new0(virStoragePoolDef, 1);
+    g_autoptr(virStorageBackendRefreshJob) job = NULL;
+    virStorageVolDefPtr vol;
+    virStorageVolDefPtr newc;
+    virStorageVolDefPtr newd;
+    const char *initial[] = { "a.img", "b.img", "c.img", NULL };
+    const char *final[] = { "a.img", "c.img", "d.img", "e.img", NULL };
+    int ret = -1;
+
+    def->name = g_strdup("refresh");
+    def->type = VIR_STORAGE_POOL_DIR;
+    def->target.path = g_strdup(dir);
+
+    if (!(pool = virStoragePoolObjNew())) {
+        virStoragePoolDefFree(def);
+        return -1;
+    }
+    virStoragePoolObjSetDef(pool, def);
+
+    if (testRefreshWriteFile(dir, "a.img", "a") < 0 ||
+        testRefreshWriteFile(dir, "b.img", "b") < 0 ||
+        testRefreshWriteFile(dir, "c.img", "c") < 0)
+        goto cleanup;
+
+    if (testRefreshRun(pool) < 0 ||
+        testRefreshCheckVols(pool, initial) < 0)
+        goto cleanup;
+
+    /* 'b.img' is probed again by the scan, 'c.img' is missing from it
+     * and 'd.img' is new */
+    if (testRefreshWriteFile(dir, "b.img", "bb") < 0 ||
+        testRefreshUnlinkFile(dir, "c.img") < 0 ||
+        testRefreshWriteFile(dir, "d.img", "d") < 0)
+        goto cleanup;
+
+    if (!(job = virStorageBackendRefreshLocalScan(pool)))
+        goto cleanup;
+
+    /* While the pool was unlocked 'b.img' was deleted, 'c.img' deleted
+     * and created again, 'd.img' and 'e.img' created */
+    vol = virStorageVolDefFindByName(pool, "b.img");
+    virStoragePoolObjRemoveVol(pool, vol);
+    if (testRefreshUnlinkFile(dir, "b.img") < 0)
+        goto cleanup;
+
+    vol = virStorageVolDefFindByName(pool, "c.img");
+    virStoragePoolObjRemoveVol(pool, vol);
+    newc = testRefreshVolNew(dir, "c.img");
+    if (virStoragePoolObjAddVol(pool, newc) < 0) {
+        virStorageVolDefFree(newc);
+        goto cleanup;
+    }
+    if (testRefreshWriteFile(dir, "c.img", "c") < 0)
+        goto cleanup;
+
+    newd = testRefreshVolNew(dir, "d.img");
+    if (virStoragePoolObjAddVol(pool, newd) < 0) {
+        virStorageVolDefFree(newd);
+        goto cleanup;
+    }
+
+    vol = testRefreshVolNew(dir, "e.img");
+    if (virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        goto cleanup;
+    }
+    if (testRefreshWriteFile(dir, "e.img", "e") < 0)
+        goto cleanup;
+
+    if (virStorageBackendRefreshLocalApply(pool, job) < 0 ||
+        testRefreshCheckVols(pool, final) < 0)
+        goto cleanup;
+
+    if (virStorageVolDefFindByName(pool, "c.img") != newc ||
+        virStorageVolDefFindByName(pool, "d.img") != newd) {
+        fprintf(stderr, "volumes created during the scan were replaced\n");
+        goto cleanup;
+    }
+
+    /* Another refresh picks up all the files */
+    if (testRefreshRun(pool) < 0 ||
+        testRefreshCheckVols(pool, final) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjEndAPI(&pool);
+    return ret;
+}
+
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/storageutildir-XXXXXX"
+
 static int
 mymain(void)
 {
     int ret = 0;
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
 
 #define DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_FULL(testname, sffx, pooltype) \
     do { \
@@ -104,6 +292,18 @@ mymain(void)
 #undef DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_NETFS
 #undef DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_FULL
 
+    if (!g_mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create storageutildir");
+        abort();
+    }
+
+    if (virTestRun("refresh concurrent volume changes",
+                   testRefreshConcurrentVolChanges, scratchdir) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 
 #if defined(WITH_BSD_NSS)
@@ -107,6 +108,8 @@ findLease(const char *name,
     struct dirent *entry;
     char **leaseFiles = NULL;
     size_t nleaseFiles = 0;
+    char **leaseDBs = NULL;
+    size_t nleaseDBs = 0;
     char **macs = NULL;
     size_t nmacs = 0;
     size_t i;
@@ -132,8 +135,34 @@ findLease(const char *name,
         char *path;
         size_t dlen = strlen(entry->d_name);
 
-        if (dlen >= 7 && !strcmp(entry->d_name + dlen - 7, ".status")) {
+        if (dlen >= 8 && !strcmp(entry->d_name + dlen - 8, ".leasedb")) {
             char **tmpLease;
+            if (asprintf(&path, "%s/%s", leaseDir, entry->d_name) < 0)
+                goto cleanup;
+
+            tmpLease = realloc(leaseDBs, sizeof(char *) * (nleaseDBs + 1));
+            if (!tmpLease) {
+                free(path);
+                goto cleanup;
+            }
+            leaseDBs = tmpLease;
+            leaseDBs[nleaseDBs++] = path;
+        } else if (dlen >= 7 && !strcmp(entry->d_name + dlen - 7, ".status")) {
+            char **tmpLease;
+            char *dbPath;
+
+            /* Leases already moved into a database are read from there */
+            if (asprintf(&dbPath, "%s/%.*s.leasedb",
+                         leaseDir, (int)(dlen - 7), entry->d_name) < 0)
+                goto cleanup;
+            if (access(dbPath, F_OK) == 0) {
+                DEBUG("Skipping %s in favour of %s", entry->d_name, dbPath);
+                free(dbPath);
+                errno = 0;
+                continue;
+            }
+            free(dbPath);
+
             if (asprintf(&path, "%s/%s", leaseDir, entry->d_name) < 0)
                 goto cleanup;
 
@@ -183,6 +212,15 @@ findLease(const char *name,
             goto cleanup;
     }
 
+    for (i = 0; i < nleaseDBs; i++) {
+        if (findLeasesDB(leaseDBs[i],
+                         name, macs, nmacs,
+                         af, now,
+                         address, naddress,
+                         found) < 0)
+            goto cleanup;
+    }
+
     DEBUG("Found %zu addresses", *naddress);
     sortAddr(*address, *naddress);
 
@@ -193,6 +231,9 @@ findLease(const char *name,
     for (i = 0; i < nleaseFiles; i++)
         free(leaseFiles[i]);
     free(leaseFiles);
+    for (i = 0; i < nleaseDBs; i++)
+        free(leaseDBs[i]);
+    free(leaseDBs);
     for (i = 0; i < nmacs; i++)
         free(macs[i]);
     free(macs);
@@ -25,12 +25,15 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_parse.h>
 
 #include "libvirt_nss_leases.h"
 #include "libvirt_nss.h"
+#include "virleasedbformat.h"
 
 enum {
     FIND_LEASES_STATE_START,
@@ -438,3 +441,159 @@ findLeases(const char *file,
         close(fd);
     return ret;
 }
+
+
+typedef struct {
+    char ipaddr[VIR_LEASE_DB_IPADDR_LEN];
+    long long expirytime;
+} findLeasesDBMatch;
+
+
+static int
+findLeasesDBCollect(virLeaseDBHeader *hdr,
+                    virLeaseDBIndexType type,
+                    const char *key,
+                    time_t now,
+                    findLeasesDBMatch **matches,
+                    size_t *nmatches)
+{
+    virLeaseDBRecord *rec;
+    int64_t pos = -1;
+
+    DEBUG("Lookup '%s' in index %d", key, type);
+
+    while ((rec = virLeaseDBLookupNext(hdr, type, key, &pos))) {
+        findLeasesDBMatch *tmp;
+        long long expirytime = rec->expirytime;
+
+        if (expirytime != 0 && expirytime < now) {
+            DEBUG("Entry expired at %lld vs now %lld",
+                  expirytime, (long long) now);
+            continue;
+        }
+
+        tmp = realloc(*matches, sizeof(*tmp) * (*nmatches + 1));
+        if (!tmp) {
+            ERROR("Out of memory");
+            return -1;
+        }
+        *matches = tmp;
+
+        memcpy(tmp[*nmatches].ipaddr, rec->ipaddr, sizeof(rec->ipaddr));
+        tmp[*nmatches].ipaddr[sizeof(rec->ipaddr) - 1] = '\0';
+        tmp[*nmatches].expirytime = expirytime;
+        (*nmatches)++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * findLeasesDB:
+ *
+ * Same as findLeases() except that @file is an indexed lease database
+ * maintained by the leases helper. Only the records matching @name, or
+ * @macs if there are any, are visited.
+ */
+int
+findLeasesDB(const char *file,
+             const char *name,
+             char **macs,
+             size_t nmacs,
+             int af,
+             time_t now,
+             leaseAddress **addrs,
+             size_t *naddrs,
+             bool *found)
+{
+    int fd = -1;
+    int ret = -1;
+    struct stat sb;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    virLeaseDBHeader *hdr;
+    findLeasesDBMatch *matches = NULL;
+    size_t nmatches = 0;
+    size_t attempt;
+    size_t i;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        ERROR("Cannot open %s", file);
+        goto cleanup;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        ERROR("Cannot stat %s", file);
+        goto cleanup;
+    }
+
+    if (sb.st_size < (off_t) sizeof(virLeaseDBHeader)) {
+        ERROR("Invalid lease database %s", file);
+        goto cleanup;
+    }
+    size = sb.st_size;
+
+    if ((map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        ERROR("Cannot map %s", file);
+        goto cleanup;
+    }
+    hdr = map;
+
+    if (virLeaseDBValidate(hdr, size) < 0) {
+        ERROR("Invalid lease database %s", file);
+        goto cleanup;
+    }
+
+    for (attempt = 0; attempt < VIR_LEASE_DB_READ_RETRIES; attempt++) {
+        uint64_t generation = virLeaseDBReadBegin(hdr);
+
+        nmatches = 0;
+        if (nmacs) {
+            for (i = 0; i < nmacs; i++) {
+                if (findLeasesDBCollect(hdr, VIR_LEASE_DB_INDEX_MAC, macs[i],
+                                        now, &matches, &nmatches) < 0)
+                    goto cleanup;
+            }
+        } else {
+            if (findLeasesDBCollect(hdr, VIR_LEASE_DB_INDEX_HOSTNAME, name,
+                                    now, &matches, &nmatches) < 0)
+                goto cleanup;
+        }
+
+        if (!virLeaseDBReadRetry(hdr, generation))
+            break;
+
+        /* The writer is in the middle of an update, or died in one in
+         * which case the last attempt is used as is */
+        DEBUG("Lease database %s changed while reading", file);
+        if (generation & 1)
+            usleep(1000);
+    }
+
+    DEBUG("Found %zu matching leases", nmatches);
+    for (i = 0; i < nmatches; i++) {
+        *found = true;
+
+        if (appendAddr(name, addrs, naddrs,
+                       matches[i].ipaddr,
+                       matches[i].expirytime,
+                       af) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret != 0) {
+        free(*addrs);
+        *addrs = NULL;
+        *naddrs = 0;
+    }
+    free(matches);
+    if (map != MAP_FAILED)
+        munmap(map, size);
+    if (fd != -1)
+        close(fd);
+    return ret;
+}
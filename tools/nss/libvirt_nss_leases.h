@@ -38,3 +38,14 @@ findLeases(const char *file,
            leaseAddress **addrs,
            size_t *naddrs,
            bool *found);
+
+int
+findLeasesDB(const char *file,
+             const char *name,
+             char **macs,
+             size_t nmacs,
+             int af,
+             time_t now,
+             leaseAddress **addrs,
+             size_t *naddrs,
+             bool *found);
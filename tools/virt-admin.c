@@ -1110,6 +1110,48 @@ cmdDaemonLogOutputs(vshControl *ctl, const vshCmd *cmd)
     return true;
 }
 
+/* -----------------------
+ * Command daemon-log-dump
+ * -----------------------
+ */
+static const vshCmdInfo info_daemon_log_dump[] = {
+    {.name = "help",
+     .data = N_("write the messages recorded by the memory logging output of "
+                "daemon into a file")
+    },
+    {.name = "desc",
+     .data = N_("Writes the most recent messages kept by the memory logging "
+                "output of daemon into a file on the daemon's host, or "
+                "appends them to the dump file of the output.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_daemon_log_dump[] = {
+    {.name = "file",
+     .type = VSH_OT_STRING,
+     .help = N_("file to write the messages into"),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLogDump(vshControl *ctl, const vshCmd *cmd)
+{
+    vshAdmControlPtr priv = ctl->privData;
+    const char *file = NULL;
+
+    if (vshCommandOptStringReq(ctl, cmd, "file", &file) < 0)
+        return false;
+
+    if (virAdmConnectDumpLoggingMemory(priv->conn, file, 0) < 0) {
+        vshError(ctl, _("Unable to dump daemon log messages"));
+        return false;
+    }
+
+    return true;
+}
+
 static void *
 vshAdmConnectionHandler(vshControl *ctl)
 {
@@ -1501,6 +1543,12 @@ static const vshCmdDef managementCmds[] = {
      .info = info_daemon_log_outputs,
      .flags = 0
     },
+    {.name = "daemon-log-dump",
+     .handler = cmdDaemonLogDump,
+     .opts = opts_daemon_log_dump,
+     .info = info_daemon_log_dump,
+     .flags = 0
+    },
     {.name = NULL}
 };
 